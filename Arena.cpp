@@ -0,0 +1,102 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#include <algorithm>
+#include <new>
+
+#include "Arena.h"
+
+static thread_local Arena* g_currentArena = nullptr;
+
+// Block headers keep the data after them aligned for any type.
+const size_t g_blockHeaderSize = (sizeof(void*) + sizeof(size_t) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+
+Arena::Arena(size_t blockSize)
+	: m_blockSize(blockSize)
+	, m_first(nullptr)
+	, m_current(nullptr)
+	, m_cursor(nullptr)
+	, m_end(nullptr)
+	, m_heapAllocations(0)
+{
+}
+
+Arena::~Arena()
+{
+	while (m_first)
+	{
+		Block* next = m_first->next;
+		::operator delete(m_first);
+		m_first = next;
+	}
+}
+
+void* Arena::Allocate(size_t size, size_t alignment)
+{
+	for (;;)
+	{
+		if (m_cursor)
+		{
+			char* p = (char*)(((uintptr_t)m_cursor + alignment - 1) & ~(uintptr_t)(alignment - 1));
+			if (p <= m_end && size <= (size_t)(m_end - p))
+			{
+				m_cursor = p + size;
+				return p;
+			}
+		}
+		// The first kept block big enough is moved next, else a new one is
+		// made, sized in powers of two so files of about the same size fit.
+		Block** link = m_current ? &m_current->next : &m_first;
+		Block** fit = link;
+		while (*fit && (*fit)->size < size + alignment)
+			fit = &(*fit)->next;
+		Block* block = *fit;
+		if (block)
+		{
+			*fit = block->next;
+		}
+		else
+		{
+			size_t blockSize = m_blockSize;
+			while (blockSize < size + alignment)
+				blockSize *= 2;
+			block = static_cast<Block*>(::operator new(g_blockHeaderSize + blockSize));
+			block->size = blockSize;
+			++m_heapAllocations;
+		}
+		block->next = *link;
+		*link = block;
+		m_current = block;
+		m_cursor = (char*)block + g_blockHeaderSize;
+		m_end = m_cursor + block->size;
+	}
+}
+
+void Arena::Reset()
+{
+	m_current = m_first;
+	m_cursor = m_first ? (char*)m_first + g_blockHeaderSize : nullptr;
+	m_end = m_first ? m_cursor + m_first->size : nullptr;
+}
+
+Arena* Arena::Current()
+{
+	return g_currentArena;
+}
+
+ArenaScope::ArenaScope(Arena& arena)
+	: m_previous(g_currentArena)
+{
+	g_currentArena = &arena;
+}
+
+ArenaScope::~ArenaScope()
+{
+	g_currentArena = m_previous;
+}
@@ -0,0 +1,156 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Bytes of a block of an arena, more if one allocation needs it.
+const size_t g_arenaBlockSize = 64 * 1024;
+
+// A bump allocator for the transient data of one file or chunk of records.
+// Allocating moves a pointer through blocks taken from the heap; nothing is
+// freed one by one, Reset frees it all at once in O(1) and keeps the blocks,
+// so once they are big enough for a file the next ones take nothing from the
+// heap. Not thread safe, every thread has its own.
+class Arena
+{
+public:
+	explicit Arena(size_t blockSize = g_arenaBlockSize);
+	~Arena();
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	void* Allocate(size_t size, size_t alignment);
+	// Only the last allocation is given back, as when a string grows in place.
+	void Deallocate(void* p, size_t size)
+	{
+		if ((char*)p + size == m_cursor)
+			m_cursor = (char*)p;
+	}
+	// Everything allocated is gone.
+	void Reset();
+
+	// Blocks taken from the heap since the arena was made.
+	uint64_t HeapAllocations() const
+	{
+		return m_heapAllocations;
+	}
+
+	// The arena of the calling thread set by ArenaScope, nullptr if none.
+	static Arena* Current();
+
+private:
+	struct Block
+	{
+		Block* next;
+		size_t size;
+	};
+
+	const size_t m_blockSize;
+	Block* m_first;
+	Block* m_current;
+	char* m_cursor;
+	char* m_end;
+	uint64_t m_heapAllocations;
+};
+
+// Makes arena the current one of the thread until it is destroyed.
+class ArenaScope
+{
+public:
+	explicit ArenaScope(Arena& arena);
+	~ArenaScope();
+	ArenaScope(const ArenaScope&) = delete;
+	ArenaScope& operator=(const ArenaScope&) = delete;
+
+private:
+	Arena* m_previous;
+};
+
+// Allocates from the arena current when it was made, or from the heap if
+// there was none, so code using it runs the same outside an ArenaScope.
+template<typename T>
+class ArenaAllocator
+{
+public:
+	typedef T value_type;
+	// Swapped containers keep their own memory.
+	typedef std::true_type propagate_on_container_swap;
+
+	ArenaAllocator()
+		: m_arena(Arena::Current())
+	{
+	}
+	explicit ArenaAllocator(Arena* arena)
+		: m_arena(arena)
+	{
+	}
+	template<typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other)
+		: m_arena(other.GetArena())
+	{
+	}
+
+	T* allocate(size_t n)
+	{
+		if (!m_arena)
+			return std::allocator<T>().allocate(n);
+		return static_cast<T*>(m_arena->Allocate(n * sizeof(T), alignof(T)));
+	}
+	void deallocate(T* p, size_t n)
+	{
+		if (!m_arena)
+			std::allocator<T>().deallocate(p, n);
+		else
+			m_arena->Deallocate(p, n * sizeof(T));
+	}
+
+	// A copy goes to the arena current where it is made, so copying out of
+	// a scope takes from the heap instead of an arena about to be reset.
+	ArenaAllocator select_on_container_copy_construction() const
+	{
+		return ArenaAllocator();
+	}
+
+	Arena* GetArena() const
+	{
+		return m_arena;
+	}
+
+private:
+	Arena* m_arena;
+};
+
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+	return a.GetArena() == b.GetArena();
+}
+
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+	return a.GetArena() != b.GetArena();
+}
+
+typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>> ArenaString;
+typedef std::basic_string<wchar_t, std::char_traits<wchar_t>, ArenaAllocator<wchar_t>> ArenaWString;
+typedef std::basic_string<char16_t, std::char_traits<char16_t>, ArenaAllocator<char16_t>> ArenaU16String;
+typedef std::basic_stringstream<char, std::char_traits<char>, ArenaAllocator<char>> ArenaStringStream;
+typedef std::basic_ostringstream<char, std::char_traits<char>, ArenaAllocator<char>> ArenaOStringStream;
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
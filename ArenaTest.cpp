@@ -0,0 +1,377 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+// The SVG export in an ArenaScope takes nothing from the heap once the arena
+// has seen the file: the heap allocations of a second run are counted by
+// replacing the global operator new.
+//
+//   ArenaTest [FILE...]
+//
+// A metafile made here, with paths, text, clipping, regions and gradients,
+// is exported as well as the files given.
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "Arena.h"
+#include "SvgExporter.h"
+
+static std::atomic<bool> g_counting(false);
+static std::atomic<uint64_t> g_allocations(0);
+
+static void* Allocate(size_t size)
+{
+	if (g_counting)
+		++g_allocations;
+	if (void* p = malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void* operator new(size_t size)
+{
+	return Allocate(size);
+}
+
+void* operator new[](size_t size)
+{
+	return Allocate(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+	free(p);
+}
+
+// Records appended one by one, the header fixed up by Finish.
+class MetafileWriter
+{
+public:
+	MetafileWriter()
+		: m_records(0)
+	{
+		Begin(EmrType::Header);
+		Rect(0, 0, 400, 400);
+		Rect(0, 0, 10000, 10000);
+		U32(g_emfSignature);
+		U32(0x10000);
+		U32(0); // nBytes
+		U32(0); // nRecords
+		U32(4); // nHandles, nReserved
+		U32(0); // nDescription
+		U32(0); // offDescription
+		U32(0); // nPalEntries
+		U32(1000);
+		U32(1000);
+		U32(320);
+		U32(240);
+		End();
+	}
+
+	void Begin(EmrType type)
+	{
+		m_start = m_data.size();
+		U32((uint32_t)type);
+		U32(0);
+	}
+	void End()
+	{
+		while (m_data.size() % 4)
+			m_data.push_back(0);
+		Patch(m_start + 4, (uint32_t)(m_data.size() - m_start));
+		++m_records;
+	}
+	void U16(uint16_t value)
+	{
+		m_data.push_back((uint8_t)value);
+		m_data.push_back((uint8_t)(value >> 8));
+	}
+	void U32(uint32_t value)
+	{
+		U16((uint16_t)value);
+		U16((uint16_t)(value >> 16));
+	}
+	void Rect(int32_t left, int32_t top, int32_t right, int32_t bottom)
+	{
+		U32(left);
+		U32(top);
+		U32(right);
+		U32(bottom);
+	}
+	void Record(EmrType type, std::initializer_list<uint32_t> values)
+	{
+		Begin(type);
+		for (uint32_t value : values)
+			U32(value);
+		End();
+	}
+	// RGNDATA of count rectangles of height h, w wide, every other one skipped.
+	void Region(int32_t left, int32_t top, int32_t w, int32_t h, uint32_t count)
+	{
+		U32(32);
+		U32(1);
+		U32(count);
+		U32(count * 16);
+		Rect(left, top, left + (int32_t)count * 2 * w, top + h);
+		for (uint32_t i = 0; i < count; ++i)
+			Rect(left + (int32_t)i * 2 * w, top, left + (int32_t)i * 2 * w + w, top + h);
+	}
+
+	std::vector<uint8_t> Finish()
+	{
+		Record(EmrType::Eof, { 0, 16, 20 });
+		Patch(48, (uint32_t)m_data.size());
+		Patch(52, m_records);
+		return m_data;
+	}
+
+private:
+	std::vector<uint8_t> m_data;
+	size_t m_start;
+	uint32_t m_records;
+
+	void Patch(size_t offset, uint32_t value)
+	{
+		for (int i = 0; i < 4; ++i)
+			m_data[offset + i] = (uint8_t)(value >> (8 * i));
+	}
+};
+
+static std::vector<uint8_t> MakeMetafile()
+{
+	MetafileWriter w;
+	// Pens of two widths, a solid brush, a hatched one.
+	w.Record(EmrType::CreatePen, { 1, 0, 3, 0, 0x0000FF });
+	w.Record(EmrType::CreatePen, { 2, 2, 1, 0, 0x00FF00 });
+	w.Record(EmrType::CreateBrushIndirect, { 3, 0, 0xFF8000, 0 });
+	w.Record(EmrType::CreateBrushIndirect, { 4, 2, 0x008080, 3 });
+	for (int32_t i = 0; i < 40; ++i)
+	{
+		int32_t x = i * 9 % 350, y = i * 7 % 350;
+		w.Record(EmrType::SaveDC, {});
+		w.Record(EmrType::SelectObject, { 1u + i % 2 });
+		w.Record(EmrType::SelectObject, { 3u + i % 2 });
+		w.Record(EmrType::IntersectClipRect, { (uint32_t)x, (uint32_t)y, (uint32_t)x + 60, (uint32_t)y + 60 });
+		if (i % 4 == 0)
+		{
+			// ExtSelectClipRgn with RGN_OR.
+			w.Begin(EmrType::ExtSelectClipRgn);
+			w.U32(32 + 16 * 3);
+			w.U32(2);
+			w.Region(x, y + 70, 5, 10, 3);
+			w.End();
+		}
+		// Polyline16 and PolyBezier16 of a growing number of points.
+		uint32_t count = 4 + i * 3;
+		w.Begin(EmrType::Polyline16);
+		w.Rect(0, 0, 400, 400);
+		w.U32(count);
+		for (uint32_t k = 0; k < count; ++k)
+		{
+			w.U16((uint16_t)(x + k * 3 % 50));
+			w.U16((uint16_t)(y + k * 7 % 40));
+		}
+		w.End();
+		w.Begin(EmrType::PolyBezier16);
+		w.Rect(0, 0, 400, 400);
+		w.U32(1 + 3 * (count / 3));
+		for (uint32_t k = 0; k < 1 + 3 * (count / 3); ++k)
+		{
+			w.U16((uint16_t)(x + k * 5 % 70));
+			w.U16((uint16_t)(y + k * 11 % 30));
+		}
+		w.End();
+		w.Record(EmrType::Rectangle, { (uint32_t)x, (uint32_t)y, (uint32_t)x + 30, (uint32_t)y + 20 });
+		w.Record(EmrType::Ellipse, { (uint32_t)x + 5, (uint32_t)y + 5, (uint32_t)x + 45, (uint32_t)y + 25 });
+		// A path bracket.
+		w.Record(EmrType::BeginPath, {});
+		w.Record(EmrType::MoveToEx, { (uint32_t)x, (uint32_t)y });
+		w.Record(EmrType::LineTo, { (uint32_t)x + 40, (uint32_t)y + 10 });
+		w.Record(EmrType::LineTo, { (uint32_t)x + 10, (uint32_t)y + 40 });
+		w.Record(EmrType::CloseFigure, {});
+		w.Record(EmrType::EndPath, {});
+		w.Record(EmrType::StrokeAndFillPath, { 0, 0, 400, 400 });
+		// ExtTextOutW with advances and an opaque rectangle, every other one
+		// from the current position.
+		w.Record(EmrType::SetTextAlign, { i % 2 ? 1u : 0u });
+		std::u16string text = u"Arena text ";
+		text.append(i % 17, u'x');
+		w.Begin(EmrType::ExtTextOutW);
+		w.Rect(0, 0, 400, 400);
+		w.U32(1);
+		w.U32(0);
+		w.U32(0);
+		w.U32(x);
+		w.U32(y + 30);
+		w.U32((uint32_t)text.size());
+		w.U32(76);
+		w.U32(2); // ETO_OPAQUE
+		w.Rect(x, y + 20, x + 80, y + 40);
+		uint32_t offDx = 76 + ((uint32_t)text.size() * 2 + 3) / 4 * 4;
+		w.U32(offDx);
+		for (char16_t c : text)
+			w.U16(c);
+		if (text.size() % 2)
+			w.U16(0);
+		for (size_t k = 0; k < text.size(); ++k)
+			w.U32(6);
+		w.End();
+		// FillRgn and FrameRgn with the brush of index 3.
+		w.Begin(EmrType::FillRgn);
+		w.Rect(0, 0, 400, 400);
+		w.U32(32 + 16 * 4);
+		w.U32(3);
+		w.Region(x, y + 50, 4, 6, 4);
+		w.End();
+		w.Begin(EmrType::FrameRgn);
+		w.Rect(0, 0, 400, 400);
+		w.U32(32 + 16 * 2);
+		w.U32(4);
+		w.U32(2);
+		w.U32(2);
+		w.Region(x, y + 60, 12, 12, 2);
+		w.End();
+		// GradientFill of two rectangles.
+		w.Begin(EmrType::GradientFill);
+		w.Rect(0, 0, 400, 400);
+		w.U32(4);
+		w.U32(2);
+		w.U32(0); // GRADIENT_FILL_RECT_H
+		for (int k = 0; k < 4; ++k)
+		{
+			w.U32(x + k * 10);
+			w.U32(y + k * 10);
+			w.U16((uint16_t)(k * 0x4000));
+			w.U16(0x8000);
+			w.U16((uint16_t)(0xFF00 - k * 0x3000));
+			w.U16(0xFF00);
+		}
+		w.U32(0);
+		w.U32(1);
+		w.U32(2);
+		w.U32(3);
+		w.End();
+		w.Record(EmrType::OffsetClipRgn, { 3, 2 });
+		w.Record(EmrType::RestoreDC, { (uint32_t)-1 });
+	}
+	return w.Finish();
+}
+
+struct Input
+{
+	std::string name;
+	std::vector<uint8_t> data;
+};
+
+// Both SVG exports of every input; false if one fails.
+static bool ExportAll(const std::vector<Input>& inputs, std::vector<std::string>* outputs)
+{
+	for (const Input& input : inputs)
+	{
+		for (unsigned maxSide : { 0u, 64u })
+		{
+			ArenaOStringStream svg;
+			if (!ExportSvg(input.data.data(), input.data.size(), svg, maxSide))
+				return false;
+			if (outputs)
+			{
+				ArenaString text = svg.str();
+				outputs->emplace_back(text.data(), text.size());
+			}
+		}
+	}
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector<Input> inputs;
+	inputs.push_back({ "generated", MakeMetafile() });
+	for (int i = 1; i < argc; ++i)
+	{
+		std::ifstream file(argv[i], std::ios::binary);
+		Input input{ argv[i], std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()) };
+		if (input.data.empty())
+		{
+			printf("%s can't be read\n", argv[i]);
+			return 1;
+		}
+		inputs.push_back(std::move(input));
+	}
+
+	// Same output from the heap and from the arena.
+	std::vector<std::string> expected, actual;
+	if (!ExportAll(inputs, &expected))
+	{
+		printf("an input isn't an EMF\n");
+		return 1;
+	}
+
+	bool ok = true;
+	Arena arena;
+	{
+		ArenaScope scope(arena);
+		for (int run = 0; run < 3 && ok; ++run)
+		{
+			g_allocations = 0;
+			g_counting = run > 0;
+			ExportAll(inputs, nullptr);
+			g_counting = false;
+			arena.Reset();
+			printf("run %d: %llu heap allocations\n", run + 1, (unsigned long long)g_allocations);
+			ok = run == 0 || g_allocations == 0;
+		}
+	}
+	{
+		// The outputs are copied out of the scope before the arena is reset.
+		ArenaScope scope(arena);
+		std::vector<std::string> outputs;
+		ExportAll(inputs, &outputs);
+		actual.swap(outputs);
+		arena.Reset();
+	}
+	for (size_t i = 0; i < expected.size(); ++i)
+	{
+		if (actual[i] != expected[i])
+		{
+			printf("%s, %s: the SVG differs from the one exported without an arena\n",
+				inputs[i / 2].name.c_str(), i % 2 ? "thumbnail" : "full size");
+			ok = false;
+		}
+	}
+	if (expected[0].size() < 10000 || expected[0].find("clipPath") == std::string::npos || expected[0].find("<text") == std::string::npos)
+	{
+		printf("the generated metafile exports to too little\n");
+		ok = false;
+	}
+
+	printf(ok ? "Arena: ok\n" : "Arena: FAILED\n");
+	return ok ? 0 : 1;
+}
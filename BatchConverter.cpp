@@ -0,0 +1,757 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define BATCH_IO_URING
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "Arena.h"
+#include "BatchConverter.h"
+
+// Files read ahead of the decoding threads, per thread.
+const unsigned g_readAheadPerThread = 2;
+// Longest single read, bigger files take several.
+const size_t g_maxReadSize = 1 << 30;
+
+struct LoadedFile
+{
+	size_t job;
+	std::unique_ptr<uint8_t[]> data;
+	size_t size;
+};
+
+struct ConvertedFile
+{
+	size_t job;
+	std::string output;
+};
+
+// Queues between the I/O and the decoding threads. Every job is taken by
+// the I/O side, loaded, converted, written and finished, or finished early
+// if a step fails; files between taken and finished are bounded by capacity.
+class BatchQueue
+{
+public:
+	BatchQueue(const std::vector<BatchJob>& jobs, const BatchConvert& convert, size_t capacity)
+		: m_jobs(jobs)
+		, m_convert(convert)
+		, m_capacity(capacity)
+		, m_nextJob(0)
+		, m_reading(0)
+		, m_inMemory(0)
+		, m_finished(0)
+	{
+	}
+
+	const BatchJob& Job(size_t job) const
+	{
+		return m_jobs[job];
+	}
+	const BatchResult& Result() const
+	{
+		return m_result;
+	}
+
+	// I/O side, none of them block.
+	bool TakeJob(size_t& job);
+	bool TakeConverted(ConvertedFile& file);
+	void Loaded(LoadedFile&& file);
+	// A file is finished, written or not.
+	void Written(bool ok, uint64_t size);
+	// A taken job failed before its file was loaded.
+	void Failed();
+	// Block until there is a job to take, a file to write or all are finished;
+	// return false once all are.
+	bool WaitForIo();
+
+	// Decoding threads.
+	void Decode();
+
+private:
+	const std::vector<BatchJob>& m_jobs;
+	const BatchConvert& m_convert;
+	const size_t m_capacity;
+	std::mutex m_mutex;
+	std::condition_variable m_decodeReady;
+	std::condition_variable m_ioReady;
+	std::deque<LoadedFile> m_loaded;
+	std::deque<ConvertedFile> m_converted;
+	size_t m_nextJob;
+	size_t m_reading;
+	size_t m_inMemory;
+	size_t m_finished;
+	BatchResult m_result;
+
+	bool CanTakeJob() const
+	{
+		return m_nextJob < m_jobs.size() && m_inMemory < m_capacity;
+	}
+	// Called with m_mutex held.
+	void Finish();
+};
+
+bool BatchQueue::TakeJob(size_t& job)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!CanTakeJob())
+		return false;
+	job = m_nextJob++;
+	++m_reading;
+	++m_inMemory;
+	return true;
+}
+
+bool BatchQueue::TakeConverted(ConvertedFile& file)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_converted.empty())
+		return false;
+	file = std::move(m_converted.front());
+	m_converted.pop_front();
+	return true;
+}
+
+void BatchQueue::Loaded(LoadedFile&& file)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	--m_reading;
+	m_result.bytesRead += file.size;
+	m_loaded.push_back(std::move(file));
+	m_decodeReady.notify_one();
+}
+
+void BatchQueue::Written(bool ok, uint64_t size)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (ok)
+		m_result.bytesWritten += size;
+	else
+		++m_result.failed;
+	Finish();
+}
+
+void BatchQueue::Failed()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	// Only reads fail on the I/O side before the file is loaded.
+	--m_reading;
+	++m_result.failed;
+	Finish();
+	// No more loaded files may come.
+	m_decodeReady.notify_all();
+}
+
+void BatchQueue::Finish()
+{
+	--m_inMemory;
+	++m_finished;
+	m_ioReady.notify_one();
+	if (m_finished == m_jobs.size())
+	{
+		m_ioReady.notify_all();
+		m_decodeReady.notify_all();
+	}
+}
+
+bool BatchQueue::WaitForIo()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_ioReady.wait(lock, [this]() { return !m_converted.empty() || CanTakeJob() || m_finished == m_jobs.size(); });
+	return m_finished < m_jobs.size();
+}
+
+void BatchQueue::Decode()
+{
+	Arena arena;
+	ArenaScope scope(arena);
+	for (;;)
+	{
+		LoadedFile file;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			// Done once every job is taken and read.
+			m_decodeReady.wait(lock, [this]() { return !m_loaded.empty() || (m_nextJob == m_jobs.size() && m_reading == 0); });
+			if (m_loaded.empty())
+				break;
+			file = std::move(m_loaded.front());
+			m_loaded.pop_front();
+		}
+		ConvertedFile converted{ file.job, std::string() };
+		bool ok = m_convert(file.data.get(), file.size, converted.output);
+		file.data.reset();
+		arena.Reset();
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!ok)
+		{
+			++m_result.failed;
+			Finish();
+		}
+		else if (m_jobs[file.job].output.empty())
+		{
+			Finish();
+		}
+		else
+		{
+			m_converted.push_back(std::move(converted));
+			m_ioReady.notify_one();
+		}
+	}
+	// Wake the other decoding threads, the condition holds for them too.
+	m_decodeReady.notify_all();
+}
+
+// Blocking I/O, queueDepth threads run this. Writes go first, they free memory.
+static void BlockingIo(BatchQueue& queue)
+{
+	while (queue.WaitForIo())
+	{
+		ConvertedFile converted;
+		size_t job;
+		if (queue.TakeConverted(converted))
+		{
+			std::ofstream os(std::filesystem::u8path(queue.Job(converted.job).output), std::ios::binary | std::ios::trunc);
+			os.write(converted.output.data(), converted.output.size());
+			bool ok = os.flush().good();
+			os.close();
+			queue.Written(ok && !os.fail(), converted.output.size());
+		}
+		else if (queue.TakeJob(job))
+		{
+			std::ifstream is(std::filesystem::u8path(queue.Job(job).input), std::ios::binary | std::ios::ate);
+			std::streamoff size = is ? (std::streamoff)is.tellg() : -1;
+			LoadedFile file{ job, nullptr, size > 0 ? (size_t)size : 0 };
+			if (size > 0)
+			{
+				file.data.reset(new uint8_t[file.size]);
+				is.seekg(0);
+				is.read((char*)file.data.get(), file.size);
+			}
+			if (size < 0 || !is)
+				queue.Failed();
+			else
+				queue.Loaded(std::move(file));
+		}
+	}
+}
+
+#ifdef BATCH_IO_URING
+// Submission and completion rings of io_uring, set up with raw system calls.
+class IoUring
+{
+public:
+	IoUring()
+		: m_fd(-1)
+		, m_sqRing(nullptr)
+		, m_cqRing(nullptr)
+		, m_sqes(nullptr)
+		, m_sqRingSize(0)
+		, m_cqRingSize(0)
+		, m_sqesSize(0)
+		, m_pending(0)
+	{
+	}
+	~IoUring();
+
+	// Return false if the kernel lacks io_uring or the file operations.
+	bool Init(unsigned entries);
+	// A cleared submission entry, nullptr if the ring is full.
+	io_uring_sqe* Sqe();
+	// Submit the pending entries and wait for a completion.
+	bool SubmitAndWait();
+	// Take a completion, false if there is none.
+	bool Reap(io_uring_cqe& cqe);
+	// Entries queued but not submitted yet.
+	unsigned Pending() const
+	{
+		return m_pending;
+	}
+
+private:
+	int m_fd;
+	io_uring_params m_params;
+	uint8_t* m_sqRing;
+	uint8_t* m_cqRing;
+	io_uring_sqe* m_sqes;
+	size_t m_sqRingSize;
+	size_t m_cqRingSize;
+	size_t m_sqesSize;
+	unsigned m_pending;
+
+	unsigned* SqField(uint32_t offset) const
+	{
+		return (unsigned*)(m_sqRing + offset);
+	}
+	unsigned* CqField(uint32_t offset) const
+	{
+		return (unsigned*)(m_cqRing + offset);
+	}
+};
+
+IoUring::~IoUring()
+{
+	if (m_sqes)
+		munmap(m_sqes, m_sqesSize);
+	if (m_cqRing && m_cqRing != m_sqRing)
+		munmap(m_cqRing, m_cqRingSize);
+	if (m_sqRing)
+		munmap(m_sqRing, m_sqRingSize);
+	if (m_fd >= 0)
+		close(m_fd);
+}
+
+bool IoUring::Init(unsigned entries)
+{
+	// One thread submits and reaps, so completions can wait for it
+	// (Linux 6.1); older kernels refuse the flags.
+	memset(&m_params, 0, sizeof(m_params));
+	m_params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+	m_fd = (int)syscall(__NR_io_uring_setup, entries, &m_params);
+	if (m_fd < 0)
+	{
+		memset(&m_params, 0, sizeof(m_params));
+		m_fd = (int)syscall(__NR_io_uring_setup, entries, &m_params);
+	}
+	if (m_fd < 0)
+		return false;
+
+	// The operations used came with Linux 5.6, as the probe did.
+	const unsigned probeOps = 256;
+	std::vector<uint8_t> probeBuffer(sizeof(io_uring_probe) + probeOps * sizeof(io_uring_probe_op));
+	auto probe = (io_uring_probe*)probeBuffer.data();
+	if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, probe, probeOps) < 0)
+		return false;
+	for (unsigned op : { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE })
+	{
+		if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+			return false;
+	}
+
+	m_sqRingSize = m_params.sq_off.array + m_params.sq_entries * sizeof(unsigned);
+	m_cqRingSize = m_params.cq_off.cqes + m_params.cq_entries * sizeof(io_uring_cqe);
+	if (m_params.features & IORING_FEAT_SINGLE_MMAP)
+		m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+	void* sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+	if (sqRing == MAP_FAILED)
+		return false;
+	m_sqRing = (uint8_t*)sqRing;
+	if (m_params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		m_cqRing = m_sqRing;
+	}
+	else
+	{
+		void* cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+		if (cqRing == MAP_FAILED)
+			return false;
+		m_cqRing = (uint8_t*)cqRing;
+	}
+	m_sqesSize = m_params.sq_entries * sizeof(io_uring_sqe);
+	void* sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+		return false;
+	m_sqes = (io_uring_sqe*)sqes;
+	return true;
+}
+
+io_uring_sqe* IoUring::Sqe()
+{
+	// Only this thread moves the tail, the kernel moves the head.
+	unsigned tail = *SqField(m_params.sq_off.tail);
+	unsigned head = __atomic_load_n(SqField(m_params.sq_off.head), __ATOMIC_ACQUIRE);
+	if (tail - head >= m_params.sq_entries)
+		return nullptr;
+	unsigned index = tail & *SqField(m_params.sq_off.ring_mask);
+	io_uring_sqe* sqe = &m_sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	SqField(m_params.sq_off.array)[index] = index;
+	__atomic_store_n(SqField(m_params.sq_off.tail), tail + 1, __ATOMIC_RELEASE);
+	++m_pending;
+	return sqe;
+}
+
+bool IoUring::SubmitAndWait()
+{
+	for (;;)
+	{
+		long submitted = syscall(__NR_io_uring_enter, m_fd, m_pending, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+		if (submitted >= 0)
+		{
+			m_pending -= (unsigned)submitted;
+			return true;
+		}
+		if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			return false;
+	}
+}
+
+bool IoUring::Reap(io_uring_cqe& cqe)
+{
+	unsigned head = *CqField(m_params.cq_off.head);
+	if (head == __atomic_load_n(CqField(m_params.cq_off.tail), __ATOMIC_ACQUIRE))
+		return false;
+	cqe = ((io_uring_cqe*)(m_cqRing + m_params.cq_off.cqes))[head & *CqField(m_params.cq_off.ring_mask)];
+	__atomic_store_n(CqField(m_params.cq_off.head), head + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+// A file being read or written through the ring, one operation at a time.
+struct IoSlot
+{
+	enum Stage
+	{
+		OpenRead,
+		Read,
+		OpenWrite,
+		Write,
+		CloseWrite,
+	};
+	Stage stage;
+	size_t job;
+	int fd;
+	// The entry of the stage reached the kernel.
+	bool submitted;
+	bool ok;
+	LoadedFile file;
+	ConvertedFile converted;
+	size_t done;
+};
+
+class UringIo
+{
+public:
+	UringIo(BatchQueue& queue, unsigned depth)
+		: m_queue(queue)
+		, m_slots(depth)
+	{
+		for (IoSlot& slot : m_slots)
+			m_free.push_back(&slot);
+	}
+
+	bool Init()
+	{
+		return m_ring.Init((unsigned)m_slots.size());
+	}
+	// Return false if the ring breaks, the files in flight are failed then.
+	bool Run();
+
+private:
+	BatchQueue& m_queue;
+	std::vector<IoSlot> m_slots;
+	std::vector<IoSlot*> m_free;
+	// Slots whose entry isn't submitted yet, in the order of the entries.
+	std::deque<IoSlot*> m_queued;
+	// Destroyed first, closing it waits for the operations on the slots.
+	IoUring m_ring;
+
+	void Next(IoSlot& slot);
+	void Complete(IoSlot& slot, int result);
+	void Close(IoSlot& slot, IoSlot::Stage stage);
+	void FinishRead(IoSlot& slot);
+	void Abandon();
+};
+
+// Queue the operation of the stage of slot.
+void UringIo::Next(IoSlot& slot)
+{
+	// There is an entry for every slot.
+	io_uring_sqe* sqe = m_ring.Sqe();
+	sqe->user_data = (uint64_t)(uintptr_t)&slot;
+	slot.submitted = false;
+	m_queued.push_back(&slot);
+	switch (slot.stage)
+	{
+	case IoSlot::OpenRead:
+	case IoSlot::OpenWrite:
+		{
+			const BatchJob& job = m_queue.Job(slot.job);
+			sqe->opcode = IORING_OP_OPENAT;
+			sqe->fd = AT_FDCWD;
+			if (slot.stage == IoSlot::OpenRead)
+			{
+				sqe->addr = (uint64_t)(uintptr_t)job.input.c_str();
+				sqe->open_flags = O_RDONLY | O_CLOEXEC;
+			}
+			else
+			{
+				sqe->addr = (uint64_t)(uintptr_t)job.output.c_str();
+				sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+				sqe->len = 0644;
+			}
+		}
+		break;
+	case IoSlot::Read:
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = slot.fd;
+		sqe->addr = (uint64_t)(uintptr_t)(slot.file.data.get() + slot.done);
+		sqe->len = (uint32_t)std::min(slot.file.size - slot.done, g_maxReadSize);
+		sqe->off = slot.done;
+		break;
+	case IoSlot::Write:
+		sqe->opcode = IORING_OP_WRITE;
+		sqe->fd = slot.fd;
+		sqe->addr = (uint64_t)(uintptr_t)(slot.converted.output.data() + slot.done);
+		sqe->len = (uint32_t)std::min(slot.converted.output.size() - slot.done, g_maxReadSize);
+		sqe->off = slot.done;
+		break;
+	case IoSlot::CloseWrite:
+		sqe->opcode = IORING_OP_CLOSE;
+		sqe->fd = slot.fd;
+		break;
+	}
+}
+
+void UringIo::Close(IoSlot& slot, IoSlot::Stage stage)
+{
+	slot.stage = stage;
+	Next(slot);
+}
+
+void UringIo::FinishRead(IoSlot& slot)
+{
+	// Closing a file only read doesn't block, unlike a written one.
+	close(slot.fd);
+	if (slot.ok)
+		m_queue.Loaded(std::move(slot.file));
+	else
+		m_queue.Failed();
+	slot.file.data.reset();
+	m_free.push_back(&slot);
+}
+
+void UringIo::Complete(IoSlot& slot, int result)
+{
+	switch (slot.stage)
+	{
+	case IoSlot::OpenRead:
+		{
+			struct stat st;
+			slot.fd = result;
+			if (result < 0 || fstat(result, &st) != 0)
+			{
+				if (result >= 0)
+					close(result);
+				m_queue.Failed();
+				m_free.push_back(&slot);
+				return;
+			}
+			slot.file.job = slot.job;
+			slot.file.size = (size_t)st.st_size;
+			slot.file.data.reset(slot.file.size ? new uint8_t[slot.file.size] : nullptr);
+			slot.done = 0;
+			slot.ok = true;
+			slot.stage = IoSlot::Read;
+			if (slot.file.size)
+				Next(slot);
+			else
+				FinishRead(slot);
+		}
+		break;
+	case IoSlot::Read:
+		// An error, or the file got shorter.
+		if (result <= 0)
+			slot.ok = false;
+		else
+			slot.done += result;
+		if (slot.ok && slot.done < slot.file.size)
+			Next(slot);
+		else
+			FinishRead(slot);
+		break;
+	case IoSlot::OpenWrite:
+		slot.fd = result;
+		if (result < 0)
+		{
+			m_queue.Written(false, 0);
+			slot.converted.output.clear();
+			m_free.push_back(&slot);
+			return;
+		}
+		slot.done = 0;
+		slot.ok = true;
+		slot.stage = slot.converted.output.empty() ? IoSlot::CloseWrite : IoSlot::Write;
+		Next(slot);
+		break;
+	case IoSlot::Write:
+		if (result <= 0)
+		{
+			slot.ok = false;
+			Close(slot, IoSlot::CloseWrite);
+			return;
+		}
+		slot.done += result;
+		if (slot.done < slot.converted.output.size())
+			Next(slot);
+		else
+			Close(slot, IoSlot::CloseWrite);
+		break;
+	case IoSlot::CloseWrite:
+		m_queue.Written(slot.ok && result == 0, slot.converted.output.size());
+		slot.converted.output = std::string();
+		m_free.push_back(&slot);
+		break;
+	}
+}
+
+// The ring broke: the files in flight are failed and their descriptors
+// closed. The completions already posted tell which opens and closes ran;
+// a close submitted but not completed is left to the kernel, and so is the
+// descriptor of an open still in it, which can't be known.
+void UringIo::Abandon()
+{
+	io_uring_cqe cqe;
+	while (m_ring.Reap(cqe))
+	{
+		IoSlot& slot = *(IoSlot*)(uintptr_t)cqe.user_data;
+		if (slot.stage == IoSlot::OpenRead || slot.stage == IoSlot::OpenWrite)
+			slot.fd = cqe.res;
+		else if (slot.stage == IoSlot::CloseWrite)
+			slot.fd = -1;
+	}
+	for (IoSlot& slot : m_slots)
+	{
+		if (std::find(m_free.begin(), m_free.end(), &slot) != m_free.end())
+			continue;
+		bool closing = slot.stage == IoSlot::CloseWrite && slot.submitted;
+		if (slot.fd >= 0 && !closing)
+			close(slot.fd);
+		if (slot.stage <= IoSlot::Read)
+			m_queue.Failed();
+		else
+			m_queue.Written(false, 0);
+	}
+}
+
+bool UringIo::Run()
+{
+	for (;;)
+	{
+		// Fill the free slots, the new writes and reads are submitted together.
+		while (!m_free.empty())
+		{
+			IoSlot& slot = *m_free.back();
+			size_t job;
+			if (m_queue.TakeConverted(slot.converted))
+			{
+				slot.job = slot.converted.job;
+				slot.stage = IoSlot::OpenWrite;
+				slot.fd = -1;
+			}
+			else if (m_queue.TakeJob(job))
+			{
+				slot.job = job;
+				slot.stage = IoSlot::OpenRead;
+				slot.fd = -1;
+			}
+			else
+			{
+				break;
+			}
+			m_free.pop_back();
+			Next(slot);
+		}
+		if (m_free.size() == m_slots.size())
+		{
+			// Nothing in flight, wait for the decoding threads.
+			if (!m_queue.WaitForIo())
+				return true;
+			continue;
+		}
+		if (!m_ring.SubmitAndWait())
+		{
+			Abandon();
+			return false;
+		}
+		for (size_t n = m_queued.size() - m_ring.Pending(); n; --n)
+		{
+			m_queued.front()->submitted = true;
+			m_queued.pop_front();
+		}
+		io_uring_cqe cqe;
+		while (m_ring.Reap(cqe))
+			Complete(*(IoSlot*)(uintptr_t)cqe.user_data, cqe.res);
+	}
+}
+#endif
+
+BatchResult ConvertBatch(const std::vector<BatchJob>& jobs, const BatchConvert& convert, const BatchOptions& options)
+{
+	auto start = std::chrono::steady_clock::now();
+	unsigned threadCount = options.threadCount ? options.threadCount : std::max(1u, std::thread::hardware_concurrency());
+	unsigned queueDepth = std::max(1u, options.queueDepth);
+	BatchQueue queue(jobs, convert, queueDepth + (size_t)threadCount * g_readAheadPerThread);
+
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < threadCount; ++i)
+		threads.emplace_back([&queue]() { queue.Decode(); });
+
+	bool asyncIo = false;
+#ifdef BATCH_IO_URING
+	if (options.asyncIo && !jobs.empty())
+	{
+		// The thread pool takes over the jobs left if the ring breaks.
+		UringIo io(queue, queueDepth);
+		asyncIo = io.Init() && io.Run();
+	}
+#endif
+	if (!asyncIo)
+	{
+		std::vector<std::thread> ioThreads;
+		for (unsigned i = 0; i < queueDepth; ++i)
+			ioThreads.emplace_back([&queue]() { BlockingIo(queue); });
+		for (auto& t : ioThreads)
+			t.join();
+	}
+	for (auto& t : threads)
+		t.join();
+
+	BatchResult result = queue.Result();
+	result.files = jobs.size();
+	result.asyncIo = asyncIo;
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return result;
+}
+
+std::vector<BatchJob> ListBatchJobs(const std::string& inputDirectory, const std::string& outputDirectory, const std::string& extension)
+{
+	std::vector<BatchJob> jobs;
+	std::error_code ec;
+	for (const auto& entry : std::filesystem::directory_iterator(std::filesystem::u8path(inputDirectory), ec))
+	{
+		std::string suffix = entry.path().extension().u8string();
+		std::transform(suffix.begin(), suffix.end(), suffix.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+		if ((suffix != ".emf" && suffix != ".emz") || !entry.is_regular_file(ec))
+			continue;
+		BatchJob job;
+		job.input = entry.path().u8string();
+		if (!outputDirectory.empty())
+			job.output = (std::filesystem::u8path(outputDirectory) / entry.path().stem()).u8string() + extension;
+		jobs.push_back(job);
+	}
+	std::sort(jobs.begin(), jobs.end(), [](const BatchJob& a, const BatchJob& b) { return a.input < b.input; });
+	return jobs;
+}
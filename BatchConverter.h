@@ -0,0 +1,65 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Files read or written at the same time.
+const unsigned g_defaultBatchQueueDepth = 64;
+
+struct BatchJob
+{
+	// UTF-8 paths. An empty output is converted but not written.
+	std::string input;
+	std::string output;
+};
+
+// Convert a whole input file into the content of the output, called on the
+// decoding threads. Return false if the input is bad. It runs in an
+// ArenaScope reset after every file, so its transient ArenaAllocator data
+// needs no freeing; the output must not use it.
+typedef std::function<bool(const uint8_t* data, size_t size, std::string& output)> BatchConvert;
+
+struct BatchOptions
+{
+	// Decoding threads, 0 for one per core.
+	unsigned threadCount = 0;
+	// Reads and writes in flight.
+	unsigned queueDepth = g_defaultBatchQueueDepth;
+	// Use io_uring where the kernel has it, else the thread pool. Off by
+	// default: it was no faster than the thread pool on the disks measured.
+	bool asyncIo = false;
+};
+
+struct BatchResult
+{
+	size_t files = 0;
+	// Files which couldn't be read, converted or written.
+	size_t failed = 0;
+	uint64_t bytesRead = 0;
+	uint64_t bytesWritten = 0;
+	double seconds = 0;
+	// True if io_uring did the I/O.
+	bool asyncIo = false;
+};
+
+// Reads overlap with decoding and writes: queueDepth I/O threads block on
+// opens, reads, writes and closes, or with asyncIo on Linux one thread keeps
+// them queued in io_uring and submits them together. Decoding runs on threadCount threads, and files read
+// ahead of them are bounded to a few per thread.
+BatchResult ConvertBatch(const std::vector<BatchJob>& jobs, const BatchConvert& convert, const BatchOptions& options = BatchOptions());
+
+// Jobs for the .emf and .emz files of inputDirectory, written into
+// outputDirectory with extension (".svg") instead. Sorted by name.
+std::vector<BatchJob> ListBatchJobs(const std::string& inputDirectory, const std::string& outputDirectory, const std::string& extension);
@@ -0,0 +1,275 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+// emfbench, the benchmarks of the rendering kernels, a console program of
+// the portable sources (no Qt nor GDI):
+//
+//   emfbench flatten FILE... [--repeat N] [--tolerance T]
+//   emfbench dib [--size WxH] [--repeat N]
+//   emfbench stretch [--size WxH] [--repeat N]
+//   emfbench rop [--size WxH] [--repeat N]
+//   emfbench composite [--size WxH] [--repeat N]
+//   emfbench text FILE... [--repeat N] [--threads N] [--fonts DIR]
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "Compositor.h"
+#include "DibDecoder.h"
+#include "GlyphCache.h"
+#include "ImageStretcher.h"
+#include "MappedFile.h"
+#include "PathFlattener.h"
+#include "PdfExporter.h"
+#include "RasterOp.h"
+#include "SpoolFile.h"
+
+static int Usage()
+{
+	fprintf(stderr, "usage: emfbench flatten FILE... [--repeat N] [--tolerance T]\n"
+		"       emfbench dib [--size WxH] [--repeat N]\n"
+		"       emfbench stretch [--size WxH] [--repeat N]\n"
+		"       emfbench rop [--size WxH] [--repeat N]\n"
+		"       emfbench composite [--size WxH] [--repeat N]\n"
+		"       emfbench text FILE... [--repeat N] [--threads N] [--fonts DIR]\n");
+	return 2;
+}
+
+// The pages of a spool file, or the whole file as one page.
+static bool ReadPages(const MappedFile& file, std::vector<PdfPage>& pages)
+{
+	pages.clear();
+	if (IsSpool(file.Data(), file.Size()))
+	{
+		SpoolDocument spool;
+		if (!IndexSpool(file.Data(), file.Size(), spool))
+			return false;
+		for (const SpoolPage& page : spool.pages)
+			pages.push_back(PdfPage{ page.data, page.size });
+		return true;
+	}
+	pages.push_back(PdfPage{ file.Data(), file.Size() });
+	return true;
+}
+
+static int Flatten(int argc, char* argv[])
+{
+	// Enough rounds for small files to be measurable.
+	unsigned repeat = 100;
+	float tolerance = g_defaultFlatness;
+	std::vector<std::string> inputs;
+	for (int i = 2; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "--repeat") && i + 1 < argc)
+			repeat = (unsigned)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--tolerance") && i + 1 < argc)
+			tolerance = (float)atof(argv[++i]);
+		else if (argv[i][0] == '-')
+			return Usage();
+		else
+			inputs.push_back(argv[i]);
+	}
+	if (inputs.empty())
+		return Usage();
+
+	printf("%-40s %10s %12s %10s %14s\n", "file", "curves", "segments", "s", "Msegments/s");
+	for (const std::string& input : inputs)
+	{
+		MappedFile file;
+		std::vector<PdfPage> pages;
+		if (!file.Open(input) || !ReadPages(file, pages))
+		{
+			fprintf(stderr, "emfbench: can't read %s\n", input.c_str());
+			return 1;
+		}
+		FlattenBenchmark result = {};
+		for (const PdfPage& page : pages)
+		{
+			FlattenBenchmark pageResult = BenchmarkFlatten(page.data, page.size, tolerance, repeat);
+			result.curves += pageResult.curves;
+			result.segments += pageResult.segments;
+			result.seconds += pageResult.seconds;
+		}
+		double rate = result.seconds > 0 ? result.segments / result.seconds : 0;
+		printf("%-40s %10llu %12llu %10.3f %14.1f\n", input.c_str(), (unsigned long long)result.curves,
+			(unsigned long long)result.segments, result.seconds, rate / 1e6);
+	}
+	return 0;
+}
+
+// Options of the benchmarks of synthesized images, a full HD frame by default.
+static bool ReadImageOptions(int argc, char* argv[], uint32_t& width, uint32_t& height, unsigned& repeat)
+{
+	width = 1920;
+	height = 1080;
+	for (int i = 2; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "--size") && i + 1 < argc)
+		{
+			if (sscanf(argv[++i], "%ux%u", &width, &height) != 2 || !width || !height)
+				return false;
+		}
+		else if (!strcmp(argv[i], "--repeat") && i + 1 < argc)
+			repeat = (unsigned)atoi(argv[++i]);
+		else
+			return false;
+	}
+	return true;
+}
+
+static int DecodeDibs(int argc, char* argv[])
+{
+	uint32_t width, height;
+	unsigned repeat = 20;
+	if (!ReadImageOptions(argc, argv, width, height, repeat))
+		return Usage();
+	printf("%-24s %14s\n", "format", "Mpixels/s");
+	for (const DibBenchmark& result : BenchmarkDibDecoding(width, height, repeat))
+	{
+		double rate = result.seconds > 0 ? result.pixels / result.seconds : 0;
+		printf("%-24s %14.1f\n", result.format, rate / 1e6);
+	}
+	return 0;
+}
+
+static int Stretch(int argc, char* argv[])
+{
+	uint32_t width, height;
+	unsigned repeat = 10;
+	if (!ReadImageOptions(argc, argv, width, height, repeat))
+		return Usage();
+	printf("%-32s %14s %10s\n", "mode", "Mpixels/s", "GB/s");
+	for (const StretchBenchmark& result : BenchmarkStretching(width, height, repeat))
+	{
+		double seconds = result.seconds > 0 ? result.seconds : 1;
+		printf("%-32s %14.1f %10.2f\n", result.name, result.pixels / seconds / 1e6, result.bytes / seconds / 1e9);
+	}
+	return 0;
+}
+
+// The operations with a kernel of their own one by one, the others summed up.
+static int RasterOps(int argc, char* argv[])
+{
+	uint32_t width, height;
+	unsigned repeat = 10;
+	if (!ReadImageOptions(argc, argv, width, height, repeat))
+		return Usage();
+	double slowest = 0, fastest = 0, total = 0;
+	unsigned generic = 0;
+	printf("%-24s %14s\n", "operation", "Mpixels/s");
+	for (const RasterOpBenchmark& result : BenchmarkRasterOps(width, (unsigned)height * repeat))
+	{
+		double rate = result.seconds > 0 ? result.pixels / result.seconds / 1e6 : 0;
+		if (result.dedicated)
+		{
+			printf("0x%02X %19s %14.0f\n", result.index, "", rate);
+			continue;
+		}
+		slowest = generic ? std::min(slowest, rate) : rate;
+		fastest = std::max(fastest, rate);
+		total += rate;
+		++generic;
+	}
+	printf("the other %u: %.0f to %.0f, %.0f on average\n", generic, slowest, fastest, generic ? total / generic : 0);
+	return 0;
+}
+
+static int Composite(int argc, char* argv[])
+{
+	uint32_t width, height;
+	unsigned repeat = 20;
+	if (!ReadImageOptions(argc, argv, width, height, repeat))
+		return Usage();
+	printf("%-32s %14s\n", "operation", "Mpixels/s");
+	for (const CompositeBenchmark& result : BenchmarkCompositing(width, height, repeat))
+	{
+		double rate = result.seconds > 0 ? result.pixels / result.seconds / 1e6 : 0;
+		printf("%-32s %14.0f\n", result.name, rate);
+	}
+	return 0;
+}
+
+// The glyph cache is shared by the threads and the files, so later files
+// mostly hit.
+static int Text(int argc, char* argv[])
+{
+	unsigned repeat = 10;
+	unsigned threadCount = 1;
+	std::vector<std::string> fontDirectories;
+	std::vector<std::string> inputs;
+	for (int i = 2; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "--repeat") && i + 1 < argc)
+			repeat = (unsigned)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+			threadCount = std::max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "--fonts") && i + 1 < argc)
+			fontDirectories.push_back(argv[++i]);
+		else if (argv[i][0] == '-')
+			return Usage();
+		else
+			inputs.push_back(argv[i]);
+	}
+	if (inputs.empty())
+		return Usage();
+
+	FontResolver fonts;
+	if (!fonts.Scan(fontDirectories))
+	{
+		fprintf(stderr, "emfbench: no fonts found\n");
+		return 1;
+	}
+	GlyphCache glyphs(fonts);
+	printf("%-40s %12s %10s %14s\n", "file", "glyphs", "s", "Mglyphs/s");
+	for (const std::string& input : inputs)
+	{
+		MappedFile file;
+		std::vector<PdfPage> pages;
+		if (!file.Open(input) || !ReadPages(file, pages))
+		{
+			fprintf(stderr, "emfbench: can't read %s\n", input.c_str());
+			return 1;
+		}
+		TextBenchmark result = {};
+		for (const PdfPage& page : pages)
+		{
+			TextBenchmark pageResult = BenchmarkText(page.data, page.size, glyphs, threadCount, repeat);
+			result.glyphs += pageResult.glyphs;
+			result.seconds += pageResult.seconds;
+		}
+		double rate = result.seconds > 0 ? result.glyphs / result.seconds : 0;
+		printf("%-40s %12llu %10.3f %14.2f\n", input.c_str(), (unsigned long long)result.glyphs, result.seconds, rate / 1e6);
+	}
+	GlyphCacheStats stats = glyphs.Stats();
+	printf("%zu faces, %zu strikes, %llu hits, %llu misses, %zu atlas pages of %zu bytes\n", fonts.FaceCount(), stats.strikes,
+		(unsigned long long)stats.hits, (unsigned long long)stats.misses, stats.atlasPages, stats.atlasBytes);
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+		return Usage();
+	if (!strcmp(argv[1], "flatten"))
+		return Flatten(argc, argv);
+	if (!strcmp(argv[1], "dib"))
+		return DecodeDibs(argc, argv);
+	if (!strcmp(argv[1], "stretch"))
+		return Stretch(argc, argv);
+	if (!strcmp(argv[1], "rop"))
+		return RasterOps(argc, argv);
+	if (!strcmp(argv[1], "composite"))
+		return Composite(argc, argv);
+	if (!strcmp(argv[1], "text"))
+		return Text(argc, argv);
+	return Usage();
+}
@@ -0,0 +1,449 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define EMF_COMPOSITE_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define EMF_COMPOSITE_AVX2
+#include <immintrin.h>
+#endif
+
+#include "Compositor.h"
+#include "DibDecoder.h"
+#include "ImageStretcher.h"
+
+const uint32_t g_opaque = 0xFF000000;
+// Gradient channels are 16.16 fixed point along a span.
+const int g_gradientBits = 16;
+
+static inline uint32_t Multiply255(uint32_t a, uint32_t b)
+{
+	uint32_t t = a * b + 128;
+	return (t + (t >> 8)) >> 8;
+}
+
+// The four channels of a pixel times a / 255.
+static inline uint32_t Scale(uint32_t pixel, uint32_t a)
+{
+	return Multiply255(pixel >> 24, a) << 24 | Multiply255(pixel >> 16 & 0xFF, a) << 16
+		| Multiply255(pixel >> 8 & 0xFF, a) << 8 | Multiply255(pixel & 0xFF, a);
+}
+
+#ifdef EMF_COMPOSITE_SSE2
+// 16 bit channels times the 16 bit factors / 255, rounded as Multiply255.
+static inline __m128i Multiply255(__m128i x, __m128i factors)
+{
+	__m128i t = _mm_add_epi16(_mm_mullo_epi16(x, factors), _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+// The alpha of every pixel of 16 bit channels in its four channels.
+static inline __m128i Alphas(__m128i x)
+{
+	return _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+}
+#endif
+
+#ifdef EMF_COMPOSITE_AVX2
+static inline __m256i Multiply255(__m256i x, __m256i factors)
+{
+	__m256i t = _mm256_add_epi16(_mm256_mullo_epi16(x, factors), _mm256_set1_epi16(128));
+	return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+static inline __m256i Alphas(__m256i x)
+{
+	return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(x, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+}
+#endif
+
+void BlendSpan(const uint32_t* source, uint32_t* destination, size_t count, uint8_t constantAlpha, bool sourceAlpha)
+{
+	const uint32_t force = sourceAlpha ? 0 : g_opaque;
+	size_t i = 0;
+	// Registers of opaque source pixels are copied and those of empty ones
+	// skipped, the usual case for shadows and antialiased edges.
+#ifdef EMF_COMPOSITE_AVX2
+	{
+		const __m256i zero = _mm256_setzero_si256(), forced = _mm256_set1_epi32((int)force);
+		const __m256i constant = _mm256_set1_epi16(constantAlpha), full = _mm256_set1_epi16(255);
+		const __m256i alphaMask = _mm256_set1_epi32((int)g_opaque);
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256i s = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(source + i)), forced);
+			if (_mm256_testz_si256(s, s))
+				continue;
+			if (constantAlpha == 255 && _mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(s, alphaMask), alphaMask)) == -1)
+			{
+				_mm256_storeu_si256((__m256i*)(destination + i), s);
+				continue;
+			}
+			__m256i sLo = _mm256_unpacklo_epi8(s, zero), sHi = _mm256_unpackhi_epi8(s, zero);
+			if (constantAlpha != 255)
+			{
+				sLo = Multiply255(sLo, constant);
+				sHi = Multiply255(sHi, constant);
+			}
+			__m256i d = _mm256_loadu_si256((const __m256i*)(destination + i));
+			__m256i dLo = Multiply255(_mm256_unpacklo_epi8(d, zero), _mm256_sub_epi16(full, Alphas(sLo)));
+			__m256i dHi = Multiply255(_mm256_unpackhi_epi8(d, zero), _mm256_sub_epi16(full, Alphas(sHi)));
+			__m256i out = _mm256_adds_epu8(_mm256_packus_epi16(sLo, sHi), _mm256_packus_epi16(dLo, dHi));
+			_mm256_storeu_si256((__m256i*)(destination + i), out);
+		}
+	}
+#endif
+#ifdef EMF_COMPOSITE_SSE2
+	{
+		const __m128i zero = _mm_setzero_si128(), forced = _mm_set1_epi32((int)force);
+		const __m128i constant = _mm_set1_epi16(constantAlpha), full = _mm_set1_epi16(255);
+		const __m128i alphaMask = _mm_set1_epi32((int)g_opaque);
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128i s = _mm_or_si128(_mm_loadu_si128((const __m128i*)(source + i)), forced);
+			if (_mm_movemask_epi8(_mm_cmpeq_epi32(s, zero)) == 0xFFFF)
+				continue;
+			if (constantAlpha == 255 && _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(s, alphaMask), alphaMask)) == 0xFFFF)
+			{
+				_mm_storeu_si128((__m128i*)(destination + i), s);
+				continue;
+			}
+			__m128i sLo = _mm_unpacklo_epi8(s, zero), sHi = _mm_unpackhi_epi8(s, zero);
+			if (constantAlpha != 255)
+			{
+				sLo = Multiply255(sLo, constant);
+				sHi = Multiply255(sHi, constant);
+			}
+			__m128i d = _mm_loadu_si128((const __m128i*)(destination + i));
+			__m128i dLo = Multiply255(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(full, Alphas(sLo)));
+			__m128i dHi = Multiply255(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(full, Alphas(sHi)));
+			_mm_storeu_si128((__m128i*)(destination + i), _mm_adds_epu8(_mm_packus_epi16(sLo, sHi), _mm_packus_epi16(dLo, dHi)));
+		}
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		uint32_t s = source[i] | force;
+		if (constantAlpha != 255)
+			s = Scale(s, constantAlpha);
+		uint32_t a = s >> 24;
+		if (a == 255)
+			destination[i] = s;
+		else if (s != 0)
+		{
+			uint32_t d = Scale(destination[i], 255 - a), out = 0;
+			// Saturated per channel as the registers are.
+			for (int c = 0; c < 32; c += 8)
+				out |= std::min((s >> c & 0xFF) + (d >> c & 0xFF), 255u) << c;
+			destination[i] = out;
+		}
+	}
+}
+
+void ColorKeySpan(const uint32_t* source, uint32_t* destination, size_t count, uint32_t key)
+{
+	size_t i = 0;
+#ifdef EMF_COMPOSITE_AVX2
+	{
+		const __m256i colorMask = _mm256_set1_epi32(0x00FFFFFF), keys = _mm256_set1_epi32((int)key);
+		const __m256i alphaMask = _mm256_set1_epi32((int)g_opaque);
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256i s = _mm256_loadu_si256((const __m256i*)(source + i));
+			__m256i keyed = _mm256_cmpeq_epi32(_mm256_and_si256(s, colorMask), keys);
+			int mask = _mm256_movemask_epi8(keyed);
+			if (mask == -1)
+				continue;
+			s = _mm256_or_si256(s, alphaMask);
+			if (mask != 0)
+				s = _mm256_blendv_epi8(s, _mm256_loadu_si256((const __m256i*)(destination + i)), keyed);
+			_mm256_storeu_si256((__m256i*)(destination + i), s);
+		}
+	}
+#endif
+#ifdef EMF_COMPOSITE_SSE2
+	{
+		const __m128i colorMask = _mm_set1_epi32(0x00FFFFFF), keys = _mm_set1_epi32((int)key);
+		const __m128i alphaMask = _mm_set1_epi32((int)g_opaque);
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128i s = _mm_loadu_si128((const __m128i*)(source + i));
+			__m128i keyed = _mm_cmpeq_epi32(_mm_and_si128(s, colorMask), keys);
+			int mask = _mm_movemask_epi8(keyed);
+			if (mask == 0xFFFF)
+				continue;
+			s = _mm_or_si128(s, alphaMask);
+			if (mask != 0)
+				s = _mm_or_si128(_mm_and_si128(keyed, _mm_loadu_si128((const __m128i*)(destination + i))), _mm_andnot_si128(keyed, s));
+			_mm_storeu_si128((__m128i*)(destination + i), s);
+		}
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		if ((source[i] & 0x00FFFFFF) != key)
+			destination[i] = source[i] | g_opaque;
+	}
+}
+
+// Fill count pixels from the channels of color (b, g, r, a, 16.16 fixed
+// point), adding step to them from one pixel to the next.
+static void GradientSpan(const int32_t* color, const int32_t* step, uint32_t* destination, size_t count)
+{
+	size_t i = 0;
+	int32_t c[4] = { color[0], color[1], color[2], color[3] };
+#ifdef EMF_COMPOSITE_AVX2
+	if (count >= 8)
+	{
+		// Pixels k and k + 4 in a register, so the packs leave them in order.
+		__m256i first = _mm256_setr_epi32(c[0], c[1], c[2], c[3],
+			c[0] + 4 * step[0], c[1] + 4 * step[1], c[2] + 4 * step[2], c[3] + 4 * step[3]);
+		__m256i delta = _mm256_setr_epi32(step[0], step[1], step[2], step[3], step[0], step[1], step[2], step[3]);
+		__m256i p0 = first, p1 = _mm256_add_epi32(p0, delta), p2 = _mm256_add_epi32(p1, delta), p3 = _mm256_add_epi32(p2, delta);
+		__m256i delta8 = _mm256_slli_epi32(delta, 3);
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256i p01 = _mm256_packs_epi32(_mm256_srai_epi32(p0, g_gradientBits), _mm256_srai_epi32(p1, g_gradientBits));
+			__m256i p23 = _mm256_packs_epi32(_mm256_srai_epi32(p2, g_gradientBits), _mm256_srai_epi32(p3, g_gradientBits));
+			_mm256_storeu_si256((__m256i*)(destination + i), _mm256_packus_epi16(p01, p23));
+			p0 = _mm256_add_epi32(p0, delta8);
+			p1 = _mm256_add_epi32(p1, delta8);
+			p2 = _mm256_add_epi32(p2, delta8);
+			p3 = _mm256_add_epi32(p3, delta8);
+		}
+		for (int k = 0; k < 4; ++k)
+			c[k] += (int32_t)i * step[k];
+	}
+#endif
+#ifdef EMF_COMPOSITE_SSE2
+	if (count - i >= 4)
+	{
+		__m128i delta = _mm_setr_epi32(step[0], step[1], step[2], step[3]);
+		__m128i p0 = _mm_setr_epi32(c[0], c[1], c[2], c[3]);
+		__m128i p1 = _mm_add_epi32(p0, delta), p2 = _mm_add_epi32(p1, delta), p3 = _mm_add_epi32(p2, delta);
+		__m128i delta4 = _mm_slli_epi32(delta, 2);
+		size_t start = i;
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128i p01 = _mm_packs_epi32(_mm_srai_epi32(p0, g_gradientBits), _mm_srai_epi32(p1, g_gradientBits));
+			__m128i p23 = _mm_packs_epi32(_mm_srai_epi32(p2, g_gradientBits), _mm_srai_epi32(p3, g_gradientBits));
+			_mm_storeu_si128((__m128i*)(destination + i), _mm_packus_epi16(p01, p23));
+			p0 = _mm_add_epi32(p0, delta4);
+			p1 = _mm_add_epi32(p1, delta4);
+			p2 = _mm_add_epi32(p2, delta4);
+			p3 = _mm_add_epi32(p3, delta4);
+		}
+		for (int k = 0; k < 4; ++k)
+			c[k] += (int32_t)(i - start) * step[k];
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		uint32_t pixel = 0;
+		for (int k = 0; k < 4; ++k)
+		{
+			pixel |= (uint32_t)std::min(std::max(c[k] >> g_gradientBits, 0), 255) << (8 * k);
+			c[k] += step[k];
+		}
+		destination[i] = pixel;
+	}
+}
+
+// Pixels [left, right) of row y of image inside clip, if any.
+template<typename Fn>
+static void ClipRow(const EmfRegion* clip, int32_t y, int32_t left, int32_t right, Fn fn)
+{
+	if (left >= right)
+		return;
+	if (clip)
+		clip->ClipSpan(y, left, right, fn);
+	else
+		fn(left, right);
+}
+
+bool CompositeImage(const EmfImage& image, const EmfDeviceContext& dc, RenderedImage& target)
+{
+	bool blend = image.type == EmrType::AlphaBlend;
+	if (!blend && image.type != EmrType::TransparentBlt)
+		return false;
+	if (blend && (image.rop & 0xFF) != g_acSrcOver)
+		return false;
+	const EmfMatrix& m = image.placement;
+	if (m.b != 0 || m.c != 0)
+		return false;
+	int32_t left = (int32_t)std::lround(std::min(m.e, m.e + m.a)), right = (int32_t)std::lround(std::max(m.e, m.e + m.a));
+	int32_t top = (int32_t)std::lround(std::min(m.f, m.f + m.d)), bottom = (int32_t)std::lround(std::max(m.f, m.f + m.d));
+	if (left == right || top == bottom)
+		return true;
+
+	bool sourceAlpha = blend && (image.rop >> 24 & g_acSrcAlpha);
+	RenderedImage decoded, stretched;
+	if (!DecodeDib(image.bmi, image.bmiSize, image.bits, image.bitsSize, sourceAlpha, decoded))
+		return false;
+	// A negative extent of the placement mirrors the destination.
+	if (!StretchImage(decoded, image.srcX, image.srcY, image.srcWidth, image.srcHeight,
+		m.a < 0 ? left - right : right - left, m.d < 0 ? top - bottom : bottom - top, g_colorOnColor, stretched))
+		return false;
+
+	uint8_t constantAlpha = (uint8_t)(image.rop >> 16);
+	uint32_t key = (image.rop & 0xFF) << 16 | (image.rop & 0xFF00) | (image.rop >> 16 & 0xFF);
+	const EmfRegion* clip = dc.clip.get();
+	int32_t x0 = std::max(left, 0), x1 = std::min(right, (int32_t)target.width);
+	for (int32_t y = std::max(top, 0); y < std::min(bottom, (int32_t)target.height); ++y)
+	{
+		const uint32_t* src = stretched.pixels.data() + (size_t)(y - top) * stretched.width - left;
+		uint32_t* dst = target.pixels.data() + (size_t)y * target.width;
+		ClipRow(clip, y, x0, x1, [&](int32_t l, int32_t r)
+		{
+			if (blend)
+				BlendSpan(src + l, dst + l, r - l, constantAlpha, sourceAlpha);
+			else
+				ColorKeySpan(src + l, dst + l, r - l, key);
+		});
+	}
+	return true;
+}
+
+// A channel of a triangle as a plane over device space.
+struct GradientPlane
+{
+	double value, dx, dy;
+};
+
+void FillGradient(const EmfGradient& gradient, const EmfRegion* clip, RenderedImage& image)
+{
+	for (size_t t = 0; t + 3 <= gradient.triangles.size(); t += 3)
+	{
+		const EmfGradientVertex* v[3] = { &gradient.vertices[gradient.triangles[t]],
+			&gradient.vertices[gradient.triangles[t + 1]], &gradient.vertices[gradient.triangles[t + 2]] };
+		double x0 = v[0]->point.x, y0 = v[0]->point.y;
+		double x1 = v[1]->point.x - x0, y1 = v[1]->point.y - y0;
+		double x2 = v[2]->point.x - x0, y2 = v[2]->point.y - y0;
+		double area = x1 * y2 - x2 * y1;
+		if (std::fabs(area) < 1e-9)
+			continue;
+
+		// Channels b, g, r from the high bytes of COLOR16, alpha opaque.
+		GradientPlane planes[4];
+		for (int k = 0; k < 3; ++k)
+		{
+			auto channel = [k](const EmfGradientVertex* vertex) { return (k == 0 ? vertex->blue : k == 1 ? vertex->green : vertex->red) / 256.0; };
+			double c0 = channel(v[0]), c1 = channel(v[1]) - c0, c2 = channel(v[2]) - c0;
+			planes[k] = { c0, (c1 * y2 - c2 * y1) / area, (c2 * x1 - c1 * x2) / area };
+		}
+		planes[3] = { 255, 0, 0 };
+		int32_t step[4];
+		for (int k = 0; k < 4; ++k)
+			step[k] = (int32_t)std::lround(planes[k].dx * (1 << g_gradientBits));
+
+		// Rows whose centers are in [minY, maxY).
+		double minY = std::min({ v[0]->point.y, v[1]->point.y, v[2]->point.y });
+		double maxY = std::max({ v[0]->point.y, v[1]->point.y, v[2]->point.y });
+		int32_t rowBegin = std::max((int32_t)std::ceil(minY - 0.5), 0);
+		int32_t rowEnd = std::min((int32_t)std::ceil(maxY - 0.5), (int32_t)image.height);
+		for (int32_t y = rowBegin; y < rowEnd; ++y)
+		{
+			double center = y + 0.5, xl = HUGE_VAL, xr = -HUGE_VAL;
+			for (int e = 0; e < 3; ++e)
+			{
+				const EmfPointF& a = v[e]->point;
+				const EmfPointF& b = v[(e + 1) % 3]->point;
+				double ya = std::min(a.y, b.y), yb = std::max(a.y, b.y);
+				if (ya == yb || center < ya || center >= yb)
+					continue;
+				double x = a.x + (center - a.y) * (b.x - a.x) / (b.y - a.y);
+				xl = std::min(xl, x);
+				xr = std::max(xr, x);
+			}
+			if (xl >= xr)
+				continue;
+			// Columns whose centers are in [xl, xr).
+			int32_t left = (int32_t)std::max(std::ceil(xl - 0.5), 0.0);
+			int32_t right = (int32_t)std::min(std::ceil(xr - 0.5), (double)image.width);
+			uint32_t* row = image.pixels.data() + (size_t)y * image.width;
+			ClipRow(clip, y, left, right, [&](int32_t l, int32_t r)
+			{
+				int32_t color[4];
+				for (int k = 0; k < 4; ++k)
+				{
+					double value = planes[k].value + planes[k].dx * (l + 0.5 - x0) + planes[k].dy * (center - y0);
+					color[k] = (int32_t)std::lround(value * (1 << g_gradientBits));
+				}
+				GradientSpan(color, step, row + l, r - l);
+			});
+		}
+	}
+}
+
+std::vector<CompositeBenchmark> BenchmarkCompositing(uint32_t width, uint32_t height, unsigned repeat)
+{
+	size_t count = (size_t)width * height;
+	std::vector<uint32_t> translucent(count), opaque(count), keyed(count), destination(count);
+	uint64_t state = 1;
+	for (size_t i = 0; i < count; ++i)
+	{
+		state = state * 6364136223846793005ull + 1442695040888963407ull;
+		uint32_t random = (uint32_t)(state >> 32), a = random >> 24;
+		translucent[i] = (Scale(random | g_opaque, a) & 0x00FFFFFF) | a << 24;
+		opaque[i] = random | g_opaque;
+		// Half the pixels are the key.
+		keyed[i] = random & 1 ? 0xFF00FF : random;
+		destination[i] = (uint32_t)state | g_opaque;
+	}
+	// A horizontal gradient as a rectangle, and a mesh of 32 x 32 pixel cells.
+	EmfGradient rectangle, mesh;
+	float w = (float)width, h = (float)height;
+	rectangle.vertices = { { { 0, 0 }, 0xFF00, 0, 0x8000, 0xFF00 }, { { w, 0 }, 0, 0xFF00, 0x4000, 0xFF00 },
+		{ { w, h }, 0, 0xFF00, 0x4000, 0xFF00 }, { { 0, h }, 0xFF00, 0, 0x8000, 0xFF00 } };
+	rectangle.triangles = { 0, 1, 2, 0, 2, 3 };
+	uint32_t columns = width / 32 + 1, rows = height / 32 + 1;
+	for (uint32_t y = 0; y <= rows; ++y)
+	{
+		for (uint32_t x = 0; x <= columns; ++x)
+		{
+			uint16_t shade = (uint16_t)((x * 7919 + y * 104729) * 0x101);
+			mesh.vertices.push_back({ { 32.0f * x, 32.0f * y }, shade, (uint16_t)~shade, (uint16_t)(shade >> 1), 0xFF00 });
+			if (x < columns && y < rows)
+			{
+				uint32_t i = y * (columns + 1) + x;
+				mesh.triangles.insert(mesh.triangles.end(), { i, i + 1, i + columns + 2, i, i + columns + 2, i + columns + 1 });
+			}
+		}
+	}
+
+	RenderedImage target = { width, height, destination };
+	auto run = [&](const char* name, auto fn)
+	{
+		CompositeBenchmark result = { name, 0, 0 };
+		auto start = std::chrono::steady_clock::now();
+		for (unsigned r = 0; r < repeat; ++r)
+		{
+			target.pixels = destination;
+			fn();
+			result.pixels += count;
+		}
+		result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		return result;
+	};
+	// Restoring the destination is timed too, it is the same for all.
+	std::vector<CompositeBenchmark> results;
+	results.push_back(run("AlphaBlend, source alpha", [&] { BlendSpan(translucent.data(), target.pixels.data(), count, 255, true); }));
+	results.push_back(run("AlphaBlend, constant alpha", [&] { BlendSpan(opaque.data(), target.pixels.data(), count, 128, false); }));
+	results.push_back(run("AlphaBlend, both", [&] { BlendSpan(translucent.data(), target.pixels.data(), count, 128, true); }));
+	results.push_back(run("AlphaBlend, opaque", [&] { BlendSpan(opaque.data(), target.pixels.data(), count, 255, false); }));
+	results.push_back(run("TransparentBlt", [&] { ColorKeySpan(keyed.data(), target.pixels.data(), count, 0xFF00FF); }));
+	results.push_back(run("GradientFill, rectangle", [&] { FillGradient(rectangle, nullptr, target); }));
+	results.push_back(run("GradientFill, triangles", [&] { FillGradient(mesh, nullptr, target); }));
+	return results;
+}
@@ -0,0 +1,55 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "EmfPlayer.h"
+#include "RenderCache.h"
+
+// AlphaBlend, TransparentBlt and GradientFill on premultiplied 0xAARRGGBB
+// pixels, whose positions are device pixels.
+
+// BLENDFUNCTION, the dwRop of an AlphaBlend record: BlendOp, BlendFlags,
+// SourceConstantAlpha and AlphaFormat from the low byte up.
+const uint32_t g_acSrcOver = 0;
+const uint32_t g_acSrcAlpha = 1;
+
+// destination = source * constantAlpha + destination * (1 - alpha of that),
+// as AlphaBlend with AC_SRC_OVER. Without sourceAlpha (AC_SRC_ALPHA) the
+// source is opaque.
+void BlendSpan(const uint32_t* source, uint32_t* destination, size_t count, uint8_t constantAlpha, bool sourceAlpha);
+
+// Copy the pixels of source but those of the color key (0xRRGGBB), opaque,
+// as TransparentBlt.
+void ColorKeySpan(const uint32_t* source, uint32_t* destination, size_t count, uint32_t key);
+
+// Draw an AlphaBlend or TransparentBlt record into target, inside the clip
+// of dc. The bitmap is stretched COLORONCOLOR, as both functions do, so
+// color keys stay exact. Return false if the record is another one, its
+// placement is rotated or skewed, or GDI would fail it.
+bool CompositeImage(const EmfImage& image, const EmfDeviceContext& dc, RenderedImage& target);
+
+// Fill the triangles of gradient into image, inside clip if any, opaque.
+// Pixels whose centers are inside a triangle are filled, those on a shared
+// edge by one of the triangles only.
+void FillGradient(const EmfGradient& gradient, const EmfRegion* clip, RenderedImage& image);
+
+struct CompositeBenchmark
+{
+	const char* name;
+	uint64_t pixels;
+	double seconds;
+};
+
+// Blend, key and fill width x height pixels repeat times in every way.
+std::vector<CompositeBenchmark> BenchmarkCompositing(uint32_t width, uint32_t height, unsigned repeat);
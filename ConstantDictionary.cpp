@@ -51,9 +51,9 @@ ConstantDictionary::~ConstantDictionary()
 
 const char g_or[] = " | ";
 size_t g_orLen = sizeof(g_or) - 1;
-// Not thread safe! But no problem in this program.
-char g_intBuffer[12];
-char g_symbolsBuffer[256];
+// One buffer per thread, records may be translated on several threads.
+thread_local char g_intBuffer[12];
+thread_local char g_symbolsBuffer[256];
 const char * ConstantDictionary::BkMode(int mode)
 {
 	g_intBuffer[0] = '\0';
@@ -218,6 +218,7 @@ const char * ConstantDictionary::ClipRgnMergeMode(int mode)
 	CASE(RGN_OR)
 	CASE(RGN_XOR)
 	CASE(RGN_DIFF)
+	CASE(RGN_COPY)
 	default:
 		str = itoa(mode, g_intBuffer, 10);
 		break;
@@ -297,6 +298,22 @@ const char * ConstantDictionary::FontWeight(int mode)
 	return str;
 }
 
+const char * ConstantDictionary::GradientFillMode(int mode)
+{
+	g_intBuffer[0] = '\0';
+	const char* str;
+	switch (mode)
+	{
+	CASE(GRADIENT_FILL_RECT_H)
+	CASE(GRADIENT_FILL_RECT_V)
+	CASE(GRADIENT_FILL_TRIANGLE)
+	default:
+		str = itoa(mode, g_intBuffer, 10);
+		break;
+	}
+	return str;
+}
+
 const char * ConstantDictionary::HatchStyle(int mode)
 {
 	g_intBuffer[0] = '\0';
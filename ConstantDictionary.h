@@ -26,6 +26,7 @@ public:
 	static const char* ColorTableUsage(int);
 	static const char* ExtTextOutOptions(int);
 	static const char* FontWeight(int);
+	static const char* GradientFillMode(int);
 	static const char* HatchStyle(int);
 	static const char* ICMMode(int);
 	static const char* Layout(int);
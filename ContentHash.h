@@ -0,0 +1,43 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// 64 bit hashes of record and resource contents. Fast, not cryptographic.
+const uint64_t g_hashSeed = 0xCBF29CE484222325ull;
+
+inline uint64_t HashMix(uint64_t h, uint64_t v)
+{
+	h ^= v;
+	h *= 0x9E3779B97F4A7C15ull;
+	return h ^ (h >> 29);
+}
+
+inline uint64_t HashBytes(const uint8_t* data, size_t size, uint64_t h = g_hashSeed)
+{
+	h = HashMix(h, size);
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+	{
+		uint64_t v;
+		memcpy(&v, data + i, sizeof(v));
+		h = HashMix(h, v);
+	}
+	if (i < size)
+	{
+		uint64_t v = 0;
+		memcpy(&v, data + i, size - i);
+		h = HashMix(h, v);
+	}
+	return h;
+}
@@ -0,0 +1,976 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <map>
+
+#include "Arena.h"
+#include "ContentHash.h"
+#include "ConversionDaemon.h"
+#include "MappedFile.h"
+#include "PdfExporter.h"
+#include "SpoolFile.h"
+#include "SvgExporter.h"
+
+// Descriptors taken by one receive, more are a protocol error.
+const size_t g_maxReceivedFds = 16;
+const size_t g_receiveSize = 64 * 1024;
+
+#ifdef MSG_NOSIGNAL
+const int g_sendFlags = MSG_NOSIGNAL;
+#else
+const int g_sendFlags = 0;
+#endif
+
+static void SetNonBlocking(int fd)
+{
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+static void SetCloseOnExec(int fd)
+{
+	fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+}
+
+static void SetNoSigPipe(int fd)
+{
+#ifdef SO_NOSIGPIPE
+	int on = 1;
+	setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#else
+	(void)fd;
+#endif
+}
+
+static bool SocketAddress(const std::string& path, sockaddr_un& address)
+{
+	memset(&address, 0, sizeof(address));
+	if (path.empty() || path.size() >= sizeof(address.sun_path))
+		return false;
+	address.sun_family = AF_UNIX;
+	memcpy(address.sun_path, path.data(), path.size());
+	return true;
+}
+
+// Append what socket has to received and the descriptors sent with it to
+// fds. Return the bytes received, 0 at the end, -1 on error.
+static ssize_t ReceiveWithFds(int socket, std::vector<uint8_t>& received, std::deque<int>& fds)
+{
+	size_t used = received.size();
+	received.resize(used + g_receiveSize);
+	iovec iov = { received.data() + used, g_receiveSize };
+	union
+	{
+		cmsghdr header;
+		char buffer[CMSG_SPACE(sizeof(int) * g_maxReceivedFds)];
+	} control;
+	msghdr message = {};
+	message.msg_iov = &iov;
+	message.msg_iovlen = 1;
+	message.msg_control = control.buffer;
+	message.msg_controllen = sizeof(control.buffer);
+	int flags = 0;
+#ifdef MSG_CMSG_CLOEXEC
+	flags |= MSG_CMSG_CLOEXEC;
+#endif
+	ssize_t n;
+	do
+		n = recvmsg(socket, &message, flags);
+	while (n < 0 && errno == EINTR);
+	received.resize(used + (n > 0 ? n : 0));
+	if (n < 0)
+		return n;
+	for (cmsghdr* c = CMSG_FIRSTHDR(&message); c; c = CMSG_NXTHDR(&message, c))
+	{
+		if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+			continue;
+		size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (size_t i = 0; i < count; ++i)
+		{
+			int fd;
+			memcpy(&fd, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+			fds.push_back(fd);
+		}
+	}
+	// Descriptors dropped by the kernel would pair the next ones with the wrong requests.
+	if (message.msg_flags & MSG_CTRUNC)
+	{
+		errno = EPROTO;
+		return -1;
+	}
+	return n;
+}
+
+// Send data, with fd if it isn't -1.
+static ssize_t SendWithFd(int socket, const void* data, size_t size, int fd)
+{
+	iovec iov = { const_cast<void*>(data), size };
+	union
+	{
+		cmsghdr header;
+		char buffer[CMSG_SPACE(sizeof(int))];
+	} control;
+	msghdr message = {};
+	message.msg_iov = &iov;
+	message.msg_iovlen = 1;
+	if (fd >= 0)
+	{
+		memset(&control, 0, sizeof(control));
+		message.msg_control = control.buffer;
+		message.msg_controllen = sizeof(control.buffer);
+		cmsghdr* c = CMSG_FIRSTHDR(&message);
+		c->cmsg_level = SOL_SOCKET;
+		c->cmsg_type = SCM_RIGHTS;
+		c->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(c), &fd, sizeof(int));
+	}
+	ssize_t n;
+	do
+		n = sendmsg(socket, &message, g_sendFlags);
+	while (n < 0 && errno == EINTR);
+	return n;
+}
+
+// A file holding size bytes of data, -1 if it can't be made. On Linux a memfd
+// sealed once written, so the receiver may map it without fearing a change.
+static int DataFile(const void* data, size_t size)
+{
+#ifdef __linux__
+	int fd = memfd_create("emfparser", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+	char name[] = "/tmp/emfparser-XXXXXX";
+	int fd = mkstemp(name);
+	if (fd >= 0)
+	{
+		unlink(name);
+		SetCloseOnExec(fd);
+	}
+#endif
+	if (fd < 0)
+		return -1;
+	const char* p = static_cast<const char*>(data);
+	while (size)
+	{
+		ssize_t n = write(fd, p, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+		{
+			close(fd);
+			return -1;
+		}
+		p += n;
+		size -= n;
+	}
+#ifdef __linux__
+	fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
+	return fd;
+}
+
+// An input descriptor, closed once read. A memfd sealed against shrinking is
+// mapped; any other file could be truncated by the client under the mapping,
+// a SIGBUS for the daemon, so it is read into the arena of the worker. Only
+// regular files of maxSize bytes at most are taken.
+class InputDescriptor
+{
+public:
+	InputDescriptor(int fd, uint64_t maxSize)
+		: m_data(nullptr)
+		, m_size(0)
+		, m_mapped(false)
+		, m_tooLarge(false)
+		, m_buffer(nullptr)
+		, m_capacity(0)
+	{
+		struct stat status;
+		if (fstat(fd, &status) == 0 && S_ISREG(status.st_mode) && status.st_size > 0)
+		{
+			if ((uint64_t)status.st_size > maxSize)
+			{
+				m_tooLarge = true;
+				close(fd);
+				return;
+			}
+#ifdef F_GET_SEALS
+			int seals = fcntl(fd, F_GET_SEALS);
+			if (seals >= 0 && (seals & F_SEAL_SHRINK))
+			{
+				void* p = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (p != MAP_FAILED)
+				{
+					m_data = static_cast<const uint8_t*>(p);
+					m_size = (size_t)status.st_size;
+					m_mapped = true;
+				}
+			}
+#endif
+			if (!m_mapped)
+			{
+				try
+				{
+					Read(fd, (size_t)status.st_size);
+				}
+				catch (...)
+				{
+					close(fd);
+					throw;
+				}
+			}
+		}
+		close(fd);
+	}
+	~InputDescriptor()
+	{
+		if (m_mapped)
+			munmap(const_cast<uint8_t*>(m_data), m_size);
+		if (m_buffer)
+			m_allocator.deallocate(m_buffer, m_capacity);
+	}
+	InputDescriptor(const InputDescriptor&) = delete;
+	InputDescriptor& operator=(const InputDescriptor&) = delete;
+
+	const uint8_t* Data() const
+	{
+		return m_data;
+	}
+	size_t Size() const
+	{
+		return m_size;
+	}
+	bool TooLarge() const
+	{
+		return m_tooLarge;
+	}
+
+private:
+	const uint8_t* m_data;
+	size_t m_size;
+	bool m_mapped;
+	bool m_tooLarge;
+	// Not a vector, its bytes would be zeroed before being read over.
+	ArenaAllocator<uint8_t> m_allocator;
+	uint8_t* m_buffer;
+	size_t m_capacity;
+
+	// The size of the file when it was opened at most; what it lost since is
+	// cut off.
+	void Read(int fd, size_t size)
+	{
+		m_buffer = m_allocator.allocate(size);
+		m_capacity = size;
+		size_t done = 0;
+		while (done < size)
+		{
+			ssize_t n = pread(fd, m_buffer + done, size - done, (off_t)done);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				break;
+			done += n;
+		}
+		if (done)
+		{
+			m_data = m_buffer;
+			m_size = done;
+		}
+	}
+};
+
+static bool Export(const DaemonRequest& request, const uint8_t* data, size_t size, std::ostream& os)
+{
+	std::vector<PdfPage> pages;
+	SpoolDocument spool;
+	if (IsSpool(data, size))
+	{
+		if (!IndexSpool(data, size, spool))
+			return false;
+		for (const SpoolPage& page : spool.pages)
+			pages.push_back(PdfPage{ page.data, page.size });
+	}
+	else
+	{
+		pages.push_back(PdfPage{ data, size });
+	}
+	switch ((DaemonJob)request.job)
+	{
+	case DaemonJob::Svg:
+	case DaemonJob::Thumbnail:
+	{
+		if (request.page >= pages.size())
+			return false;
+		uint32_t maxSide = request.maxSide;
+		if (request.job == (uint32_t)DaemonJob::Thumbnail && maxSide == 0)
+			maxSide = g_daemonThumbnailSize;
+		return ExportSvg(pages[request.page].data, pages[request.page].size, os, maxSide);
+	}
+	case DaemonJob::Pdf:
+		// On the calling worker only, the workers are the concurrency cap.
+		return ExportPdf(pages, os, 1);
+	default:
+		return false;
+	}
+}
+
+struct ConversionDaemon::Connection
+{
+	int fd = -1;
+	std::vector<uint8_t> received;
+	std::deque<int> fds;
+	// Stream offset of the end of the bytes each of fds came with, and of
+	// the first byte of received.
+	std::deque<uint64_t> fdEnds;
+	uint64_t receivedStart = 0;
+	// Requests taken whose reply isn't sent yet.
+	unsigned inFlight = 0;
+	std::deque<Reply> replies;
+	// Bytes of the first reply sent.
+	size_t sent = 0;
+	// The client shut down its side, no more requests come.
+	bool ended = false;
+
+	bool Done() const
+	{
+		return ended && inFlight == 0;
+	}
+	// Send replies until the socket is full. Return false on error.
+	bool SendReplies()
+	{
+		while (!replies.empty())
+		{
+			Reply& reply = replies.front();
+			const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&reply.response);
+			ssize_t n = SendWithFd(fd, bytes + sent, sizeof(DaemonResponse) - sent, sent == 0 ? reply.output : -1);
+			if (n < 0)
+				return errno == EAGAIN || errno == EWOULDBLOCK;
+			sent += n;
+			if (sent < sizeof(DaemonResponse))
+				continue;
+			if (reply.output >= 0)
+				close(reply.output);
+			replies.pop_front();
+			sent = 0;
+			--inFlight;
+		}
+		return true;
+	}
+	void Close()
+	{
+		close(fd);
+		for (int input : fds)
+			close(input);
+		for (const Reply& reply : replies)
+		{
+			if (reply.output >= 0)
+				close(reply.output);
+		}
+	}
+};
+
+ConversionDaemon::ConversionDaemon()
+	: m_listen(-1)
+	, m_wake{ -1, -1 }
+	, m_stopping(false)
+	, m_connections(0)
+	, m_requests(0)
+	, m_failed(0)
+	, m_cacheHits(0)
+	, m_cacheUsed(0)
+{
+}
+
+ConversionDaemon::~ConversionDaemon()
+{
+	Stop();
+}
+
+bool ConversionDaemon::Start(const std::string& socketPath, const DaemonOptions& options)
+{
+	Stop();
+	sockaddr_un address;
+	if (!SocketAddress(socketPath, address))
+		return false;
+	m_listen = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (m_listen < 0)
+		return false;
+	SetCloseOnExec(m_listen);
+	unlink(socketPath.c_str());
+	m_socketPath = socketPath;
+	if (bind(m_listen, (const sockaddr*)&address, sizeof(address)) < 0 || listen(m_listen, SOMAXCONN) < 0 || pipe(m_wake) < 0)
+	{
+		Stop();
+		return false;
+	}
+	SetNonBlocking(m_listen);
+	for (int fd : m_wake)
+	{
+		SetNonBlocking(fd);
+		SetCloseOnExec(fd);
+	}
+
+	m_options = options;
+	if (m_options.threadCount == 0)
+		m_options.threadCount = std::max(1u, std::thread::hardware_concurrency());
+	m_options.pipelineDepth = std::max(1u, m_options.pipelineDepth);
+	m_stopping = false;
+	for (unsigned i = 0; i < m_options.threadCount; ++i)
+		m_workers.emplace_back(&ConversionDaemon::Work, this);
+	m_ioThread = std::thread(&ConversionDaemon::ServeIo, this);
+	return true;
+}
+
+void ConversionDaemon::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_taskReady.notify_all();
+	if (m_wake[1] >= 0)
+	{
+		char c = 0;
+		(void)!write(m_wake[1], &c, 1);
+	}
+	if (m_ioThread.joinable())
+		m_ioThread.join();
+	for (std::thread& worker : m_workers)
+		worker.join();
+	m_workers.clear();
+	for (const Task& task : m_tasks)
+	{
+		if (task.input >= 0)
+			close(task.input);
+	}
+	m_tasks.clear();
+	for (const Reply& reply : m_replies)
+	{
+		if (reply.output >= 0)
+			close(reply.output);
+	}
+	m_replies.clear();
+	if (m_listen >= 0)
+	{
+		close(m_listen);
+		unlink(m_socketPath.c_str());
+		m_listen = -1;
+	}
+	for (int& fd : m_wake)
+	{
+		if (fd >= 0)
+			close(fd);
+		fd = -1;
+	}
+	std::lock_guard<std::mutex> lock(m_cacheMutex);
+	m_cache.clear();
+	m_cacheIndex.clear();
+	m_cacheUsed = 0;
+}
+
+DaemonStats ConversionDaemon::Stats() const
+{
+	return { m_connections.load(), m_requests.load(), m_failed.load(), m_cacheHits.load() };
+}
+
+void ConversionDaemon::ServeIo()
+{
+	std::map<uint64_t, Connection> connections;
+	uint64_t nextConnection = 0;
+	std::vector<pollfd> polled;
+	std::vector<uint64_t> polledConnections;
+	for (;;)
+	{
+		std::deque<Reply> replies;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_stopping)
+				break;
+			replies.swap(m_replies);
+		}
+		for (const Reply& reply : replies)
+		{
+			auto found = connections.find(reply.connection);
+			if (found != connections.end())
+				found->second.replies.push_back(reply);
+			else if (reply.output >= 0)
+				close(reply.output);
+		}
+
+		polled.clear();
+		polledConnections.clear();
+		polled.push_back({ m_wake[0], POLLIN, 0 });
+		polled.push_back({ m_listen, POLLIN, 0 });
+		for (auto& entry : connections)
+		{
+			const Connection& connection = entry.second;
+			short events = 0;
+			if (!connection.ended && connection.inFlight < m_options.pipelineDepth)
+				events |= POLLIN;
+			if (!connection.replies.empty())
+				events |= POLLOUT;
+			polled.push_back({ connection.fd, events, 0 });
+			polledConnections.push_back(entry.first);
+		}
+		if (poll(polled.data(), polled.size(), -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (polled[0].revents)
+		{
+			char buffer[256];
+			while (read(m_wake[0], buffer, sizeof(buffer)) > 0)
+				;
+		}
+		if (polled[1].revents & POLLIN)
+		{
+			for (;;)
+			{
+				int fd = accept(m_listen, nullptr, nullptr);
+				if (fd < 0)
+					break;
+				SetNonBlocking(fd);
+				SetCloseOnExec(fd);
+				SetNoSigPipe(fd);
+				connections[nextConnection++].fd = fd;
+				++m_connections;
+			}
+		}
+		for (size_t i = 2; i < polled.size(); ++i)
+		{
+			uint64_t id = polledConnections[i - 2];
+			Connection& connection = connections[id];
+			short revents = polled[i].revents;
+			bool ok = !(revents & (POLLERR | POLLHUP | POLLNVAL));
+			if (ok && (revents & POLLIN))
+			{
+				ssize_t n = ReceiveWithFds(connection.fd, connection.received, connection.fds);
+				// A read stops right after the bytes sent with descriptors.
+				connection.fdEnds.resize(connection.fds.size(), connection.receivedStart + connection.received.size());
+				if (n == 0)
+					connection.ended = true;
+				else if (n < 0)
+					ok = errno == EAGAIN || errno == EWOULDBLOCK;
+			}
+			if (ok)
+				ok = connection.SendReplies();
+			// Requests held back by the pipeline depth are taken as replies go.
+			if (ok)
+				ok = TakeRequests(id, connection);
+			if (!ok || connection.Done())
+			{
+				connection.Close();
+				connections.erase(id);
+			}
+		}
+	}
+	for (auto& entry : connections)
+		entry.second.Close();
+}
+
+bool ConversionDaemon::TakeRequests(uint64_t id, Connection& connection)
+{
+	std::vector<uint8_t>& received = connection.received;
+	size_t offset = 0;
+	std::vector<Task> tasks;
+	while (connection.inFlight < m_options.pipelineDepth && received.size() - offset >= sizeof(DaemonRequest))
+	{
+		Task task = { id, {}, std::string(), -1 };
+		memcpy(&task.request, received.data() + offset, sizeof(DaemonRequest));
+		uint32_t pathLength = task.request.pathLength;
+		if (task.request.magic != g_daemonMagic || pathLength > g_maxDaemonPath)
+			return false;
+		if (received.size() - offset - sizeof(DaemonRequest) < pathLength)
+			break;
+		task.path.assign((const char*)received.data() + offset + sizeof(DaemonRequest), pathLength);
+		// The descriptor came with the bytes of its request, path or not: one
+		// with a path is refused. Extra ones of an earlier request are dropped.
+		uint64_t start = connection.receivedStart + offset;
+		offset += sizeof(DaemonRequest) + pathLength;
+		while (!connection.fds.empty() && connection.fdEnds.front() <= start)
+		{
+			close(connection.fds.front());
+			connection.fds.pop_front();
+			connection.fdEnds.pop_front();
+		}
+		if (!connection.fds.empty() && connection.fdEnds.front() <= connection.receivedStart + offset)
+		{
+			task.input = connection.fds.front();
+			connection.fds.pop_front();
+			connection.fdEnds.pop_front();
+		}
+		++connection.inFlight;
+		tasks.push_back(std::move(task));
+	}
+	received.erase(received.begin(), received.begin() + offset);
+	connection.receivedStart += offset;
+	if (tasks.empty())
+		return true;
+	m_requests += tasks.size();
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (Task& task : tasks)
+			m_tasks.push_back(std::move(task));
+	}
+	if (tasks.size() == 1)
+		m_taskReady.notify_one();
+	else
+		m_taskReady.notify_all();
+	return true;
+}
+
+void ConversionDaemon::Work()
+{
+	// Kept from a job to the next, so steady work takes nothing from the heap.
+	Arena arena;
+	ArenaScope scope(arena);
+	for (;;)
+	{
+		Task task;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_taskReady.wait(lock, [this] { return m_stopping || !m_tasks.empty(); });
+			if (m_stopping)
+				return;
+			task = std::move(m_tasks.front());
+			m_tasks.pop_front();
+		}
+		Reply reply;
+		try
+		{
+			reply = Convert(task);
+		}
+		catch (const std::exception&)
+		{
+			// Out of memory on one input, say; the others go on.
+			reply = { task.connection, { g_daemonMagic, task.request.id, (uint32_t)DaemonStatus::Failed, 0, 0, 0 }, -1 };
+		}
+		arena.Reset();
+		if (reply.response.status != (uint32_t)DaemonStatus::Ok)
+			++m_failed;
+		bool wake;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			wake = m_replies.empty();
+			m_replies.push_back(reply);
+		}
+		// Once per batch of replies, the I/O thread takes them all.
+		if (wake)
+		{
+			char c = 0;
+			(void)!write(m_wake[1], &c, 1);
+		}
+	}
+}
+
+ConversionDaemon::Reply ConversionDaemon::Convert(const Task& task)
+{
+	auto start = std::chrono::steady_clock::now();
+	const DaemonRequest& request = task.request;
+	Reply reply = { task.connection, { g_daemonMagic, request.id, (uint32_t)DaemonStatus::Ok, 0, 0, 0 }, -1 };
+	DaemonResponse& response = reply.response;
+	auto finish = [&](DaemonStatus status)
+	{
+		response.status = (uint32_t)status;
+		response.microseconds = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		return reply;
+	};
+	if (request.job < (uint32_t)DaemonJob::Svg || request.job > (uint32_t)DaemonJob::Pdf || (task.input < 0) == task.path.empty())
+	{
+		if (task.input >= 0)
+			close(task.input);
+		return finish(DaemonStatus::BadRequest);
+	}
+
+	// A path names a file the client may truncate too. Opening a FIFO
+	// doesn't wait for a writer, it is refused as not a regular file.
+	int fd = task.input >= 0 ? task.input : open(task.path.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+	if (fd < 0)
+		return finish(DaemonStatus::CantOpen);
+	InputDescriptor input(fd, m_options.maxInputBytes);
+	if (input.TooLarge())
+		return finish(DaemonStatus::BadInput);
+	const uint8_t* data = input.Data();
+	size_t size = input.Size();
+	if (!data)
+		return finish(DaemonStatus::CantOpen);
+
+	uint64_t key = 0;
+	if (m_options.cacheBytes)
+	{
+		key = HashMix(HashMix(HashMix(HashBytes(data, size), request.job), request.maxSide), request.page);
+		if (std::shared_ptr<const std::string> output = FindCached(key, data, size))
+		{
+			++m_cacheHits;
+			response.cached = 1;
+			response.size = output->size();
+			reply.output = DataFile(output->data(), output->size());
+			return finish(reply.output >= 0 ? DaemonStatus::Ok : DaemonStatus::Failed);
+		}
+	}
+
+	ArenaOStringStream os;
+	if (!Export(request, data, size, os))
+		return finish(DaemonStatus::BadInput);
+	ArenaString text = os.str();
+	response.size = text.size();
+	reply.output = DataFile(text.data(), text.size());
+	if (reply.output < 0)
+		return finish(DaemonStatus::Failed);
+	if (m_options.cacheBytes && size + text.size() <= m_options.cacheBytes)
+		Cache(key, data, size, std::make_shared<const std::string>(text.data(), text.size()));
+	return finish(DaemonStatus::Ok);
+}
+
+// The key is a fast hash, the input it was made from decides.
+std::shared_ptr<const std::string> ConversionDaemon::FindCached(uint64_t key, const uint8_t* input, size_t size)
+{
+	std::lock_guard<std::mutex> lock(m_cacheMutex);
+	auto found = m_cacheIndex.find(key);
+	if (found == m_cacheIndex.end())
+		return nullptr;
+	const std::string& cachedInput = found->second->input;
+	if (cachedInput.size() != size || memcmp(cachedInput.data(), input, size) != 0)
+		return nullptr;
+	m_cache.splice(m_cache.begin(), m_cache, found->second);
+	return found->second->output;
+}
+
+void ConversionDaemon::Cache(uint64_t key, const uint8_t* input, size_t size, const std::shared_ptr<const std::string>& output)
+{
+	std::lock_guard<std::mutex> lock(m_cacheMutex);
+	if (m_cacheIndex.count(key))
+		return;
+	uint64_t bytes = size + output->size();
+	while (!m_cache.empty() && m_cacheUsed + bytes > m_options.cacheBytes)
+	{
+		m_cacheUsed -= m_cache.back().input.size() + m_cache.back().output->size();
+		m_cacheIndex.erase(m_cache.back().key);
+		m_cache.pop_back();
+	}
+	m_cache.push_front({ key, std::string((const char*)input, size), output });
+	m_cacheIndex[key] = m_cache.begin();
+	m_cacheUsed += bytes;
+}
+
+DaemonClient::DaemonClient()
+	: m_fd(-1)
+{
+}
+
+DaemonClient::~DaemonClient()
+{
+	Close();
+}
+
+bool DaemonClient::Connect(const std::string& socketPath)
+{
+	Close();
+	sockaddr_un address;
+	if (!SocketAddress(socketPath, address))
+		return false;
+	m_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (m_fd < 0)
+		return false;
+	SetCloseOnExec(m_fd);
+	SetNoSigPipe(m_fd);
+	if (connect(m_fd, (const sockaddr*)&address, sizeof(address)) < 0)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void DaemonClient::Close()
+{
+	if (m_fd >= 0)
+		close(m_fd);
+	m_fd = -1;
+	for (int fd : m_fds)
+		close(fd);
+	m_fds.clear();
+	m_received.clear();
+}
+
+void DaemonClient::Shutdown()
+{
+	if (m_fd >= 0)
+		shutdown(m_fd, SHUT_WR);
+}
+
+bool DaemonClient::Send(DaemonRequest request, const std::string& path, int input)
+{
+	if (m_fd < 0 || path.size() > g_maxDaemonPath)
+		return false;
+	request.magic = g_daemonMagic;
+	request.pathLength = input >= 0 ? 0 : (uint32_t)path.size();
+	std::string frame((const char*)&request, sizeof(request));
+	frame.append(path, 0, request.pathLength);
+	size_t sent = 0;
+	while (sent < frame.size())
+	{
+		ssize_t n = SendWithFd(m_fd, frame.data() + sent, frame.size() - sent, sent == 0 ? input : -1);
+		if (n < 0)
+			return false;
+		sent += n;
+	}
+	return true;
+}
+
+bool DaemonClient::Receive(DaemonResponse& response, int& output)
+{
+	output = -1;
+	while (m_received.size() < sizeof(DaemonResponse))
+	{
+		if (m_fd < 0 || ReceiveWithFds(m_fd, m_received, m_fds) <= 0)
+			return false;
+	}
+	memcpy(&response, m_received.data(), sizeof(response));
+	m_received.erase(m_received.begin(), m_received.begin() + sizeof(response));
+	if (response.magic != g_daemonMagic)
+		return false;
+	if (response.status == (uint32_t)DaemonStatus::Ok)
+	{
+		if (m_fds.empty())
+			return false;
+		output = m_fds.front();
+		m_fds.pop_front();
+	}
+	return true;
+}
+
+// Value at fraction of sorted, 0 if it is empty.
+static double Percentile(const std::vector<double>& sorted, double fraction)
+{
+	if (sorted.empty())
+		return 0;
+	size_t i = std::min(sorted.size() - 1, (size_t)(sorted.size() * fraction));
+	return sorted[i];
+}
+
+std::vector<DaemonLatency> MeasureDaemonLatency(const std::string& socketPath, const std::vector<std::string>& inputs,
+	const std::vector<double>& rates, const DaemonLoadOptions& options)
+{
+	typedef std::chrono::steady_clock Clock;
+	std::vector<DaemonLatency> results;
+	if (inputs.empty())
+		return results;
+	// Paths as the daemon sees them, or the files copied in memfds as a
+	// caller holding them in memory would send them.
+	std::vector<std::string> paths;
+	std::vector<int> descriptors;
+	for (const std::string& input : inputs)
+	{
+		std::error_code error;
+		paths.push_back(std::filesystem::absolute(std::filesystem::u8path(input), error).string());
+		if (options.sendDescriptors)
+		{
+			MappedFile file;
+			descriptors.push_back(file.Open(input) ? DataFile(file.Data(), file.Size()) : -1);
+		}
+	}
+
+	const unsigned connectionCount = std::max(1u, options.connections);
+	for (double rate : rates)
+	{
+		if (rate <= 0)
+			continue;
+		const uint64_t perConnection = std::max<uint64_t>(1, (uint64_t)(rate * options.seconds / connectionCount));
+		const double interval = connectionCount / rate;
+		std::mutex mutex;
+		std::vector<double> latencies;
+		std::atomic<uint64_t> sent(0), answered(0), failed(0);
+		const Clock::time_point start = Clock::now() + std::chrono::milliseconds(10);
+		std::vector<std::thread> threads;
+		for (unsigned c = 0; c < connectionCount; ++c)
+		{
+			threads.emplace_back([&, c]
+			{
+				DaemonClient client;
+				if (!client.Connect(socketPath))
+					return;
+				// Connections take turns through the interval.
+				std::vector<Clock::time_point> due(perConnection);
+				for (uint64_t k = 0; k < perConnection; ++k)
+					due[k] = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>((k + (double)c / connectionCount) * interval));
+				std::thread receiver([&]
+				{
+					std::vector<double> local;
+					DaemonResponse response;
+					int output;
+					while (client.Receive(response, output))
+					{
+						Clock::time_point now = Clock::now();
+						if (output >= 0)
+							close(output);
+						if (response.id >= perConnection)
+							continue;
+						++answered;
+						if (response.status != (uint32_t)DaemonStatus::Ok)
+							++failed;
+						else
+							local.push_back(std::chrono::duration<double, std::milli>(now - due[response.id]).count());
+					}
+					std::lock_guard<std::mutex> lock(mutex);
+					latencies.insert(latencies.end(), local.begin(), local.end());
+				});
+				for (uint64_t k = 0; k < perConnection; ++k)
+				{
+					std::this_thread::sleep_until(due[k]);
+					DaemonRequest request = {};
+					request.id = (uint32_t)k;
+					request.job = (uint32_t)options.job;
+					request.maxSide = options.maxSide;
+					size_t input = (size_t)((k * connectionCount + c) % inputs.size());
+					if (!client.Send(request, paths[input], options.sendDescriptors ? descriptors[input] : -1))
+						break;
+					++sent;
+				}
+				client.Shutdown();
+				receiver.join();
+			});
+		}
+		for (std::thread& thread : threads)
+			thread.join();
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+		std::sort(latencies.begin(), latencies.end());
+		DaemonLatency result;
+		result.rate = rate;
+		result.achieved = seconds > 0 ? latencies.size() / seconds : 0;
+		result.sent = sent;
+		// Unanswered requests failed too.
+		result.failed = failed + (sent - answered);
+		result.p50 = Percentile(latencies, 0.5);
+		result.p99 = Percentile(latencies, 0.99);
+		result.max = latencies.empty() ? 0 : latencies.back();
+		results.push_back(result);
+	}
+	for (int fd : descriptors)
+	{
+		if (fd >= 0)
+			close(fd);
+	}
+	return results;
+}
@@ -0,0 +1,250 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// A long running conversion server on a Unix domain socket, for callers which
+// convert many small metafiles and can't afford a process each. POSIX only.
+//
+// A client writes requests, each a DaemonRequest followed by pathLength bytes
+// of UTF-8 path, without waiting for the replies. With pathLength 0 the input
+// is instead the file descriptor sent with the request (SCM_RIGHTS); the
+// daemon closes its copy. A request with a path must come without one. Both
+// are regular files of maxInputBytes at most. A memfd sealed with F_SEAL_SHRINK is mapped, other
+// files, named or sent, are read as they could shrink. Every request
+// gets a DaemonResponse, in the order the jobs finish, not the order they
+// were sent; id tells which. A successful one comes with a sealed memfd, or
+// an unlinked temporary file elsewhere than on Linux, holding the output:
+// read it with pread or mmap, its offset may be shared. Shutting down the
+// write side of the connection makes the daemon close it once the requests
+// in flight are answered.
+
+// "EMFD", first field of both frames.
+const uint32_t g_daemonMagic = 0x44464D45;
+// Requests of one connection in flight; the daemon stops reading past it.
+const unsigned g_defaultDaemonPipelineDepth = 64;
+// Outputs kept to answer the same request again.
+const uint64_t g_defaultDaemonCacheBytes = 64 * 1024 * 1024;
+// Longest path of a request.
+const uint32_t g_maxDaemonPath = 4096;
+// Largest input, a larger one is answered BadInput.
+const uint64_t g_defaultDaemonMaxInput = 256 * 1024 * 1024;
+// maxSide of a Thumbnail job which has none.
+const uint32_t g_daemonThumbnailSize = 256;
+
+enum class DaemonJob : uint32_t
+{
+	// SVG of a page, in device pixels or scaled to maxSide if it isn't 0.
+	Svg = 1,
+	// SVG thumbnail of a page simplified by LodFilter, maxSide pixels at most.
+	Thumbnail = 2,
+	// PDF of all the pages.
+	Pdf = 3,
+};
+
+enum class DaemonStatus : uint32_t
+{
+	Ok = 0,
+	// Unknown job, no path nor descriptor, or both.
+	BadRequest = 1,
+	// The path or descriptor can't be opened or mapped, or isn't a regular file.
+	CantOpen = 2,
+	// Not an EMF, EMZ or spool file, no such page, or too large.
+	BadInput = 3,
+	// The output can't be written, or the conversion ran out of memory.
+	Failed = 4,
+};
+
+struct DaemonRequest
+{
+	uint32_t magic;
+	// Chosen by the client, given back in the response.
+	uint32_t id;
+	uint32_t job;
+	uint32_t maxSide;
+	// Page of a spool file for Svg and Thumbnail, 0 for an EMF.
+	uint32_t page;
+	uint32_t pathLength;
+};
+
+struct DaemonResponse
+{
+	uint32_t magic;
+	uint32_t id;
+	uint32_t status;
+	// 1 if the output came from the cache.
+	uint32_t cached;
+	uint64_t size;
+	// Spent converting, not waiting in the queue.
+	uint64_t microseconds;
+};
+
+struct DaemonOptions
+{
+	// Jobs converted at once, 0 for one per core.
+	unsigned threadCount = 0;
+	// Requests of one connection in flight.
+	unsigned pipelineDepth = g_defaultDaemonPipelineDepth;
+	// Byte budget of the output cache, inputs and outputs, 0 for none.
+	uint64_t cacheBytes = g_defaultDaemonCacheBytes;
+	// Largest input, mapped or read.
+	uint64_t maxInputBytes = g_defaultDaemonMaxInput;
+};
+
+struct DaemonStats
+{
+	uint64_t connections;
+	uint64_t requests;
+	uint64_t failed;
+	uint64_t cacheHits;
+};
+
+// One thread polls the socket and the connections, threadCount threads
+// convert. The workers, their arenas and the output cache stay from a job to
+// the next.
+class ConversionDaemon
+{
+public:
+	ConversionDaemon();
+	~ConversionDaemon();
+	ConversionDaemon(const ConversionDaemon&) = delete;
+	ConversionDaemon& operator=(const ConversionDaemon&) = delete;
+
+	// Listen on socketPath, replacing what is there, and start the threads.
+	bool Start(const std::string& socketPath, const DaemonOptions& options = DaemonOptions());
+	// Close the connections, even with jobs in flight, and join the threads.
+	void Stop();
+	DaemonStats Stats() const;
+
+private:
+	struct Task
+	{
+		uint64_t connection;
+		DaemonRequest request;
+		std::string path;
+		// Input descriptor, -1 for path.
+		int input;
+	};
+	struct Reply
+	{
+		uint64_t connection;
+		DaemonResponse response;
+		// Output descriptor, -1 if none.
+		int output;
+	};
+	struct CachedOutput
+	{
+		uint64_t key;
+		// Compared on a hit, the key may collide.
+		std::string input;
+		std::shared_ptr<const std::string> output;
+	};
+	struct Connection;
+
+	std::string m_socketPath;
+	DaemonOptions m_options;
+	int m_listen;
+	// Pipe waking the I/O thread when replies are ready or on Stop.
+	int m_wake[2];
+	std::thread m_ioThread;
+	std::vector<std::thread> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_taskReady;
+	std::deque<Task> m_tasks;
+	std::deque<Reply> m_replies;
+	bool m_stopping;
+	std::atomic<uint64_t> m_connections;
+	std::atomic<uint64_t> m_requests;
+	std::atomic<uint64_t> m_failed;
+	std::atomic<uint64_t> m_cacheHits;
+	// Most recently used first.
+	std::mutex m_cacheMutex;
+	std::list<CachedOutput> m_cache;
+	std::unordered_map<uint64_t, std::list<CachedOutput>::iterator> m_cacheIndex;
+	uint64_t m_cacheUsed;
+
+	void ServeIo();
+	void Work();
+	// Parse the requests received on connection, false on a protocol error.
+	bool TakeRequests(uint64_t id, Connection& connection);
+	Reply Convert(const Task& task);
+	std::shared_ptr<const std::string> FindCached(uint64_t key, const uint8_t* input, size_t size);
+	void Cache(uint64_t key, const uint8_t* input, size_t size, const std::shared_ptr<const std::string>& output);
+};
+
+// Blocking client end, sending and receiving may be done on two threads.
+class DaemonClient
+{
+public:
+	DaemonClient();
+	~DaemonClient();
+	DaemonClient(const DaemonClient&) = delete;
+	DaemonClient& operator=(const DaemonClient&) = delete;
+
+	bool Connect(const std::string& socketPath);
+	void Close();
+	// No more requests; the replies in flight still come.
+	void Shutdown();
+
+	// Send request with path, or with input, not closed, if it isn't -1.
+	bool Send(DaemonRequest request, const std::string& path, int input = -1);
+	// Wait for the next response. output is the descriptor of the output for
+	// the caller to close, -1 unless the status is Ok. False once the daemon
+	// closed the connection.
+	bool Receive(DaemonResponse& response, int& output);
+
+private:
+	int m_fd;
+	std::vector<uint8_t> m_received;
+	std::deque<int> m_fds;
+};
+
+struct DaemonLoadOptions
+{
+	DaemonJob job = DaemonJob::Svg;
+	uint32_t maxSide = 0;
+	// Send the inputs as memfds instead of paths.
+	bool sendDescriptors = false;
+	// Connections sharing the rate, each pipelined.
+	unsigned connections = 4;
+	// At every rate.
+	double seconds = 5;
+};
+
+struct DaemonLatency
+{
+	// Requests per second asked and answered.
+	double rate;
+	double achieved;
+	uint64_t sent;
+	uint64_t failed;
+	// Milliseconds from the time a request was due to its response.
+	double p50;
+	double p99;
+	double max;
+};
+
+// Open loop load: at every rate requests are due at fixed intervals, going
+// round inputs, whether or not the earlier ones were answered, and a latency
+// is counted from the due time, so a daemon falling behind shows as such.
+std::vector<DaemonLatency> MeasureDaemonLatency(const std::string& socketPath, const std::vector<std::string>& inputs,
+	const std::vector<double>& rates, const DaemonLoadOptions& options = DaemonLoadOptions());
@@ -0,0 +1,142 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+// emfparserd, the conversion daemon and its load generator, a console
+// program of the portable sources (no Qt nor GDI):
+//
+//   emfparserd serve SOCKET [--threads N] [--pipeline N] [--cache MB] [--max-input MB]
+//   emfparserd load SOCKET FILE... [--job svg|thumbnail|pdf] [--size N] [--fd]
+//       [--connections N] [--seconds S] [--rates R,R,...]
+#include <signal.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#include "ConversionDaemon.h"
+
+static int Usage()
+{
+	fprintf(stderr, "usage: emfparserd serve SOCKET [--threads N] [--pipeline N] [--cache MB] [--max-input MB]\n"
+		"       emfparserd load SOCKET FILE... [--job svg|thumbnail|pdf] [--size N] [--fd]\n"
+		"                  [--connections N] [--seconds S] [--rates R,R,...]\n");
+	return 2;
+}
+
+static int Serve(int argc, char* argv[])
+{
+	DaemonOptions options;
+	for (int i = 3; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+			options.threadCount = (unsigned)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--pipeline") && i + 1 < argc)
+			options.pipelineDepth = (unsigned)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--cache") && i + 1 < argc)
+			options.cacheBytes = (uint64_t)atoll(argv[++i]) * 1024 * 1024;
+		else if (!strcmp(argv[i], "--max-input") && i + 1 < argc)
+			options.maxInputBytes = (uint64_t)atoll(argv[++i]) * 1024 * 1024;
+		else
+			return Usage();
+	}
+
+	// Stopped by a signal, waited for on this thread only.
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+	signal(SIGPIPE, SIG_IGN);
+
+	ConversionDaemon daemon;
+	if (!daemon.Start(argv[2], options))
+	{
+		fprintf(stderr, "emfparserd: can't listen on %s\n", argv[2]);
+		return 1;
+	}
+	fprintf(stderr, "emfparserd: listening on %s\n", argv[2]);
+	int signal;
+	sigwait(&signals, &signal);
+	daemon.Stop();
+	DaemonStats stats = daemon.Stats();
+	fprintf(stderr, "emfparserd: %llu connections, %llu requests, %llu failed, %llu from the cache\n",
+		(unsigned long long)stats.connections, (unsigned long long)stats.requests,
+		(unsigned long long)stats.failed, (unsigned long long)stats.cacheHits);
+	return 0;
+}
+
+static int Load(int argc, char* argv[])
+{
+	DaemonLoadOptions options;
+	std::vector<std::string> inputs;
+	std::vector<double> rates = { 100, 200, 400, 800, 1600 };
+	for (int i = 3; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "--job") && i + 1 < argc)
+		{
+			++i;
+			if (!strcmp(argv[i], "svg"))
+				options.job = DaemonJob::Svg;
+			else if (!strcmp(argv[i], "thumbnail"))
+				options.job = DaemonJob::Thumbnail;
+			else if (!strcmp(argv[i], "pdf"))
+				options.job = DaemonJob::Pdf;
+			else
+				return Usage();
+		}
+		else if (!strcmp(argv[i], "--size") && i + 1 < argc)
+			options.maxSide = (uint32_t)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--fd"))
+			options.sendDescriptors = true;
+		else if (!strcmp(argv[i], "--connections") && i + 1 < argc)
+			options.connections = (unsigned)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--seconds") && i + 1 < argc)
+			options.seconds = atof(argv[++i]);
+		else if (!strcmp(argv[i], "--rates") && i + 1 < argc)
+		{
+			rates.clear();
+			std::istringstream list(argv[++i]);
+			std::string rate;
+			while (std::getline(list, rate, ','))
+				rates.push_back(atof(rate.c_str()));
+		}
+		else if (argv[i][0] == '-')
+			return Usage();
+		else
+			inputs.push_back(argv[i]);
+	}
+	if (inputs.empty())
+		return Usage();
+
+	signal(SIGPIPE, SIG_IGN);
+	printf("%10s %10s %8s %8s %10s %10s %10s\n", "rate/s", "achieved/s", "sent", "failed", "p50 ms", "p99 ms", "max ms");
+	for (double rate : rates)
+	{
+		std::vector<DaemonLatency> results = MeasureDaemonLatency(argv[2], inputs, { rate }, options);
+		for (const DaemonLatency& r : results)
+		{
+			printf("%10.0f %10.1f %8llu %8llu %10.3f %10.3f %10.3f\n", r.rate, r.achieved,
+				(unsigned long long)r.sent, (unsigned long long)r.failed, r.p50, r.p99, r.max);
+			fflush(stdout);
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3)
+		return Usage();
+	if (!strcmp(argv[1], "serve"))
+		return Serve(argc, argv);
+	if (!strcmp(argv[1], "load"))
+		return Load(argc, argv);
+	return Usage();
+}
@@ -0,0 +1,839 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#include <algorithm>
+#include <chrono>
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define EMF_DIB_SSE2
+#include <emmintrin.h>
+#endif
+// pshufb and gather need the compiler to target SSSE3 and AVX2.
+#if defined(__SSSE3__) || defined(__AVX__)
+#define EMF_DIB_SSSE3
+#include <tmmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define EMF_DIB_AVX2
+#include <immintrin.h>
+#endif
+
+#include <jpeglib.h>
+#include <png.h>
+
+#include "DibDecoder.h"
+#include "EmfFormat.h"
+
+const uint32_t g_coreHeaderSize = 12;
+const uint32_t g_infoHeaderSize = 40;
+// BITMAPV3INFOHEADER, the first with the alpha mask in the header.
+const uint32_t g_v3HeaderSize = 56;
+const uint32_t g_opaque = 0xFF000000;
+
+// Bitfield masks are runs of contiguous bits, 0 for a missing channel.
+static bool IsContiguousMask(uint32_t mask)
+{
+	uint32_t low = mask & (~mask + 1);
+	return !((mask + low) & mask);
+}
+
+// Channel of a 16 or 32 bpp pixel scaled to 8 bits. Narrower channels have
+// their bits repeated, so 0 and the maximum stay black and full.
+struct BitField
+{
+	uint32_t mask;
+	int shift;
+	int bits;
+	// Channel values of narrow channels, scaled.
+	uint8_t expand[128];
+
+	explicit BitField(uint32_t m = 0)
+		: mask(m), shift(0), bits(0)
+	{
+		if (!mask)
+			return;
+		while (!((mask >> shift) & 1))
+			++shift;
+		while (shift + bits < 32 && ((mask >> (shift + bits)) & 1))
+			++bits;
+		// Only the lowest run of bits is read, expand has no room for more.
+		mask = (bits < 32 ? (1u << bits) - 1 : ~0u) << shift;
+		for (uint32_t v = 0; bits < 8 && v < (1u << bits); ++v)
+		{
+			uint32_t x = v << (8 - bits);
+			for (int filled = bits; filled < 8; filled *= 2)
+				x |= x >> filled;
+			expand[v] = (uint8_t)x;
+		}
+	}
+	uint32_t operator()(uint32_t pixel) const
+	{
+		if (!bits)
+			return 0;
+		uint32_t v = (pixel & mask) >> shift;
+		return bits >= 8 ? v >> (bits - 8) : expand[v];
+	}
+};
+
+bool ReadDibInfo(const uint8_t* bmi, size_t bmiSize, DibInfo& info)
+{
+	info = DibInfo();
+	if (bmiSize < sizeof(uint32_t))
+		return false;
+	uint32_t headerSize = ReadU32(bmi);
+	if (headerSize > bmiSize)
+		return false;
+	size_t colorsOffset = headerSize;
+	uint32_t colorsUsed = 0;
+	if (headerSize == g_coreHeaderSize)
+	{
+		// bcWidth, bcHeight, bcPlanes and bcBitCount, bottom-up always.
+		uint16_t values[4];
+		memcpy(values, bmi + 4, sizeof(values));
+		info.width = values[0];
+		info.height = values[1];
+		info.bottomUp = true;
+		info.bitCount = values[3];
+		info.compression = g_biRgb;
+		info.colorSize = 3;
+	}
+	else if (headerSize >= g_infoHeaderSize)
+	{
+		info.width = ReadI32(bmi + 4);
+		int32_t height = ReadI32(bmi + 8);
+		if (height == INT32_MIN)
+			return false;
+		info.height = std::abs(height);
+		info.bottomUp = height > 0;
+		info.bitCount = (uint16_t)(ReadU32(bmi + 12) >> 16);
+		info.compression = ReadU32(bmi + 16);
+		info.colorSize = 4;
+		colorsUsed = ReadU32(bmi + 32);
+	}
+	else
+	{
+		return false;
+	}
+
+	if (info.bitCount == 16)
+	{
+		info.redMask = 0x7C00;
+		info.greenMask = 0x03E0;
+		info.blueMask = 0x001F;
+	}
+	else
+	{
+		info.redMask = 0x00FF0000;
+		info.greenMask = 0x0000FF00;
+		info.blueMask = 0x000000FF;
+	}
+	if (info.compression == g_biBitfields || info.compression == g_biAlphaBitfields)
+	{
+		// After a BITMAPINFOHEADER the masks precede the colors, the later
+		// headers hold them.
+		uint32_t maskCount = info.compression == g_biAlphaBitfields ? 4 : 3;
+		uint64_t masksEnd = g_infoHeaderSize + 4 * maskCount;
+		if (headerSize == g_infoHeaderSize)
+			colorsOffset = masksEnd;
+		if (headerSize < masksEnd && headerSize != g_infoHeaderSize)
+			return false;
+		if (bmiSize < masksEnd)
+			return false;
+		info.redMask = ReadU32(bmi + 40);
+		info.greenMask = ReadU32(bmi + 44);
+		info.blueMask = ReadU32(bmi + 48);
+		if (maskCount == 4 || headerSize >= g_v3HeaderSize)
+			info.alphaMask = ReadU32(bmi + 52);
+		if (!IsContiguousMask(info.redMask) || !IsContiguousMask(info.greenMask)
+			|| !IsContiguousMask(info.blueMask) || !IsContiguousMask(info.alphaMask))
+			return false;
+	}
+
+	switch (info.compression)
+	{
+	case g_biRgb:
+		if (info.bitCount != 1 && info.bitCount != 2 && info.bitCount != 4 && info.bitCount != 8
+			&& info.bitCount != 16 && info.bitCount != 24 && info.bitCount != 32)
+			return false;
+		break;
+	case g_biRle8:
+	case g_biRle4:
+		// Compressed DIBs are bottom-up.
+		if (info.bitCount != (info.compression == g_biRle8 ? 8 : 4) || !info.bottomUp)
+			return false;
+		break;
+	case g_biBitfields:
+	case g_biAlphaBitfields:
+		if (info.bitCount != 16 && info.bitCount != 32)
+			return false;
+		break;
+	case g_biJpeg:
+	case g_biPng:
+		// The size is that of the image in the bits.
+		return true;
+	default:
+		return false;
+	}
+	if (info.width <= 0 || info.height <= 0)
+		return false;
+
+	if (info.bitCount <= 8)
+	{
+		uint32_t maxColors = 1u << info.bitCount;
+		info.colorCount = colorsUsed && colorsUsed < maxColors ? colorsUsed : maxColors;
+		info.colorCount = (uint32_t)std::min<uint64_t>(info.colorCount, (bmiSize - colorsOffset) / info.colorSize);
+		if (info.colorCount == 0)
+			return false;
+		info.colors = bmi + colorsOffset;
+	}
+	info.stride = ((uint64_t)info.width * info.bitCount + 31) / 32 * 4;
+	return true;
+}
+
+static inline uint32_t Multiply255(uint32_t a, uint32_t b)
+{
+	uint32_t t = a * b + 128;
+	return (t + (t >> 8)) >> 8;
+}
+
+static void Premultiply(uint32_t* pixels, size_t count)
+{
+	size_t i = 0;
+#ifdef EMF_DIB_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi16(128);
+	const __m128i alphaMask = _mm_set1_epi32((int)g_opaque);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i p = _mm_loadu_si128((const __m128i*)(pixels + i));
+		__m128i lo = _mm_unpacklo_epi8(p, zero), hi = _mm_unpackhi_epi8(p, zero);
+		__m128i alphaLo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		__m128i alphaHi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		// x * a / 255 rounded, as Multiply255.
+		lo = _mm_add_epi16(_mm_mullo_epi16(lo, alphaLo), round);
+		hi = _mm_add_epi16(_mm_mullo_epi16(hi, alphaHi), round);
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+		__m128i colors = _mm_packus_epi16(lo, hi);
+		_mm_storeu_si128((__m128i*)(pixels + i), _mm_or_si128(_mm_andnot_si128(alphaMask, colors), _mm_and_si128(p, alphaMask)));
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		uint32_t p = pixels[i], a = p >> 24;
+		if (a == 255)
+			continue;
+		pixels[i] = a << 24 | Multiply255(p >> 16 & 0xFF, a) << 16 | Multiply255(p >> 8 & 0xFF, a) << 8 | Multiply255(p & 0xFF, a);
+	}
+}
+
+static void Indices1(const uint8_t* src, uint32_t count, const uint32_t* table, uint32_t* dst)
+{
+	uint32_t x = 0;
+#ifdef EMF_DIB_SSE2
+	// Every bit selects one of the two colors.
+	const __m128i color0 = _mm_set1_epi32((int)table[0]), color1 = _mm_set1_epi32((int)table[1]);
+	const __m128i high = _mm_setr_epi32(0x80, 0x40, 0x20, 0x10), low = _mm_setr_epi32(8, 4, 2, 1);
+	const __m128i zero = _mm_setzero_si128();
+	for (; x + 8 <= count; x += 8)
+	{
+		__m128i byte = _mm_set1_epi32(src[x / 8]);
+		__m128i clear = _mm_cmpeq_epi32(_mm_and_si128(byte, high), zero);
+		_mm_storeu_si128((__m128i*)(dst + x), _mm_or_si128(_mm_and_si128(clear, color0), _mm_andnot_si128(clear, color1)));
+		clear = _mm_cmpeq_epi32(_mm_and_si128(byte, low), zero);
+		_mm_storeu_si128((__m128i*)(dst + x + 4), _mm_or_si128(_mm_and_si128(clear, color0), _mm_andnot_si128(clear, color1)));
+	}
+#endif
+	for (; x < count; ++x)
+		dst[x] = table[src[x / 8] >> (7 - x % 8) & 1];
+}
+
+static void Indices2(const uint8_t* src, uint32_t count, const uint32_t* table, uint32_t* dst)
+{
+	for (uint32_t x = 0; x < count; ++x)
+		dst[x] = table[src[x / 4] >> (6 - 2 * (x % 4)) & 3];
+}
+
+static void Indices4(const uint8_t* src, uint32_t count, const uint32_t* table, uint32_t* dst)
+{
+	uint32_t x = 0;
+#ifdef EMF_DIB_SSSE3
+	// The 16 colors split into byte planes, one shuffle looks a plane up
+	// for 16 pixels; unpacking the planes interleaves them back.
+	alignas(16) uint8_t planes[4][16];
+	for (int i = 0; i < 16; ++i)
+	{
+		for (int c = 0; c < 4; ++c)
+			planes[c][i] = (uint8_t)(table[i] >> (8 * c));
+	}
+	const __m128i blue = _mm_load_si128((const __m128i*)planes[0]);
+	const __m128i green = _mm_load_si128((const __m128i*)planes[1]);
+	const __m128i red = _mm_load_si128((const __m128i*)planes[2]);
+	const __m128i alpha = _mm_load_si128((const __m128i*)planes[3]);
+	const __m128i nibble = _mm_set1_epi8(0x0F);
+	for (; x + 32 <= count; x += 32)
+	{
+		__m128i bytes = _mm_loadu_si128((const __m128i*)(src + x / 2));
+		// The high nibble is the left pixel.
+		__m128i high = _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble);
+		__m128i low = _mm_and_si128(bytes, nibble);
+		__m128i indices[2] = { _mm_unpacklo_epi8(high, low), _mm_unpackhi_epi8(high, low) };
+		for (int k = 0; k < 2; ++k)
+		{
+			__m128i b = _mm_shuffle_epi8(blue, indices[k]), g = _mm_shuffle_epi8(green, indices[k]);
+			__m128i r = _mm_shuffle_epi8(red, indices[k]), a = _mm_shuffle_epi8(alpha, indices[k]);
+			__m128i bg0 = _mm_unpacklo_epi8(b, g), bg1 = _mm_unpackhi_epi8(b, g);
+			__m128i ra0 = _mm_unpacklo_epi8(r, a), ra1 = _mm_unpackhi_epi8(r, a);
+			uint32_t* out = dst + x + 16 * k;
+			_mm_storeu_si128((__m128i*)out, _mm_unpacklo_epi16(bg0, ra0));
+			_mm_storeu_si128((__m128i*)(out + 4), _mm_unpackhi_epi16(bg0, ra0));
+			_mm_storeu_si128((__m128i*)(out + 8), _mm_unpacklo_epi16(bg1, ra1));
+			_mm_storeu_si128((__m128i*)(out + 12), _mm_unpackhi_epi16(bg1, ra1));
+		}
+	}
+#endif
+	for (; x < count; ++x)
+		dst[x] = table[src[x / 2] >> (x & 1 ? 0 : 4) & 0x0F];
+}
+
+static void Indices8(const uint8_t* src, uint32_t count, const uint32_t* table, uint32_t* dst)
+{
+	uint32_t x = 0;
+#ifdef EMF_DIB_AVX2
+	for (; x + 8 <= count; x += 8)
+	{
+		__m256i indices = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + x)));
+		_mm256_storeu_si256((__m256i*)(dst + x), _mm256_i32gather_epi32((const int*)table, indices, 4));
+	}
+#endif
+	for (; x + 4 <= count; x += 4)
+	{
+		dst[x] = table[src[x]];
+		dst[x + 1] = table[src[x + 1]];
+		dst[x + 2] = table[src[x + 2]];
+		dst[x + 3] = table[src[x + 3]];
+	}
+	for (; x < count; ++x)
+		dst[x] = table[src[x]];
+}
+
+// 5 or 6 bit channels of 16 bit lanes to 8 bits, the high bits repeated.
+#ifdef EMF_DIB_SSE2
+static inline __m128i Expand5(__m128i v)
+{
+	return _mm_or_si128(_mm_slli_epi16(v, 3), _mm_srli_epi16(v, 2));
+}
+static inline __m128i Expand6(__m128i v)
+{
+	return _mm_or_si128(_mm_slli_epi16(v, 2), _mm_srli_epi16(v, 4));
+}
+#endif
+
+static void Rgb16(const uint8_t* src, uint32_t count, bool is565, uint32_t* dst)
+{
+	uint32_t x = 0;
+#ifdef EMF_DIB_SSE2
+	const __m128i five = _mm_set1_epi16(0x1F), six = _mm_set1_epi16(0x3F);
+	const __m128i alpha = _mm_set1_epi16((short)0xFF00);
+	for (; x + 8 <= count; x += 8)
+	{
+		__m128i p = _mm_loadu_si128((const __m128i*)(src + 2 * x));
+		__m128i r, g;
+		if (is565)
+		{
+			r = Expand5(_mm_srli_epi16(p, 11));
+			g = Expand6(_mm_and_si128(_mm_srli_epi16(p, 5), six));
+		}
+		else
+		{
+			r = Expand5(_mm_and_si128(_mm_srli_epi16(p, 10), five));
+			g = Expand5(_mm_and_si128(_mm_srli_epi16(p, 5), five));
+		}
+		__m128i b = Expand5(_mm_and_si128(p, five));
+		// Blue and green, red and alpha in 16 bit lanes, then interleaved.
+		__m128i bg = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+		__m128i ra = _mm_or_si128(r, alpha);
+		_mm_storeu_si128((__m128i*)(dst + x), _mm_unpacklo_epi16(bg, ra));
+		_mm_storeu_si128((__m128i*)(dst + x + 4), _mm_unpackhi_epi16(bg, ra));
+	}
+#endif
+	const BitField red(is565 ? 0xF800 : 0x7C00), green(is565 ? 0x07E0 : 0x03E0), blue(0x001F);
+	for (; x < count; ++x)
+	{
+		uint32_t p = src[2 * x] | src[2 * x + 1] << 8;
+		dst[x] = g_opaque | red(p) << 16 | green(p) << 8 | blue(p);
+	}
+}
+
+static void Bgr24(const uint8_t* src, uint32_t count, uint32_t* dst)
+{
+	uint32_t x = 0;
+#ifdef EMF_DIB_SSSE3
+	const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const __m128i alpha = _mm_set1_epi32((int)g_opaque);
+	// 16 bytes are loaded for the 12 of 4 pixels, stop before the row end.
+	for (; x + 6 <= count; x += 4)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + 3 * x));
+		_mm_storeu_si128((__m128i*)(dst + x), _mm_or_si128(_mm_shuffle_epi8(v, shuffle), alpha));
+	}
+#endif
+	for (; x < count; ++x)
+		dst[x] = g_opaque | src[3 * x + 2] << 16 | src[3 * x + 1] << 8 | src[3 * x];
+}
+
+// 32 bpp with the standard masks, made opaque.
+static void Bgrx32(const uint8_t* src, uint32_t count, uint32_t* dst)
+{
+	uint32_t x = 0;
+#ifdef EMF_DIB_SSE2
+	const __m128i alpha = _mm_set1_epi32((int)g_opaque);
+	for (; x + 4 <= count; x += 4)
+		_mm_storeu_si128((__m128i*)(dst + x), _mm_or_si128(_mm_loadu_si128((const __m128i*)(src + 4 * x)), alpha));
+#endif
+	for (; x < count; ++x)
+		dst[x] = ReadU32(src + 4 * x) | g_opaque;
+}
+
+enum class RowFormat
+{
+	Indices1,
+	Indices2,
+	Indices4,
+	Indices8,
+	Rgb555,
+	Rgb565,
+	Bgr24,
+	Bgrx32,
+	// Copied as they are, the alpha is premultiplied afterwards if straight.
+	Bgra32,
+	Masks16,
+	Masks32,
+};
+
+struct RowConversion
+{
+	RowFormat format;
+	// Straight alpha, to be premultiplied.
+	bool premultiply;
+	uint32_t table[256];
+	BitField red, green, blue, alpha;
+};
+
+static void ConvertRow(const uint8_t* src, uint32_t count, const RowConversion& conversion, uint32_t* dst)
+{
+	switch (conversion.format)
+	{
+	case RowFormat::Indices1:
+		Indices1(src, count, conversion.table, dst);
+		break;
+	case RowFormat::Indices2:
+		Indices2(src, count, conversion.table, dst);
+		break;
+	case RowFormat::Indices4:
+		Indices4(src, count, conversion.table, dst);
+		break;
+	case RowFormat::Indices8:
+		Indices8(src, count, conversion.table, dst);
+		break;
+	case RowFormat::Rgb555:
+	case RowFormat::Rgb565:
+		Rgb16(src, count, conversion.format == RowFormat::Rgb565, dst);
+		break;
+	case RowFormat::Bgr24:
+		Bgr24(src, count, dst);
+		break;
+	case RowFormat::Bgrx32:
+		Bgrx32(src, count, dst);
+		break;
+	case RowFormat::Bgra32:
+		memcpy(dst, src, (size_t)count * 4);
+		break;
+	case RowFormat::Masks16:
+		for (uint32_t x = 0; x < count; ++x)
+		{
+			uint32_t p = src[2 * x] | src[2 * x + 1] << 8;
+			uint32_t a = conversion.alpha.mask ? conversion.alpha(p) : 255;
+			dst[x] = a << 24 | conversion.red(p) << 16 | conversion.green(p) << 8 | conversion.blue(p);
+		}
+		break;
+	case RowFormat::Masks32:
+		for (uint32_t x = 0; x < count; ++x)
+		{
+			uint32_t p = ReadU32(src + 4 * x);
+			uint32_t a = conversion.alpha.mask ? conversion.alpha(p) : 255;
+			dst[x] = a << 24 | conversion.red(p) << 16 | conversion.green(p) << 8 | conversion.blue(p);
+		}
+		break;
+	}
+	if (conversion.premultiply)
+		Premultiply(dst, count);
+}
+
+static void PrepareConversion(const DibInfo& info, bool keepAlpha, RowConversion& conversion)
+{
+	conversion.premultiply = false;
+	if (info.bitCount <= 8)
+	{
+		conversion.format = info.bitCount == 1 ? RowFormat::Indices1 : info.bitCount == 2 ? RowFormat::Indices2
+			: info.bitCount == 4 ? RowFormat::Indices4 : RowFormat::Indices8;
+		// Indices past the color table get its first color, so lookups
+		// need no bounds check.
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			const uint8_t* color = info.colors + (size_t)(i < info.colorCount ? i : 0) * info.colorSize;
+			conversion.table[i] = g_opaque | color[2] << 16 | color[1] << 8 | color[0];
+		}
+		return;
+	}
+	bool alpha = keepAlpha && info.alphaMask != 0;
+	if (info.bitCount == 24)
+		conversion.format = RowFormat::Bgr24;
+	else if (info.bitCount == 16 && !alpha && info.redMask == 0x7C00 && info.greenMask == 0x03E0 && info.blueMask == 0x001F)
+		conversion.format = RowFormat::Rgb555;
+	else if (info.bitCount == 16 && !alpha && info.redMask == 0xF800 && info.greenMask == 0x07E0 && info.blueMask == 0x001F)
+		conversion.format = RowFormat::Rgb565;
+	else if (info.bitCount == 32 && info.redMask == 0x00FF0000 && info.greenMask == 0x0000FF00 && info.blueMask == 0x000000FF
+		&& (!alpha || info.alphaMask == g_opaque))
+	{
+		// The reserved byte of BI_RGB is premultiplied alpha for AlphaBlend.
+		if (alpha || (keepAlpha && info.compression == g_biRgb))
+			conversion.format = RowFormat::Bgra32;
+		else
+			conversion.format = RowFormat::Bgrx32;
+		conversion.premultiply = alpha;
+	}
+	else
+	{
+		conversion.format = info.bitCount == 16 ? RowFormat::Masks16 : RowFormat::Masks32;
+		conversion.premultiply = alpha;
+	}
+	conversion.red = BitField(info.redMask);
+	conversion.green = BitField(info.greenMask);
+	conversion.blue = BitField(info.blueMask);
+	conversion.alpha = BitField(alpha ? info.alphaMask : 0);
+}
+
+// BI_RLE8 and BI_RLE4 straight into the pixels, from the bottom row up.
+// A run repeats one index (RLE8) or alternates two (RLE4); an escape ends a
+// row or the bitmap, moves by a delta, or is followed by absolute indices.
+// A truncated stream keeps what was decoded.
+static void DecodeRle(const uint8_t* bits, size_t size, const DibInfo& info, const uint32_t* table, RenderedImage& image)
+{
+	const bool rle4 = info.compression == g_biRle4;
+	const int64_t width = info.width, height = info.height;
+	int64_t x = 0, y = 0;
+	size_t i = 0;
+	while (i + 2 <= size && y < height)
+	{
+		uint32_t count = bits[i], value = bits[i + 1];
+		i += 2;
+		uint32_t* row = image.pixels.data() + (size_t)(height - 1 - y) * width;
+		if (count)
+		{
+			int64_t n = std::min<int64_t>(count, std::max<int64_t>(width - x, 0));
+			if (rle4)
+			{
+				uint32_t colors[2] = { table[value >> 4], table[value & 0x0F] };
+				for (int64_t k = 0; k < n; ++k)
+					row[x + k] = colors[k & 1];
+			}
+			else if (n > 0)
+			{
+				std::fill(row + x, row + x + n, table[value]);
+			}
+			x += count;
+			continue;
+		}
+		switch (value)
+		{
+		case 0:
+			x = 0;
+			++y;
+			break;
+		case 1:
+			return;
+		case 2:
+			if (i + 2 > size)
+				return;
+			x += bits[i];
+			y += bits[i + 1];
+			i += 2;
+			break;
+		default:
+			{
+				// Absolute indices, padded to 16 bits.
+				size_t bytes = rle4 ? (value + 1) / 2 : value;
+				uint32_t n = value;
+				if (bytes > size - i)
+				{
+					bytes = size - i;
+					n = (uint32_t)(rle4 ? bytes * 2 : bytes);
+				}
+				for (uint32_t k = 0; k < n && x + k < width; ++k)
+				{
+					uint32_t index = rle4 ? bits[i + k / 2] >> (k & 1 ? 0 : 4) & 0x0F : bits[i + k];
+					row[x + k] = table[index];
+				}
+				x += n;
+				i += std::min(size - i, (bytes + 1) & ~(size_t)1);
+			}
+			break;
+		}
+	}
+}
+
+struct JpegError
+{
+	jpeg_error_mgr manager;
+	jmp_buf jump;
+};
+
+static void JpegErrorExit(j_common_ptr cinfo)
+{
+	longjmp(((JpegError*)cinfo->err)->jump, 1);
+}
+
+static void JpegMessage(j_common_ptr)
+{
+}
+
+// Nothing in here has a destructor for longjmp to skip; the row buffer of
+// CMYK comes from the pool of libjpeg.
+static bool DecodeJpeg(const uint8_t* data, size_t size, RenderedImage& image)
+{
+	jpeg_decompress_struct cinfo;
+	JpegError error;
+	cinfo.err = jpeg_std_error(&error.manager);
+	error.manager.error_exit = JpegErrorExit;
+	error.manager.output_message = JpegMessage;
+	if (setjmp(error.jump))
+	{
+		jpeg_destroy_decompress(&cinfo);
+		return false;
+	}
+	jpeg_create_decompress(&cinfo);
+	jpeg_mem_src(&cinfo, const_cast<uint8_t*>(data), (unsigned long)size);
+	jpeg_read_header(&cinfo, TRUE);
+	if ((uint64_t)cinfo.image_width * cinfo.image_height > g_maxDibPixels)
+	{
+		jpeg_destroy_decompress(&cinfo);
+		return false;
+	}
+	bool cmyk = cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK;
+	cinfo.out_color_space = cmyk ? JCS_CMYK : JCS_EXT_BGRA;
+	jpeg_start_decompress(&cinfo);
+	image.width = cinfo.output_width;
+	image.height = cinfo.output_height;
+	image.pixels.resize((size_t)image.width * image.height);
+	JSAMPARRAY buffer = cmyk ? (*cinfo.mem->alloc_sarray)((j_common_ptr)&cinfo, JPOOL_IMAGE, cinfo.output_width * 4, 1) : nullptr;
+	while (cinfo.output_scanline < cinfo.output_height)
+	{
+		uint32_t* row = image.pixels.data() + (size_t)cinfo.output_scanline * image.width;
+		if (!cmyk)
+		{
+			JSAMPROW rows[1] = { (JSAMPROW)row };
+			jpeg_read_scanlines(&cinfo, rows, 1);
+			continue;
+		}
+		jpeg_read_scanlines(&cinfo, buffer, 1);
+		// Adobe writes CMYK inverted, so the channels are 255 - C and so on.
+		const uint8_t* p = buffer[0];
+		for (uint32_t x = 0; x < image.width; ++x, p += 4)
+			row[x] = g_opaque | Multiply255(p[0], p[3]) << 16 | Multiply255(p[1], p[3]) << 8 | Multiply255(p[2], p[3]);
+	}
+	jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+	return true;
+}
+
+static bool DecodePng(const uint8_t* data, size_t size, bool keepAlpha, RenderedImage& image)
+{
+	png_image png;
+	memset(&png, 0, sizeof(png));
+	png.version = PNG_IMAGE_VERSION;
+	if (!png_image_begin_read_from_memory(&png, data, size))
+		return false;
+	if ((uint64_t)png.width * png.height > g_maxDibPixels)
+	{
+		png_image_free(&png);
+		return false;
+	}
+	png.format = PNG_FORMAT_BGRA;
+	image.width = png.width;
+	image.height = png.height;
+	image.pixels.resize((size_t)image.width * image.height);
+	if (!png_image_finish_read(&png, nullptr, image.pixels.data(), 0, nullptr))
+		return false;
+	if (keepAlpha)
+	{
+		Premultiply(image.pixels.data(), image.pixels.size());
+	}
+	else
+	{
+		for (uint32_t& pixel : image.pixels)
+			pixel |= g_opaque;
+	}
+	return true;
+}
+
+bool DecodeDib(const uint8_t* bmi, size_t bmiSize, const uint8_t* bits, size_t bitsSize, bool keepAlpha, RenderedImage& image)
+{
+	DibInfo info;
+	if (!ReadDibInfo(bmi, bmiSize, info))
+		return false;
+	if (info.compression == g_biJpeg)
+		return DecodeJpeg(bits, bitsSize, image);
+	if (info.compression == g_biPng)
+		return DecodePng(bits, bitsSize, keepAlpha, image);
+	if ((uint64_t)info.width * info.height > g_maxDibPixels)
+		return false;
+
+	RowConversion conversion;
+	PrepareConversion(info, keepAlpha, conversion);
+	image.width = info.width;
+	image.height = info.height;
+	if (info.compression == g_biRle8 || info.compression == g_biRle4)
+	{
+		image.pixels.assign((size_t)info.width * info.height, 0);
+		DecodeRle(bits, bitsSize, info, conversion.table, image);
+		return true;
+	}
+	if (info.stride * info.height > bitsSize)
+		return false;
+	// Every pixel is written, a bitmap decoded again into the same image
+	// isn't cleared first.
+	image.pixels.resize((size_t)info.width * info.height);
+	for (int32_t y = 0; y < info.height; ++y)
+	{
+		const uint8_t* row = bits + info.stride * (info.bottomUp ? info.height - 1 - y : y);
+		ConvertRow(row, info.width, conversion, image.pixels.data() + (size_t)y * info.width);
+	}
+	return true;
+}
+
+// Bits of the benchmark images, the same on every run.
+class BenchmarkRandom
+{
+public:
+	uint32_t Next()
+	{
+		m_state = m_state * 6364136223846793005ull + 1442695040888963407ull;
+		return (uint32_t)(m_state >> 33);
+	}
+
+private:
+	uint64_t m_state = 1;
+};
+
+static std::vector<uint8_t> BenchmarkHeader(int32_t width, int32_t height, uint16_t bitCount, uint32_t compression,
+	const uint32_t* masks, uint32_t maskCount, BenchmarkRandom& random)
+{
+	std::vector<uint8_t> bmi(g_infoHeaderSize + maskCount * 4 + (bitCount <= 8 ? 4u << bitCount : 0));
+	uint32_t values[] = { g_infoHeaderSize, (uint32_t)width, (uint32_t)height, 1u | (uint32_t)bitCount << 16, compression };
+	memcpy(bmi.data(), values, sizeof(values));
+	if (maskCount)
+		memcpy(bmi.data() + g_infoHeaderSize, masks, maskCount * 4);
+	for (size_t i = g_infoHeaderSize + maskCount * 4; i < bmi.size(); ++i)
+		bmi[i] = (uint8_t)random.Next();
+	return bmi;
+}
+
+// Runs of 1 to 32 pixels, with an absolute stretch now and then.
+static std::vector<uint8_t> BenchmarkRle(int32_t width, int32_t height, bool rle4, BenchmarkRandom& random)
+{
+	std::vector<uint8_t> bits;
+	for (int32_t y = 0; y < height; ++y)
+	{
+		for (int32_t x = 0; x < width;)
+		{
+			uint32_t n = std::min<uint32_t>(1 + random.Next() % 32, width - x);
+			if (n >= 3 && random.Next() % 4 == 0)
+			{
+				bits.push_back(0);
+				bits.push_back((uint8_t)n);
+				size_t bytes = rle4 ? (n + 1) / 2 : n;
+				for (size_t k = 0; k < bytes; ++k)
+					bits.push_back((uint8_t)random.Next());
+				if (bytes & 1)
+					bits.push_back(0);
+			}
+			else
+			{
+				bits.push_back((uint8_t)n);
+				bits.push_back((uint8_t)random.Next());
+			}
+			x += n;
+		}
+		bits.push_back(0);
+		bits.push_back(0);
+	}
+	bits.push_back(0);
+	bits.push_back(1);
+	return bits;
+}
+
+std::vector<DibBenchmark> BenchmarkDibDecoding(uint32_t width, uint32_t height, unsigned repeat)
+{
+	struct Format
+	{
+		const char* name;
+		uint16_t bitCount;
+		uint32_t compression;
+		uint32_t masks[4];
+		uint32_t maskCount;
+		bool keepAlpha;
+	};
+	static const Format formats[] = {
+		{ "1 bpp", 1, g_biRgb, {}, 0, false },
+		{ "4 bpp", 4, g_biRgb, {}, 0, false },
+		{ "8 bpp", 8, g_biRgb, {}, 0, false },
+		{ "BI_RLE4", 4, g_biRle4, {}, 0, false },
+		{ "BI_RLE8", 8, g_biRle8, {}, 0, false },
+		{ "16 bpp 555", 16, g_biRgb, {}, 0, false },
+		{ "16 bpp 565", 16, g_biBitfields, { 0xF800, 0x07E0, 0x001F }, 3, false },
+		{ "16 bpp 4444", 16, g_biAlphaBitfields, { 0x0F00, 0x00F0, 0x000F, 0xF000 }, 4, true },
+		{ "24 bpp", 24, g_biRgb, {}, 0, false },
+		{ "32 bpp", 32, g_biRgb, {}, 0, false },
+		{ "32 bpp alpha", 32, g_biAlphaBitfields, { 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000 }, 4, true },
+	};
+
+	std::vector<DibBenchmark> results;
+	BenchmarkRandom random;
+	RenderedImage image;
+	for (const Format& format : formats)
+	{
+		std::vector<uint8_t> bmi = BenchmarkHeader(width, height, format.bitCount, format.compression, format.masks, format.maskCount, random);
+		std::vector<uint8_t> bits;
+		if (format.compression == g_biRle4 || format.compression == g_biRle8)
+		{
+			bits = BenchmarkRle(width, height, format.compression == g_biRle4, random);
+		}
+		else
+		{
+			bits.resize(((uint64_t)width * format.bitCount + 31) / 32 * 4 * height);
+			for (uint8_t& b : bits)
+				b = (uint8_t)random.Next();
+		}
+		DibBenchmark result = { format.name, 0, 0 };
+		auto start = std::chrono::steady_clock::now();
+		for (unsigned r = 0; r < repeat; ++r)
+		{
+			if (DecodeDib(bmi.data(), bmi.size(), bits.data(), bits.size(), format.keepAlpha, image))
+				result.pixels += (uint64_t)width * height;
+		}
+		result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		results.push_back(result);
+	}
+	return results;
+}
@@ -0,0 +1,74 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "RenderCache.h"
+
+// biCompression values.
+const uint32_t g_biRgb = 0;
+const uint32_t g_biRle8 = 1;
+const uint32_t g_biRle4 = 2;
+const uint32_t g_biBitfields = 3;
+const uint32_t g_biJpeg = 4;
+const uint32_t g_biPng = 5;
+const uint32_t g_biAlphaBitfields = 6;
+
+// Pixels of a decoded DIB at most, 8192 x 8192.
+const uint64_t g_maxDibPixels = 1 << 26;
+
+// What a BITMAPINFO says about its bits.
+struct DibInfo
+{
+	int32_t width;
+	// Always positive, bottomUp tells the sign of biHeight.
+	int32_t height;
+	bool bottomUp;
+	uint16_t bitCount;
+	uint32_t compression;
+	// RGBQUADs, or RGBTRIPLEs after a BITMAPCOREHEADER.
+	const uint8_t* colors;
+	uint32_t colorCount;
+	uint32_t colorSize;
+	// Channels of 16 and 32 bpp pixels, the BI_RGB ones if there are no
+	// masks. alphaMask is 0 if there is no alpha.
+	uint32_t redMask;
+	uint32_t greenMask;
+	uint32_t blueMask;
+	uint32_t alphaMask;
+	// Bytes of a row of uncompressed bits.
+	uint64_t stride;
+};
+
+// Read a BITMAPCOREHEADER, BITMAPINFOHEADER or BITMAPV4/V5HEADER with its
+// masks and color table. Return false if it is malformed or unsupported.
+bool ReadDibInfo(const uint8_t* bmi, size_t bmiSize, DibInfo& info);
+
+// Decode a DIB into premultiplied 0xAARRGGBB pixels, top-down: 1, 2, 4 and
+// 8 bpp with a color table, BI_RLE4 and BI_RLE8, 16 and 32 bpp BI_RGB and
+// BI_BITFIELDS, 24 bpp, BI_JPEG and BI_PNG.
+// Unless keepAlpha every pixel is opaque, as BitBlt draws them. Else the
+// reserved byte of 32 bpp BI_RGB is premultiplied alpha, as AlphaBlend
+// takes it, and the alpha of masks and PNG is premultiplied here. Pixels
+// skipped by RLE are transparent either way.
+bool DecodeDib(const uint8_t* bmi, size_t bmiSize, const uint8_t* bits, size_t bitsSize, bool keepAlpha, RenderedImage& image);
+
+struct DibBenchmark
+{
+	const char* format;
+	uint64_t pixels;
+	double seconds;
+};
+
+// Decode a synthesized width x height DIB of every format repeat times.
+std::vector<DibBenchmark> BenchmarkDibDecoding(uint32_t width, uint32_t height, unsigned repeat);
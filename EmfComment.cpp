@@ -0,0 +1,266 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#include <algorithm>
+
+#include "EmfComment.h"
+
+// PublicCommentIdentifier values.
+enum class PublicComment : uint32_t
+{
+	WindowsMetafile = 0x80000001,
+	BeginGroup = 0x00000002,
+	EndGroup = 0x00000003,
+	MultiFormats = 0x40000004,
+	UnicodeString = 0x00000040,
+	UnicodeEnd = 0x00000080,
+};
+
+// Offsets from CommentIdentifier.
+const size_t g_publicIdentifierOffset = 4;
+const size_t g_publicBoundsOffset = 8;
+// Version, Checksum, Flags and WinMetafileSize of EMR_COMMENT_WINDOWS_METAFILE.
+const size_t g_wmfSizeOffset = 18;
+const size_t g_wmfOffset = 22;
+// nDescription and Description of EMR_COMMENT_BEGINGROUP.
+const size_t g_groupDescriptionCountOffset = 24;
+const size_t g_groupDescriptionOffset = 28;
+// countFormats and aFormats of EMR_COMMENT_MULTIFORMATS.
+const size_t g_formatCountOffset = 24;
+const size_t g_formatsOffset = 28;
+const size_t g_formatSize = 16;
+
+static EmfRectL ReadRect(const uint8_t* p)
+{
+	return EmfRectL{ ReadI32(p), ReadI32(p + 4), ReadI32(p + 8), ReadI32(p + 12) };
+}
+
+static void ParsePublicComment(EmfComment& comment)
+{
+	const uint8_t* data = comment.data;
+	const uint32_t size = comment.dataSize;
+	comment.kind = EmfCommentKind::Public;
+	if (size < g_publicIdentifierOffset + sizeof(uint32_t))
+		return;
+	comment.payload = data + g_publicIdentifierOffset + sizeof(uint32_t);
+	comment.payloadSize = size - (g_publicIdentifierOffset + sizeof(uint32_t));
+	switch ((PublicComment)ReadU32(data + g_publicIdentifierOffset))
+	{
+	case PublicComment::WindowsMetafile:
+		if (size >= g_wmfOffset)
+		{
+			comment.kind = EmfCommentKind::WindowsMetafile;
+			comment.payload = data + g_wmfOffset;
+			comment.payloadSize = std::min<uint32_t>(ReadU32(data + g_wmfSizeOffset), size - g_wmfOffset);
+		}
+		break;
+	case PublicComment::BeginGroup:
+		if (size >= g_groupDescriptionOffset)
+		{
+			comment.kind = EmfCommentKind::BeginGroup;
+			comment.bounds = ReadRect(data + g_publicBoundsOffset);
+			uint32_t length = ReadU32(data + g_groupDescriptionCountOffset);
+			comment.description = data + g_groupDescriptionOffset;
+			comment.descriptionLength = std::min<uint32_t>(length, (size - g_groupDescriptionOffset) / 2);
+			// Writers count the terminating zero or not.
+			if (comment.descriptionLength && ReadI16(comment.description + 2 * (comment.descriptionLength - 1)) == 0)
+				--comment.descriptionLength;
+		}
+		break;
+	case PublicComment::EndGroup:
+		comment.kind = EmfCommentKind::EndGroup;
+		break;
+	case PublicComment::MultiFormats:
+		if (size >= g_formatsOffset)
+		{
+			comment.kind = EmfCommentKind::MultiFormats;
+			comment.bounds = ReadRect(data + g_publicBoundsOffset);
+			comment.formatCount = (uint32_t)std::min<uint64_t>(ReadU32(data + g_formatCountOffset), (size - g_formatsOffset) / g_formatSize);
+		}
+		break;
+	case PublicComment::UnicodeString:
+		comment.kind = EmfCommentKind::UnicodeString;
+		break;
+	case PublicComment::UnicodeEnd:
+		comment.kind = EmfCommentKind::UnicodeEnd;
+		break;
+	}
+}
+
+bool ParseComment(const uint8_t* params, size_t size, EmfComment& comment)
+{
+	comment = EmfComment{};
+	comment.kind = EmfCommentKind::Private;
+	if (size < sizeof(uint32_t))
+		return false;
+	uint32_t dataSize = ReadU32(params);
+	if (dataSize > size - sizeof(uint32_t))
+		return false;
+	comment.data = params + sizeof(uint32_t);
+	comment.dataSize = dataSize;
+	comment.payload = comment.data;
+	comment.payloadSize = dataSize;
+	if (dataSize < sizeof(uint32_t))
+		return true;
+	switch (ReadU32(comment.data))
+	{
+	case g_emfPlusCommentIdentifier:
+		comment.kind = EmfCommentKind::EmfPlus;
+		comment.payload = comment.data + sizeof(uint32_t);
+		comment.payloadSize = dataSize - sizeof(uint32_t);
+		break;
+	case g_publicCommentIdentifier:
+		ParsePublicComment(comment);
+		break;
+	case g_emfSpoolCommentIdentifier:
+		// Followed by the EMFSpoolRecordIdentifier.
+		if (dataSize >= 2 * sizeof(uint32_t))
+		{
+			comment.kind = EmfCommentKind::EmfSpool;
+			comment.payload = comment.data + 2 * sizeof(uint32_t);
+			comment.payloadSize = dataSize - 2 * sizeof(uint32_t);
+		}
+		break;
+	}
+	return true;
+}
+
+bool ParseComment(const EmfRecordSpan& record, EmfComment& comment)
+{
+	if (record.type != (uint32_t)EmrType::GdiComment)
+		return false;
+	return ParseComment(record.data + sizeof(EmfRecordHeader), record.size - sizeof(EmfRecordHeader), comment);
+}
+
+bool GetCommentFormat(const EmfComment& comment, uint32_t index, EmfCommentFormat& format)
+{
+	if (comment.kind != EmfCommentKind::MultiFormats || index >= comment.formatCount)
+		return false;
+	const uint8_t* p = comment.data + g_formatsOffset + (size_t)index * g_formatSize;
+	uint32_t size = ReadU32(p + 8);
+	uint32_t offset = ReadU32(p + 12);
+	if (offset > comment.dataSize || size > comment.dataSize - offset)
+		return false;
+	format = EmfCommentFormat{ ReadU32(p), ReadU32(p + 4), comment.data + offset, size };
+	return true;
+}
+
+// Walks one metafile and recurses into its comments. Each level walks a
+// sub-span of a comment of the level above, so the recursion always ends;
+// the limits bound the work which overlapping formats could multiply.
+class NestingWalker
+{
+public:
+	NestingWalker(EmfNestingSink& sink, const EmfNestingLimits& limits, EmfNestingStats& stats)
+		: m_sink(sink)
+		, m_limits(limits)
+		, m_stats(stats)
+	{
+	}
+
+	bool WalkMetafile(const uint8_t* data, size_t size, unsigned depth);
+	void WalkContent(const EmfComment& comment, unsigned depth);
+
+private:
+	EmfNestingSink& m_sink;
+	const EmfNestingLimits& m_limits;
+	EmfNestingStats& m_stats;
+};
+
+bool NestingWalker::WalkMetafile(const uint8_t* data, size_t size, unsigned depth)
+{
+	if (!IsEmf(data, size))
+		return false;
+	m_stats.maxDepth = std::max(m_stats.maxDepth, depth);
+	uint64_t openGroups = 0;
+	bool valid = ForEachRecord(data, size, [this, depth, &openGroups](const EmfRecordSpan& record) {
+		++m_stats.records;
+		m_sink.Record(record, depth);
+		EmfComment comment;
+		if (!ParseComment(record, comment))
+			return true;
+		m_sink.Comment(comment, depth);
+		if (comment.kind == EmfCommentKind::BeginGroup)
+		{
+			++openGroups;
+			++m_stats.groups;
+			m_sink.BeginGroup(comment, depth);
+		}
+		else if (comment.kind == EmfCommentKind::EndGroup)
+		{
+			if (openGroups == 0)
+			{
+				++m_stats.unbalancedGroups;
+				return true;
+			}
+			--openGroups;
+			m_sink.EndGroup(depth);
+		}
+		WalkContent(comment, depth);
+		return true;
+	});
+	m_stats.unbalancedGroups += openGroups;
+	for (; openGroups; --openGroups)
+		m_sink.EndGroup(depth);
+	return valid;
+}
+
+void NestingWalker::WalkContent(const EmfComment& comment, unsigned depth)
+{
+	if (comment.kind == EmfCommentKind::EmfPlus)
+	{
+		bool valid = ForEachEmfPlusRecord(comment.payload, comment.payloadSize, [this, depth](const EmfPlusRecordSpan& record) {
+			++m_stats.emfPlusRecords;
+			m_sink.EmfPlusRecord(record, depth);
+			return true;
+		});
+		if (!valid)
+			++m_stats.corrupt;
+		return;
+	}
+	if (comment.kind != EmfCommentKind::MultiFormats)
+		return;
+	for (uint32_t i = 0; i < comment.formatCount; ++i)
+	{
+		EmfCommentFormat format;
+		if (!GetCommentFormat(comment, i, format))
+		{
+			++m_stats.corrupt;
+			continue;
+		}
+		if (format.signature != g_emfFormatSignature)
+			continue;
+		if (depth + 1 > m_limits.maxDepth || m_stats.nestedBytes + format.size > m_limits.maxNestedBytes)
+		{
+			++m_stats.limited;
+			m_sink.LimitReached(comment, depth);
+			return;
+		}
+		m_stats.nestedBytes += format.size;
+		++m_stats.nestedMetafiles;
+		m_sink.BeginMetafile(format, depth);
+		if (!WalkMetafile(format.data, format.size, depth + 1))
+			++m_stats.corrupt;
+		m_sink.EndMetafile(depth);
+	}
+}
+
+bool WalkNestedRecords(const uint8_t* data, size_t size, EmfNestingSink& sink, const EmfNestingLimits& limits, EmfNestingStats* stats)
+{
+	EmfNestingStats localStats;
+	NestingWalker walker(sink, limits, stats ? *stats : localStats);
+	return walker.WalkMetafile(data, size, 0);
+}
+
+void WalkCommentContent(const EmfComment& comment, unsigned depth, EmfNestingSink& sink, const EmfNestingLimits& limits, EmfNestingStats* stats)
+{
+	EmfNestingStats localStats;
+	NestingWalker walker(sink, limits, stats ? *stats : localStats);
+	walker.WalkContent(comment, depth);
+}
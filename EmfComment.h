@@ -0,0 +1,198 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include "EmfFormat.h"
+
+// Payloads of EMR_COMMENT ([MS-EMF] 2.3.3), identified by their signature.
+// Everything points into the record, nothing is copied.
+
+// CommentIdentifier values.
+const uint32_t g_emfPlusCommentIdentifier = 0x2B464D45;		// "EMF+"
+const uint32_t g_publicCommentIdentifier = 0x43494447;		// "GDIC"
+const uint32_t g_emfSpoolCommentIdentifier = 0x00000000;
+// Signatures of EmrFormat in EMR_COMMENT_MULTIFORMATS.
+const uint32_t g_emfFormatSignature = 0x464D4520;			// " EMF"
+const uint32_t g_epsFormatSignature = 0x46535045;			// "EPSF"
+
+// Metafiles inside comments inside metafiles, the top one is depth 0.
+const unsigned g_maxCommentNesting = 8;
+// Bytes of nested metafiles walked in all, 256 MB.
+const uint64_t g_maxNestedBytes = 256 * 1024 * 1024;
+
+enum class EmfCommentKind : uint8_t
+{
+	// No known identifier, the payload is the whole comment data.
+	Private,
+	// EMF+ records.
+	EmfPlus,
+	// EMR_COMMENT_EMFSPOOL, records of an EMF spool file.
+	EmfSpool,
+	// EMR_COMMENT_WINDOWS_METAFILE, the payload is a WMF.
+	WindowsMetafile,
+	BeginGroup,
+	EndGroup,
+	// EMR_COMMENT_MULTIFORMATS, the formats are read by GetCommentFormat.
+	MultiFormats,
+	UnicodeString,
+	UnicodeEnd,
+	// GDIC with a public identifier not listed above.
+	Public,
+};
+
+struct EmfComment
+{
+	EmfCommentKind kind;
+	// CommentIdentifier and what follows it, DataSize bytes. offData of
+	// EMR_COMMENT_MULTIFORMATS counts from here.
+	const uint8_t* data;
+	uint32_t dataSize;
+	// After the identifiers: the EMF+ records, the WMF and so on.
+	const uint8_t* payload;
+	uint32_t payloadSize;
+	// BEGINGROUP and MULTIFORMATS.
+	EmfRectL bounds;
+	// BEGINGROUP, UTF-16LE code units, not zero terminated.
+	const uint8_t* description;
+	uint32_t descriptionLength;
+	// MULTIFORMATS.
+	uint32_t formatCount;
+};
+
+// One EmrFormat of EMR_COMMENT_MULTIFORMATS.
+struct EmfCommentFormat
+{
+	uint32_t signature;
+	uint32_t version;
+	const uint8_t* data;
+	uint32_t size;
+};
+
+// One EMF+ record of an EMF+ comment, data points to its 12 byte header.
+struct EmfPlusRecordSpan
+{
+	const uint8_t* data;
+	// From the start of the comment payload.
+	size_t offset;
+	uint16_t type;
+	uint16_t flags;
+	uint32_t size;
+	uint32_t dataSize;
+};
+
+// params is the EMR_COMMENT record after its EMR header, as handed out by
+// Graphics::EnumerateMetafile. Return false if the record is too short.
+bool ParseComment(const uint8_t* params, size_t size, EmfComment& comment);
+// Same for a raw record; false if it isn't an EMR_COMMENT.
+bool ParseComment(const EmfRecordSpan& record, EmfComment& comment);
+
+// Return false if index is out of range or the format lies outside the comment.
+bool GetCommentFormat(const EmfComment& comment, uint32_t index, EmfCommentFormat& format);
+
+// Call fn(const EmfPlusRecordSpan&) for every EMF+ record of the payload of an
+// EMF+ comment, fn returns false to stop early. Return false if a record size
+// is invalid.
+template<typename Fn>
+bool ForEachEmfPlusRecord(const uint8_t* data, size_t size, Fn fn)
+{
+	// Type, Flags, Size and DataSize.
+	const size_t headerSize = 12;
+	size_t offset = 0;
+	while (offset + headerSize <= size)
+	{
+		const uint8_t* p = data + offset;
+		uint32_t recordSize = ReadU32(p + 4);
+		if (recordSize < headerSize || (recordSize & 3) || recordSize > size - offset)
+			return false;
+		uint16_t typeAndFlags[2];
+		memcpy(typeAndFlags, p, sizeof(typeAndFlags));
+		if (!fn(EmfPlusRecordSpan{ p, offset, typeAndFlags[0], typeAndFlags[1], recordSize, ReadU32(p + 8) }))
+			return true;
+		offset += recordSize;
+	}
+	return offset == size;
+}
+
+struct EmfNestingLimits
+{
+	unsigned maxDepth = g_maxCommentNesting;
+	// Formats of a MULTIFORMATS comment may overlap, so overlapping bytes are
+	// counted again; this bounds the work whatever the nesting.
+	uint64_t maxNestedBytes = g_maxNestedBytes;
+};
+
+struct EmfNestingStats
+{
+	uint64_t records = 0;
+	uint64_t emfPlusRecords = 0;
+	uint64_t nestedMetafiles = 0;
+	uint64_t nestedBytes = 0;
+	uint64_t groups = 0;
+	unsigned maxDepth = 0;
+	// Nested metafiles or EMF+ payloads which are corrupt; those records
+	// before the bad one are walked.
+	uint64_t corrupt = 0;
+	// EndGroup without BeginGroup, or BeginGroup never ended, per metafile.
+	uint64_t unbalancedGroups = 0;
+	// Nested content skipped for a limit.
+	uint64_t limited = 0;
+};
+
+// Receives the records of a metafile and of the metafiles nested in its
+// comments, in stream order. The spans point into the buffer given to
+// WalkNestedRecords.
+class EmfNestingSink
+{
+public:
+	virtual ~EmfNestingSink()
+	{
+	}
+	// Every EMF record, comments included; the content of a comment follows it.
+	virtual void Record(const EmfRecordSpan& /*record*/, unsigned /*depth*/)
+	{
+	}
+	virtual void Comment(const EmfComment& /*comment*/, unsigned /*depth*/)
+	{
+	}
+	// EMF+ records of a comment of the metafile at depth.
+	virtual void EmfPlusRecord(const EmfPlusRecordSpan& /*record*/, unsigned /*depth*/)
+	{
+	}
+	// Groups are balanced within each metafile: stray EndGroups are dropped,
+	// open groups are ended at its end.
+	virtual void BeginGroup(const EmfComment& /*comment*/, unsigned /*depth*/)
+	{
+	}
+	virtual void EndGroup(unsigned /*depth*/)
+	{
+	}
+	// An EMF of a MULTIFORMATS comment, its records follow at depth + 1.
+	virtual void BeginMetafile(const EmfCommentFormat& /*format*/, unsigned /*depth*/)
+	{
+	}
+	virtual void EndMetafile(unsigned /*depth*/)
+	{
+	}
+	// Nested content of the comment skipped, past maxDepth or maxNestedBytes.
+	virtual void LimitReached(const EmfComment& /*comment*/, unsigned /*depth*/)
+	{
+	}
+};
+
+// Walk the EMF in data and, recursively, the EMF and EMF+ streams in its
+// comments. Return false if data isn't an EMF or a record size of it is
+// invalid; corrupt nested streams are counted in stats only.
+bool WalkNestedRecords(const uint8_t* data, size_t size, EmfNestingSink& sink,
+	const EmfNestingLimits& limits = EmfNestingLimits(), EmfNestingStats* stats = nullptr);
+
+// Walk the content of one comment of the metafile at depth, without calling
+// Record or Comment for the comment itself.
+void WalkCommentContent(const EmfComment& comment, unsigned depth, EmfNestingSink& sink,
+	const EmfNestingLimits& limits = EmfNestingLimits(), EmfNestingStats* stats = nullptr);
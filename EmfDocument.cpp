@@ -0,0 +1,279 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#include "EmfDocument.h"
+#include "EmzStream.h"
+
+// ETO_PDY: ExtTextOut advances come in x, y pairs.
+const uint32_t g_etoPdy = 0x2000;
+
+static bool HasRange(const EmfRecordSpan& record, uint64_t offset, uint64_t size)
+{
+	return offset <= record.size && size <= record.size - offset;
+}
+
+static EmfRectL ReadRect(const uint8_t* p)
+{
+	return { ReadI32(p), ReadI32(p + 4), ReadI32(p + 8), ReadI32(p + 12) };
+}
+
+static void VisitHeader(const EmfRecordSpan& record, EmfVisitor& visitor)
+{
+	// rclBounds, rclFrame, dSignature, nVersion, nBytes, nRecords, nHandles,
+	// sReserved, nDescription, offDescription, nPalEntries, szlDevice, szlMillimeters.
+	const uint8_t* p = record.data;
+	if (!HasRange(record, 0, 88))
+		return;
+	EmfHeaderView header = {};
+	header.bounds = ReadRect(p + 8);
+	header.frame = ReadRect(p + 24);
+	header.version = ReadU32(p + 44);
+	header.bytes = ReadU32(p + 48);
+	header.recordCount = ReadU32(p + 52);
+	header.handleCount = ReadU16(p + 56);
+	header.device = { ReadI32(p + 72), ReadI32(p + 76) };
+	header.millimeters = { ReadI32(p + 80), ReadI32(p + 84) };
+	uint32_t length = ReadU32(p + 60), offset = ReadU32(p + 64);
+	header.description.wide = true;
+	if (length && HasRange(record, offset, (uint64_t)length * 2))
+	{
+		header.description.data = p + offset;
+		header.description.length = length;
+	}
+	visitor.Header(record, header);
+}
+
+static void VisitPoints(const EmfRecordSpan& record, uint32_t pointSize, EmfVisitor& visitor)
+{
+	// rclBounds, cptl, aptl.
+	const uint8_t* p = record.data;
+	if (!HasRange(record, 0, 28))
+		return;
+	uint32_t count = ReadU32(p + 24);
+	if (!HasRange(record, 28, (uint64_t)count * pointSize))
+		return;
+	visitor.Points(record, ReadRect(p + 8), EmfPointsView{ p + 28, count, pointSize });
+}
+
+static void VisitPolyPoints(const EmfRecordSpan& record, uint32_t pointSize, EmfVisitor& visitor)
+{
+	// rclBounds, nPolys, cptl, aPolyCounts, aptl.
+	const uint8_t* p = record.data;
+	if (!HasRange(record, 0, 32))
+		return;
+	uint32_t polyCount = ReadU32(p + 24);
+	uint32_t count = ReadU32(p + 28);
+	uint64_t pointsOffset = 32 + (uint64_t)polyCount * 4;
+	if (!HasRange(record, 32, (uint64_t)polyCount * 4) || !HasRange(record, pointsOffset, (uint64_t)count * pointSize))
+		return;
+	// The counts must add up to the points.
+	uint64_t total = 0;
+	for (uint32_t i = 0; i < polyCount; ++i)
+		total += ReadU32(p + 32 + (size_t)i * 4);
+	if (total != count)
+		return;
+	visitor.PolyPoints(record, ReadRect(p + 8), EmfInt32View{ p + 32, polyCount }, EmfPointsView{ p + pointsOffset, count, pointSize });
+}
+
+static void VisitText(const EmfRecordSpan& record, bool wide, EmfVisitor& visitor)
+{
+	// rclBounds, iGraphicsMode, exScale, eyScale, then EMRTEXT: ptlReference,
+	// nChars, offString, fOptions, rcl, offDx.
+	const uint8_t* p = record.data;
+	if (!HasRange(record, 0, 76))
+		return;
+	EmfTextView text = {};
+	text.bounds = ReadRect(p + 8);
+	text.reference = { ReadI32(p + 36), ReadI32(p + 40) };
+	uint32_t length = ReadU32(p + 44), offString = ReadU32(p + 48);
+	text.options = ReadU32(p + 52);
+	text.rect = ReadRect(p + 56);
+	uint32_t offDx = ReadU32(p + 72);
+	if (!HasRange(record, offString, (uint64_t)length * (wide ? 2 : 1)))
+		return;
+	text.string = { p + offString, length, wide };
+	uint64_t dxCount = (uint64_t)length * (text.options & g_etoPdy ? 2 : 1);
+	if (offDx && HasRange(record, offDx, dxCount * 4))
+		text.dx = { p + offDx, (uint32_t)dxCount };
+	visitor.Text(record, text);
+}
+
+static void VisitDib(const EmfRecordSpan& record, EmfVisitor& visitor)
+{
+	const uint8_t* p = record.data;
+	EmfDibView dib = {};
+	uint32_t offBmi, offBits;
+	if (record.type == (uint32_t)EmrType::StretchDIBits || record.type == (uint32_t)EmrType::SetDIBitsToDevice)
+	{
+		// rclBounds, xDest, yDest, xSrc, ySrc, cxSrc, cySrc, offBmiSrc,
+		// cbBmiSrc, offBitsSrc, cbBitsSrc, iUsageSrc, then dwRop, cxDest,
+		// cyDest for StretchDIBits or iStartScan, cScans.
+		if (!HasRange(record, 0, 76))
+			return;
+		dib.x = ReadI32(p + 24);
+		dib.y = ReadI32(p + 28);
+		dib.srcX = ReadI32(p + 32);
+		dib.srcY = ReadI32(p + 36);
+		dib.srcWidth = ReadI32(p + 40);
+		dib.srcHeight = ReadI32(p + 44);
+		offBmi = ReadU32(p + 48);
+		dib.bmiSize = ReadU32(p + 52);
+		offBits = ReadU32(p + 56);
+		dib.bitsSize = ReadU32(p + 60);
+		dib.usage = ReadU32(p + 64);
+		if (record.type == (uint32_t)EmrType::StretchDIBits)
+		{
+			if (!HasRange(record, 0, 80))
+				return;
+			dib.rop = ReadU32(p + 68);
+			dib.width = ReadI32(p + 72);
+			dib.height = ReadI32(p + 76);
+		}
+		else
+		{
+			dib.rop = 0x00CC0020; // SRCCOPY
+			dib.width = dib.srcWidth;
+			dib.height = dib.srcHeight;
+		}
+	}
+	else
+	{
+		// rclBounds, xDest, yDest, cxDest, cyDest, dwRop, xSrc, ySrc,
+		// xformSrc, crBkColorSrc, iUsageSrc, offBmiSrc, cbBmiSrc, offBitsSrc,
+		// cbBitsSrc, then cxSrc, cySrc but for BitBlt.
+		if (!HasRange(record, 0, 100))
+			return;
+		dib.x = ReadI32(p + 24);
+		dib.y = ReadI32(p + 28);
+		dib.width = ReadI32(p + 32);
+		dib.height = ReadI32(p + 36);
+		dib.rop = ReadU32(p + 40);
+		dib.srcX = ReadI32(p + 44);
+		dib.srcY = ReadI32(p + 48);
+		dib.usage = ReadU32(p + 80);
+		offBmi = ReadU32(p + 84);
+		dib.bmiSize = ReadU32(p + 88);
+		offBits = ReadU32(p + 92);
+		dib.bitsSize = ReadU32(p + 96);
+		dib.srcWidth = dib.width;
+		dib.srcHeight = dib.height;
+		if (record.type != (uint32_t)EmrType::BitBlt && HasRange(record, 0, 108))
+		{
+			dib.srcWidth = ReadI32(p + 100);
+			dib.srcHeight = ReadI32(p + 104);
+		}
+	}
+	// Without a bitmap BitBlt is a PatBlt. BITMAPINFOHEADER is 40 bytes at least.
+	if (dib.bmiSize < 40 || !HasRange(record, offBmi, dib.bmiSize) || !HasRange(record, offBits, dib.bitsSize))
+		return;
+	dib.bmi = p + offBmi;
+	dib.bits = p + offBits;
+	visitor.Dib(record, dib);
+}
+
+static bool VisitRecord(const EmfRecordSpan& record, EmfVisitor& visitor)
+{
+	if (!visitor.Record(record))
+		return false;
+	switch ((EmrType)record.type)
+	{
+	case EmrType::Header:
+		VisitHeader(record, visitor);
+		break;
+	case EmrType::PolyBezier:
+	case EmrType::Polygon:
+	case EmrType::Polyline:
+	case EmrType::PolyBezierTo:
+	case EmrType::PolyLineTo:
+		VisitPoints(record, sizeof(EmfPointL), visitor);
+		break;
+	case EmrType::PolyBezier16:
+	case EmrType::Polygon16:
+	case EmrType::Polyline16:
+	case EmrType::PolyBezierTo16:
+	case EmrType::PolylineTo16:
+		VisitPoints(record, sizeof(EmfPointS), visitor);
+		break;
+	case EmrType::PolyPolyline:
+	case EmrType::PolyPolygon:
+		VisitPolyPoints(record, sizeof(EmfPointL), visitor);
+		break;
+	case EmrType::PolyPolyline16:
+	case EmrType::PolyPolygon16:
+		VisitPolyPoints(record, sizeof(EmfPointS), visitor);
+		break;
+	case EmrType::ExtTextOutA:
+	case EmrType::ExtTextOutW:
+		VisitText(record, record.type == (uint32_t)EmrType::ExtTextOutW, visitor);
+		break;
+	case EmrType::BitBlt:
+	case EmrType::StretchBlt:
+	case EmrType::StretchDIBits:
+	case EmrType::SetDIBitsToDevice:
+	case EmrType::AlphaBlend:
+	case EmrType::TransparentBlt:
+		VisitDib(record, visitor);
+		break;
+	default:
+		break;
+	}
+	return true;
+}
+
+EmfDocument::EmfDocument()
+	: m_data(nullptr)
+	, m_size(0)
+	, m_compressed(false)
+{
+}
+
+bool EmfDocument::Open(const uint8_t* data, size_t size)
+{
+	Close();
+	return Attach(data, size);
+}
+
+bool EmfDocument::Open(const std::string& fileName)
+{
+	Close();
+	if (!m_file.Open(fileName))
+		return false;
+	if (!Attach(m_file.Data(), m_file.Size()))
+	{
+		m_file.Close();
+		return false;
+	}
+	return true;
+}
+
+bool EmfDocument::Attach(const uint8_t* data, size_t size)
+{
+	m_compressed = IsGzip(data, size);
+	if (!m_compressed && !IsEmf(data, size))
+		return false;
+	m_data = data;
+	m_size = size;
+	return true;
+}
+
+void EmfDocument::Close()
+{
+	m_file.Close();
+	m_data = nullptr;
+	m_size = 0;
+	m_compressed = false;
+}
+
+bool EmfDocument::Visit(EmfVisitor& visitor) const
+{
+	if (!m_data)
+		return false;
+	auto visit = [&visitor](const EmfRecordSpan& record) { return VisitRecord(record, visitor); };
+	return m_compressed ? StreamEmzRecords(m_data, m_size, visit) : ForEachRecord(m_data, m_size, visit);
+}
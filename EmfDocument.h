@@ -0,0 +1,185 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "EmfFormat.h"
+#include "MappedFile.h"
+
+// The C++ API of libemfparser, the part of the tree built without Qt and
+// GDI: EmfDocument, EmfParser (its C API), EmfFormat, EmzStream and
+// MappedFile, with zlib. The views handed to an EmfVisitor point into the
+// metafile and copy nothing; for an EMF they are valid while the document is
+// open, for an EMZ during the call only. Read them through their accessors,
+// records are aligned on 4 bytes only.
+
+// Points of a poly record, POINTL or POINTS as the record has them.
+struct EmfPointsView
+{
+	const uint8_t* data;
+	uint32_t count;
+	// 8 for POINTL, 4 for POINTS.
+	uint32_t pointSize;
+
+	EmfPointL operator[](uint32_t i) const
+	{
+		const uint8_t* p = data + (size_t)i * pointSize;
+		if (pointSize == sizeof(EmfPointS))
+			return { ReadI16(p), ReadI16(p + 2) };
+		return { ReadI32(p), ReadI32(p + 4) };
+	}
+};
+
+// 32 bit integers: the point counts of PolyPolyline and PolyPolygon, the
+// character advances of ExtTextOut.
+struct EmfInt32View
+{
+	const uint8_t* data;
+	uint32_t count;
+
+	int32_t operator[](uint32_t i) const
+	{
+		return ReadI32(data + (size_t)i * 4);
+	}
+};
+
+// ANSI or UTF-16LE characters, not null terminated.
+struct EmfStringView
+{
+	const uint8_t* data;
+	uint32_t length;
+	bool wide;
+
+	uint32_t operator[](uint32_t i) const
+	{
+		return wide ? ReadU16(data + (size_t)i * 2) : data[i];
+	}
+};
+
+struct EmfHeaderView
+{
+	EmfRectL bounds;
+	// .01 mm units.
+	EmfRectL frame;
+	EmfPointL device;
+	EmfPointL millimeters;
+	uint32_t version;
+	uint32_t bytes;
+	uint32_t recordCount;
+	uint32_t handleCount;
+	// Empty if there is none.
+	EmfStringView description;
+};
+
+// ExtTextOutA and ExtTextOutW.
+struct EmfTextView
+{
+	EmfRectL bounds;
+	EmfPointL reference;
+	uint32_t options;
+	// Clipping or opaquing rectangle.
+	EmfRectL rect;
+	EmfStringView string;
+	// Advance of every character, two values a character with ETO_PDY; empty if there are none.
+	EmfInt32View dx;
+};
+
+// BitBlt, StretchBlt, StretchDIBits, SetDIBitsToDevice, AlphaBlend and
+// TransparentBlt with a source bitmap.
+struct EmfDibView
+{
+	// Destination in logical units.
+	int32_t x, y, width, height;
+	// Source rectangle as the record has it, in pixels of the bitmap.
+	int32_t srcX, srcY, srcWidth, srcHeight;
+	// Raster operation, BLENDFUNCTION for AlphaBlend, transparent color for TransparentBlt.
+	uint32_t rop;
+	uint32_t usage;
+	const uint8_t* bmi;
+	uint32_t bmiSize;
+	const uint8_t* bits;
+	uint32_t bitsSize;
+};
+
+// Called for the records of a document in order. Record is called for every
+// record, then the typed call if the record is of its kind and well formed.
+class EmfVisitor
+{
+public:
+	virtual ~EmfVisitor()
+	{
+	}
+	// Return false to stop the walk.
+	virtual bool Record(const EmfRecordSpan& /*record*/)
+	{
+		return true;
+	}
+	virtual void Header(const EmfRecordSpan& /*record*/, const EmfHeaderView& /*header*/)
+	{
+	}
+	// PolyBezier, Polygon, Polyline, PolyBezierTo, PolylineTo and their 16 bit forms.
+	virtual void Points(const EmfRecordSpan& /*record*/, const EmfRectL& /*bounds*/, const EmfPointsView& /*points*/)
+	{
+	}
+	// PolyPolyline and PolyPolygon and their 16 bit forms.
+	virtual void PolyPoints(const EmfRecordSpan& /*record*/, const EmfRectL& /*bounds*/, const EmfInt32View& /*polyCounts*/, const EmfPointsView& /*points*/)
+	{
+	}
+	virtual void Text(const EmfRecordSpan& /*record*/, const EmfTextView& /*text*/)
+	{
+	}
+	virtual void Dib(const EmfRecordSpan& /*record*/, const EmfDibView& /*dib*/)
+	{
+	}
+};
+
+// An EMF or EMZ metafile held in memory or mapped from a file.
+class EmfDocument
+{
+public:
+	EmfDocument();
+	EmfDocument(const EmfDocument&) = delete;
+	EmfDocument& operator=(const EmfDocument&) = delete;
+
+	// data isn't copied and must outlive the document. Return false if it
+	// isn't an EMF or a gzip compressed one.
+	bool Open(const uint8_t* data, size_t size);
+	// fileName is UTF-8.
+	bool Open(const std::string& fileName);
+	void Close();
+
+	const uint8_t* Data() const
+	{
+		return m_data;
+	}
+	size_t Size() const
+	{
+		return m_size;
+	}
+	bool IsCompressed() const
+	{
+		return m_compressed;
+	}
+
+	// Walk the records up to EMR_EOF. Return false if the document isn't open,
+	// is corrupt or a record size is invalid; the records before are visited.
+	bool Visit(EmfVisitor& visitor) const;
+
+private:
+	MappedFile m_file;
+	const uint8_t* m_data;
+	size_t m_size;
+	bool m_compressed;
+
+	bool Attach(const uint8_t* data, size_t size);
+};
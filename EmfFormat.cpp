@@ -0,0 +1,90 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#include "EmfFormat.h"
+
+// Offset of ENHMETAHEADER::dSignature.
+const size_t g_signatureOffset = 40;
+
+bool IsEmf(const uint8_t* data, size_t size)
+{
+	if (size < g_signatureOffset + sizeof(uint32_t))
+		return false;
+	if (ReadU32(data) != (uint32_t)EmrType::Header)
+		return false;
+	return ReadU32(data + g_signatureOffset) == g_emfSignature;
+}
+
+bool ScanRecords(const uint8_t* data, size_t size, std::vector<EmfRecordSpan>& records)
+{
+	if (!IsEmf(data, size))
+		return false;
+	return ForEachRecord(data, size, [&records](const EmfRecordSpan& record) {
+		records.push_back(record);
+		return true;
+	});
+}
+
+bool GetRecordBounds(const EmfRecordSpan& record, EmfRectL& bounds)
+{
+	switch ((EmrType)record.type)
+	{
+	case EmrType::Header:
+	case EmrType::PolyBezier:
+	case EmrType::Polygon:
+	case EmrType::Polyline:
+	case EmrType::PolyBezierTo:
+	case EmrType::PolyLineTo:
+	case EmrType::PolyPolyline:
+	case EmrType::PolyPolygon:
+	case EmrType::Ellipse:
+	case EmrType::Rectangle:
+	case EmrType::RoundRect:
+	case EmrType::Arc:
+	case EmrType::Chord:
+	case EmrType::Pie:
+	case EmrType::ArcTo:
+	case EmrType::PolyDraw:
+	case EmrType::FillPath:
+	case EmrType::StrokeAndFillPath:
+	case EmrType::StrokePath:
+	case EmrType::FillRgn:
+	case EmrType::FrameRgn:
+	case EmrType::InvertRgn:
+	case EmrType::PaintRgn:
+	case EmrType::BitBlt:
+	case EmrType::StretchBlt:
+	case EmrType::MaskBlt:
+	case EmrType::PlgBlt:
+	case EmrType::SetDIBitsToDevice:
+	case EmrType::StretchDIBits:
+	case EmrType::ExtTextOutA:
+	case EmrType::ExtTextOutW:
+	case EmrType::PolyBezier16:
+	case EmrType::Polygon16:
+	case EmrType::Polyline16:
+	case EmrType::PolyBezierTo16:
+	case EmrType::PolylineTo16:
+	case EmrType::PolyPolyline16:
+	case EmrType::PolyPolygon16:
+	case EmrType::PolyDraw16:
+	case EmrType::PolyTextOutA:
+	case EmrType::PolyTextOutW:
+	case EmrType::AlphaBlend:
+	case EmrType::TransparentBlt:
+	case EmrType::GradientFill:
+		break;
+	default:
+		return false;
+	}
+	if (record.size < sizeof(EmfRecordHeader) + sizeof(EmfRectL))
+		return false;
+	memcpy(&bounds, record.data + sizeof(EmfRecordHeader), sizeof(bounds));
+	return true;
+}
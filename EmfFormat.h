@@ -0,0 +1,251 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Portable description of the EMF record stream ([MS-EMF] 2.3).
+// It doesn't need Windows.h, so the record walkers built on it can also run
+// on machines without GDI.
+
+// Same values as EMR_XXX in wingdi.h and Gdiplus::EmfRecordTypeXXX.
+enum class EmrType : uint32_t
+{
+	Header = 1,
+	PolyBezier = 2,
+	Polygon = 3,
+	Polyline = 4,
+	PolyBezierTo = 5,
+	PolyLineTo = 6,
+	PolyPolyline = 7,
+	PolyPolygon = 8,
+	SetWindowExtEx = 9,
+	SetWindowOrgEx = 10,
+	SetViewportExtEx = 11,
+	SetViewportOrgEx = 12,
+	SetBrushOrgEx = 13,
+	Eof = 14,
+	SetPixelV = 15,
+	SetMapperFlags = 16,
+	SetMapMode = 17,
+	SetBkMode = 18,
+	SetPolyFillMode = 19,
+	SetROP2 = 20,
+	SetStretchBltMode = 21,
+	SetTextAlign = 22,
+	SetColorAdjustment = 23,
+	SetTextColor = 24,
+	SetBkColor = 25,
+	OffsetClipRgn = 26,
+	MoveToEx = 27,
+	SetMetaRgn = 28,
+	ExcludeClipRect = 29,
+	IntersectClipRect = 30,
+	ScaleViewportExtEx = 31,
+	ScaleWindowExtEx = 32,
+	SaveDC = 33,
+	RestoreDC = 34,
+	SetWorldTransform = 35,
+	ModifyWorldTransform = 36,
+	SelectObject = 37,
+	CreatePen = 38,
+	CreateBrushIndirect = 39,
+	DeleteObject = 40,
+	AngleArc = 41,
+	Ellipse = 42,
+	Rectangle = 43,
+	RoundRect = 44,
+	Arc = 45,
+	Chord = 46,
+	Pie = 47,
+	SelectPalette = 48,
+	CreatePalette = 49,
+	SetPaletteEntries = 50,
+	ResizePalette = 51,
+	RealizePalette = 52,
+	ExtFloodFill = 53,
+	LineTo = 54,
+	ArcTo = 55,
+	PolyDraw = 56,
+	SetArcDirection = 57,
+	SetMiterLimit = 58,
+	BeginPath = 59,
+	EndPath = 60,
+	CloseFigure = 61,
+	FillPath = 62,
+	StrokeAndFillPath = 63,
+	StrokePath = 64,
+	FlattenPath = 65,
+	WidenPath = 66,
+	SelectClipPath = 67,
+	AbortPath = 68,
+	GdiComment = 70,
+	FillRgn = 71,
+	FrameRgn = 72,
+	InvertRgn = 73,
+	PaintRgn = 74,
+	ExtSelectClipRgn = 75,
+	BitBlt = 76,
+	StretchBlt = 77,
+	MaskBlt = 78,
+	PlgBlt = 79,
+	SetDIBitsToDevice = 80,
+	StretchDIBits = 81,
+	ExtCreateFontIndirectW = 82,
+	ExtTextOutA = 83,
+	ExtTextOutW = 84,
+	PolyBezier16 = 85,
+	Polygon16 = 86,
+	Polyline16 = 87,
+	PolyBezierTo16 = 88,
+	PolylineTo16 = 89,
+	PolyPolyline16 = 90,
+	PolyPolygon16 = 91,
+	PolyDraw16 = 92,
+	CreateMonoBrush = 93,
+	CreateDIBPatternBrushPt = 94,
+	ExtCreatePen = 95,
+	PolyTextOutA = 96,
+	PolyTextOutW = 97,
+	SetICMMode = 98,
+	CreateColorSpace = 99,
+	SetColorSpace = 100,
+	DeleteColorSpace = 101,
+	GLSRecord = 102,
+	GLSBoundedRecord = 103,
+	PixelFormat = 104,
+	DrawEscape = 105,
+	ExtEscape = 106,
+	SmallTextOut = 108,
+	ForceUFIMapping = 109,
+	NamedEscape = 110,
+	ColorCorrectPalette = 111,
+	SetICMProfileA = 112,
+	SetICMProfileW = 113,
+	AlphaBlend = 114,
+	SetLayout = 115,
+	TransparentBlt = 116,
+	GradientFill = 118,
+	SetLinkedUFIs = 119,
+	SetTextJustification = 120,
+	ColorMatchToTargetW = 121,
+	CreateColorSpaceW = 122,
+};
+
+// " EMF" in ENHMETAHEADER::dSignature.
+const uint32_t g_emfSignature = 0x464D4520;
+
+// Fixed part of every record, same layout as EMR.
+struct EmfRecordHeader
+{
+	uint32_t iType;
+	uint32_t nSize;
+};
+
+struct EmfPointL
+{
+	int32_t x, y;
+};
+
+struct EmfPointS
+{
+	int16_t x, y;
+};
+
+// Same layout as RECTL.
+struct EmfRectL
+{
+	int32_t left, top, right, bottom;
+};
+
+// One record of a metafile held in memory. data points to the EMR header,
+// the parameters start at data + sizeof(EmfRecordHeader).
+struct EmfRecordSpan
+{
+	const uint8_t* data;
+	size_t offset;
+	uint32_t type;
+	uint32_t size;
+};
+
+// Records may be packed on 4 byte boundaries only, so always read through memcpy.
+inline uint32_t ReadU32(const uint8_t* p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+inline int32_t ReadI32(const uint8_t* p)
+{
+	int32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+inline int16_t ReadI16(const uint8_t* p)
+{
+	int16_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+inline uint16_t ReadU16(const uint8_t* p)
+{
+	uint16_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+inline float ReadF32(const uint8_t* p)
+{
+	float v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+// Check the first record is an EMR_HEADER carrying the " EMF" signature.
+bool IsEmf(const uint8_t* data, size_t size);
+
+// Call fn(const EmfRecordSpan&) for every record up to and including EMR_EOF,
+// fn returns false to stop early. Return false if a record size is invalid.
+template<typename Fn>
+bool ForEachRecord(const uint8_t* data, size_t size, Fn fn)
+{
+	size_t offset = 0;
+	while (offset + sizeof(EmfRecordHeader) <= size)
+	{
+		const uint8_t* p = data + offset;
+		uint32_t type = ReadU32(p);
+		uint32_t recordSize = ReadU32(p + sizeof(uint32_t));
+		if (recordSize < sizeof(EmfRecordHeader) || (recordSize & 3) || recordSize > size - offset)
+			return false;
+		if (!fn(EmfRecordSpan{ p, offset, type, recordSize }))
+			return true;
+		offset += recordSize;
+		if (type == (uint32_t)EmrType::Eof)
+			return true;
+	}
+	// No EMR_EOF, but everything before the end is usable.
+	return offset == size;
+}
+
+// Bounds carried by the record: rclBounds of the poly, text, bitmap and
+// region records, rclBox of the ellipse and arc records.
+bool GetRecordBounds(const EmfRecordSpan& record, EmfRectL& bounds);
+
+// Append every record of the metafile to records, stopping after EMR_EOF.
+// Only the record headers are touched, so this runs at memory bandwidth.
+// Return false if the stream is not an EMF or a record size is invalid;
+// records scanned before the bad one are kept.
+bool ScanRecords(const uint8_t* data, size_t size, std::vector<EmfRecordSpan>& records);
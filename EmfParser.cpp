@@ -0,0 +1,166 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#include <new>
+
+#include "EmfDocument.h"
+#include "EmfParser.h"
+
+struct EmfParserDocument
+{
+	EmfDocument document;
+};
+
+// A callback is there if the caller's struct reaches it and it isn't NULL.
+#define HAS_CALLBACK(visitor, name) \
+	((visitor)->size >= offsetof(EmfParserVisitor, name) + sizeof((visitor)->name) && (visitor)->name)
+
+static EmfParserRect ToRect(const EmfRectL& rect)
+{
+	return { rect.left, rect.top, rect.right, rect.bottom };
+}
+
+static EmfParserPoints ToPoints(const EmfPointsView& points)
+{
+	return { points.data, points.count, points.pointSize };
+}
+
+static EmfParserString ToString(const EmfStringView& string)
+{
+	return { string.data, string.length, string.wide ? 1 : 0 };
+}
+
+class CVisitor : public EmfVisitor
+{
+public:
+	explicit CVisitor(const EmfParserVisitor& visitor)
+		: m_visitor(visitor)
+	{
+	}
+	virtual bool Record(const EmfRecordSpan& record) override
+	{
+		if (!HAS_CALLBACK(&m_visitor, record))
+			return true;
+		return m_visitor.record(m_visitor.context, record.type, record.data, record.size) != 0;
+	}
+	virtual void Header(const EmfRecordSpan& /*record*/, const EmfHeaderView& header) override
+	{
+		if (!HAS_CALLBACK(&m_visitor, header))
+			return;
+		EmfParserHeader h = { ToRect(header.bounds), ToRect(header.frame), header.device.x, header.device.y,
+			header.millimeters.x, header.millimeters.y, header.version, header.bytes, header.recordCount,
+			header.handleCount, ToString(header.description) };
+		m_visitor.header(m_visitor.context, &h);
+	}
+	virtual void Points(const EmfRecordSpan& record, const EmfRectL& bounds, const EmfPointsView& points) override
+	{
+		if (!HAS_CALLBACK(&m_visitor, points))
+			return;
+		EmfParserRect b = ToRect(bounds);
+		EmfParserPoints p = ToPoints(points);
+		m_visitor.points(m_visitor.context, record.type, &b, &p);
+	}
+	virtual void PolyPoints(const EmfRecordSpan& record, const EmfRectL& bounds, const EmfInt32View& polyCounts, const EmfPointsView& points) override
+	{
+		if (!HAS_CALLBACK(&m_visitor, polyPoints))
+			return;
+		EmfParserRect b = ToRect(bounds);
+		EmfParserPoints p = ToPoints(points);
+		m_visitor.polyPoints(m_visitor.context, record.type, &b, polyCounts.data, polyCounts.count, &p);
+	}
+	virtual void Text(const EmfRecordSpan& record, const EmfTextView& text) override
+	{
+		if (!HAS_CALLBACK(&m_visitor, text))
+			return;
+		EmfParserText t = { ToRect(text.bounds), text.reference.x, text.reference.y, text.options,
+			ToRect(text.rect), ToString(text.string), text.dx.data, text.dx.count };
+		m_visitor.text(m_visitor.context, record.type, &t);
+	}
+	virtual void Dib(const EmfRecordSpan& record, const EmfDibView& dib) override
+	{
+		if (!HAS_CALLBACK(&m_visitor, dib))
+			return;
+		EmfParserDib d = { dib.x, dib.y, dib.width, dib.height, dib.srcX, dib.srcY, dib.srcWidth, dib.srcHeight,
+			dib.rop, dib.usage, dib.bmi, dib.bmiSize, dib.bits, dib.bitsSize };
+		m_visitor.dib(m_visitor.context, record.type, &d);
+	}
+
+private:
+	const EmfParserVisitor& m_visitor;
+};
+
+int EmfParserVersion(void)
+{
+	return EMFPARSER_VERSION;
+}
+
+EmfParserDocument* EmfParserOpenMemory(const uint8_t* data, size_t size)
+{
+	EmfParserDocument* document = new (std::nothrow) EmfParserDocument;
+	if (document && !document->document.Open(data, size))
+	{
+		delete document;
+		return nullptr;
+	}
+	return document;
+}
+
+EmfParserDocument* EmfParserOpenFile(const char* fileName)
+{
+	if (!fileName)
+		return nullptr;
+	EmfParserDocument* document = new (std::nothrow) EmfParserDocument;
+	try
+	{
+		if (document && !document->document.Open(std::string(fileName)))
+		{
+			delete document;
+			return nullptr;
+		}
+	}
+	catch (...)
+	{
+		delete document;
+		return nullptr;
+	}
+	return document;
+}
+
+void EmfParserClose(EmfParserDocument* document)
+{
+	delete document;
+}
+
+int EmfParserVisit(const EmfParserDocument* document, const EmfParserVisitor* visitor)
+{
+	if (!document || !visitor)
+		return 0;
+	// No exception may cross the C boundary.
+	try
+	{
+		CVisitor adapter(*visitor);
+		return document->document.Visit(adapter) ? 1 : 0;
+	}
+	catch (...)
+	{
+		return 0;
+	}
+}
+
+int EmfParserGetPoint(const EmfParserPoints* points, uint32_t index, int32_t* x, int32_t* y)
+{
+	if (!points || index >= points->count)
+		return 0;
+	EmfPointL point = EmfPointsView{ points->data, points->count, points->pointSize }[index];
+	if (x)
+		*x = point.x;
+	if (y)
+		*y = point.y;
+	return 1;
+}
@@ -0,0 +1,139 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The C API of libemfparser, the same walk as EmfDocument and EmfVisitor
+// for callers which can't use C++. Only plain structs and functions cross
+// it, so a shared build keeps its ABI: structs are only ever extended at
+// their end, and EmfParserVisitor carries its own size.
+// Define EMFPARSER_SHARED when building or using the shared library, and
+// EMFPARSER_BUILD when building it.
+
+#if defined(EMFPARSER_SHARED) && defined(_WIN32)
+#ifdef EMFPARSER_BUILD
+#define EMFPARSER_API __declspec(dllexport)
+#else
+#define EMFPARSER_API __declspec(dllimport)
+#endif
+#elif defined(EMFPARSER_SHARED) && defined(__GNUC__)
+#define EMFPARSER_API __attribute__((visibility("default")))
+#else
+#define EMFPARSER_API
+#endif
+
+// Bumped when the API changes incompatibly.
+#define EMFPARSER_VERSION 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct EmfParserDocument EmfParserDocument;
+
+typedef struct EmfParserRect
+{
+	int32_t left, top, right, bottom;
+} EmfParserRect;
+
+// Points as the record has them: pointSize is 8 for POINTL, 4 for POINTS.
+// Read them with EmfParserGetPoint, they are aligned on 4 bytes only.
+typedef struct EmfParserPoints
+{
+	const uint8_t* data;
+	uint32_t count;
+	uint32_t pointSize;
+} EmfParserPoints;
+
+// ANSI characters, or UTF-16LE if wide, not null terminated.
+typedef struct EmfParserString
+{
+	const uint8_t* data;
+	uint32_t length;
+	int wide;
+} EmfParserString;
+
+typedef struct EmfParserHeader
+{
+	EmfParserRect bounds;
+	EmfParserRect frame;
+	int32_t deviceWidth, deviceHeight;
+	int32_t millimetersWidth, millimetersHeight;
+	uint32_t version;
+	uint32_t bytes;
+	uint32_t recordCount;
+	uint32_t handleCount;
+	EmfParserString description;
+} EmfParserHeader;
+
+typedef struct EmfParserText
+{
+	EmfParserRect bounds;
+	int32_t x, y;
+	uint32_t options;
+	EmfParserRect rect;
+	EmfParserString string;
+	// int32 advances, dxCount of them; data is NULL if there are none.
+	const uint8_t* dx;
+	uint32_t dxCount;
+} EmfParserText;
+
+typedef struct EmfParserDib
+{
+	int32_t x, y, width, height;
+	int32_t srcX, srcY, srcWidth, srcHeight;
+	uint32_t rop;
+	uint32_t usage;
+	const uint8_t* bmi;
+	uint32_t bmiSize;
+	const uint8_t* bits;
+	uint32_t bitsSize;
+} EmfParserDib;
+
+// Callbacks of EmfParserVisit, any of them may be NULL. The views point
+// into the metafile as with EmfVisitor. type is the EMR_XXX record type,
+// record and size the whole record.
+typedef struct EmfParserVisitor
+{
+	// sizeof(EmfParserVisitor).
+	size_t size;
+	void* context;
+	// Every record; return 0 to stop the walk.
+	int (*record)(void* context, uint32_t type, const uint8_t* record, uint32_t size);
+	void (*header)(void* context, const EmfParserHeader* header);
+	void (*points)(void* context, uint32_t type, const EmfParserRect* bounds, const EmfParserPoints* points);
+	// polyCounts is polyCount uint32 values.
+	void (*polyPoints)(void* context, uint32_t type, const EmfParserRect* bounds, const uint8_t* polyCounts, uint32_t polyCount, const EmfParserPoints* points);
+	void (*text)(void* context, uint32_t type, const EmfParserText* text);
+	void (*dib)(void* context, uint32_t type, const EmfParserDib* dib);
+} EmfParserVisitor;
+
+// EMFPARSER_VERSION of the library.
+EMFPARSER_API int EmfParserVersion(void);
+
+// An EMF or EMZ in memory, not copied; data must outlive the document.
+// NULL if it isn't one.
+EMFPARSER_API EmfParserDocument* EmfParserOpenMemory(const uint8_t* data, size_t size);
+// fileName is UTF-8; the file is mapped. NULL if it can't be opened or isn't an EMF or EMZ.
+EMFPARSER_API EmfParserDocument* EmfParserOpenFile(const char* fileName);
+EMFPARSER_API void EmfParserClose(EmfParserDocument* document);
+
+// Walk the records up to EMR_EOF. Return 0 if the document is corrupt or
+// a record size is invalid, the records before are visited.
+EMFPARSER_API int EmfParserVisit(const EmfParserDocument* document, const EmfParserVisitor* visitor);
+
+// Point index of points, 0 if it is out of range.
+EMFPARSER_API int EmfParserGetPoint(const EmfParserPoints* points, uint32_t index, int32_t* x, int32_t* y);
+
+#ifdef __cplusplus
+}
+#endif
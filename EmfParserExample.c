@@ -0,0 +1,144 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+/* Summary of a metafile through the C API of libemfparser:
+ *
+ *   EmfParserExample FILE
+ *
+ * Fails if the records don't add up to the count of the header. */
+#include <stdio.h>
+#include <string.h>
+
+#include "EmfParser.h"
+
+typedef struct Summary
+{
+	uint32_t records;
+	uint32_t headerRecords;
+	uint32_t polys;
+	uint32_t points;
+	uint32_t texts;
+	uint32_t characters;
+	uint32_t dibs;
+	EmfParserRect bounds;
+} Summary;
+
+static int CountRecord(void* context, uint32_t type, const uint8_t* record, uint32_t size)
+{
+	(void)type;
+	(void)record;
+	(void)size;
+	((Summary*)context)->records++;
+	return 1;
+}
+
+static void ReadHeader(void* context, const EmfParserHeader* header)
+{
+	Summary* summary = (Summary*)context;
+	summary->headerRecords = header->recordCount;
+	summary->bounds = header->bounds;
+}
+
+static void CountPoints(void* context, uint32_t type, const EmfParserRect* bounds, const EmfParserPoints* points)
+{
+	Summary* summary = (Summary*)context;
+	uint32_t i;
+	int32_t x, y;
+	(void)type;
+	(void)bounds;
+	summary->polys++;
+	/* Every point must be readable. */
+	for (i = 0; i < points->count; ++i)
+	{
+		if (EmfParserGetPoint(points, i, &x, &y))
+			summary->points++;
+	}
+}
+
+static void CountPolyPoints(void* context, uint32_t type, const EmfParserRect* bounds, const uint8_t* polyCounts, uint32_t polyCount, const EmfParserPoints* points)
+{
+	(void)polyCounts;
+	(void)polyCount;
+	CountPoints(context, type, bounds, points);
+}
+
+static void CountText(void* context, uint32_t type, const EmfParserText* text)
+{
+	Summary* summary = (Summary*)context;
+	(void)type;
+	summary->texts++;
+	summary->characters += text->string.length;
+}
+
+static void CountDib(void* context, uint32_t type, const EmfParserDib* dib)
+{
+	(void)type;
+	(void)dib;
+	((Summary*)context)->dibs++;
+}
+
+int main(int argc, char* argv[])
+{
+	EmfParserDocument* document;
+	EmfParserVisitor visitor;
+	Summary summary;
+	static const uint8_t notEmf[64] = { 0 };
+	int ok;
+
+	if (argc != 2)
+	{
+		fprintf(stderr, "usage: EmfParserExample FILE\n");
+		return 2;
+	}
+	if (EmfParserVersion() != EMFPARSER_VERSION)
+	{
+		fprintf(stderr, "library version %d, header version %d\n", EmfParserVersion(), EMFPARSER_VERSION);
+		return 1;
+	}
+	if (EmfParserOpenMemory(notEmf, sizeof(notEmf)))
+	{
+		fprintf(stderr, "zeros taken for a metafile\n");
+		return 1;
+	}
+	document = EmfParserOpenFile(argv[1]);
+	if (!document)
+	{
+		fprintf(stderr, "%s isn't an EMF nor an EMZ\n", argv[1]);
+		return 1;
+	}
+
+	memset(&summary, 0, sizeof(summary));
+	memset(&visitor, 0, sizeof(visitor));
+	visitor.size = sizeof(visitor);
+	visitor.context = &summary;
+	visitor.record = CountRecord;
+	visitor.header = ReadHeader;
+	visitor.points = CountPoints;
+	visitor.polyPoints = CountPolyPoints;
+	visitor.text = CountText;
+	visitor.dib = CountDib;
+	ok = EmfParserVisit(document, &visitor);
+	EmfParserClose(document);
+
+	printf("%s: %u records, bounds (%d,%d,%d,%d)\n", argv[1], summary.records,
+		summary.bounds.left, summary.bounds.top, summary.bounds.right, summary.bounds.bottom);
+	printf("%u poly records with %u points, %u texts with %u characters, %u bitmaps\n",
+		summary.polys, summary.points, summary.texts, summary.characters, summary.dibs);
+	if (!ok)
+	{
+		fprintf(stderr, "the metafile is corrupt\n");
+		return 1;
+	}
+	if (summary.records != summary.headerRecords)
+	{
+		fprintf(stderr, "%u records, the header says %u\n", summary.records, summary.headerRecords);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,1271 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#include <algorithm>
+#include <cmath>
+
+#include "EmfPlayer.h"
+#include "EmzStream.h"
+#include "PathFlattener.h"
+
+// wingdi.h values used below.
+const uint32_t g_stockObject = 0x80000000;
+const uint32_t g_psStyleMask = 0x0000000F;
+const uint32_t g_psNull = 5;
+const uint32_t g_bsSolid = 0;
+const uint32_t g_bsNull = 1;
+const uint32_t g_taUpdateCP = 1;
+const uint32_t g_etoPdy = 0x2000;
+const uint32_t g_adCounterClockwise = 1;
+const uint32_t g_mwtIdentity = 1;
+const uint32_t g_mwtLeftMultiply = 2;
+const uint32_t g_mwtRightMultiply = 3;
+const uint32_t g_mwtSet = 4;
+const uint32_t g_ropPatCopy = 0x00F00021;
+const uint32_t g_ropBlackness = 0x00000042;
+const uint32_t g_ropWhiteness = 0x00FF0062;
+const uint32_t g_gradientFillRectH = 0;
+const uint32_t g_gradientFillTriangle = 2;
+const uint8_t g_ptCloseFigure = 1;
+const uint8_t g_ptLineTo = 2;
+const uint8_t g_ptBezierTo = 4;
+const uint8_t g_ptMoveTo = 6;
+
+const double g_pi = 3.14159265358979323846;
+
+enum MapMode
+{
+	MapModeText = 1,
+	MapModeLoMetric,
+	MapModeHiMetric,
+	MapModeLoEnglish,
+	MapModeHiEnglish,
+	MapModeTwips,
+	MapModeIsotropic,
+	MapModeAnisotropic,
+};
+
+EmfMatrix EmfMatrix::Then(const EmfMatrix& next) const
+{
+	return {
+		next.a * a + next.c * b,
+		next.b * a + next.d * b,
+		next.a * c + next.c * d,
+		next.b * c + next.d * d,
+		next.a * e + next.c * f + next.e,
+		next.b * e + next.d * f + next.f,
+	};
+}
+
+double EmfMatrix::Scale() const
+{
+	return std::sqrt(std::fabs(a * d - b * c));
+}
+
+static bool Has(const EmfRecordSpan& record, size_t size)
+{
+	return record.size >= size;
+}
+
+static bool HasRange(const EmfRecordSpan& record, uint64_t offset, uint64_t size)
+{
+	return offset <= record.size && size <= record.size - offset;
+}
+
+static EmfMatrix ReadMatrix(const uint8_t* p)
+{
+	return { ReadF32(p), ReadF32(p + 4), ReadF32(p + 8), ReadF32(p + 12), ReadF32(p + 16), ReadF32(p + 20) };
+}
+
+struct PointL
+{
+	static const size_t size = 8;
+	static EmfPointL Read(const uint8_t* p)
+	{
+		return { ReadI32(p), ReadI32(p + 4) };
+	}
+};
+
+struct PointS
+{
+	static const size_t size = 4;
+	static EmfPointL Read(const uint8_t* p)
+	{
+		return { ReadI16(p), ReadI16(p + 2) };
+	}
+};
+
+static EmfPen StockPen(uint32_t index)
+{
+	switch (index)
+	{
+	case 6: // WHITE_PEN
+		return { 0, 0, 0xFFFFFF };
+	case 8: // NULL_PEN
+		return { g_psNull, 0, 0 };
+	default: // BLACK_PEN, DC_PEN
+		return { 0, 0, 0 };
+	}
+}
+
+static bool StockBrush(uint32_t index, EmfBrush& brush)
+{
+	static const uint32_t colors[] = { 0xFFFFFF, 0xC0C0C0, 0x808080, 0x404040, 0x000000 };
+	if (index < 5)
+		brush = { g_bsSolid, colors[index], 0 };
+	else if (index == 5)
+		brush = { g_bsNull, 0, 0 };
+	else if (index == 18) // DC_BRUSH
+		brush = { g_bsSolid, 0xFFFFFF, 0 };
+	else
+		return false;
+	return true;
+}
+
+static EmfFont DefaultFont()
+{
+	EmfFont font = {};
+	font.height = -16;
+	font.weight = 400;
+	const char* face = "Arial";
+	for (int i = 0; face[i]; ++i)
+		font.faceName[i] = face[i];
+	return font;
+}
+
+EmfPlayer::EmfPlayer()
+{
+	Reset();
+}
+
+void EmfPlayer::Reset()
+{
+	m_header = {};
+	m_dc = {};
+	m_dc.pen = StockPen(7);
+	StockBrush(0, m_dc.brush);
+	m_dc.font = DefaultFont();
+	m_dc.bkColor = 0xFFFFFF;
+	m_dc.bkMode = 2; // OPAQUE
+	m_dc.polyFillMode = 1; // ALTERNATE
+	m_dc.mapMode = MapModeText;
+	m_dc.arcDirection = g_adCounterClockwise;
+	m_dc.stretchBltMode = 1; // BLACKONWHITE
+	m_dc.rop2 = 13; // R2_COPYPEN
+	m_dc.miterLimit = 10;
+	m_dc.windowExt = { 1, 1 };
+	m_dc.viewportExt = { 1, 1 };
+	m_dc.world = EmfMatrix::Identity();
+	m_dc.toDevice = EmfMatrix::Identity();
+	m_savedDC.clear();
+	m_objects.clear();
+	m_inPath = false;
+	m_path.Clear();
+	m_scratch.Clear();
+	m_lines.Clear();
+}
+
+void EmfPlayer::UpdateTransform()
+{
+	double sx = 1, sy = 1;
+	if (m_dc.mapMode >= MapModeLoMetric && m_dc.mapMode <= MapModeTwips)
+	{
+		// Fixed modes have y going up.
+		double pixelsPerMmX = m_header.millimeters.x > 0 ? (double)m_header.device.x / m_header.millimeters.x : 96 / 25.4;
+		double pixelsPerMmY = m_header.millimeters.y > 0 ? (double)m_header.device.y / m_header.millimeters.y : 96 / 25.4;
+		static const double mmPerUnit[] = { 0.1, 0.01, 0.254, 0.0254, 25.4 / 1440 };
+		double mm = mmPerUnit[m_dc.mapMode - MapModeLoMetric];
+		sx = pixelsPerMmX * mm;
+		sy = -pixelsPerMmY * mm;
+	}
+	else if (m_dc.mapMode == MapModeIsotropic || m_dc.mapMode == MapModeAnisotropic)
+	{
+		if (m_dc.windowExt.x != 0)
+			sx = (double)m_dc.viewportExt.x / m_dc.windowExt.x;
+		if (m_dc.windowExt.y != 0)
+			sy = (double)m_dc.viewportExt.y / m_dc.windowExt.y;
+		if (m_dc.mapMode == MapModeIsotropic)
+		{
+			double s = std::min(std::fabs(sx), std::fabs(sy));
+			sx = sx < 0 ? -s : s;
+			sy = sy < 0 ? -s : s;
+		}
+	}
+	EmfMatrix page = { sx, 0, 0, sy, m_dc.viewportOrg.x - m_dc.windowOrg.x * sx, m_dc.viewportOrg.y - m_dc.windowOrg.y * sy };
+	m_dc.toDevice = m_dc.world.Then(page);
+}
+
+void EmfHeaderInfo::PictureRect(double& left, double& top, double& width, double& height) const
+{
+	// rclBounds is inclusive.
+	left = bounds.left;
+	top = bounds.top;
+	width = (double)bounds.right - bounds.left + 1;
+	height = (double)bounds.bottom - bounds.top + 1;
+	if (width <= 1 || height <= 1)
+	{
+		// rclFrame is given in .01 mm.
+		double x = millimeters.x > 0 ? (double)device.x / millimeters.x / 100 : 96 / 2540.0;
+		double y = millimeters.y > 0 ? (double)device.y / millimeters.y / 100 : 96 / 2540.0;
+		left = frame.left * x;
+		top = frame.top * y;
+		width = std::max(1.0, (frame.right - frame.left) * x);
+		height = std::max(1.0, (frame.bottom - frame.top) * y);
+	}
+}
+
+bool EmfPlayer::Play(const uint8_t* data, size_t size, EmfSink& sink)
+{
+	bool compressed = IsGzip(data, size);
+	if (!compressed && !IsEmf(data, size))
+		return false;
+	Reset();
+	auto play = [this, &sink](const EmfRecordSpan& record) {
+		PlayRecord(record, sink);
+		return true;
+	};
+	// EMZ is inflated while it is played.
+	bool result = compressed ? StreamEmzRecords(data, size, play) : ForEachRecord(data, size, play);
+	FlushLines(sink);
+	sink.End();
+	return result;
+}
+
+void EmfPlayer::FlushLines(EmfSink& sink)
+{
+	if (m_lines.Empty())
+		return;
+	if ((m_dc.pen.style & g_psStyleMask) != g_psNull)
+		sink.DrawPath(m_lines, m_dc, true, false);
+	m_lines.Clear();
+}
+
+EmfPath& EmfPlayer::Target()
+{
+	if (m_inPath)
+		return m_path;
+	m_scratch.Clear();
+	return m_scratch;
+}
+
+void EmfPlayer::Draw(EmfSink& sink, bool stroke, bool fill)
+{
+	if (m_inPath || m_scratch.Empty())
+		return;
+	stroke = stroke && (m_dc.pen.style & g_psStyleMask) != g_psNull;
+	fill = fill && m_dc.brush.style != g_bsNull;
+	if (stroke || fill)
+		sink.DrawPath(m_scratch, m_dc, stroke, fill);
+}
+
+void EmfPlayer::FillRect(EmfSink& sink, double left, double top, double right, double bottom, uint32_t color)
+{
+	m_scratch.Clear();
+	m_scratch.MoveTo(ToDevice(left, top));
+	m_scratch.LineTo(ToDevice(right, top));
+	m_scratch.LineTo(ToDevice(right, bottom));
+	m_scratch.LineTo(ToDevice(left, bottom));
+	m_scratch.Close();
+	EmfDeviceContext dc = m_dc;
+	dc.brush = { g_bsSolid, color, 0 };
+	sink.DrawPath(m_scratch, dc, false, true);
+}
+
+static bool OpenFigure(const EmfPath& path)
+{
+	return !path.Empty() && path.verbs.back() != PathVerb::Close;
+}
+
+template<typename PointType>
+void EmfPlayer::Poly(const EmfRecordSpan& record, EmfSink& sink, bool closed, bool bezier, bool fromCurrent)
+{
+	// rclBounds, count, points
+	if (!Has(record, 28))
+		return;
+	uint32_t count = ReadU32(record.data + 24);
+	if (!HasRange(record, 28, (uint64_t)count * PointType::size) || count == 0)
+		return;
+	const uint8_t* p = record.data + 28;
+	EmfPath& path = Target();
+	uint32_t i = 0;
+	if (fromCurrent)
+	{
+		if (!OpenFigure(path))
+			path.MoveTo(m_dc.currentPosition);
+	}
+	else
+	{
+		EmfPointL pt = PointType::Read(p);
+		path.MoveTo(ToDevice(pt.x, pt.y));
+		i = 1;
+	}
+	if (bezier)
+	{
+		for (; i + 3 <= count; i += 3)
+		{
+			EmfPointL p1 = PointType::Read(p + i * PointType::size);
+			EmfPointL p2 = PointType::Read(p + (i + 1) * PointType::size);
+			EmfPointL p3 = PointType::Read(p + (i + 2) * PointType::size);
+			path.BezierTo(ToDevice(p1.x, p1.y), ToDevice(p2.x, p2.y), ToDevice(p3.x, p3.y));
+		}
+	}
+	else
+	{
+		for (; i < count; ++i)
+		{
+			EmfPointL pt = PointType::Read(p + i * PointType::size);
+			path.LineTo(ToDevice(pt.x, pt.y));
+		}
+	}
+	if (closed)
+		path.Close();
+	if (fromCurrent)
+		m_dc.currentPosition = path.points.back();
+	Draw(sink, true, closed);
+}
+
+template<typename PointType>
+void EmfPlayer::PolyPoly(const EmfRecordSpan& record, EmfSink& sink, bool closed)
+{
+	// rclBounds, nPolys, total points, counts, points
+	if (!Has(record, 32))
+		return;
+	uint32_t polyCount = ReadU32(record.data + 24);
+	uint32_t total = ReadU32(record.data + 28);
+	uint64_t pointsOffset = 32 + (uint64_t)polyCount * 4;
+	if (!HasRange(record, 32, (uint64_t)polyCount * 4) || !HasRange(record, pointsOffset, (uint64_t)total * PointType::size))
+		return;
+	const uint8_t* counts = record.data + 32;
+	const uint8_t* p = record.data + pointsOffset;
+	EmfPath& path = Target();
+	uint64_t used = 0;
+	for (uint32_t poly = 0; poly < polyCount; ++poly)
+	{
+		uint32_t count = ReadU32(counts + poly * 4);
+		if (count > total - used)
+			break;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			EmfPointL pt = PointType::Read(p + (used + i) * PointType::size);
+			if (i == 0)
+				path.MoveTo(ToDevice(pt.x, pt.y));
+			else
+				path.LineTo(ToDevice(pt.x, pt.y));
+		}
+		if (closed && count > 0)
+			path.Close();
+		used += count;
+	}
+	Draw(sink, true, closed);
+}
+
+template<typename PointType>
+void EmfPlayer::PolyDraw(const EmfRecordSpan& record, EmfSink& sink)
+{
+	// rclBounds, count, points, point types
+	if (!Has(record, 28))
+		return;
+	uint32_t count = ReadU32(record.data + 24);
+	if (!HasRange(record, 28, (uint64_t)count * (PointType::size + 1)))
+		return;
+	const uint8_t* p = record.data + 28;
+	const uint8_t* types = p + (size_t)count * PointType::size;
+	EmfPath& path = Target();
+	if (!OpenFigure(path))
+		path.MoveTo(m_dc.currentPosition);
+	EmfPointF figureStart = m_dc.currentPosition;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		EmfPointL pt = PointType::Read(p + i * PointType::size);
+		uint8_t type = types[i];
+		switch (type & ~g_ptCloseFigure)
+		{
+		case g_ptMoveTo:
+			figureStart = ToDevice(pt.x, pt.y);
+			path.MoveTo(figureStart);
+			break;
+		case g_ptLineTo:
+			path.LineTo(ToDevice(pt.x, pt.y));
+			break;
+		case g_ptBezierTo:
+			if (i + 2 < count)
+			{
+				EmfPointL p2 = PointType::Read(p + (i + 1) * PointType::size);
+				EmfPointL p3 = PointType::Read(p + (i + 2) * PointType::size);
+				path.BezierTo(ToDevice(pt.x, pt.y), ToDevice(p2.x, p2.y), ToDevice(p3.x, p3.y));
+				i += 2;
+				type = types[i];
+			}
+			break;
+		}
+		if (type & g_ptCloseFigure)
+		{
+			path.Close();
+			path.MoveTo(figureStart);
+		}
+	}
+	m_dc.currentPosition = path.points.back();
+	Draw(sink, true, false);
+}
+
+void EmfPlayer::AddArc(EmfPath& path, double left, double top, double right, double bottom, double startAngle, double sweep, bool moveToStart)
+{
+	// The ellipse is (cx + rx * cos(t), cy + ry * sin(t)) in logical units,
+	// cut into pieces of at most 90 degrees, each one a cubic bezier.
+	double cx = (left + right) / 2, cy = (top + bottom) / 2;
+	double rx = (right - left) / 2, ry = (bottom - top) / 2;
+	int pieces = std::max(1, (int)std::ceil(std::fabs(sweep) / (g_pi / 2) - 1e-9));
+	double step = sweep / pieces;
+	double k = 4.0 / 3.0 * std::tan(step / 4);
+	double t = startAngle;
+	double cosT = std::cos(t), sinT = std::sin(t);
+	EmfPointF start = ToDevice(cx + rx * cosT, cy + ry * sinT);
+	if (moveToStart || !OpenFigure(path))
+		path.MoveTo(start);
+	else
+		path.LineTo(start);
+	for (int i = 0; i < pieces; ++i)
+	{
+		double t2 = startAngle + step * (i + 1);
+		double cos2 = std::cos(t2), sin2 = std::sin(t2);
+		path.BezierTo(
+			ToDevice(cx + rx * (cosT - k * sinT), cy + ry * (sinT + k * cosT)),
+			ToDevice(cx + rx * (cos2 + k * sin2), cy + ry * (sin2 - k * cos2)),
+			ToDevice(cx + rx * cos2, cy + ry * sin2));
+		cosT = cos2;
+		sinT = sin2;
+	}
+}
+
+void EmfPlayer::ArcRecord(const EmfRecordSpan& record, EmfSink& sink)
+{
+	// rclBox, ptlStart, ptlEnd
+	if (!Has(record, 40))
+		return;
+	const uint8_t* p = record.data + 8;
+	double left = ReadI32(p), top = ReadI32(p + 4), right = ReadI32(p + 8), bottom = ReadI32(p + 12);
+	double cx = (left + right) / 2, cy = (top + bottom) / 2;
+	double rx = std::max(std::fabs(right - left) / 2, 1e-9), ry = std::max(std::fabs(bottom - top) / 2, 1e-9);
+	double start = std::atan2((ReadI32(p + 20) - cy) / ry, (ReadI32(p + 16) - cx) / rx);
+	double end = std::atan2((ReadI32(p + 28) - cy) / ry, (ReadI32(p + 24) - cx) / rx);
+	// Counterclockwise on a y down device is a decreasing angle.
+	double sweep = end - start;
+	if (m_dc.arcDirection == g_adCounterClockwise)
+	{
+		while (sweep >= 0)
+			sweep -= 2 * g_pi;
+	}
+	else
+	{
+		while (sweep <= 0)
+			sweep += 2 * g_pi;
+	}
+
+	EmfPath& path = Target();
+	auto type = (EmrType)record.type;
+	if (type == EmrType::ArcTo && !OpenFigure(path))
+		path.MoveTo(m_dc.currentPosition);
+	bool moveToStart = type != EmrType::ArcTo;
+	if (type == EmrType::Pie)
+	{
+		path.MoveTo(ToDevice(cx, cy));
+		moveToStart = false;
+	}
+	AddArc(path, left, top, right, bottom, start, sweep, moveToStart);
+	if (type == EmrType::ArcTo)
+		m_dc.currentPosition = path.points.back();
+	bool closed = type == EmrType::Chord || type == EmrType::Pie;
+	if (closed)
+		path.Close();
+	Draw(sink, true, closed);
+}
+
+void EmfPlayer::AngleArc(const EmfRecordSpan& record, EmfSink& sink)
+{
+	// ptlCenter, nRadius, eStartAngle, eSweepAngle in degrees, counterclockwise
+	if (!Has(record, 28))
+		return;
+	double cx = ReadI32(record.data + 8), cy = ReadI32(record.data + 12);
+	double r = ReadU32(record.data + 16);
+	double start = -ReadF32(record.data + 20) * g_pi / 180;
+	double sweep = -ReadF32(record.data + 24) * g_pi / 180;
+	EmfPath& path = Target();
+	if (!OpenFigure(path))
+		path.MoveTo(m_dc.currentPosition);
+	AddArc(path, cx - r, cy - r, cx + r, cy + r, start, sweep, false);
+	m_dc.currentPosition = path.points.back();
+	Draw(sink, true, false);
+}
+
+void EmfPlayer::Box(const EmfRecordSpan& record, EmfSink& sink)
+{
+	// rclBox, szlCorner for RoundRect
+	if (!Has(record, 24))
+		return;
+	const uint8_t* p = record.data + 8;
+	double left = ReadI32(p), top = ReadI32(p + 4), right = ReadI32(p + 8), bottom = ReadI32(p + 12);
+	EmfPath& path = Target();
+	switch ((EmrType)record.type)
+	{
+	case EmrType::Ellipse:
+		AddArc(path, left, top, right, bottom, 0, 2 * g_pi, true);
+		break;
+	case EmrType::RoundRect:
+		if (Has(record, 32))
+		{
+			double w = std::min<double>(std::abs(ReadI32(p + 16)), std::fabs(right - left));
+			double h = std::min<double>(std::abs(ReadI32(p + 20)), std::fabs(bottom - top));
+			AddArc(path, right - w, top, right, top + h, -g_pi / 2, g_pi / 2, true);
+			AddArc(path, right - w, bottom - h, right, bottom, 0, g_pi / 2, false);
+			AddArc(path, left, bottom - h, left + w, bottom, g_pi / 2, g_pi / 2, false);
+			AddArc(path, left, top, left + w, top + h, g_pi, g_pi / 2, false);
+			break;
+		}
+		// Fall through
+	default:
+		path.MoveTo(ToDevice(left, top));
+		path.LineTo(ToDevice(right, top));
+		path.LineTo(ToDevice(right, bottom));
+		path.LineTo(ToDevice(left, bottom));
+		break;
+	}
+	path.Close();
+	Draw(sink, true, true);
+}
+
+void EmfPlayer::TextOut(const EmfRecordSpan& record, EmfSink& sink, bool wide)
+{
+	// rclBounds, iGraphicsMode, exScale, eyScale, EMRTEXT
+	if (!Has(record, 76))
+		return;
+	const uint8_t* p = record.data;
+	EmfTextRun& run = m_run;
+	double x = ReadI32(p + 36), y = ReadI32(p + 40);
+	uint32_t count = ReadU32(p + 44);
+	uint32_t offString = ReadU32(p + 48);
+	run.options = ReadU32(p + 52);
+	uint32_t offDx = ReadU32(p + 72);
+	if (!HasRange(record, offString, (uint64_t)count * (wide ? 2 : 1)))
+		return;
+	run.text.resize(count);
+	run.advances.clear();
+	if (wide)
+		memcpy(&run.text[0], p + offString, count * 2);
+	else
+	{
+		for (uint32_t i = 0; i < count; ++i)
+			run.text[i] = p[offString + i];
+	}
+
+	double scale = m_dc.toDevice.Scale();
+	uint32_t dxStride = (run.options & g_etoPdy) ? 8 : 4;
+	if (offDx != 0 && HasRange(record, offDx, (uint64_t)count * dxStride))
+	{
+		run.advances.resize(count);
+		for (uint32_t i = 0; i < count; ++i)
+			run.advances[i] = (float)(ReadI32(p + offDx + i * dxStride) * scale);
+	}
+	run.fontHeight = (float)(std::abs(m_dc.font.height ? m_dc.font.height : 16) * scale);
+	double left = ReadI32(p + 56), top = ReadI32(p + 60), right = ReadI32(p + 64), bottom = ReadI32(p + 68);
+	run.opaque[0] = ToDevice(left, top);
+	run.opaque[1] = ToDevice(right, top);
+	run.opaque[2] = ToDevice(right, bottom);
+	run.opaque[3] = ToDevice(left, bottom);
+
+	if (m_dc.textAlign & g_taUpdateCP)
+	{
+		run.origin = m_dc.currentPosition;
+		float advance = 0;
+		for (float a : run.advances)
+			advance += a;
+		m_dc.currentPosition.x += advance;
+	}
+	else
+		run.origin = ToDevice(x, y);
+	sink.DrawText(run, m_dc);
+}
+
+void EmfPlayer::Bitmap(const EmfRecordSpan& record, EmfSink& sink)
+{
+	EmfImage image = {};
+	image.type = (EmrType)record.type;
+	const uint8_t* p = record.data;
+	double x, y, width, height;
+	uint32_t offBmi, offBits;
+	switch (image.type)
+	{
+	case EmrType::StretchDIBits:
+	case EmrType::SetDIBitsToDevice:
+		if (!Has(record, 76))
+			return;
+		x = ReadI32(p + 24);
+		y = ReadI32(p + 28);
+		image.srcX = ReadI32(p + 32);
+		image.srcY = ReadI32(p + 36);
+		image.srcWidth = ReadI32(p + 40);
+		image.srcHeight = ReadI32(p + 44);
+		offBmi = ReadU32(p + 48);
+		image.bmiSize = ReadU32(p + 52);
+		offBits = ReadU32(p + 56);
+		image.bitsSize = ReadU32(p + 60);
+		image.usage = ReadU32(p + 64);
+		if (image.type == EmrType::StretchDIBits)
+		{
+			if (!Has(record, 80))
+				return;
+			image.rop = ReadU32(p + 68);
+			width = ReadI32(p + 72);
+			height = ReadI32(p + 76);
+		}
+		else
+		{
+			image.rop = 0x00CC0020; // SRCCOPY
+			width = image.srcWidth;
+			height = image.srcHeight;
+		}
+		break;
+	default:
+		// BitBlt, StretchBlt, AlphaBlend, TransparentBlt
+		if (!Has(record, 100))
+			return;
+		x = ReadI32(p + 24);
+		y = ReadI32(p + 28);
+		width = ReadI32(p + 32);
+		height = ReadI32(p + 36);
+		image.rop = ReadU32(p + 40);
+		image.srcX = ReadI32(p + 44);
+		image.srcY = ReadI32(p + 48);
+		image.usage = ReadU32(p + 80);
+		offBmi = ReadU32(p + 84);
+		image.bmiSize = ReadU32(p + 88);
+		offBits = ReadU32(p + 92);
+		image.bitsSize = ReadU32(p + 96);
+		image.srcWidth = (int32_t)width;
+		image.srcHeight = (int32_t)height;
+		if (image.type != EmrType::BitBlt && Has(record, 108))
+		{
+			image.srcWidth = ReadI32(p + 100);
+			image.srcHeight = ReadI32(p + 104);
+		}
+		break;
+	}
+
+	if (image.bmiSize == 0)
+	{
+		// No source bitmap, BitBlt used as PatBlt.
+		if (image.rop == g_ropPatCopy && m_dc.brush.style != g_bsNull)
+			FillRect(sink, x, y, x + width, y + height, m_dc.brush.color);
+		else if (image.rop == g_ropBlackness)
+			FillRect(sink, x, y, x + width, y + height, 0);
+		else if (image.rop == g_ropWhiteness)
+			FillRect(sink, x, y, x + width, y + height, 0xFFFFFF);
+		return;
+	}
+	// BITMAPINFOHEADER is at least 40 bytes, BITMAPCOREHEADER isn't used in EMF.
+	if (image.bmiSize < 40 || !HasRange(record, offBmi, image.bmiSize) || !HasRange(record, offBits, image.bitsSize))
+		return;
+	image.bmi = p + offBmi;
+	image.bits = p + offBits;
+	// The DIB functions count source rows from the bottom of a bottom-up DIB.
+	int32_t bitmapHeight = ReadI32(image.bmi + 8);
+	if ((image.type == EmrType::StretchDIBits || image.type == EmrType::SetDIBitsToDevice) && bitmapHeight > 0)
+		image.srcY = bitmapHeight - image.srcY - image.srcHeight;
+	image.placement = EmfMatrix{ width, 0, 0, height, x, y }.Then(m_dc.toDevice);
+	sink.DrawImage(image, m_dc);
+}
+
+void EmfPlayer::Gradient(const EmfRecordSpan& record, EmfSink& sink)
+{
+	// rclBounds, nVer, nTri, ulMode, then TRIVERTEXes and GRADIENT_RECTs or GRADIENT_TRIANGLEs.
+	const uint8_t* p = record.data;
+	if (!Has(record, 36))
+		return;
+	uint32_t vertexCount = ReadU32(p + 24);
+	uint32_t count = ReadU32(p + 28);
+	uint32_t mode = ReadU32(p + 32);
+	uint32_t corners = mode == g_gradientFillTriangle ? 3 : 2;
+	if (mode > g_gradientFillTriangle || !HasRange(record, 36, (uint64_t)vertexCount * 16)
+		|| !HasRange(record, 36 + (uint64_t)vertexCount * 16, (uint64_t)count * corners * 4))
+		return;
+
+	EmfGradient& gradient = m_gradient;
+	gradient.vertices.clear();
+	gradient.triangles.clear();
+	gradient.vertices.reserve(vertexCount);
+	for (uint32_t i = 0; i < vertexCount; ++i)
+	{
+		const uint8_t* v = p + 36 + 16 * i;
+		gradient.vertices.push_back({ ToDevice(ReadI32(v), ReadI32(v + 4)), ReadU16(v + 8), ReadU16(v + 10), ReadU16(v + 12), ReadU16(v + 14) });
+	}
+	const uint8_t* indices = p + 36 + 16 * (size_t)vertexCount;
+	for (uint32_t i = 0; i < count; ++i, indices += 4 * corners)
+	{
+		uint32_t a = ReadU32(indices), b = ReadU32(indices + 4);
+		if (a >= vertexCount || b >= vertexCount)
+			continue;
+		if (mode == g_gradientFillTriangle)
+		{
+			uint32_t c = ReadU32(indices + 8);
+			if (c >= vertexCount)
+				continue;
+			gradient.triangles.insert(gradient.triangles.end(), { a, b, c });
+			continue;
+		}
+		// Upper left and lower right corners; the other two take the color
+		// of the same side, left and right for RECT_H, top and bottom for RECT_V.
+		const uint8_t* upperLeft = p + 36 + 16 * a;
+		const uint8_t* lowerRight = p + 36 + 16 * b;
+		EmfGradientVertex upperRight = gradient.vertices[mode == g_gradientFillRectH ? b : a];
+		EmfGradientVertex lowerLeft = gradient.vertices[mode == g_gradientFillRectH ? a : b];
+		upperRight.point = ToDevice(ReadI32(lowerRight), ReadI32(upperLeft + 4));
+		lowerLeft.point = ToDevice(ReadI32(upperLeft), ReadI32(lowerRight + 4));
+		uint32_t first = (uint32_t)gradient.vertices.size();
+		gradient.vertices.push_back(upperRight);
+		gradient.vertices.push_back(lowerLeft);
+		gradient.triangles.insert(gradient.triangles.end(), { a, first, b, a, b, first + 1 });
+	}
+	if (!gradient.triangles.empty())
+		sink.FillGradient(gradient, m_dc);
+}
+
+// Clipping to everything, for the modes which need a region when there is no clip.
+static const EmfRectL g_everywhere = { -(1 << 30), -(1 << 30), 1 << 30, 1 << 30 };
+
+void EmfPlayer::RegionRecord(const EmfRecordSpan& record, EmfSink& sink)
+{
+	auto type = (EmrType)record.type;
+	const uint8_t* p = record.data;
+	// rclBounds, cbRgnData, then ihBrush and szlStroke for some, then RgnData.
+	size_t offset = type == EmrType::FillRgn ? 32 : type == EmrType::FrameRgn ? 40 : 28;
+	if (!Has(record, offset))
+		return;
+	uint32_t size = ReadU32(p + 24);
+	EmfRegion region;
+	if (!HasRange(record, offset, size) || !region.Decode(p + offset, size) || region.Empty())
+		return;
+	EmfBrush brush = m_dc.brush;
+	if (type != EmrType::PaintRgn && !Brush(ReadU32(p + 28), brush))
+		return;
+	if (type == EmrType::FrameRgn)
+		region = EmfRegion::Frame(region, ReadI32(p + 32), ReadI32(p + 36));
+	FillRegion(sink, region, brush);
+}
+
+void EmfPlayer::FillRegion(EmfSink& sink, const EmfRegion& region, const EmfBrush& brush)
+{
+	if (brush.style == g_bsNull)
+		return;
+	m_scratch.Clear();
+	region.ForEachRect([this](double left, double top, double right, double bottom) {
+		m_scratch.MoveTo(ToDevice(left, top));
+		m_scratch.LineTo(ToDevice(right, top));
+		m_scratch.LineTo(ToDevice(right, bottom));
+		m_scratch.LineTo(ToDevice(left, bottom));
+		m_scratch.Close();
+	});
+	// The rectangles don't overlap, the fill mode doesn't matter.
+	EmfDeviceContext dc = m_dc;
+	dc.brush = brush;
+	sink.DrawPath(m_scratch, dc, false, true);
+}
+
+// Clip regions and their counts are in the current arena too.
+static std::shared_ptr<const EmfRegion> ShareRegion(EmfRegion&& region)
+{
+	return std::allocate_shared<EmfRegion>(ArenaAllocator<EmfRegion>(), std::move(region));
+}
+
+void EmfPlayer::Clip(const EmfRegion& region, RegionMode mode)
+{
+	if (mode == RegionMode::Copy)
+	{
+		m_dc.clip = ShareRegion(EmfRegion(region));
+		return;
+	}
+	if (!m_dc.clip)
+	{
+		// No clip is the same as clipping to everything.
+		if (mode == RegionMode::Or)
+			return;
+		EmfRegion everywhere(g_everywhere);
+		m_dc.clip = ShareRegion(EmfRegion::Combine(everywhere, region, mode));
+		return;
+	}
+	m_dc.clip = ShareRegion(EmfRegion::Combine(*m_dc.clip, region, mode));
+}
+
+EmfRectL EmfPlayer::DeviceRect(const EmfRectL& rect) const
+{
+	EmfPointF corners[] = { ToDevice(rect.left, rect.top), ToDevice(rect.right, rect.top),
+		ToDevice(rect.right, rect.bottom), ToDevice(rect.left, rect.bottom) };
+	float left = corners[0].x, top = corners[0].y, right = left, bottom = top;
+	for (const EmfPointF& corner : corners)
+	{
+		left = std::min(left, corner.x);
+		top = std::min(top, corner.y);
+		right = std::max(right, corner.x);
+		bottom = std::max(bottom, corner.y);
+	}
+	auto pixel = [](double v) {
+		return (int32_t)std::max(-1e9, std::min(1e9, std::floor(v + 0.5)));
+	};
+	return EmfRectL{ pixel(left), pixel(top), pixel(right), pixel(bottom) };
+}
+
+bool EmfPlayer::Brush(uint32_t index, EmfBrush& brush) const
+{
+	if (index & g_stockObject)
+		return StockBrush(index & ~g_stockObject, brush);
+	if (index >= m_objects.size() || m_objects[index].kind != ObjectKind::Brush)
+		return false;
+	brush = m_objects[index].brush;
+	return true;
+}
+
+void EmfPlayer::CreateObject(uint32_t index, const GdiObject& object)
+{
+	// Handle 0 is the metafile itself.
+	if (index == 0 || index >= 0x10000)
+		return;
+	if (index >= m_objects.size())
+		m_objects.resize(index + 1, GdiObject());
+	m_objects[index] = object;
+}
+
+void EmfPlayer::SelectObject(uint32_t index)
+{
+	if (index & g_stockObject)
+	{
+		uint32_t stock = index & ~g_stockObject;
+		EmfBrush brush;
+		if (StockBrush(stock, brush))
+			m_dc.brush = brush;
+		else if ((stock >= 6 && stock <= 8) || stock == 19)
+			m_dc.pen = StockPen(stock);
+		else if (stock >= 10 && stock <= 17 && stock != 15)
+			m_dc.font = DefaultFont();
+		return;
+	}
+	if (index >= m_objects.size())
+		return;
+	const GdiObject& object = m_objects[index];
+	switch (object.kind)
+	{
+	case ObjectKind::Pen:
+		m_dc.pen = object.pen;
+		break;
+	case ObjectKind::Brush:
+		m_dc.brush = object.brush;
+		break;
+	case ObjectKind::Font:
+		m_dc.font = object.font;
+		break;
+	default:
+		break;
+	}
+}
+
+void EmfPlayer::PlayRecord(const EmfRecordSpan& record, EmfSink& sink)
+{
+	sink.Record(record);
+	auto type = (EmrType)record.type;
+	if (type != EmrType::LineTo && type != EmrType::MoveToEx)
+		FlushLines(sink);
+	const uint8_t* p = record.data;
+
+	switch (type)
+	{
+	case EmrType::Header:
+		if (Has(record, 88))
+		{
+			memcpy(&m_header.bounds, p + 8, sizeof(EmfRectL));
+			memcpy(&m_header.frame, p + 24, sizeof(EmfRectL));
+			m_header.recordCount = ReadU32(p + 52);
+			m_header.device = { ReadI32(p + 72), ReadI32(p + 76) };
+			m_header.millimeters = { ReadI32(p + 80), ReadI32(p + 84) };
+			sink.Begin(m_header);
+		}
+		break;
+
+	case EmrType::PolyBezier:
+		Poly<PointL>(record, sink, false, true, false);
+		break;
+	case EmrType::Polygon:
+		Poly<PointL>(record, sink, true, false, false);
+		break;
+	case EmrType::Polyline:
+		Poly<PointL>(record, sink, false, false, false);
+		break;
+	case EmrType::PolyBezierTo:
+		Poly<PointL>(record, sink, false, true, true);
+		break;
+	case EmrType::PolyLineTo:
+		Poly<PointL>(record, sink, false, false, true);
+		break;
+	case EmrType::PolyBezier16:
+		Poly<PointS>(record, sink, false, true, false);
+		break;
+	case EmrType::Polygon16:
+		Poly<PointS>(record, sink, true, false, false);
+		break;
+	case EmrType::Polyline16:
+		Poly<PointS>(record, sink, false, false, false);
+		break;
+	case EmrType::PolyBezierTo16:
+		Poly<PointS>(record, sink, false, true, true);
+		break;
+	case EmrType::PolylineTo16:
+		Poly<PointS>(record, sink, false, false, true);
+		break;
+	case EmrType::PolyPolyline:
+		PolyPoly<PointL>(record, sink, false);
+		break;
+	case EmrType::PolyPolygon:
+		PolyPoly<PointL>(record, sink, true);
+		break;
+	case EmrType::PolyPolyline16:
+		PolyPoly<PointS>(record, sink, false);
+		break;
+	case EmrType::PolyPolygon16:
+		PolyPoly<PointS>(record, sink, true);
+		break;
+	case EmrType::PolyDraw:
+		PolyDraw<PointL>(record, sink);
+		break;
+	case EmrType::PolyDraw16:
+		PolyDraw<PointS>(record, sink);
+		break;
+
+	case EmrType::MoveToEx:
+		if (Has(record, 16))
+		{
+			m_dc.currentPosition = ToDevice(ReadI32(p + 8), ReadI32(p + 12));
+			if (m_inPath)
+				m_path.MoveTo(m_dc.currentPosition);
+			else if (!m_lines.Empty())
+				m_lines.MoveTo(m_dc.currentPosition);
+		}
+		break;
+	case EmrType::LineTo:
+		if (Has(record, 16))
+		{
+			EmfPath& path = m_inPath ? m_path : m_lines;
+			if (!OpenFigure(path))
+				path.MoveTo(m_dc.currentPosition);
+			m_dc.currentPosition = ToDevice(ReadI32(p + 8), ReadI32(p + 12));
+			path.LineTo(m_dc.currentPosition);
+		}
+		break;
+	case EmrType::Arc:
+	case EmrType::ArcTo:
+	case EmrType::Chord:
+	case EmrType::Pie:
+		ArcRecord(record, sink);
+		break;
+	case EmrType::AngleArc:
+		AngleArc(record, sink);
+		break;
+	case EmrType::Ellipse:
+	case EmrType::Rectangle:
+	case EmrType::RoundRect:
+		Box(record, sink);
+		break;
+	case EmrType::SetPixelV:
+		if (Has(record, 20))
+		{
+			double x = ReadI32(p + 8), y = ReadI32(p + 12);
+			FillRect(sink, x, y, x + 1, y + 1, ReadU32(p + 16));
+		}
+		break;
+
+	case EmrType::FillRgn:
+	case EmrType::FrameRgn:
+	case EmrType::PaintRgn:
+		RegionRecord(record, sink);
+		break;
+	case EmrType::ExtSelectClipRgn:
+		if (Has(record, 16))
+		{
+			uint32_t size = ReadU32(p + 8);
+			auto mode = (RegionMode)ReadU32(p + 12);
+			EmfRegion region;
+			if (mode == RegionMode::Copy && size == 0)
+				m_dc.clip.reset();
+			else if (mode >= RegionMode::And && mode <= RegionMode::Copy && HasRange(record, 16, size) && region.Decode(p + 16, size))
+				Clip(region, mode);
+		}
+		break;
+	case EmrType::IntersectClipRect:
+	case EmrType::ExcludeClipRect:
+		if (Has(record, 24))
+		{
+			EmfRectL rect = { ReadI32(p + 8), ReadI32(p + 12), ReadI32(p + 16), ReadI32(p + 20) };
+			Clip(EmfRegion(DeviceRect(rect)), type == EmrType::IntersectClipRect ? RegionMode::And : RegionMode::Diff);
+		}
+		break;
+	case EmrType::OffsetClipRgn:
+		if (Has(record, 16) && m_dc.clip)
+		{
+			// A logical offset, in device pixels.
+			const EmfMatrix& m = m_dc.toDevice;
+			double x = ReadI32(p + 8), y = ReadI32(p + 12);
+			EmfRegion region = *m_dc.clip;
+			region.Offset((int32_t)std::lround(m.a * x + m.c * y), (int32_t)std::lround(m.b * x + m.d * y));
+			m_dc.clip = ShareRegion(std::move(region));
+		}
+		break;
+
+	case EmrType::BeginPath:
+		m_inPath = true;
+		m_path.Clear();
+		break;
+	case EmrType::EndPath:
+		m_inPath = false;
+		break;
+	case EmrType::AbortPath:
+		m_inPath = false;
+		m_path.Clear();
+		break;
+	case EmrType::CloseFigure:
+		if (OpenFigure(m_path))
+			m_path.Close();
+		break;
+	case EmrType::FlattenPath:
+		{
+			// Rare enough to make the flattener here.
+			PathFlattener flattener;
+			flattener.Flatten(m_path, m_scratch);
+			std::swap(m_path, m_scratch);
+		}
+		break;
+	case EmrType::FillPath:
+	case EmrType::StrokePath:
+	case EmrType::StrokeAndFillPath:
+		{
+			bool stroke = type != EmrType::FillPath && (m_dc.pen.style & g_psStyleMask) != g_psNull;
+			bool fill = type != EmrType::StrokePath && m_dc.brush.style != g_bsNull;
+			if (!m_path.Empty() && (stroke || fill))
+				sink.DrawPath(m_path, m_dc, stroke, fill);
+			m_path.Clear();
+		}
+		break;
+
+	case EmrType::ExtTextOutW:
+		TextOut(record, sink, true);
+		break;
+	case EmrType::ExtTextOutA:
+		TextOut(record, sink, false);
+		break;
+	case EmrType::BitBlt:
+	case EmrType::StretchBlt:
+	case EmrType::StretchDIBits:
+	case EmrType::SetDIBitsToDevice:
+	case EmrType::AlphaBlend:
+	case EmrType::TransparentBlt:
+		Bitmap(record, sink);
+		break;
+	case EmrType::GradientFill:
+		Gradient(record, sink);
+		break;
+
+	case EmrType::CreatePen:
+		if (Has(record, 28))
+		{
+			GdiObject object = {};
+			object.kind = ObjectKind::Pen;
+			object.pen = { ReadU32(p + 12), ReadU32(p + 16), ReadU32(p + 24) };
+			CreateObject(ReadU32(p + 8), object);
+		}
+		break;
+	case EmrType::ExtCreatePen:
+		if (Has(record, 52))
+		{
+			GdiObject object = {};
+			object.kind = ObjectKind::Pen;
+			object.pen = { ReadU32(p + 28), ReadU32(p + 32), ReadU32(p + 40) };
+			CreateObject(ReadU32(p + 8), object);
+		}
+		break;
+	case EmrType::CreateBrushIndirect:
+		if (Has(record, 24))
+		{
+			GdiObject object = {};
+			object.kind = ObjectKind::Brush;
+			object.brush = { ReadU32(p + 12), ReadU32(p + 16), ReadU32(p + 20) };
+			CreateObject(ReadU32(p + 8), object);
+		}
+		break;
+	case EmrType::CreateMonoBrush:
+	case EmrType::CreateDIBPatternBrushPt:
+		if (Has(record, 12))
+		{
+			// Patterns are approximated by a gray fill.
+			GdiObject object = {};
+			object.kind = ObjectKind::Brush;
+			object.brush = { g_bsSolid, 0x808080, 0 };
+			CreateObject(ReadU32(p + 8), object);
+		}
+		break;
+	case EmrType::ExtCreateFontIndirectW:
+		if (Has(record, 104))
+		{
+			GdiObject object = {};
+			object.kind = ObjectKind::Font;
+			memcpy(&object.font, p + 12, 28);
+			memcpy(object.font.faceName, p + 40, sizeof(object.font.faceName));
+			object.font.faceName[31] = 0;
+			CreateObject(ReadU32(p + 8), object);
+		}
+		break;
+	case EmrType::CreatePalette:
+	case EmrType::CreateColorSpace:
+	case EmrType::CreateColorSpaceW:
+		if (Has(record, 12))
+		{
+			GdiObject object = {};
+			object.kind = ObjectKind::Other;
+			CreateObject(ReadU32(p + 8), object);
+		}
+		break;
+	case EmrType::SelectObject:
+		if (Has(record, 12))
+			SelectObject(ReadU32(p + 8));
+		break;
+	case EmrType::DeleteObject:
+		if (Has(record, 12) && ReadU32(p + 8) < m_objects.size())
+			m_objects[ReadU32(p + 8)].kind = ObjectKind::None;
+		break;
+
+	case EmrType::SetTextColor:
+		if (Has(record, 12))
+			m_dc.textColor = ReadU32(p + 8);
+		break;
+	case EmrType::SetBkColor:
+		if (Has(record, 12))
+			m_dc.bkColor = ReadU32(p + 8);
+		break;
+	case EmrType::SetBkMode:
+		if (Has(record, 12))
+			m_dc.bkMode = ReadU32(p + 8);
+		break;
+	case EmrType::SetTextAlign:
+		if (Has(record, 12))
+			m_dc.textAlign = ReadU32(p + 8);
+		break;
+	case EmrType::SetPolyFillMode:
+		if (Has(record, 12))
+			m_dc.polyFillMode = ReadU32(p + 8);
+		break;
+	case EmrType::SetArcDirection:
+		if (Has(record, 12))
+			m_dc.arcDirection = ReadU32(p + 8);
+		break;
+	case EmrType::SetStretchBltMode:
+		if (Has(record, 12))
+			m_dc.stretchBltMode = ReadU32(p + 8);
+		break;
+	case EmrType::SetROP2:
+		if (Has(record, 12))
+			m_dc.rop2 = ReadU32(p + 8);
+		break;
+	case EmrType::SetMiterLimit:
+		if (Has(record, 12))
+			m_dc.miterLimit = (float)ReadU32(p + 8);
+		break;
+
+	case EmrType::SetMapMode:
+		if (Has(record, 12))
+		{
+			m_dc.mapMode = ReadU32(p + 8);
+			UpdateTransform();
+		}
+		break;
+	case EmrType::SetWindowExtEx:
+	case EmrType::SetWindowOrgEx:
+	case EmrType::SetViewportExtEx:
+	case EmrType::SetViewportOrgEx:
+		if (Has(record, 16))
+		{
+			EmfPointL value = { ReadI32(p + 8), ReadI32(p + 12) };
+			if (type == EmrType::SetWindowExtEx)
+				m_dc.windowExt = value;
+			else if (type == EmrType::SetWindowOrgEx)
+				m_dc.windowOrg = value;
+			else if (type == EmrType::SetViewportExtEx)
+				m_dc.viewportExt = value;
+			else
+				m_dc.viewportOrg = value;
+			UpdateTransform();
+		}
+		break;
+	case EmrType::ScaleWindowExtEx:
+	case EmrType::ScaleViewportExtEx:
+		if (Has(record, 24))
+		{
+			EmfPointL& ext = type == EmrType::ScaleWindowExtEx ? m_dc.windowExt : m_dc.viewportExt;
+			int32_t xDenom = ReadI32(p + 12), yDenom = ReadI32(p + 20);
+			if (xDenom != 0 && yDenom != 0)
+			{
+				ext.x = (int32_t)((int64_t)ext.x * ReadI32(p + 8) / xDenom);
+				ext.y = (int32_t)((int64_t)ext.y * ReadI32(p + 16) / yDenom);
+				UpdateTransform();
+			}
+		}
+		break;
+	case EmrType::SetWorldTransform:
+		if (Has(record, 32))
+		{
+			m_dc.world = ReadMatrix(p + 8);
+			UpdateTransform();
+		}
+		break;
+	case EmrType::ModifyWorldTransform:
+		if (Has(record, 36))
+		{
+			EmfMatrix xform = ReadMatrix(p + 8);
+			switch (ReadU32(p + 32))
+			{
+			case g_mwtIdentity:
+				m_dc.world = EmfMatrix::Identity();
+				break;
+			case g_mwtLeftMultiply:
+				m_dc.world = xform.Then(m_dc.world);
+				break;
+			case g_mwtRightMultiply:
+				m_dc.world = m_dc.world.Then(xform);
+				break;
+			case g_mwtSet:
+				m_dc.world = xform;
+				break;
+			}
+			UpdateTransform();
+		}
+		break;
+
+	case EmrType::SaveDC:
+		m_savedDC.push_back(m_dc);
+		break;
+	case EmrType::RestoreDC:
+		if (Has(record, 12))
+		{
+			// Negative is relative to the top of the stack, positive is an absolute level.
+			int32_t n = ReadI32(p + 8);
+			size_t level = n < 0 ? (size_t)std::max<int64_t>(0, (int64_t)m_savedDC.size() + n) : (size_t)std::max(0, n - 1);
+			if (level < m_savedDC.size())
+			{
+				m_dc = m_savedDC[level];
+				m_savedDC.resize(level);
+			}
+		}
+		break;
+
+	default:
+		break;
+	}
+}
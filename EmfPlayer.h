@@ -0,0 +1,331 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <memory>
+
+#include "Arena.h"
+#include "EmfFormat.h"
+#include "EmfRegion.h"
+
+// Interpreter of the EMF records for the consumers which don't draw with GDI
+// (exporters, offline renderers). It keeps the DC state like GDI does and
+// hands device space geometry to an EmfSink. Its paths, runs, saved DCs and
+// clip regions are taken from the current arena, if any, so a player made in
+// an ArenaScope takes nothing from the heap once the arena is big enough.
+
+struct EmfPointF
+{
+	float x, y;
+};
+
+// x' = a * x + c * y + e, y' = b * x + d * y + f. Same element order as XFORM.
+struct EmfMatrix
+{
+	double a, b, c, d, e, f;
+
+	static EmfMatrix Identity()
+	{
+		return { 1, 0, 0, 1, 0, 0 };
+	}
+	// Apply this first, then next.
+	EmfMatrix Then(const EmfMatrix& next) const;
+	EmfPointF Apply(double x, double y) const
+	{
+		return { (float)(a * x + c * y + e), (float)(b * x + d * y + f) };
+	}
+	// Average scale, used for pen widths and font heights.
+	double Scale() const;
+};
+
+enum class PathVerb : uint8_t
+{
+	MoveTo,
+	LineTo,
+	// Uses three points.
+	BezierTo,
+	Close,
+};
+
+struct EmfPath
+{
+	ArenaVector<PathVerb> verbs;
+	ArenaVector<EmfPointF> points;
+
+	void MoveTo(EmfPointF p)
+	{
+		verbs.push_back(PathVerb::MoveTo);
+		points.push_back(p);
+	}
+	void LineTo(EmfPointF p)
+	{
+		verbs.push_back(PathVerb::LineTo);
+		points.push_back(p);
+	}
+	void BezierTo(EmfPointF p1, EmfPointF p2, EmfPointF p3)
+	{
+		verbs.push_back(PathVerb::BezierTo);
+		points.push_back(p1);
+		points.push_back(p2);
+		points.push_back(p3);
+	}
+	void Close()
+	{
+		verbs.push_back(PathVerb::Close);
+	}
+	void Clear()
+	{
+		verbs.clear();
+		points.clear();
+	}
+	bool Empty() const
+	{
+		return verbs.empty();
+	}
+};
+
+// Values as in wingdi.h.
+struct EmfPen
+{
+	uint32_t style;
+	// Logical units, 0 is one pixel wide.
+	uint32_t width;
+	uint32_t color;
+};
+
+struct EmfBrush
+{
+	uint32_t style;
+	uint32_t color;
+	uint32_t hatch;
+};
+
+// LOGFONTW without Windows.h.
+struct EmfFont
+{
+	int32_t height;
+	int32_t width;
+	int32_t escapement;
+	int32_t orientation;
+	int32_t weight;
+	uint8_t italic;
+	uint8_t underline;
+	uint8_t strikeOut;
+	uint8_t charSet;
+	uint8_t outPrecision;
+	uint8_t clipPrecision;
+	uint8_t quality;
+	uint8_t pitchAndFamily;
+	char16_t faceName[32];
+};
+
+struct EmfDeviceContext
+{
+	EmfPen pen;
+	EmfBrush brush;
+	EmfFont font;
+	uint32_t textColor;
+	uint32_t bkColor;
+	uint32_t bkMode;
+	uint32_t textAlign;
+	uint32_t polyFillMode;
+	uint32_t mapMode;
+	uint32_t arcDirection;
+	uint32_t stretchBltMode;
+	uint32_t rop2;
+	float miterLimit;
+	EmfPointL windowOrg, windowExt;
+	EmfPointL viewportOrg, viewportExt;
+	EmfMatrix world;
+	// World, then page space to device space.
+	EmfMatrix toDevice;
+	EmfPointF currentPosition;
+	// Clip region in device units, nullptr if there is none. Never changed in
+	// place, so saved DCs share it and sinks can compare the pointers.
+	std::shared_ptr<const EmfRegion> clip;
+};
+
+struct EmfHeaderInfo
+{
+	EmfRectL bounds;
+	EmfRectL frame;
+	EmfPointL device;
+	EmfPointL millimeters;
+	uint32_t recordCount;
+
+	// Picture rectangle in device units: rclBounds, or rclFrame if the bounds are empty.
+	void PictureRect(double& left, double& top, double& width, double& height) const;
+};
+
+struct EmfTextRun
+{
+	// Device space reference point and the text.
+	EmfPointF origin;
+	ArenaU16String text;
+	// Advance of every character in device units, empty if the record has none.
+	ArenaVector<float> advances;
+	float fontHeight;
+	uint32_t options;
+	// Opaque rectangle for ETO_OPAQUE, device space.
+	EmfPointF opaque[4];
+};
+
+struct EmfImage
+{
+	// BitBlt, StretchBlt, StretchDIBits, SetDIBitsToDevice, AlphaBlend or TransparentBlt.
+	EmrType type;
+	// Maps the unit square onto the destination in device space.
+	// (0, 0) is the top left corner of the source rectangle.
+	EmfMatrix placement;
+	// Source rectangle, top-down, in pixels of the bitmap.
+	int32_t srcX, srcY, srcWidth, srcHeight;
+	const uint8_t* bmi;
+	uint32_t bmiSize;
+	const uint8_t* bits;
+	uint32_t bitsSize;
+	uint32_t usage;
+	// Raster operation, BLENDFUNCTION for AlphaBlend, transparent color for TransparentBlt.
+	uint32_t rop;
+};
+
+// A TRIVERTEX of GradientFill in device space, 16 bit channels.
+struct EmfGradientVertex
+{
+	EmfPointF point;
+	uint16_t red, green, blue, alpha;
+};
+
+// GradientFill as Gouraud shaded triangles. A rectangle is split in two
+// with the colors of its sides at its corners, which interpolates the same
+// and stays right under any transform.
+struct EmfGradient
+{
+	ArenaVector<EmfGradientVertex> vertices;
+	// Three indices of vertices a triangle.
+	ArenaVector<uint32_t> triangles;
+};
+
+class EmfSink
+{
+public:
+	virtual ~EmfSink()
+	{
+	}
+	virtual void Begin(const EmfHeaderInfo& /*header*/)
+	{
+	}
+	virtual void End()
+	{
+	}
+	virtual void DrawPath(const EmfPath& /*path*/, const EmfDeviceContext& /*dc*/, bool /*stroke*/, bool /*fill*/)
+	{
+	}
+	virtual void DrawText(const EmfTextRun& /*run*/, const EmfDeviceContext& /*dc*/)
+	{
+	}
+	virtual void DrawImage(const EmfImage& /*image*/, const EmfDeviceContext& /*dc*/)
+	{
+	}
+	virtual void FillGradient(const EmfGradient& /*gradient*/, const EmfDeviceContext& /*dc*/)
+	{
+	}
+	// Called for every record before it is played, for consumers needing more than the geometry.
+	virtual void Record(const EmfRecordSpan& /*record*/)
+	{
+	}
+};
+
+class EmfPlayer
+{
+public:
+	EmfPlayer();
+
+	// Play all records of an EMF held in memory, or of an EMZ inflated as it
+	// is played. Return false if it isn't one.
+	bool Play(const uint8_t* data, size_t size, EmfSink& sink);
+	void PlayRecord(const EmfRecordSpan& record, EmfSink& sink);
+
+	const EmfHeaderInfo& Header() const
+	{
+		return m_header;
+	}
+	const EmfDeviceContext& DC() const
+	{
+		return m_dc;
+	}
+
+private:
+	enum class ObjectKind : uint8_t
+	{
+		None,
+		Pen,
+		Brush,
+		Font,
+		Other,
+	};
+	struct GdiObject
+	{
+		ObjectKind kind;
+		EmfPen pen;
+		EmfBrush brush;
+		EmfFont font;
+	};
+
+	EmfHeaderInfo m_header;
+	EmfDeviceContext m_dc;
+	ArenaVector<EmfDeviceContext> m_savedDC;
+	ArenaVector<GdiObject> m_objects;
+	// Path bracket between BeginPath and EndPath.
+	bool m_inPath;
+	EmfPath m_path;
+	// Geometry of the record being played when not in a path bracket.
+	EmfPath m_scratch;
+	// Consecutive LineTo records are merged into one path.
+	EmfPath m_lines;
+	// Handed to the sink by TextOut and Gradient, reused from a record to the next.
+	EmfTextRun m_run;
+	EmfGradient m_gradient;
+
+	void Reset();
+	void UpdateTransform();
+	EmfPointF ToDevice(double x, double y) const
+	{
+		return m_dc.toDevice.Apply(x, y);
+	}
+	void FlushLines(EmfSink& sink);
+	// Geometry goes to the path bracket if open, else to m_scratch and Draw
+	// hands it to the sink.
+	EmfPath& Target();
+	void Draw(EmfSink& sink, bool stroke, bool fill);
+	void FillRect(EmfSink& sink, double left, double top, double right, double bottom, uint32_t color);
+	template<typename PointType>
+	void Poly(const EmfRecordSpan& record, EmfSink& sink, bool closed, bool bezier, bool fromCurrent);
+	template<typename PointType>
+	void PolyPoly(const EmfRecordSpan& record, EmfSink& sink, bool closed);
+	template<typename PointType>
+	void PolyDraw(const EmfRecordSpan& record, EmfSink& sink);
+	void AddArc(EmfPath& path, double left, double top, double right, double bottom, double startAngle, double sweep, bool moveToStart);
+	void ArcRecord(const EmfRecordSpan& record, EmfSink& sink);
+	void AngleArc(const EmfRecordSpan& record, EmfSink& sink);
+	void Box(const EmfRecordSpan& record, EmfSink& sink);
+	void TextOut(const EmfRecordSpan& record, EmfSink& sink, bool wide);
+	void Bitmap(const EmfRecordSpan& record, EmfSink& sink);
+	void Gradient(const EmfRecordSpan& record, EmfSink& sink);
+	// FillRgn, FrameRgn and PaintRgn, whose regions are in logical units.
+	void RegionRecord(const EmfRecordSpan& record, EmfSink& sink);
+	void FillRegion(EmfSink& sink, const EmfRegion& region, const EmfBrush& brush);
+	// Combine the clip region with region, in device units.
+	void Clip(const EmfRegion& region, RegionMode mode);
+	// Device pixels of the logical rectangle, the bounding box if rotated.
+	EmfRectL DeviceRect(const EmfRectL& rect) const;
+	bool Brush(uint32_t index, EmfBrush& brush) const;
+	void SelectObject(uint32_t index);
+	void CreateObject(uint32_t index, const GdiObject& object);
+};
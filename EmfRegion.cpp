@@ -0,0 +1,388 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#include "EmfRegion.h"
+
+// dwSize of RGNDATAHEADER, the rectangles follow it.
+const uint32_t g_rgnDataHeaderSize = 32;
+// iType of RGNDATAHEADER.
+const uint32_t g_rdhRectangles = 1;
+
+EmfRegion::EmfRegion(const EmfRectL& rect)
+{
+	if (rect.left < rect.right && rect.top < rect.bottom)
+	{
+		Span span = { rect.left, rect.right };
+		AddBand(rect.top, rect.bottom, &span, 1);
+	}
+}
+
+void EmfRegion::AddBand(int32_t top, int32_t bottom, const Span* spans, size_t count)
+{
+	if (!m_bands.empty())
+	{
+		Band& last = m_bands.back();
+		if (last.bottom == top && last.end - last.begin == count)
+		{
+			bool same = true;
+			for (size_t i = 0; i < count && same; ++i)
+				same = m_spans[last.begin + i].left == spans[i].left && m_spans[last.begin + i].right == spans[i].right;
+			if (same)
+			{
+				last.bottom = bottom;
+				return;
+			}
+		}
+	}
+	uint32_t begin = (uint32_t)m_spans.size();
+	m_spans.insert(m_spans.end(), spans, spans + count);
+	m_bands.push_back(Band{ top, bottom, begin, (uint32_t)m_spans.size() });
+}
+
+bool EmfRegion::FromBandedRects(const uint8_t* rects, uint32_t count)
+{
+	ArenaVector<Span> spans;
+	int32_t top = 0, bottom = INT32_MIN;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		const uint8_t* p = rects + (size_t)i * sizeof(EmfRectL);
+		EmfRectL rect = { ReadI32(p), ReadI32(p + 4), ReadI32(p + 8), ReadI32(p + 12) };
+		if (rect.left >= rect.right || rect.top >= rect.bottom)
+			return false;
+		if (rect.top != top || rect.bottom != bottom)
+		{
+			if (rect.top < bottom)
+				return false;
+			if (!spans.empty())
+				AddBand(top, bottom, spans.data(), spans.size());
+			spans.clear();
+			top = rect.top;
+			bottom = rect.bottom;
+		}
+		if (!spans.empty() && rect.left < spans.back().right)
+			return false;
+		if (!spans.empty() && rect.left == spans.back().right)
+			spans.back().right = rect.right;
+		else
+			spans.push_back(Span{ rect.left, rect.right });
+	}
+	if (!spans.empty())
+		AddBand(top, bottom, spans.data(), spans.size());
+	return true;
+}
+
+bool EmfRegion::Decode(const uint8_t* data, size_t size)
+{
+	*this = EmfRegion();
+	if (size < g_rgnDataHeaderSize)
+		return false;
+	uint32_t headerSize = ReadU32(data);
+	uint32_t count = ReadU32(data + 8);
+	if (headerSize < g_rgnDataHeaderSize || headerSize > size || ReadU32(data + 4) != g_rdhRectangles
+		|| count > (size - headerSize) / sizeof(EmfRectL))
+		return false;
+	const uint8_t* rects = data + headerSize;
+	if (FromBandedRects(rects, count))
+		return true;
+
+	// Rectangles in any order: swept from the top, every band between two
+	// consecutive rectangle edges gets the spans of the rectangles over it.
+	*this = EmfRegion();
+	ArenaVector<EmfRectL> sorted;
+	sorted.reserve(count);
+	ArenaVector<int32_t> edges;
+	edges.reserve(2 * (size_t)count);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		const uint8_t* p = rects + (size_t)i * sizeof(EmfRectL);
+		EmfRectL rect = { ReadI32(p), ReadI32(p + 4), ReadI32(p + 8), ReadI32(p + 12) };
+		if (rect.left >= rect.right || rect.top >= rect.bottom)
+			continue;
+		sorted.push_back(rect);
+		edges.push_back(rect.top);
+		edges.push_back(rect.bottom);
+	}
+	std::sort(sorted.begin(), sorted.end(), [](const EmfRectL& a, const EmfRectL& b) { return a.top < b.top; });
+	std::sort(edges.begin(), edges.end());
+	edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+	// Rectangles over the current band, sorted by left.
+	ArenaVector<EmfRectL> active;
+	ArenaVector<Span> spans;
+	size_t next = 0;
+	for (size_t k = 0; k + 1 < edges.size(); ++k)
+	{
+		int32_t top = edges[k], bottom = edges[k + 1];
+		active.erase(std::remove_if(active.begin(), active.end(), [top](const EmfRectL& rect) { return rect.bottom <= top; }), active.end());
+		size_t added = active.size();
+		for (; next < sorted.size() && sorted[next].top == top; ++next)
+			active.push_back(sorted[next]);
+		auto byLeft = [](const EmfRectL& a, const EmfRectL& b) { return a.left < b.left; };
+		std::sort(active.begin() + added, active.end(), byLeft);
+		std::inplace_merge(active.begin(), active.begin() + added, active.end(), byLeft);
+		spans.clear();
+		for (const EmfRectL& rect : active)
+		{
+			if (!spans.empty() && rect.left <= spans.back().right)
+				spans.back().right = std::max(spans.back().right, rect.right);
+			else
+				spans.push_back(Span{ rect.left, rect.right });
+		}
+		if (!spans.empty())
+			AddBand(top, bottom, spans.data(), spans.size());
+	}
+	return true;
+}
+
+static bool Apply(RegionMode mode, bool inA, bool inB)
+{
+	switch (mode)
+	{
+	case RegionMode::And:
+		return inA && inB;
+	case RegionMode::Or:
+		return inA || inB;
+	case RegionMode::Xor:
+		return inA != inB;
+	case RegionMode::Diff:
+		return inA && !inB;
+	default:
+		return inA;
+	}
+}
+
+// Sweep the edges of both span lists from the left, keeping whether x is in
+// a and in b.
+static void CombineSpans(const EmfRegion::Span* a, size_t countA, const EmfRegion::Span* b, size_t countB,
+	RegionMode mode, ArenaVector<EmfRegion::Span>& spans)
+{
+	size_t i = 0, j = 0;
+	bool inA = false, inB = false, inside = false;
+	int32_t start = 0;
+	while (i < countA || j < countB)
+	{
+		int64_t xa = i < countA ? (inA ? a[i].right : a[i].left) : INT64_MAX;
+		int64_t xb = j < countB ? (inB ? b[j].right : b[j].left) : INT64_MAX;
+		int32_t x = (int32_t)std::min(xa, xb);
+		if (xa == x)
+		{
+			if (inA)
+				++i;
+			inA = !inA;
+		}
+		if (xb == x)
+		{
+			if (inB)
+				++j;
+			inB = !inB;
+		}
+		bool now = Apply(mode, inA, inB);
+		if (now == inside)
+			continue;
+		if (now)
+			start = x;
+		else
+			spans.push_back(EmfRegion::Span{ start, x });
+		inside = now;
+	}
+}
+
+static bool Disjoint(const EmfRectL& a, const EmfRectL& b)
+{
+	return a.right <= b.left || b.right <= a.left || a.bottom <= b.top || b.bottom <= a.top;
+}
+
+EmfRegion EmfRegion::Combine(const EmfRegion& a, const EmfRegion& b, RegionMode mode)
+{
+	if (mode == RegionMode::Copy)
+		return a;
+	if (a.Empty() || b.Empty())
+	{
+		if (mode == RegionMode::And || (mode == RegionMode::Diff && a.Empty()))
+			return EmfRegion();
+		return a.Empty() ? b : a;
+	}
+	if (Disjoint(a.Bounds(), b.Bounds()))
+	{
+		if (mode == RegionMode::And)
+			return EmfRegion();
+		if (mode == RegionMode::Diff)
+			return a;
+	}
+
+	// Rows where either region starts or ends a band.
+	ArenaVector<int32_t> edgesA, edgesB, edges;
+	edgesA.reserve(2 * a.m_bands.size());
+	edgesB.reserve(2 * b.m_bands.size());
+	for (const Band& band : a.m_bands)
+	{
+		edgesA.push_back(band.top);
+		edgesA.push_back(band.bottom);
+	}
+	for (const Band& band : b.m_bands)
+	{
+		edgesB.push_back(band.top);
+		edgesB.push_back(band.bottom);
+	}
+	edges.resize(edgesA.size() + edgesB.size());
+	std::merge(edgesA.begin(), edgesA.end(), edgesB.begin(), edgesB.end(), edges.begin());
+	edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+	EmfRegion result;
+	ArenaVector<Span> spans;
+	size_t ia = 0, ib = 0;
+	for (size_t k = 0; k + 1 < edges.size(); ++k)
+	{
+		int32_t top = edges[k], bottom = edges[k + 1];
+		while (ia < a.m_bands.size() && a.m_bands[ia].bottom <= top)
+			++ia;
+		while (ib < b.m_bands.size() && b.m_bands[ib].bottom <= top)
+			++ib;
+		bool hasA = ia < a.m_bands.size() && a.m_bands[ia].top <= top;
+		bool hasB = ib < b.m_bands.size() && b.m_bands[ib].top <= top;
+		if (!hasA && !hasB)
+			continue;
+		const Band* bandA = hasA ? &a.m_bands[ia] : nullptr;
+		const Band* bandB = hasB ? &b.m_bands[ib] : nullptr;
+		spans.clear();
+		CombineSpans(bandA ? a.Spans(*bandA) : nullptr, bandA ? bandA->end - bandA->begin : 0,
+			bandB ? b.Spans(*bandB) : nullptr, bandB ? bandB->end - bandB->begin : 0, mode, spans);
+		if (!spans.empty())
+			result.AddBand(top, bottom, spans.data(), spans.size());
+	}
+	return result;
+}
+
+// The pixels p of region with p + (0, k) in it for every k in [0, n), n > 0:
+// doubling the run, from the top bit of n down, takes O(log n) combines.
+static EmfRegion RowsBelowInside(const EmfRegion& region, int32_t n)
+{
+	int bit = 30;
+	while (!((n >> bit) & 1))
+		--bit;
+	// result holds for a run of (n >> bit) rows.
+	EmfRegion result = region;
+	int32_t run = 1;
+	while (--bit >= 0)
+	{
+		EmfRegion moved = result;
+		moved.Offset(0, -run);
+		result = EmfRegion::Combine(result, moved, RegionMode::And);
+		run *= 2;
+		if ((n >> bit) & 1)
+		{
+			moved = region;
+			moved.Offset(0, -run);
+			result = EmfRegion::Combine(result, moved, RegionMode::And);
+			++run;
+		}
+	}
+	return result;
+}
+
+EmfRegion EmfRegion::Frame(const EmfRegion& region, int32_t width, int32_t height)
+{
+	// The interior is what stays inside when moved by any offset up to the
+	// pen size either way, not only by the pen size: a notch narrower than
+	// the pen is framed on both sides.
+	if (region.Empty())
+		return region;
+	width = std::max(width, 0);
+	height = std::max(height, 0);
+	EmfRectL bounds = region.Bounds();
+	if (2 * (int64_t)width >= (int64_t)bounds.right - bounds.left || 2 * (int64_t)height >= (int64_t)bounds.bottom - bounds.top
+		|| height > (INT32_MAX - 1) / 2)
+		return region;
+
+	// Across, every span shrinks by width at both ends.
+	EmfRegion inner;
+	ArenaVector<Span> spans;
+	for (const Band& band : region.m_bands)
+	{
+		spans.clear();
+		for (uint32_t i = band.begin; i < band.end; ++i)
+		{
+			const Span& span = region.m_spans[i];
+			if ((int64_t)span.right - span.left > 2 * (int64_t)width)
+				spans.push_back(Span{ span.left + width, span.right - width });
+		}
+		if (!spans.empty())
+			inner.AddBand(band.top, band.bottom, spans.data(), spans.size());
+	}
+	// Down, a pixel needs the height rows above and below it inside.
+	if (height > 0 && !inner.Empty())
+	{
+		EmfRegion column = RowsBelowInside(region, 2 * height + 1);
+		column.Offset(0, height);
+		inner = Combine(inner, column, RegionMode::And);
+	}
+	return Combine(region, inner, RegionMode::Diff);
+}
+
+// Wraps around instead of overflowing on corrupt coordinates.
+static int32_t Add(int32_t a, int32_t b)
+{
+	return (int32_t)((uint32_t)a + (uint32_t)b);
+}
+
+void EmfRegion::Offset(int32_t dx, int32_t dy)
+{
+	for (Band& band : m_bands)
+	{
+		band.top = Add(band.top, dy);
+		band.bottom = Add(band.bottom, dy);
+	}
+	for (Span& span : m_spans)
+	{
+		span.left = Add(span.left, dx);
+		span.right = Add(span.right, dx);
+	}
+}
+
+EmfRectL EmfRegion::Bounds() const
+{
+	EmfRectL bounds = {};
+	if (m_bands.empty())
+		return bounds;
+	bounds.top = m_bands.front().top;
+	bounds.bottom = m_bands.back().bottom;
+	bounds.left = INT32_MAX;
+	bounds.right = INT32_MIN;
+	for (const Band& band : m_bands)
+	{
+		bounds.left = std::min(bounds.left, m_spans[band.begin].left);
+		bounds.right = std::max(bounds.right, m_spans[band.end - 1].right);
+	}
+	return bounds;
+}
+
+bool EmfRegion::Contains(int32_t x, int32_t y) const
+{
+	bool inside = false;
+	ClipSpan(y, x, x + 1, [&inside](int32_t, int32_t) { inside = true; });
+	return inside;
+}
+
+bool EmfRegion::operator==(const EmfRegion& other) const
+{
+	if (m_bands.size() != other.m_bands.size() || m_spans.size() != other.m_spans.size())
+		return false;
+	for (size_t i = 0; i < m_bands.size(); ++i)
+	{
+		if (m_bands[i].top != other.m_bands[i].top || m_bands[i].bottom != other.m_bands[i].bottom
+			|| m_bands[i].begin != other.m_bands[i].begin)
+			return false;
+	}
+	for (size_t i = 0; i < m_spans.size(); ++i)
+	{
+		if (m_spans[i].left != other.m_spans[i].left || m_spans[i].right != other.m_spans[i].right)
+			return false;
+	}
+	return true;
+}
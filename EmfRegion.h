@@ -0,0 +1,147 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <algorithm>
+#include "Arena.h"
+#include "EmfFormat.h"
+
+// Same values as RGN_AND ... RGN_COPY, the iMode of EMR_EXTSELECTCLIPRGN.
+enum class RegionMode : uint32_t
+{
+	And = 1,
+	Or = 2,
+	Xor = 3,
+	Diff = 4,
+	Copy = 5,
+};
+
+// A set of pixels as y-x banded rectangles, the way GDI keeps regions.
+// Bands of rows [top, bottom) go from the top down without overlapping; the
+// spans [left, right) of a band go from the left without touching. Adjacent
+// bands with the same spans are merged, so equal regions are stored equally.
+// Combining two regions walks their bands and spans once, and clipping a row
+// costs a binary search for its band and then its spans. Bands and spans
+// are taken from the current arena, if any.
+class EmfRegion
+{
+public:
+	struct Span
+	{
+		int32_t left, right;
+	};
+	struct Band
+	{
+		int32_t top, bottom;
+		// Spans [begin, end) of m_spans.
+		uint32_t begin, end;
+	};
+
+	EmfRegion()
+	{
+	}
+	// Pixels [left, right) x [top, bottom), empty if the rectangle is.
+	explicit EmfRegion(const EmfRectL& rect);
+
+	// Decode an RGNDATA: an RGNDATAHEADER and its rectangles, which may come
+	// in any order and overlap. Return false if it is malformed, the region is
+	// then empty.
+	bool Decode(const uint8_t* data, size_t size);
+
+	static EmfRegion Combine(const EmfRegion& a, const EmfRegion& b, RegionMode mode);
+	// The border of region inside it, width pixels wide and height high, as FrameRgn paints.
+	static EmfRegion Frame(const EmfRegion& region, int32_t width, int32_t height);
+	void Offset(int32_t dx, int32_t dy);
+
+	bool Empty() const
+	{
+		return m_bands.empty();
+	}
+	// Exclusive right and bottom; all zero if empty.
+	EmfRectL Bounds() const;
+	size_t RectCount() const
+	{
+		return m_spans.size();
+	}
+	bool Contains(int32_t x, int32_t y) const;
+	bool operator==(const EmfRegion& other) const;
+	bool operator!=(const EmfRegion& other) const
+	{
+		return !(*this == other);
+	}
+
+	const ArenaVector<Band>& Bands() const
+	{
+		return m_bands;
+	}
+	const Span* Spans(const Band& band) const
+	{
+		return m_spans.data() + band.begin;
+	}
+	// Index of the band holding row y, or of the first one below it.
+	size_t FindBand(int32_t y) const
+	{
+		return std::upper_bound(m_bands.begin(), m_bands.end(), y, [](int32_t row, const Band& band) { return row < band.bottom; }) - m_bands.begin();
+	}
+
+	// Call fn(left, top, right, bottom) for every rectangle, from the top band
+	// down and from the left within a band.
+	template<typename Fn>
+	void ForEachRect(Fn fn) const
+	{
+		for (const Band& band : m_bands)
+		{
+			for (uint32_t i = band.begin; i < band.end; ++i)
+				fn(m_spans[i].left, band.top, m_spans[i].right, band.bottom);
+		}
+	}
+
+	// Call fn(left, top, right, bottom) for the rectangles of the region
+	// clipped to rect; only the bands and spans overlapping rect are visited.
+	template<typename Fn>
+	void ForEachRectIn(const EmfRectL& rect, Fn fn) const
+	{
+		for (size_t b = FindBand(rect.top); b < m_bands.size() && m_bands[b].top < rect.bottom; ++b)
+		{
+			const Band& band = m_bands[b];
+			int32_t top = std::max(band.top, rect.top), bottom = std::min(band.bottom, rect.bottom);
+			ClipBand(band, rect.left, rect.right, [&](int32_t left, int32_t right) { fn(left, top, right, bottom); });
+		}
+	}
+
+	// Call fn(left, right) for the parts of [left, right) of row y inside the region.
+	template<typename Fn>
+	void ClipSpan(int32_t y, int32_t left, int32_t right, Fn fn) const
+	{
+		size_t b = FindBand(y);
+		if (b < m_bands.size() && m_bands[b].top <= y)
+			ClipBand(m_bands[b], left, right, fn);
+	}
+
+private:
+	ArenaVector<Band> m_bands;
+	ArenaVector<Span> m_spans;
+
+	template<typename Fn>
+	void ClipBand(const Band& band, int32_t left, int32_t right, Fn fn) const
+	{
+		const Span* first = m_spans.data() + band.begin;
+		const Span* last = m_spans.data() + band.end;
+		first = std::upper_bound(first, last, left, [](int32_t x, const Span& span) { return x < span.right; });
+		for (; first != last && first->left < right; ++first)
+			fn(std::max(first->left, left), std::min(first->right, right));
+	}
+
+	// Append the band, or extend the last one if it continues it with the same spans.
+	void AddBand(int32_t top, int32_t bottom, const Span* spans, size_t count);
+	// Build from rectangles already y-x banded, as GDI writes them. Return
+	// false, leaving the region empty, if they aren't.
+	bool FromBandedRects(const uint8_t* rects, uint32_t count);
+};
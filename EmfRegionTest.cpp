@@ -0,0 +1,100 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+// EmfRegion::Frame against a per pixel reference.
+#include <cstdio>
+#include <random>
+
+#include "EmfRegion.h"
+
+// Pixels of the test regions are in [0, g_side) both ways.
+const int32_t g_side = 24;
+
+static EmfRegion Rect(int32_t left, int32_t top, int32_t right, int32_t bottom)
+{
+	return EmfRegion(EmfRectL{ left, top, right, bottom });
+}
+
+// A pixel is framed unless every pixel up to width across and height down
+// from it is inside too.
+static bool Framed(const EmfRegion& region, int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	if (!region.Contains(x, y))
+		return false;
+	for (int32_t d = 1; d <= width; ++d)
+	{
+		if (!region.Contains(x - d, y) || !region.Contains(x + d, y))
+			return true;
+	}
+	for (int32_t d = 1; d <= height; ++d)
+	{
+		if (!region.Contains(x, y - d) || !region.Contains(x, y + d))
+			return true;
+	}
+	return false;
+}
+
+static bool Check(const char* name, const EmfRegion& region, int32_t width, int32_t height)
+{
+	EmfRegion frame = EmfRegion::Frame(region, width, height);
+	for (int32_t y = -1; y <= g_side; ++y)
+	{
+		for (int32_t x = -1; x <= g_side; ++x)
+		{
+			bool expected = Framed(region, x, y, width, height);
+			if (frame.Contains(x, y) != expected)
+			{
+				printf("%s, pen %dx%d: pixel (%d,%d) %s\n", name, width, height, x, y,
+					expected ? "not framed" : "framed but inside");
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+int main()
+{
+	bool ok = true;
+
+	// A notch one pixel wide, narrower than a pen of 2: x = 3 is framed
+	// from the notch at 4, 5 from the left edge of [5, 10).
+	EmfRegion notch = EmfRegion::Combine(Rect(0, 0, 4, 10), Rect(5, 0, 10, 10), RegionMode::Or);
+	ok &= Check("vertical notch", notch, 2, 2);
+	ok &= EmfRegion::Frame(notch, 2, 2).Contains(3, 5);
+	EmfRegion slot = EmfRegion::Combine(Rect(0, 0, 12, 12), Rect(0, 5, 12, 6), RegionMode::Diff);
+	ok &= Check("horizontal slot", slot, 3, 3);
+	ok &= Check("horizontal slot", slot, 1, 4);
+
+	// Pens up to the size of the region, and wider.
+	EmfRegion ring = EmfRegion::Combine(Rect(2, 2, 20, 20), Rect(8, 8, 13, 13), RegionMode::Diff);
+	for (int32_t pen = 0; pen <= 10; ++pen)
+	{
+		ok &= Check("ring", ring, pen, pen);
+		ok &= Check("ring", ring, pen, 10 - pen);
+	}
+
+	// Random unions and differences of rectangles, so bands of many spans.
+	std::mt19937 random(2017);
+	std::uniform_int_distribution<int32_t> coordinate(0, g_side);
+	for (int trial = 0; trial < 300 && ok; ++trial)
+	{
+		EmfRegion region;
+		for (int i = 0; i < 6; ++i)
+		{
+			int32_t x0 = coordinate(random), x1 = coordinate(random), y0 = coordinate(random), y1 = coordinate(random);
+			EmfRegion rect = Rect(std::min(x0, x1), std::min(y0, y1), std::max(x0, x1), std::max(y0, y1));
+			region = EmfRegion::Combine(region, rect, i % 3 == 2 ? RegionMode::Diff : RegionMode::Or);
+		}
+		ok &= Check("random", region, trial % 5, trial / 5 % 7);
+	}
+
+	printf(ok ? "EmfRegion: ok\n" : "EmfRegion: FAILED\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,246 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <zlib.h>
+
+#include "EmzStream.h"
+
+// Input handed to zlib at once, avail_in is 32 bits.
+const size_t g_maxInflateInput = 1 << 30;
+
+bool IsGzip(const uint8_t* data, size_t size)
+{
+	return size >= 10 && data[0] == 0x1F && data[1] == 0x8B && data[2] == 8;
+}
+
+// Single producer, single consumer ring of inflated bytes. Positions count
+// all bytes ever written or consumed, the ring index is position % size.
+class InflateRing
+{
+public:
+	explicit InflateRing(size_t size)
+		: m_ring(size)
+		, m_written(0)
+		, m_consumed(0)
+		, m_ended(false)
+		, m_failed(false)
+		, m_stopped(false)
+	{
+	}
+
+	// Inflate data into the ring until the end of the gzip stream, waiting
+	// for room. Runs on the inflating thread.
+	void Inflate(const uint8_t* data, size_t size);
+	// Stop the inflating thread, the consumer doesn't want more.
+	void Stop();
+
+	// Consumer side. Wait until written reaches position or the stream ended;
+	// return the position written up to.
+	uint64_t WaitFor(uint64_t position);
+	// Bytes before position may be overwritten.
+	void Consume(uint64_t position);
+	// Copy size bytes at position, which are written.
+	void Copy(uint64_t position, size_t size, uint8_t* out) const;
+	// Address of size bytes at position if contiguous in the ring, else nullptr.
+	const uint8_t* Contiguous(uint64_t position, size_t size) const
+	{
+		size_t index = (size_t)(position % m_ring.size());
+		return index + size <= m_ring.size() ? m_ring.data() + index : nullptr;
+	}
+	size_t Size() const
+	{
+		return m_ring.size();
+	}
+	// Valid once WaitFor returned short.
+	bool Failed() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_failed;
+	}
+
+private:
+	std::vector<uint8_t> m_ring;
+	mutable std::mutex m_mutex;
+	std::condition_variable m_dataReady;
+	std::condition_variable m_roomReady;
+	uint64_t m_written;
+	uint64_t m_consumed;
+	bool m_ended;
+	bool m_failed;
+	bool m_stopped;
+};
+
+void InflateRing::Inflate(const uint8_t* data, size_t size)
+{
+	z_stream zs = {};
+	// 16: gzip header and trailer.
+	bool ok = inflateInit2(&zs, 16 + MAX_WBITS) == Z_OK;
+	const uint8_t* end = data + size;
+	int result = Z_OK;
+	uint64_t written = 0;
+	while (ok && result != Z_STREAM_END)
+	{
+		size_t room;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_roomReady.wait(lock, [this]() { return m_stopped || m_written - m_consumed < m_ring.size(); });
+			if (m_stopped)
+				break;
+			// Free bytes up to the end of the ring, handed over an eighth of
+			// the ring at a time so the records are walked early.
+			size_t index = (size_t)(written % m_ring.size());
+			room = std::min<size_t>(m_ring.size() - index, m_ring.size() - (size_t)(m_written - m_consumed));
+			room = std::min<size_t>(room, m_ring.size() / 8);
+		}
+		if (zs.avail_in == 0)
+		{
+			if (data == end)
+			{
+				ok = false;
+				break;
+			}
+			zs.next_in = (Bytef*)data;
+			zs.avail_in = (uInt)std::min<size_t>(end - data, g_maxInflateInput);
+			data += zs.avail_in;
+		}
+		zs.next_out = m_ring.data() + (size_t)(written % m_ring.size());
+		zs.avail_out = (uInt)room;
+		result = inflate(&zs, Z_NO_FLUSH);
+		if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR)
+			ok = false;
+		size_t produced = room - zs.avail_out;
+		if (produced)
+		{
+			written += produced;
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_written = written;
+			m_dataReady.notify_one();
+		}
+	}
+	inflateEnd(&zs);
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_ended = true;
+	m_failed = !ok;
+	m_dataReady.notify_one();
+}
+
+void InflateRing::Stop()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_stopped = true;
+	m_roomReady.notify_one();
+}
+
+uint64_t InflateRing::WaitFor(uint64_t position)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_dataReady.wait(lock, [this, position]() { return m_ended || m_written >= position; });
+	return m_written;
+}
+
+void InflateRing::Consume(uint64_t position)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_consumed = position;
+	m_roomReady.notify_one();
+}
+
+void InflateRing::Copy(uint64_t position, size_t size, uint8_t* out) const
+{
+	size_t index = (size_t)(position % m_ring.size());
+	size_t first = std::min(size, m_ring.size() - index);
+	memcpy(out, m_ring.data() + index, first);
+	memcpy(out + first, m_ring.data(), size - first);
+}
+
+// Walk the records of the ring, on the calling thread.
+static bool WalkRecords(InflateRing& ring, const std::function<bool(const EmfRecordSpan&)>& fn)
+{
+	uint64_t position = 0;
+	// Written up to, asked for again only when a record goes past it.
+	uint64_t written = 0;
+	// Consumed as told to the ring, which is told every eighth of it or
+	// before waiting.
+	uint64_t released = 0;
+	std::vector<uint8_t> gathered;
+	auto release = [&ring, &released](uint64_t consumed) {
+		released = consumed;
+		ring.Consume(consumed);
+	};
+	auto wait = [&](uint64_t end) {
+		if (written < end)
+		{
+			if (released < position)
+				release(position);
+			written = ring.WaitFor(end);
+		}
+		return written >= end;
+	};
+	for (;;)
+	{
+		uint8_t header[sizeof(EmfRecordHeader)];
+		if (!wait(position + sizeof(header)))
+			return written == position && !ring.Failed();
+		ring.Copy(position, sizeof(header), header);
+		uint32_t type = ReadU32(header);
+		uint32_t recordSize = ReadU32(header + sizeof(uint32_t));
+		if (recordSize < sizeof(EmfRecordHeader) || (recordSize & 3))
+			return false;
+		const uint8_t* p = recordSize <= ring.Size() ? ring.Contiguous(position, recordSize) : nullptr;
+		if (p)
+		{
+			if (!wait(position + recordSize))
+				return false;
+		}
+		else
+		{
+			// Gathered piece by piece, the ring is freed as it is copied.
+			gathered.resize(recordSize);
+			for (size_t done = 0; done < recordSize;)
+			{
+				if (!wait(position + done + 1))
+					return false;
+				size_t piece = (size_t)std::min<uint64_t>(written - (position + done), recordSize - done);
+				ring.Copy(position + done, piece, gathered.data() + done);
+				done += piece;
+				release(position + done);
+			}
+			p = gathered.data();
+		}
+		if (position == 0 && !IsEmf(p, recordSize))
+			return false;
+		if (!fn(EmfRecordSpan{ p, (size_t)position, type, recordSize }))
+			return true;
+		position += recordSize;
+		if (position - released >= ring.Size() / 8)
+			release(position);
+		if (type == (uint32_t)EmrType::Eof)
+			return true;
+	}
+}
+
+bool StreamEmzRecords(const uint8_t* data, size_t size, const std::function<bool(const EmfRecordSpan&)>& fn, size_t ringSize)
+{
+	if (!IsGzip(data, size))
+		return false;
+	// A ring smaller than the header record would gather every record.
+	InflateRing ring(std::max<size_t>(ringSize, 4096));
+	std::thread inflater([&ring, data, size]() { ring.Inflate(data, size); });
+	bool result = WalkRecords(ring, fn);
+	ring.Stop();
+	inflater.join();
+	return result;
+}
@@ -0,0 +1,31 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <functional>
+
+#include "EmfFormat.h"
+
+// Inflated bytes held at once, 4 MB.
+const size_t g_defaultEmzRingSize = 4 * 1024 * 1024;
+
+// Check for the gzip magic, as in the .emz files written by Office.
+bool IsGzip(const uint8_t* data, size_t size);
+
+// Call fn for every record of the gzip compressed EMF in data, up to and
+// including EMR_EOF; fn returns false to stop early. Another thread inflates
+// into a ring of ringSize bytes while fn walks the records already there, so
+// the whole metafile is never in memory. record.data is valid during the call
+// only, and record.offset is the offset in the inflated metafile. A record
+// bigger than the ring, or wrapping around its end, is gathered into a buffer
+// of its own. Return false if data isn't a compressed EMF, is corrupt, or a
+// record size is invalid; the records before the bad one are walked.
+bool StreamEmzRecords(const uint8_t* data, size_t size, const std::function<bool(const EmfRecordSpan&)>& fn,
+	size_t ringSize = g_defaultEmzRingSize);
@@ -10,14 +10,17 @@
 #include <Windows.h>
 #include <Gdiplus.h>
 
-#include <functional>
+#include <algorithm>
 #include <memory>
 #include <sstream>
 #include <type_traits>
 
+#include "Arena.h"
 #include "ConstantDictionary.h"
+#include "EmfComment.h"
+#include "EmfRegion.h"
 
-using ModeConverter = std::function<const char * (int mode)>;
+typedef const char* (*ModeConverter)(int mode);
 
 struct ShortPoint
 {
@@ -37,37 +40,55 @@ struct OutputType<ShortPoint>
 };
 
 template<typename T>
-void TypeToString(std::stringstream& ss, const T& t)
+void TypeToString(std::ostream& ss, const T& t)
 {
 	ss << t;
 }
 
 template<>
-void TypeToString<ShortPoint>(std::stringstream& ss, const ShortPoint& t)
+void TypeToString<ShortPoint>(std::ostream& ss, const ShortPoint& t)
 {
 	ss << '{' << t.x << ',' << t.y << '}';
 }
 
 template<>
-void TypeToString<POINT>(std::stringstream& ss, const POINT& t)
+void TypeToString<POINT>(std::ostream& ss, const POINT& t)
 {
 	ss << '{' << t.x << ',' << t.y << '}';
 }
 
 template<>
-void TypeToString<RECTL>(std::stringstream& ss, const RECTL& t)
+void TypeToString<RECTL>(std::ostream& ss, const RECTL& t)
 {
 	ss << '{' << t.left << ',' << t.top << ',' << t.right << ',' << t.bottom << '}';
 }
 
 template<>
-void TypeToString<RECT>(std::stringstream& ss, const RECT& t)
+void TypeToString<RECT>(std::ostream& ss, const RECT& t)
 {
 	ss << '{' << t.left << ',' << t.top << ',' << t.right << ',' << t.bottom << '}';
 }
 
+template<>
+void TypeToString<TRIVERTEX>(std::ostream& ss, const TRIVERTEX& t)
+{
+	ss << '{' << t.x << ',' << t.y << ",0x" << std::hex << t.Red << ",0x" << t.Green << ",0x" << t.Blue << ",0x" << t.Alpha << std::dec << '}';
+}
+
+template<>
+void TypeToString<GRADIENT_RECT>(std::ostream& ss, const GRADIENT_RECT& t)
+{
+	ss << '{' << t.UpperLeft << ',' << t.LowerRight << '}';
+}
+
+template<>
+void TypeToString<GRADIENT_TRIANGLE>(std::ostream& ss, const GRADIENT_TRIANGLE& t)
+{
+	ss << '{' << t.Vertex1 << ',' << t.Vertex2 << ',' << t.Vertex3 << '}';
+}
+
 template<typename T>
-void ArrayToString(std::stringstream& ss, const T* array, int32_t count, const char* arrayName, int indentLevel)
+void ArrayToString(std::ostream& ss, const T* array, int32_t count, const char* arrayName, int indentLevel)
 {
 	for (int i = 0; i < indentLevel; ++i)
 		ss << '\t';
@@ -139,9 +160,9 @@ struct CharTraits<char>
 	{
 		return "";
 	}
-	static std::string convert(const std::string& buffer)
+	static void write(std::ostream& ss, const char* text, size_t length)
 	{
-		return buffer;
+		ss.write(text, length);
 	}
 };
 
@@ -153,18 +174,18 @@ struct CharTraits<wchar_t>
 		return "L";
 	}
 
-	static std::string convert(const std::wstring& buffer)
+	static void write(std::ostream& ss, const wchar_t* text, size_t length)
 	{
 		UINT acp = CP_UTF8;
-		DWORD  num = WideCharToMultiByte(acp, 0, buffer.c_str(), buffer.length(), NULL, 0, NULL, NULL);
-		std::string res(num, '?');
-		WideCharToMultiByte(acp, 0, buffer.c_str(), buffer.length(), &res[0], num, NULL, NULL);
-		return res;
+		DWORD  num = WideCharToMultiByte(acp, 0, text, (int)length, NULL, 0, NULL, NULL);
+		ArenaString res(num, '?');
+		WideCharToMultiByte(acp, 0, text, (int)length, &res[0], num, NULL, NULL);
+		ss.write(res.data(), res.size());
 	}
 };
 
 template<typename LOGBRUSHType>
-void LogBrushToString(std::stringstream& ss, const LOGBRUSHType& logBrush, int indentLevel)
+void LogBrushToString(std::ostream& ss, const LOGBRUSHType& logBrush, int indentLevel)
 {
 	const char* lbHatch;
 	switch (logBrush.lbStyle)
@@ -194,7 +215,7 @@ void LogBrushToString(std::stringstream& ss, const LOGBRUSHType& logBrush, int i
 		<< ConstantDictionary::RGBColor(logBrush.lbColor) << ", " << lbHatch << "};\n";
 }
 
-void LogFontWToString(std::stringstream& ss, const LOGFONTW& logFont, int indentLevel)
+void LogFontWToString(std::ostream& ss, const LOGFONTW& logFont, int indentLevel)
 {
 	for (int i = 0; i < indentLevel; ++i)
 		ss << '\t';
@@ -209,10 +230,12 @@ void LogFontWToString(std::stringstream& ss, const LOGFONTW& logFont, int indent
 		<< ConstantDictionary::ClipPrecision(logFont.lfClipPrecision) << ", "
 		<< ConstantDictionary::CharQuality(logFont.lfQuality) << ", "
 		<< ConstantDictionary::PitchAndFamily(logFont.lfPitchAndFamily) << ", "
-		<< "L\"" << CharTraits<wchar_t>::convert(logFont.lfFaceName).c_str() << "\"};\n";
+		<< "L\"";
+	CharTraits<wchar_t>::write(ss, logFont.lfFaceName, wcsnlen(logFont.lfFaceName, LF_FACESIZE));
+	ss << "\"};\n";
 }
 
-void AppendBMIText(const BITMAPINFO* pBmi, std::stringstream& ss)
+void AppendBMIText(const BITMAPINFO* pBmi, std::ostream& ss)
 {
 	auto pBH = &pBmi->bmiHeader;
 	const char* format = R"(	BITMAPINFO bmi = {
@@ -238,7 +261,7 @@ void AppendBMIText(const BITMAPINFO* pBmi, std::stringstream& ss)
 	ss << buffer;
 }
 
-void AppendBits(const char* pBits, int byteCount, int height, std::stringstream& ss)
+void AppendBits(const char* pBits, int byteCount, int height, std::ostream& ss)
 {
 	ss << std::hex;
 
@@ -264,12 +287,12 @@ void AppendBits(const char* pBits, int byteCount, int height, std::stringstream&
 	ss << std::dec;
 }
 
-void NoParams(const char* func, std::stringstream& ss)
+void NoParams(const char* func, std::ostream& ss)
 {
 	ss << func << "(hdc);";
 }
 
-void OneInt(const char* func, const unsigned char* data, std::stringstream& ss, ModeConverter converter = nullptr)
+void OneInt(const char* func, const unsigned char* data, std::ostream& ss, ModeConverter converter = nullptr)
 {
 	int32_t x = *(int32_t*)(data);
 	if (converter)
@@ -278,7 +301,7 @@ void OneInt(const char* func, const unsigned char* data, std::stringstream& ss,
 		ss << func << "(hdc, " << x << ");\n";
 }
 
-void SelectObject(const unsigned char* data, std::stringstream& ss)
+void SelectObject(const unsigned char* data, std::ostream& ss)
 {
 	int32_t x = *(int32_t*)(data);
 	if (x & 0x80000000)
@@ -292,13 +315,76 @@ void SelectObject(const unsigned char* data, std::stringstream& ss)
 	}
 }
 
-void DeleteObject(const unsigned char* data, std::stringstream& ss)
+void BrushHandle(std::ostream& ss, uint32_t index)
+{
+	if (index & 0x80000000)
+		ss << "(HBRUSH)GetStockObject(" << ConstantDictionary::StockObject(index & ~0x80000000) << ")";
+	else
+		ss << "(HBRUSH)gdiHandles[" << index << "]";
+}
+
+// Opens a block creating hrgn from the RGNDATA, its rectangles banded the
+// way GDI keeps them. Return false, the block not opened, if it is malformed.
+bool RegionToString(std::ostream& ss, const unsigned char* rgnData, size_t size)
+{
+	EmfRegion region;
+	if (!region.Decode(rgnData, size))
+	{
+		ss << "// Bad RGNDATA\n";
+		return false;
+	}
+	ss << "{\n";
+	if (region.Empty())
+	{
+		ss << "\tHRGN hrgn = CreateRectRgn(0, 0, 0, 0);\n";
+		return true;
+	}
+	ss << "\t// " << region.RectCount() << " rectangles in " << region.Bands().size() << " bands\n";
+	ss << "\tconst RECT rects[] = {\n";
+	region.ForEachRect([&ss](int32_t left, int32_t top, int32_t right, int32_t bottom) {
+		ss << "\t\t{" << left << ", " << top << ", " << right << ", " << bottom << "},\n";
+	});
+	EmfRectL bounds = region.Bounds();
+	ss << "\t};\n";
+	ss << "\tstd::vector<char> buffer(sizeof(RGNDATAHEADER) + sizeof(rects));\n";
+	ss << "\tRGNDATA* rgnData = (RGNDATA*)buffer.data();\n";
+	ss << "\trgnData->rdh = { sizeof(RGNDATAHEADER), RDH_RECTANGLES, " << region.RectCount() << ", sizeof(rects), { "
+		<< bounds.left << ", " << bounds.top << ", " << bounds.right << ", " << bounds.bottom << " } };\n";
+	ss << "\tmemcpy(rgnData->Buffer, rects, sizeof(rects));\n";
+	ss << "\tHRGN hrgn = ExtCreateRegion(nullptr, (DWORD)buffer.size(), rgnData);\n";
+	return true;
+}
+
+// FillRgn, FrameRgn, InvertRgn and PaintRgn: rclBounds, cbRgnData, then
+// ihBrush and szlStroke for some, then RgnData.
+void RegionRecord(const char* func, unsigned int dataSize, const unsigned char* data, std::ostream& ss, bool brush, bool frame)
+{
+	size_t offset = frame ? 32 : brush ? 24 : 20;
+	if (dataSize < offset)
+		return;
+	uint32_t size = *(uint32_t*)(data + 16);
+	if (size > dataSize - offset || !RegionToString(ss, data + offset, size))
+		return;
+	ss << "\t" << func << "(hdc, hrgn";
+	if (brush)
+	{
+		ss << ", ";
+		BrushHandle(ss, *(uint32_t*)(data + 20));
+	}
+	if (frame)
+		ss << ", " << *(int32_t*)(data + 24) << ", " << *(int32_t*)(data + 28);
+	ss << ");\n";
+	ss << "\tDeleteObject(hrgn);\n";
+	ss << "}\n";
+}
+
+void DeleteObject(const unsigned char* data, std::ostream& ss)
 {
 	int32_t x = *(int32_t*)(data);
 	ss << "DeleteObject(gdiHandles[" << x << "]);\n";
 }
 
-void CreatePen(const unsigned char* data, std::stringstream& ss)
+void CreatePen(const unsigned char* data, std::ostream& ss)
 {
 	int32_t elements[5];
 	for (int i = 0; i < 5; ++i)
@@ -306,7 +392,7 @@ void CreatePen(const unsigned char* data, std::stringstream& ss)
 	ss << "gdiHandles[" << elements[0] << "] = CreatePen(" << ConstantDictionary::PenStyle(elements[1]) << ", " << elements[2] << ", " << ConstantDictionary::RGBColor(elements[4]) << ");\n";
 }
 
-void ExtCreatePen(const unsigned char* data, std::stringstream& ss)
+void ExtCreatePen(const unsigned char* data, std::ostream& ss)
 {
 	auto record = reinterpret_cast<const EMREXTCREATEPEN*>(data - sizeof(EMR));
 	const auto& elp = record->elp;
@@ -328,7 +414,7 @@ void ExtCreatePen(const unsigned char* data, std::stringstream& ss)
 	ss << "}\n";
 }
 
-void CreateBrushIndirect(const unsigned char* data, std::stringstream& ss)
+void CreateBrushIndirect(const unsigned char* data, std::ostream& ss)
 {
 	auto record = reinterpret_cast<const EMRCREATEBRUSHINDIRECT*>(data - sizeof(EMR));
 	const auto& logBrush = record->lb;
@@ -338,7 +424,7 @@ void CreateBrushIndirect(const unsigned char* data, std::stringstream& ss)
 	ss << "}\n";
 }
 
-void CreateFontIndirectW(const unsigned char* data, std::stringstream& ss)
+void CreateFontIndirectW(const unsigned char* data, std::ostream& ss)
 {
 	auto record = reinterpret_cast<const EMREXTCREATEFONTINDIRECTW*>(data - sizeof(EMR));
 	const auto& logFont = record->elfw.elfLogFont;
@@ -348,14 +434,14 @@ void CreateFontIndirectW(const unsigned char* data, std::stringstream& ss)
 	ss << "}\n";
 }
 
-void OnePoint(const char* func, const unsigned char* data, std::stringstream& ss, const char* suffix = "")
+void OnePoint(const char* func, const unsigned char* data, std::ostream& ss, const char* suffix = "")
 {
 	int32_t x = *(int32_t*)(data);
 	int32_t y = *(int32_t*)(data + sizeof(int32_t));
 	ss << func << "(hdc, " << x << ", " << y << suffix << ");\n";
 }
 
-void TwoPoints(const char* func, const unsigned char* data, std::stringstream& ss)
+void TwoPoints(const char* func, const unsigned char* data, std::ostream& ss)
 {
 	int32_t elements[4];
 	for (int i = 0; i < 4; ++i)
@@ -363,7 +449,7 @@ void TwoPoints(const char* func, const unsigned char* data, std::stringstream& s
 	ss << func << "(hdc, " << elements[0] << ", " << elements[1] << ", " << elements[2] << ", " << elements[3] << ");\n";
 }
 
-void ThreePoints(const char* func, const unsigned char* data, std::stringstream& ss)
+void ThreePoints(const char* func, const unsigned char* data, std::ostream& ss)
 {
 	int32_t elements[6];
 	for (int i = 0; i < 6; ++i)
@@ -371,7 +457,7 @@ void ThreePoints(const char* func, const unsigned char* data, std::stringstream&
 	ss << func << "(hdc, " << elements[0] << ", " << elements[1] << ", " << elements[2] << ", " << elements[3] << ", " << elements[4] << ", " << elements[5] << ");\n";
 }
 
-void FourPoints(const char* func, const unsigned char* data, std::stringstream& ss)
+void FourPoints(const char* func, const unsigned char* data, std::ostream& ss)
 {
 	int32_t elements[8];
 	for (int i = 0; i < 8; ++i)
@@ -379,7 +465,7 @@ void FourPoints(const char* func, const unsigned char* data, std::stringstream&
 	ss << func << "(hdc, " << elements[0] << ", " << elements[1] << ", " << elements[2] << ", " << elements[3] << ", " << elements[4] << ", " << elements[5] << ", " << elements[6] << ", " << elements[7] << ");\n";
 }
 
-void AngleArc(const char* func, const unsigned char* data, std::stringstream& ss)
+void AngleArc(const char* func, const unsigned char* data, std::ostream& ss)
 {
 	int32_t x, y;
 	DWORD r;
@@ -394,7 +480,7 @@ void AngleArc(const char* func, const unsigned char* data, std::stringstream& ss
 }
 
 template<typename PointType>
-void Polyline(const char* func, const unsigned char* data, std::stringstream& ss)
+void Polyline(const char* func, const unsigned char* data, std::ostream& ss)
 {
 	int32_t count = *(int32_t*)(data + 4 * sizeof(int32_t));
 	ss << "{\n";
@@ -405,7 +491,7 @@ void Polyline(const char* func, const unsigned char* data, std::stringstream& ss
 }
 
 template<typename PointType>
-void PolyPolyline(const char* func, const unsigned char* data, std::stringstream& ss)
+void PolyPolyline(const char* func, const unsigned char* data, std::ostream& ss)
 {
 	data += 4 * sizeof(int32_t); // skip Bounds
 	int32_t numberOfPolylines = *(int32_t*)(data);
@@ -422,7 +508,7 @@ void PolyPolyline(const char* func, const unsigned char* data, std::stringstream
 	ss << "}\n";
 }
 
-void BitBlt(unsigned int dataSize, const unsigned char* data, std::stringstream& ss)
+void BitBlt(unsigned int dataSize, const unsigned char* data, std::ostream& ss)
 {
 	auto pEmrBitBlt = reinterpret_cast<const EMRBITBLT*>(data - sizeof(EMR));
 	auto pBmi = reinterpret_cast<const BITMAPINFO*>((const char*)pEmrBitBlt + pEmrBitBlt->offBmiSrc);
@@ -448,7 +534,7 @@ void BitBlt(unsigned int dataSize, const unsigned char* data, std::stringstream&
 	ss << "}\n";
 }
 
-void StretchBlt(unsigned int dataSize, const unsigned char* data, std::stringstream& ss)
+void StretchBlt(unsigned int dataSize, const unsigned char* data, std::ostream& ss)
 {
 	auto pEmrStretchBlt = reinterpret_cast<const EMRSTRETCHBLT*>(data - sizeof(EMR));
 	auto pBmi = reinterpret_cast<const BITMAPINFO*>((const char*)pEmrStretchBlt + pEmrStretchBlt->offBmiSrc);
@@ -474,7 +560,91 @@ void StretchBlt(unsigned int dataSize, const unsigned char* data, std::stringstr
 	ss << "}\n";
 }
 
-void StretchDIBits(unsigned int dataSize, const unsigned char* data, std::stringstream& ss)
+void AlphaBlend(unsigned int dataSize, const unsigned char* data, std::ostream& ss)
+{
+	auto pEmrAlphaBlend = reinterpret_cast<const EMRALPHABLEND*>(data - sizeof(EMR));
+	auto pBmi = reinterpret_cast<const BITMAPINFO*>((const char*)pEmrAlphaBlend + pEmrAlphaBlend->offBmiSrc);
+	auto pBH = &pBmi->bmiHeader;
+	auto pBits = (const char*)pEmrAlphaBlend + pEmrAlphaBlend->offBitsSrc;
+	// dwRop is the BLENDFUNCTION.
+	auto blend = pEmrAlphaBlend->dwRop;
+	ss << "{\n";
+	AppendBits(pBits, pEmrAlphaBlend->cbBitsSrc, pBH->biHeight, ss);
+	AppendBMIText(pBmi, ss);
+	const char* alphaBlendtext = R"(	HBITMAP hBitmap;
+	HDC hMemDC;
+	hBitmap = CreateCompatibleBitmap(hdc, pBH->biWidth, pBH->biHeight);
+	hMemDC = CreateCompatibleDC(hdc);
+	SetDIBits(hdc, hBitmap, 0, pBH->biHeight, bits, &bmi, pEmrAlphaBlend->iUsageSrc);
+	HGDIOBJ holdBmp = SelectObject(hMemDC, hBitmap);
+	BLENDFUNCTION bf = { AC_SRC_OVER, 0, " << %d << ", " << %s << " };
+	AlphaBlend(hdc, " << %d << ", " << %d << ", " << %d << ", " << %d << ", hMemDC, " << %d << ", " << %d << ", " << %d << ", " << %d << ", bf);
+	DeleteObject(SelectObject(hMemDC, holdBmp));
+	DeleteDC(hMemDC);
+)";
+	char buffer[640];
+	sprintf_s(buffer, alphaBlendtext, (int)(blend >> 16 & 0xFF), (blend >> 24 & AC_SRC_ALPHA) ? "AC_SRC_ALPHA" : "0",
+		(int)pEmrAlphaBlend->xDest, (int)pEmrAlphaBlend->yDest, (int)pEmrAlphaBlend->cxDest, (int)pEmrAlphaBlend->cyDest,
+		(int)pEmrAlphaBlend->xSrc, (int)pEmrAlphaBlend->ySrc, (int)pEmrAlphaBlend->cxSrc, (int)pEmrAlphaBlend->cySrc);
+	ss << buffer;
+	ss << "}\n";
+}
+
+void TransparentBlt(unsigned int dataSize, const unsigned char* data, std::ostream& ss)
+{
+	auto pEmrTransparentBlt = reinterpret_cast<const EMRTRANSPARENTBLT*>(data - sizeof(EMR));
+	auto pBmi = reinterpret_cast<const BITMAPINFO*>((const char*)pEmrTransparentBlt + pEmrTransparentBlt->offBmiSrc);
+	auto pBH = &pBmi->bmiHeader;
+	auto pBits = (const char*)pEmrTransparentBlt + pEmrTransparentBlt->offBitsSrc;
+	// dwRop is the transparent color.
+	auto color = pEmrTransparentBlt->dwRop;
+	ss << "{\n";
+	AppendBits(pBits, pEmrTransparentBlt->cbBitsSrc, pBH->biHeight, ss);
+	AppendBMIText(pBmi, ss);
+	const char* transparentBlttext = R"(	HBITMAP hBitmap;
+	HDC hMemDC;
+	hBitmap = CreateCompatibleBitmap(hdc, pBH->biWidth, pBH->biHeight);
+	hMemDC = CreateCompatibleDC(hdc);
+	SetDIBits(hdc, hBitmap, 0, pBH->biHeight, bits, &bmi, pEmrTransparentBlt->iUsageSrc);
+	HGDIOBJ holdBmp = SelectObject(hMemDC, hBitmap);
+	TransparentBlt(hdc, " << %d << ", " << %d << ", " << %d << ", " << %d << ", hMemDC, " << %d << ", " << %d << ", " << %d << ", " << %d << ", RGB(" << %d << ", " << %d << ", " << %d << "));
+	DeleteObject(SelectObject(hMemDC, holdBmp));
+	DeleteDC(hMemDC);
+)";
+	char buffer[640];
+	sprintf_s(buffer, transparentBlttext, (int)pEmrTransparentBlt->xDest, (int)pEmrTransparentBlt->yDest, (int)pEmrTransparentBlt->cxDest, (int)pEmrTransparentBlt->cyDest,
+		(int)pEmrTransparentBlt->xSrc, (int)pEmrTransparentBlt->ySrc, (int)pEmrTransparentBlt->cxSrc, (int)pEmrTransparentBlt->cySrc,
+		(int)GetRValue(color), (int)GetGValue(color), (int)GetBValue(color));
+	ss << buffer;
+	ss << "}\n";
+}
+
+void GradientFill(unsigned int dataSize, const unsigned char* data, std::ostream& ss)
+{
+	// rclBounds, nVer, nTri, ulMode, then the vertices and the meshes, whose
+	// counts must fit the record.
+	const size_t headerSize = offsetof(EMRGRADIENTFILL, Ver) - sizeof(EMR);
+	if (dataSize < headerSize)
+		return;
+	auto pEmrGradientFill = reinterpret_cast<const EMRGRADIENTFILL*>(data - sizeof(EMR));
+	uint64_t meshSize = pEmrGradientFill->ulMode == GRADIENT_FILL_TRIANGLE ? sizeof(GRADIENT_TRIANGLE) : sizeof(GRADIENT_RECT);
+	if ((uint64_t)pEmrGradientFill->nVer * sizeof(TRIVERTEX) + (uint64_t)pEmrGradientFill->nTri * meshSize > dataSize - headerSize)
+		return;
+	auto vertices = pEmrGradientFill->Ver;
+	// The meshes follow the vertices.
+	auto meshes = reinterpret_cast<const char*>(vertices + pEmrGradientFill->nVer);
+	ss << "{\n";
+	ArrayToString(ss, vertices, pEmrGradientFill->nVer, "vertices", 1);
+	if (pEmrGradientFill->ulMode == GRADIENT_FILL_TRIANGLE)
+		ArrayToString(ss, reinterpret_cast<const GRADIENT_TRIANGLE*>(meshes), pEmrGradientFill->nTri, "meshes", 1);
+	else
+		ArrayToString(ss, reinterpret_cast<const GRADIENT_RECT*>(meshes), pEmrGradientFill->nTri, "meshes", 1);
+	ss << "\tGradientFill(hdc, vertices, " << pEmrGradientFill->nVer << ", meshes, " << pEmrGradientFill->nTri
+		<< ", " << ConstantDictionary::GradientFillMode(pEmrGradientFill->ulMode) << ");\n";
+	ss << "}\n";
+}
+
+void StretchDIBits(unsigned int dataSize, const unsigned char* data, std::ostream& ss)
 {
 	auto pEmrStretchDIBits = reinterpret_cast<const EMRSTRETCHDIBITS*>(data - sizeof(EMR));
 	auto pBmi = reinterpret_cast<const BITMAPINFO*>((const char*)pEmrStretchDIBits + pEmrStretchDIBits->offBmiSrc);
@@ -492,13 +662,13 @@ void StretchDIBits(unsigned int dataSize, const unsigned char* data, std::string
 	ss << "}\n";
 }
 
-inline void AppendXForm(const unsigned char* data, std::stringstream& ss)
+inline void AppendXForm(const unsigned char* data, std::ostream& ss)
 {
 	auto pf = reinterpret_cast<const XFORM*>(data);
 	ss << "\tXFORM xf = {" << pf->eM11 << ", " << pf->eM12 << ", " << pf->eM21 << ", " << pf->eM22 << ", " << pf->eDx << ", " << pf->eDy << "};\n";
 }
 
-void SetWorldTransform(const unsigned char* data, std::stringstream& ss)
+void SetWorldTransform(const unsigned char* data, std::ostream& ss)
 {
 	ss << "{\n";
 	AppendXForm(data, ss);
@@ -506,7 +676,7 @@ void SetWorldTransform(const unsigned char* data, std::stringstream& ss)
 	ss << "}\n";
 }
 
-void ModifyWorldTransform(const unsigned char* data, std::stringstream& ss)
+void ModifyWorldTransform(const unsigned char* data, std::ostream& ss)
 {
 	ss << "{\n";
 	AppendXForm(data, ss);
@@ -516,13 +686,16 @@ void ModifyWorldTransform(const unsigned char* data, std::stringstream& ss)
 }
 
 template<typename CharType>
-void ExtTextOut(const unsigned char* data, std::stringstream& ss)
+void ExtTextOut(const unsigned char* data, std::ostream& ss)
 {
 	auto emrText = reinterpret_cast<const EMREXTTEXTOUTA*>(data - sizeof(EMR))->emrtext;
-	using xstring = std::basic_string<CharType, std::char_traits<CharType>, std::allocator<CharType>>;
-	xstring buffer(reinterpret_cast<const CharType*>(data - sizeof(EMR) + emrText.offString), emrText.nChars);
+	// Written up to the first null, if any.
+	auto text = reinterpret_cast<const CharType*>(data - sizeof(EMR) + emrText.offString);
+	size_t length = std::find(text, text + emrText.nChars, CharType()) - text;
 	ss << "{\n";
-	ss << "\tconst " << typeid(CharType).name() << "* text = " << CharTraits<CharType>::prefix() << "\"" << CharTraits<CharType>::convert(buffer).c_str() << "\";\n";
+	ss << "\tconst " << typeid(CharType).name() << "* text = " << CharTraits<CharType>::prefix() << "\"";
+	CharTraits<CharType>::write(ss, text, length);
+	ss << "\";\n";
 	ss << "\tRECT rect = ";
 	TypeToString(ss, emrText.rcl);
 	ss << ";\n";
@@ -532,6 +705,112 @@ void ExtTextOut(const unsigned char* data, std::stringstream& ss)
 	ss << "}\n";
 }
 
+void TranslateRecord(const unsigned char* record, std::ostream& ss);
+
+// One line saying what the comment carries, without its nested content.
+void CommentToString(std::ostream& ss, const EmfComment& comment)
+{
+	switch (comment.kind)
+	{
+	case EmfCommentKind::Private:
+		ss << "//Private GdiComment, " << comment.dataSize << " bytes\n";
+		break;
+	case EmfCommentKind::EmfPlus:
+		ss << "//EMF+ GdiComment, " << comment.payloadSize << " bytes\n";
+		break;
+	case EmfCommentKind::EmfSpool:
+		ss << "//EMR_COMMENT_EMFSPOOL, " << comment.payloadSize << " bytes\n";
+		break;
+	case EmfCommentKind::WindowsMetafile:
+		ss << "//EMR_COMMENT_WINDOWS_METAFILE, " << comment.payloadSize << " bytes\n";
+		break;
+	case EmfCommentKind::BeginGroup:
+		{
+			ArenaWString description(comment.descriptionLength, L'\0');
+			for (uint32_t i = 0; i < comment.descriptionLength; ++i)
+				description[i] = (wchar_t)(uint16_t)ReadI16(comment.description + 2 * i);
+			RECT rect = { comment.bounds.left, comment.bounds.top, comment.bounds.right, comment.bounds.bottom };
+			ss << "//EMR_COMMENT_BEGINGROUP ";
+			TypeToString(ss, rect);
+			ss << " L\"";
+			CharTraits<wchar_t>::write(ss, description.c_str(), wcslen(description.c_str()));
+			ss << "\"\n";
+		}
+		break;
+	case EmfCommentKind::EndGroup:
+		ss << "//EMR_COMMENT_ENDGROUP\n";
+		break;
+	case EmfCommentKind::MultiFormats:
+		{
+			RECT rect = { comment.bounds.left, comment.bounds.top, comment.bounds.right, comment.bounds.bottom };
+			ss << "//EMR_COMMENT_MULTIFORMATS ";
+			TypeToString(ss, rect);
+			ss << ", " << comment.formatCount << " formats\n";
+		}
+		break;
+	case EmfCommentKind::UnicodeString:
+		ss << "//EMR_COMMENT_UNICODE_STRING\n";
+		break;
+	case EmfCommentKind::UnicodeEnd:
+		ss << "//EMR_COMMENT_UNICODE_END\n";
+		break;
+	case EmfCommentKind::Public:
+		ss << "//Public GdiComment, " << comment.dataSize << " bytes\n";
+		break;
+	}
+}
+
+// The nested records of a comment are commented out, indented by their depth.
+class NestedCommentTranslator : public EmfNestingSink
+{
+public:
+	explicit NestedCommentTranslator(std::ostream& ss)
+		: m_ss(ss)
+	{
+	}
+	virtual void Record(const EmfRecordSpan& record, unsigned depth) override
+	{
+		ArenaStringStream text;
+		EmfComment comment;
+		// The walker goes into nested comments itself.
+		if (ParseComment(record, comment))
+			CommentToString(text, comment);
+		else
+			TranslateRecord(record.data, text);
+		ArenaString line;
+		while (std::getline(text, line))
+			Line(depth) << line << "\n";
+	}
+	virtual void EmfPlusRecord(const EmfPlusRecordSpan& record, unsigned depth) override
+	{
+		Line(depth + 1) << ConstantDictionary::EmfPlusRecordType(record.type) << ", flags 0x" << std::hex
+			<< record.flags << std::dec << ", " << record.dataSize << " bytes\n";
+	}
+	virtual void BeginMetafile(const EmfCommentFormat& format, unsigned depth) override
+	{
+		Line(depth) << "EMF, " << format.size << " bytes {\n";
+	}
+	virtual void EndMetafile(unsigned depth) override
+	{
+		Line(depth) << "}\n";
+	}
+	virtual void LimitReached(const EmfComment& comment, unsigned depth) override
+	{
+		Line(depth) << "Nested too deep or too big, skipped.\n";
+	}
+
+private:
+	std::ostream& m_ss;
+
+	std::ostream& Line(unsigned depth)
+	{
+		m_ss << "//";
+		for (unsigned i = 0; i < depth; ++i)
+			m_ss << '\t';
+		return m_ss;
+	}
+};
+
 BOOL CALLBACK EnumMetafileCallback(
 	Gdiplus::EmfPlusRecordType recordType,
 	unsigned int flags,
@@ -541,7 +820,7 @@ BOOL CALLBACK EnumMetafileCallback(
 {
 	using namespace Gdiplus;
 
-	std::stringstream& ss = *reinterpret_cast<std::stringstream*>(callbackData);
+	std::ostream& ss = *reinterpret_cast<std::ostream*>(callbackData);
 	switch (recordType)
 	{
 #pragma region "WmfRecord"
@@ -1008,6 +1287,7 @@ BOOL CALLBACK EnumMetafileCallback(
 		break;
 	case Gdiplus::EmfPlusRecordType::EmfRecordTypeOffsetClipRgn:
 		{
+			OnePoint("OffsetClipRgn", data, ss);
 		}
 		break;
 	case Gdiplus::EmfPlusRecordType::EmfRecordTypeMoveToEx:
@@ -1022,10 +1302,14 @@ BOOL CALLBACK EnumMetafileCallback(
 		break;
 	case Gdiplus::EmfPlusRecordType::EmfRecordTypeExcludeClipRect:
 		{
+			auto rect = reinterpret_cast<const RECTL*>(data);
+			ss << "ExcludeClipRect(hdc, " << rect->left << ", " << rect->top << ", " << rect->right << ", " << rect->bottom << ");\n";
 		}
 		break;
 	case Gdiplus::EmfPlusRecordType::EmfRecordTypeIntersectClipRect:
 		{
+			auto rect = reinterpret_cast<const RECTL*>(data);
+			ss << "IntersectClipRect(hdc, " << rect->left << ", " << rect->top << ", " << rect->right << ", " << rect->bottom << ");\n";
 		}
 		break;
 	case Gdiplus::EmfPlusRecordType::EmfRecordTypeScaleViewportExtEx:
@@ -1211,26 +1495,46 @@ BOOL CALLBACK EnumMetafileCallback(
 		break;
 	case Gdiplus::EmfPlusRecordType::EmfRecordTypeGdiComment:
 		{
+			EmfComment comment;
+			if (ParseComment(data, dataSize, comment))
+			{
+				CommentToString(ss, comment);
+				NestedCommentTranslator nested(ss);
+				WalkCommentContent(comment, 0, nested);
+			}
 		}
 		break;
 	case Gdiplus::EmfPlusRecordType::EmfRecordTypeFillRgn:
 		{
+			RegionRecord("FillRgn", dataSize, data, ss, true, false);
 		}
 		break;
 	case Gdiplus::EmfPlusRecordType::EmfRecordTypeFrameRgn:
 		{
+			RegionRecord("FrameRgn", dataSize, data, ss, true, true);
 		}
 		break;
 	case Gdiplus::EmfPlusRecordType::EmfRecordTypeInvertRgn:
 		{
+			RegionRecord("InvertRgn", dataSize, data, ss, false, false);
 		}
 		break;
 	case Gdiplus::EmfPlusRecordType::EmfRecordTypePaintRgn:
 		{
+			RegionRecord("PaintRgn", dataSize, data, ss, false, false);
 		}
 		break;
 	case Gdiplus::EmfPlusRecordType::EmfRecordTypeExtSelectClipRgn:
 		{
+			// cbRgnData, iMode, RgnData in device units.
+			if (dataSize < 8)
+				break;
+			uint32_t size = *(uint32_t*)data;
+			const char* mode = ConstantDictionary::ClipRgnMergeMode(*(int32_t*)(data + 4));
+			if (size == 0)
+				ss << "ExtSelectClipRgn(hdc, nullptr, " << mode << ");\n";
+			else if (size <= dataSize - 8 && RegionToString(ss, data + 8, size))
+				ss << "\tExtSelectClipRgn(hdc, hrgn, " << mode << ");\n\tDeleteObject(hrgn);\n}\n";
 		}
 		break;
 	case Gdiplus::EmfPlusRecordType::EmfRecordTypeBitBlt:
@@ -1402,6 +1706,7 @@ BOOL CALLBACK EnumMetafileCallback(
 		break;
 	case Gdiplus::EmfPlusRecordType::EmfRecordTypeAlphaBlend:
 		{
+			AlphaBlend(dataSize, data, ss);
 		}
 		break;
 	case Gdiplus::EmfPlusRecordType::EmfRecordTypeSetLayout:
@@ -1411,6 +1716,7 @@ BOOL CALLBACK EnumMetafileCallback(
 		break;
 	case Gdiplus::EmfPlusRecordType::EmfRecordTypeTransparentBlt:
 		{
+			TransparentBlt(dataSize, data, ss);
 		}
 		break;
 	case Gdiplus::EmfPlusRecordType::EmfRecordTypeReserved_117:
@@ -1419,6 +1725,7 @@ BOOL CALLBACK EnumMetafileCallback(
 		break;
 	case Gdiplus::EmfPlusRecordType::EmfRecordTypeGradientFill:
 		{
+			GradientFill(dataSize, data, ss);
 		}
 		break;
 	case Gdiplus::EmfPlusRecordType::EmfRecordTypeSetLinkedUFIs:
@@ -1694,3 +2001,12 @@ BOOL CALLBACK EnumMetafileCallback(
 	ss << "//End of " << ConstantDictionary::EmfPlusRecordType(recordType) << "\n";
 	return TRUE;
 }
+
+// Translate one raw record (EMR header included) the same way as when it is
+// enumerated by Graphics::EnumerateMetafile. EMF record types have the same
+// values in EMR_XXX and Gdiplus::EmfRecordTypeXXX.
+void TranslateRecord(const unsigned char* record, std::ostream& ss)
+{
+	auto emr = reinterpret_cast<const EMR*>(record);
+	EnumMetafileCallback((Gdiplus::EmfPlusRecordType)emr->iType, 0, emr->nSize - sizeof(EMR), record + sizeof(EMR), &ss);
+}
@@ -0,0 +1,1380 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+
+#include "ContentHash.h"
+#include "GdiBytecode.h"
+
+const uint32_t g_bytecodeMagic = 0x43424D45; // "EMBC"
+const uint32_t g_bytecodeVersion = 1;
+const size_t g_logFontSize = 92;
+const size_t g_poolAlignment = 8;
+
+static void PutUnsigned(std::vector<uint8_t>& out, uint64_t v)
+{
+	while (v >= 0x80)
+	{
+		out.push_back((uint8_t)(v | 0x80));
+		v >>= 7;
+	}
+	out.push_back((uint8_t)v);
+}
+
+static void PutSigned(std::vector<uint8_t>& out, int64_t v)
+{
+	PutUnsigned(out, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+static bool HasRange(const EmfRecordSpan& record, uint64_t offset, uint64_t size)
+{
+	return offset <= record.size && size <= record.size - offset;
+}
+
+// Distinct arrays of one kind.
+class BytecodePool
+{
+public:
+	uint32_t Add(const void* data, size_t size)
+	{
+		uint64_t hash = HashBytes((const uint8_t*)data, size);
+		auto range = m_index.equal_range(hash);
+		for (auto it = range.first; it != range.second; ++it)
+		{
+			const GdiPoolEntry& entry = m_entries[it->second];
+			if (entry.size == size && memcmp(m_data.data() + entry.offset, data, size) == 0)
+				return it->second;
+		}
+		uint32_t index = (uint32_t)m_entries.size();
+		m_entries.push_back({ m_data.size(), size });
+		m_data.insert(m_data.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+		m_data.resize((m_data.size() + g_poolAlignment - 1) / g_poolAlignment * g_poolAlignment, 0);
+		m_index.emplace(hash, index);
+		return index;
+	}
+
+	// Append data then the index to out, the entry offsets made relative to the file start.
+	void Write(std::vector<uint8_t>& out, GdiPoolHeader& header) const
+	{
+		uint64_t dataOffset = out.size();
+		out.insert(out.end(), m_data.begin(), m_data.end());
+		header.indexOffset = out.size();
+		header.count = (uint32_t)m_entries.size();
+		header.reserved = 0;
+		for (GdiPoolEntry entry : m_entries)
+		{
+			entry.offset += dataOffset;
+			const uint8_t* p = (const uint8_t*)&entry;
+			out.insert(out.end(), p, p + sizeof(entry));
+		}
+	}
+
+private:
+	std::vector<uint8_t> m_data;
+	std::vector<GdiPoolEntry> m_entries;
+	std::unordered_multimap<uint64_t, uint32_t> m_index;
+};
+
+class BytecodeCompiler
+{
+public:
+	BytecodeCompiler()
+		: m_handleCount(0)
+		, m_callCount(0)
+	{
+	}
+
+	void Record(const EmfRecordSpan& record);
+	void Finish(std::vector<uint8_t>& bytecode);
+
+private:
+	std::vector<uint8_t> m_code;
+	BytecodePool m_pools[GdiPoolCount];
+	std::vector<uint8_t> m_points;
+	std::vector<uint32_t> m_deltas;
+	uint32_t m_handleCount;
+	uint32_t m_callCount;
+
+	void Op(EmrType op)
+	{
+		m_code.push_back((uint8_t)op);
+		++m_callCount;
+	}
+	void Unsigned(uint64_t v)
+	{
+		PutUnsigned(m_code, v);
+	}
+	void Signed(int64_t v)
+	{
+		PutSigned(m_code, v);
+	}
+	void Float(const uint8_t* p)
+	{
+		m_code.insert(m_code.end(), p, p + sizeof(float));
+	}
+	// Index + 1 of the array in pool, 0 for none.
+	void Optional(GdiPool pool, const uint8_t* data, size_t size)
+	{
+		Unsigned(size ? (uint64_t)m_pools[pool].Add(data, size) + 1 : 0);
+	}
+	// Pool index of the points at p, 16 bit ones widened.
+	uint32_t Points(const uint8_t* p, uint32_t count, bool packed);
+	void Poly(const EmfRecordSpan& record, EmrType op, bool packed);
+	void PolyPoly(const EmfRecordSpan& record, EmrType op, bool packed);
+	void Blt(const EmfRecordSpan& record);
+	void Text(const EmfRecordSpan& record, bool wide);
+};
+
+uint32_t BytecodeCompiler::Points(const uint8_t* p, uint32_t count, bool packed)
+{
+	// Deltas wrap around in 32 bits, zigzag encoded.
+	m_deltas.resize(count * 2);
+	uint32_t x = 0, y = 0, all = 0;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		uint32_t px = packed ? (uint32_t)ReadI16(p + i * 4) : ReadU32(p + i * 8);
+		uint32_t py = packed ? (uint32_t)ReadI16(p + i * 4 + 2) : ReadU32(p + i * 8 + 4);
+		int32_t dx = (int32_t)(px - x), dy = (int32_t)(py - y);
+		m_deltas[i * 2] = ((uint32_t)dx << 1) ^ (uint32_t)(dx >> 31);
+		m_deltas[i * 2 + 1] = ((uint32_t)dy << 1) ^ (uint32_t)(dy >> 31);
+		all |= m_deltas[i * 2] | m_deltas[i * 2 + 1];
+		x = px;
+		y = py;
+	}
+	uint32_t width = all >> 24 ? 4 : all >> 16 ? 3 : all >> 8 ? 2 : 1;
+	m_points.clear();
+	PutUnsigned(m_points, count);
+	m_points.push_back((uint8_t)width);
+	for (uint32_t delta : m_deltas)
+	{
+		for (uint32_t i = 0; i < width; ++i)
+			m_points.push_back((uint8_t)(delta >> i * 8));
+	}
+	return m_pools[GdiPointPool].Add(m_points.data(), m_points.size());
+}
+
+void BytecodeCompiler::Poly(const EmfRecordSpan& record, EmrType op, bool packed)
+{
+	// rclBounds, cpts, points
+	if (!HasRange(record, 24, 4))
+		return;
+	uint32_t count = ReadU32(record.data + 24);
+	if (!HasRange(record, 28, (uint64_t)count * (packed ? 4 : 8)))
+		return;
+	Op(op);
+	Unsigned(Points(record.data + 28, count, packed));
+}
+
+void BytecodeCompiler::PolyPoly(const EmfRecordSpan& record, EmrType op, bool packed)
+{
+	// rclBounds, nPolys, cpts, aPolyCounts, points
+	if (!HasRange(record, 24, 8))
+		return;
+	uint32_t polyCount = ReadU32(record.data + 24), count = ReadU32(record.data + 28);
+	uint64_t pointsOffset = 32 + (uint64_t)polyCount * 4;
+	if (!HasRange(record, 32, (uint64_t)polyCount * 4) || !HasRange(record, pointsOffset, (uint64_t)count * (packed ? 4 : 8)))
+		return;
+	uint64_t total = 0;
+	for (uint32_t i = 0; i < polyCount; ++i)
+		total += ReadU32(record.data + 32 + i * 4);
+	if (total > count)
+		return;
+	Op(op);
+	Unsigned(Points(record.data + pointsOffset, count, packed));
+	Optional(GdiBlobPool, record.data + 32, (size_t)polyCount * 4);
+}
+
+void BytecodeCompiler::Blt(const EmfRecordSpan& record)
+{
+	const uint8_t* p = record.data;
+	int32_t xDest, yDest, cxDest, cyDest, xSrc, ySrc, cxSrc = 0, cySrc = 0;
+	uint32_t rop, usage, offBmi, bmiSize, offBits, bitsSize;
+	if ((EmrType)record.type == EmrType::StretchDIBits)
+	{
+		if (!HasRange(record, 0, 80))
+			return;
+		xDest = ReadI32(p + 24);
+		yDest = ReadI32(p + 28);
+		xSrc = ReadI32(p + 32);
+		ySrc = ReadI32(p + 36);
+		cxSrc = ReadI32(p + 40);
+		cySrc = ReadI32(p + 44);
+		offBmi = ReadU32(p + 48);
+		bmiSize = ReadU32(p + 52);
+		offBits = ReadU32(p + 56);
+		bitsSize = ReadU32(p + 60);
+		usage = ReadU32(p + 64);
+		rop = ReadU32(p + 68);
+		cxDest = ReadI32(p + 72);
+		cyDest = ReadI32(p + 76);
+	}
+	else
+	{
+		bool stretch = (EmrType)record.type == EmrType::StretchBlt;
+		if (!HasRange(record, 0, stretch ? 108 : 100))
+			return;
+		xDest = ReadI32(p + 24);
+		yDest = ReadI32(p + 28);
+		cxDest = ReadI32(p + 32);
+		cyDest = ReadI32(p + 36);
+		rop = ReadU32(p + 40);
+		xSrc = ReadI32(p + 44);
+		ySrc = ReadI32(p + 48);
+		usage = ReadU32(p + 80);
+		offBmi = ReadU32(p + 84);
+		bmiSize = ReadU32(p + 88);
+		offBits = ReadU32(p + 92);
+		bitsSize = ReadU32(p + 96);
+		if (stretch)
+		{
+			cxSrc = ReadI32(p + 100);
+			cySrc = ReadI32(p + 104);
+		}
+	}
+	if (!HasRange(record, offBmi, bmiSize) || !HasRange(record, offBits, bitsSize))
+		return;
+	Op((EmrType)record.type);
+	for (int32_t v : { xDest, yDest, cxDest, cyDest, xSrc, ySrc, cxSrc, cySrc })
+		Signed(v);
+	Unsigned(rop);
+	Unsigned(usage);
+	Optional(GdiBlobPool, p + offBmi, bmiSize);
+	Optional(GdiBlobPool, p + offBits, bitsSize);
+}
+
+void BytecodeCompiler::Text(const EmfRecordSpan& record, bool wide)
+{
+	// rclBounds, iGraphicsMode, exScale, eyScale, then EMRTEXT: ptlReference,
+	// nChars, offString, fOptions, rcl, offDx
+	const uint8_t* p = record.data;
+	if (!HasRange(record, 0, 76))
+		return;
+	uint32_t count = ReadU32(p + 44), offString = ReadU32(p + 48);
+	size_t size = (size_t)count * (wide ? 2 : 1);
+	if (!HasRange(record, offString, size))
+		return;
+	Op((EmrType)record.type);
+	Signed(ReadI32(p + 36));
+	Signed(ReadI32(p + 40));
+	Unsigned(ReadU32(p + 52));
+	for (int i = 0; i < 4; ++i)
+		Signed(ReadI32(p + 56 + i * 4));
+	Unsigned(m_pools[GdiStringPool].Add(p + offString, size));
+}
+
+void BytecodeCompiler::Record(const EmfRecordSpan& record)
+{
+	const uint8_t* p = record.data + sizeof(EmfRecordHeader);
+	// Parameter words after the EMR header.
+	auto has = [&record](size_t words) { return HasRange(record, sizeof(EmfRecordHeader), words * 4); };
+	EmrType type = (EmrType)record.type;
+	switch (type)
+	{
+	case EmrType::Header:
+		// nHandles, a WORD
+		if (HasRange(record, 56, 4))
+			m_handleCount = ReadU32(record.data + 56) & 0xFFFF;
+		break;
+	case EmrType::PolyBezier:
+	case EmrType::Polygon:
+	case EmrType::Polyline:
+	case EmrType::PolyBezierTo:
+	case EmrType::PolyLineTo:
+		Poly(record, type, false);
+		break;
+	case EmrType::PolyBezier16:
+		Poly(record, EmrType::PolyBezier, true);
+		break;
+	case EmrType::Polygon16:
+		Poly(record, EmrType::Polygon, true);
+		break;
+	case EmrType::Polyline16:
+		Poly(record, EmrType::Polyline, true);
+		break;
+	case EmrType::PolyBezierTo16:
+		Poly(record, EmrType::PolyBezierTo, true);
+		break;
+	case EmrType::PolylineTo16:
+		Poly(record, EmrType::PolyLineTo, true);
+		break;
+	case EmrType::PolyPolyline:
+	case EmrType::PolyPolygon:
+		PolyPoly(record, type, false);
+		break;
+	case EmrType::PolyPolyline16:
+		PolyPoly(record, EmrType::PolyPolyline, true);
+		break;
+	case EmrType::PolyPolygon16:
+		PolyPoly(record, EmrType::PolyPolygon, true);
+		break;
+	case EmrType::SetWindowExtEx:
+	case EmrType::SetWindowOrgEx:
+	case EmrType::SetViewportExtEx:
+	case EmrType::SetViewportOrgEx:
+	case EmrType::MoveToEx:
+	case EmrType::LineTo:
+		if (!has(2))
+			return;
+		Op(type);
+		Signed(ReadI32(p));
+		Signed(ReadI32(p + 4));
+		break;
+	case EmrType::SetMapMode:
+	case EmrType::SetBkMode:
+	case EmrType::SetPolyFillMode:
+	case EmrType::SetROP2:
+	case EmrType::SetStretchBltMode:
+	case EmrType::SetTextAlign:
+	case EmrType::SetTextColor:
+	case EmrType::RestoreDC:
+	case EmrType::SelectClipPath:
+	case EmrType::SetICMMode:
+	case EmrType::SetLayout:
+		if (!has(1))
+			return;
+		Op(type);
+		Signed(ReadI32(p));
+		break;
+	case EmrType::SetMetaRgn:
+	case EmrType::SaveDC:
+	case EmrType::RealizePalette:
+	case EmrType::BeginPath:
+	case EmrType::EndPath:
+	case EmrType::CloseFigure:
+	case EmrType::FlattenPath:
+	case EmrType::WidenPath:
+	case EmrType::AbortPath:
+		Op(type);
+		break;
+	case EmrType::SetWorldTransform:
+	case EmrType::ModifyWorldTransform:
+		if (!has(type == EmrType::SetWorldTransform ? 6 : 7))
+			return;
+		Op(type);
+		for (int i = 0; i < 6; ++i)
+			Float(p + i * 4);
+		if (type == EmrType::ModifyWorldTransform)
+			Signed(ReadI32(p + 24));
+		break;
+	case EmrType::SelectObject:
+	case EmrType::DeleteObject:
+		if (!has(1))
+			return;
+		Op(type);
+		Unsigned(ReadU32(p));
+		break;
+	case EmrType::CreatePen:
+		// ihPen, lopnStyle, lopnWidth.x, lopnWidth.y, lopnColor
+		if (!has(5))
+			return;
+		Op(type);
+		Unsigned(ReadU32(p));
+		Unsigned(ReadU32(p + 4));
+		Signed(ReadI32(p + 8));
+		Unsigned(ReadU32(p + 16));
+		break;
+	case EmrType::CreateBrushIndirect:
+		// ihBrush, lbStyle, lbColor, lbHatch
+		if (!has(4))
+			return;
+		Op(type);
+		for (int i = 0; i < 4; ++i)
+			Unsigned(ReadU32(p + i * 4));
+		break;
+	case EmrType::ExtCreatePen:
+		{
+			// ihPen, offBmi, cbBmi, offBits, cbBits, elpPenStyle, elpWidth,
+			// elpBrushStyle, elpColor, elpHatch, elpNumEntries, elpStyleEntry
+			if (!has(11))
+				return;
+			uint32_t entries = ReadU32(p + 40);
+			if (!HasRange(record, 52, (uint64_t)entries * 4))
+				return;
+			Op(type);
+			Unsigned(ReadU32(p));
+			for (int i = 0; i < 5; ++i)
+				Unsigned(ReadU32(p + 20 + i * 4));
+			Optional(GdiBlobPool, p + 44, (size_t)entries * 4);
+		}
+		break;
+	case EmrType::ExtCreateFontIndirectW:
+		// ihFont, LOGFONTW
+		if (!HasRange(record, 12, g_logFontSize))
+			return;
+		Op(type);
+		Unsigned(ReadU32(p));
+		Unsigned(m_pools[GdiFontPool].Add(p + 4, g_logFontSize));
+		break;
+	case EmrType::AngleArc:
+		// ptlCenter, nRadius, eStartAngle, eSweepAngle
+		if (!has(5))
+			return;
+		Op(type);
+		Signed(ReadI32(p));
+		Signed(ReadI32(p + 4));
+		Unsigned(ReadU32(p + 8));
+		Float(p + 12);
+		Float(p + 16);
+		break;
+	case EmrType::Ellipse:
+	case EmrType::Rectangle:
+	case EmrType::RoundRect:
+	case EmrType::Arc:
+	case EmrType::Chord:
+	case EmrType::Pie:
+	case EmrType::ArcTo:
+		{
+			int count = type == EmrType::Ellipse || type == EmrType::Rectangle ? 4 : type == EmrType::RoundRect ? 6 : 8;
+			if (!has(count))
+				return;
+			Op(type);
+			for (int i = 0; i < count; ++i)
+				Signed(ReadI32(p + i * 4));
+		}
+		break;
+	case EmrType::BitBlt:
+	case EmrType::StretchBlt:
+	case EmrType::StretchDIBits:
+		Blt(record);
+		break;
+	case EmrType::ExtTextOutA:
+	case EmrType::ExtTextOutW:
+		Text(record, type == EmrType::ExtTextOutW);
+		break;
+	default:
+		// Left out by the translator too.
+		break;
+	}
+}
+
+void BytecodeCompiler::Finish(std::vector<uint8_t>& bytecode)
+{
+	GdiBytecodeHeader header = {};
+	header.magic = g_bytecodeMagic;
+	header.version = g_bytecodeVersion;
+	header.handleCount = m_handleCount;
+	header.callCount = m_callCount;
+	bytecode.assign(sizeof(header), 0);
+	header.codeOffset = bytecode.size();
+	header.codeSize = m_code.size();
+	bytecode.insert(bytecode.end(), m_code.begin(), m_code.end());
+	for (int pool = 0; pool < GdiPoolCount; ++pool)
+	{
+		bytecode.resize((bytecode.size() + g_poolAlignment - 1) / g_poolAlignment * g_poolAlignment, 0);
+		m_pools[pool].Write(bytecode, header.pools[pool]);
+	}
+	memcpy(bytecode.data(), &header, sizeof(header));
+}
+
+void CompileGdiBytecode(const std::vector<EmfRecordSpan>& records, std::vector<uint8_t>& bytecode)
+{
+	BytecodeCompiler compiler;
+	for (const EmfRecordSpan& record : records)
+		compiler.Record(record);
+	compiler.Finish(bytecode);
+}
+
+GdiBytecode::GdiBytecode()
+	: m_data(nullptr)
+	, m_size(0)
+	, m_header(nullptr)
+{
+}
+
+bool GdiBytecode::Open(const std::string& fileName)
+{
+	m_header = nullptr;
+	if (!m_file.Open(fileName))
+		return false;
+	return Load(m_file.Data(), m_file.Size());
+}
+
+bool GdiBytecode::Load(const uint8_t* data, size_t size)
+{
+	m_header = nullptr;
+	if (size < sizeof(GdiBytecodeHeader) || ((uintptr_t)data % g_poolAlignment))
+		return false;
+	auto header = reinterpret_cast<const GdiBytecodeHeader*>(data);
+	if (header->magic != g_bytecodeMagic || header->version != g_bytecodeVersion)
+		return false;
+	if (header->codeOffset > size || header->codeSize > size - header->codeOffset)
+		return false;
+	for (const GdiPoolHeader& pool : header->pools)
+	{
+		if ((pool.indexOffset % g_poolAlignment) || pool.indexOffset > size || (uint64_t)pool.count * sizeof(GdiPoolEntry) > size - pool.indexOffset)
+			return false;
+	}
+	m_data = data;
+	m_size = size;
+	m_header = header;
+	return true;
+}
+
+const uint8_t* GdiBytecode::Entry(GdiPool pool, uint64_t index, size_t& size) const
+{
+	const GdiPoolHeader& header = m_header->pools[pool];
+	if (index >= header.count)
+		return nullptr;
+	const GdiPoolEntry& entry = reinterpret_cast<const GdiPoolEntry*>(m_data + header.indexOffset)[index];
+	if (entry.offset > m_size || entry.size > m_size - entry.offset || (entry.offset % g_poolAlignment))
+		return nullptr;
+	size = (size_t)entry.size;
+	return m_data + entry.offset;
+}
+
+// Reads the operands of the code, past its end they read as 0 and set bad.
+class CodeReader
+{
+public:
+	CodeReader(const uint8_t* p, const uint8_t* end)
+		: m_p(p)
+		, m_end(end)
+		, m_bad(false)
+	{
+	}
+
+	bool AtEnd() const
+	{
+		return m_p == m_end;
+	}
+	bool Bad() const
+	{
+		return m_bad;
+	}
+	size_t Remaining() const
+	{
+		return m_end - m_p;
+	}
+	uint8_t Byte()
+	{
+		if (m_p == m_end)
+		{
+			m_bad = true;
+			return 0;
+		}
+		return *m_p++;
+	}
+	uint64_t Unsigned()
+	{
+		// Most are one byte.
+		if (m_p != m_end && !(*m_p & 0x80))
+			return *m_p++;
+		if (m_end - m_p >= 10)
+		{
+			// No varint is longer, so no bound checks.
+			uint64_t v = 0;
+			for (int shift = 0; shift < 64; shift += 7)
+			{
+				uint8_t b = *m_p++;
+				v |= (uint64_t)(b & 0x7F) << shift;
+				if (!(b & 0x80))
+					return v;
+			}
+			m_bad = true;
+			m_p = m_end;
+			return 0;
+		}
+		uint64_t v = 0;
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			if (m_p == m_end)
+			{
+				m_bad = true;
+				return 0;
+			}
+			uint8_t b = *m_p++;
+			v |= (uint64_t)(b & 0x7F) << shift;
+			if (!(b & 0x80))
+				return v;
+		}
+		m_bad = true;
+		return 0;
+	}
+	int32_t Signed()
+	{
+		uint64_t v = Unsigned();
+		return (int32_t)(int64_t)((v >> 1) ^ (0 - (v & 1)));
+	}
+	float Float()
+	{
+		if (m_end - m_p < (ptrdiff_t)sizeof(float))
+		{
+			m_bad = true;
+			m_p = m_end;
+			return 0;
+		}
+		float f = ReadF32(m_p);
+		m_p += sizeof(float);
+		return f;
+	}
+
+private:
+	const uint8_t* m_p;
+	const uint8_t* m_end;
+	bool m_bad;
+};
+
+// Every delta has Width bytes, a fixed width keeps the loop free of branches.
+template<int Width>
+static void DecodePoints(const uint8_t* p, std::vector<GdiPoint>& points)
+{
+	uint32_t x = 0, y = 0;
+	for (GdiPoint& point : points)
+	{
+		uint32_t dx = 0, dy = 0;
+		for (int i = 0; i < Width; ++i)
+		{
+			dx |= (uint32_t)p[i] << i * 8;
+			dy |= (uint32_t)p[Width + i] << i * 8;
+		}
+		p += Width * 2;
+		x += (dx >> 1) ^ (0 - (dx & 1));
+		y += (dy >> 1) ^ (0 - (dy & 1));
+		point.x = (int32_t)x;
+		point.y = (int32_t)y;
+	}
+}
+
+const GdiPoint* GdiBytecode::Points(uint64_t index, std::vector<GdiPoint>& points) const
+{
+	size_t size;
+	const uint8_t* p = Entry(GdiPointPool, index, size);
+	if (!p)
+		return nullptr;
+	CodeReader r(p, p + size);
+	uint64_t count = r.Unsigned();
+	uint8_t width = r.Byte();
+	if (r.Bad() || width < 1 || width > 4 || count * 2 * width != r.Remaining())
+		return nullptr;
+	points.resize((size_t)count);
+	const uint8_t* deltas = p + size - r.Remaining();
+	switch (width)
+	{
+	case 1:
+		DecodePoints<1>(deltas, points);
+		break;
+	case 2:
+		DecodePoints<2>(deltas, points);
+		break;
+	case 3:
+		DecodePoints<3>(deltas, points);
+		break;
+	default:
+		DecodePoints<4>(deltas, points);
+		break;
+	}
+	return points.data();
+}
+
+bool GdiBytecode::Replay(GdiBackend& backend) const
+{
+	if (!m_header)
+		return false;
+	const uint8_t* code = m_data + m_header->codeOffset;
+	CodeReader r(code, code + m_header->codeSize);
+	std::vector<GdiPoint> points;
+	size_t size;
+	backend.Begin(m_header->handleCount);
+	while (!r.AtEnd())
+	{
+		EmrType op = (EmrType)r.Byte();
+		switch (op)
+		{
+		case EmrType::PolyBezier:
+		case EmrType::Polygon:
+		case EmrType::Polyline:
+		case EmrType::PolyBezierTo:
+		case EmrType::PolyLineTo:
+			{
+				if (!Points(r.Unsigned(), points) || r.Bad())
+					return false;
+				backend.Poly(op, points.data(), (uint32_t)points.size());
+			}
+			break;
+		case EmrType::PolyPolyline:
+		case EmrType::PolyPolygon:
+			{
+				size_t countsSize = 0;
+				bool hasPoints = Points(r.Unsigned(), points) != nullptr;
+				uint64_t countsIndex = r.Unsigned();
+				auto counts = countsIndex ? reinterpret_cast<const uint32_t*>(Entry(GdiBlobPool, countsIndex - 1, countsSize)) : nullptr;
+				if (!hasPoints || (countsIndex && !counts) || r.Bad())
+					return false;
+				uint32_t polyCount = (uint32_t)(countsSize / sizeof(uint32_t));
+				uint64_t total = 0;
+				for (uint32_t i = 0; i < polyCount; ++i)
+					total += counts[i];
+				if (total > points.size())
+					return false;
+				backend.PolyPoly(op, points.data(), counts, polyCount);
+			}
+			break;
+		case EmrType::SetWindowExtEx:
+		case EmrType::SetWindowOrgEx:
+		case EmrType::SetViewportExtEx:
+		case EmrType::SetViewportOrgEx:
+		case EmrType::MoveToEx:
+		case EmrType::LineTo:
+			{
+				int32_t x = r.Signed();
+				int32_t y = r.Signed();
+				backend.Point(op, x, y);
+			}
+			break;
+		case EmrType::SetMapMode:
+		case EmrType::SetBkMode:
+		case EmrType::SetPolyFillMode:
+		case EmrType::SetROP2:
+		case EmrType::SetStretchBltMode:
+		case EmrType::SetTextAlign:
+		case EmrType::SetTextColor:
+		case EmrType::RestoreDC:
+		case EmrType::SelectClipPath:
+		case EmrType::SetICMMode:
+		case EmrType::SetLayout:
+			backend.SetValue(op, r.Signed());
+			break;
+		case EmrType::SetMetaRgn:
+		case EmrType::SaveDC:
+		case EmrType::RealizePalette:
+		case EmrType::BeginPath:
+		case EmrType::EndPath:
+		case EmrType::CloseFigure:
+		case EmrType::FlattenPath:
+		case EmrType::WidenPath:
+		case EmrType::AbortPath:
+			backend.Command(op);
+			break;
+		case EmrType::SetWorldTransform:
+		case EmrType::ModifyWorldTransform:
+			{
+				GdiXform xf;
+				xf.m11 = r.Float();
+				xf.m12 = r.Float();
+				xf.m21 = r.Float();
+				xf.m22 = r.Float();
+				xf.dx = r.Float();
+				xf.dy = r.Float();
+				int32_t mode = op == EmrType::ModifyWorldTransform ? r.Signed() : 0;
+				if (r.Bad())
+					return false;
+				backend.Transform(op, xf, mode);
+			}
+			break;
+		case EmrType::SelectObject:
+			backend.SelectObject((uint32_t)r.Unsigned());
+			break;
+		case EmrType::DeleteObject:
+			backend.DeleteObject((uint32_t)r.Unsigned());
+			break;
+		case EmrType::CreatePen:
+			{
+				uint32_t index = (uint32_t)r.Unsigned();
+				uint32_t style = (uint32_t)r.Unsigned();
+				int32_t width = r.Signed();
+				uint32_t color = (uint32_t)r.Unsigned();
+				backend.CreatePen(index, style, width, color);
+			}
+			break;
+		case EmrType::CreateBrushIndirect:
+			{
+				uint32_t index = (uint32_t)r.Unsigned();
+				uint32_t style = (uint32_t)r.Unsigned();
+				uint32_t color = (uint32_t)r.Unsigned();
+				uint32_t hatch = (uint32_t)r.Unsigned();
+				backend.CreateBrush(index, style, color, hatch);
+			}
+			break;
+		case EmrType::ExtCreatePen:
+			{
+				uint32_t values[6];
+				for (uint32_t& v : values)
+					v = (uint32_t)r.Unsigned();
+				size_t stylesSize = 0;
+				uint64_t stylesIndex = r.Unsigned();
+				auto styles = stylesIndex ? reinterpret_cast<const uint32_t*>(Entry(GdiBlobPool, stylesIndex - 1, stylesSize)) : nullptr;
+				if ((stylesIndex && !styles) || r.Bad())
+					return false;
+				backend.ExtCreatePen(values[0], values[1], values[2], values[3], values[4], values[5], styles, (uint32_t)(stylesSize / sizeof(uint32_t)));
+			}
+			break;
+		case EmrType::ExtCreateFontIndirectW:
+			{
+				uint32_t index = (uint32_t)r.Unsigned();
+				const uint8_t* logFont = Entry(GdiFontPool, r.Unsigned(), size);
+				if (!logFont || size != g_logFontSize || r.Bad())
+					return false;
+				backend.CreateLogFont(index, logFont);
+			}
+			break;
+		case EmrType::AngleArc:
+			{
+				int32_t x = r.Signed();
+				int32_t y = r.Signed();
+				uint32_t radius = (uint32_t)r.Unsigned();
+				float startAngle = r.Float();
+				float sweepAngle = r.Float();
+				backend.AngleArc(x, y, radius, startAngle, sweepAngle);
+			}
+			break;
+		case EmrType::Ellipse:
+		case EmrType::Rectangle:
+		case EmrType::RoundRect:
+		case EmrType::Arc:
+		case EmrType::Chord:
+		case EmrType::Pie:
+		case EmrType::ArcTo:
+			{
+				int count = op == EmrType::Ellipse || op == EmrType::Rectangle ? 4 : op == EmrType::RoundRect ? 6 : 8;
+				int32_t values[8];
+				for (int i = 0; i < count; ++i)
+					values[i] = r.Signed();
+				backend.Shape(op, values);
+			}
+			break;
+		case EmrType::BitBlt:
+		case EmrType::StretchBlt:
+		case EmrType::StretchDIBits:
+			{
+				GdiBlt blt = {};
+				blt.type = op;
+				int32_t* values[] = { &blt.xDest, &blt.yDest, &blt.cxDest, &blt.cyDest, &blt.xSrc, &blt.ySrc, &blt.cxSrc, &blt.cySrc };
+				for (int32_t* v : values)
+					*v = r.Signed();
+				blt.rop = (uint32_t)r.Unsigned();
+				blt.usage = (uint32_t)r.Unsigned();
+				uint64_t bmiIndex = r.Unsigned(), bitsIndex = r.Unsigned();
+				if (bmiIndex)
+				{
+					blt.bmi = Entry(GdiBlobPool, bmiIndex - 1, size);
+					blt.bmiSize = (uint32_t)size;
+				}
+				if (bitsIndex)
+				{
+					blt.bits = Entry(GdiBlobPool, bitsIndex - 1, size);
+					blt.bitsSize = (uint32_t)size;
+				}
+				if ((bmiIndex && !blt.bmi) || (bitsIndex && !blt.bits) || r.Bad())
+					return false;
+				backend.Blt(blt);
+			}
+			break;
+		case EmrType::ExtTextOutA:
+		case EmrType::ExtTextOutW:
+			{
+				int32_t x = r.Signed();
+				int32_t y = r.Signed();
+				uint32_t options = (uint32_t)r.Unsigned();
+				EmfRectL rect;
+				rect.left = r.Signed();
+				rect.top = r.Signed();
+				rect.right = r.Signed();
+				rect.bottom = r.Signed();
+				const uint8_t* chars = Entry(GdiStringPool, r.Unsigned(), size);
+				if (!chars || r.Bad())
+					return false;
+				backend.Text(op, x, y, options, rect, chars, (uint32_t)(op == EmrType::ExtTextOutW ? size / 2 : size));
+			}
+			break;
+		default:
+			return false;
+		}
+		if (r.Bad())
+			return false;
+	}
+	backend.End();
+	return true;
+}
+
+static const char* OpName(EmrType op)
+{
+	switch (op)
+	{
+	case EmrType::PolyBezier: return "PolyBezier";
+	case EmrType::Polygon: return "Polygon";
+	case EmrType::Polyline: return "Polyline";
+	case EmrType::PolyBezierTo: return "PolyBezierTo";
+	case EmrType::PolyLineTo: return "PolylineTo";
+	case EmrType::PolyPolyline: return "PolyPolyline";
+	case EmrType::PolyPolygon: return "PolyPolygon";
+	case EmrType::SetWindowExtEx: return "SetWindowExtEx";
+	case EmrType::SetWindowOrgEx: return "SetWindowOrgEx";
+	case EmrType::SetViewportExtEx: return "SetViewportExtEx";
+	case EmrType::SetViewportOrgEx: return "SetViewportOrgEx";
+	case EmrType::MoveToEx: return "MoveToEx";
+	case EmrType::LineTo: return "LineTo";
+	case EmrType::SetMapMode: return "SetMapMode";
+	case EmrType::SetBkMode: return "SetBkMode";
+	case EmrType::SetPolyFillMode: return "SetPolyFillMode";
+	case EmrType::SetROP2: return "SetROP2";
+	case EmrType::SetStretchBltMode: return "SetStretchBltMode";
+	case EmrType::SetTextAlign: return "SetTextAlign";
+	case EmrType::SetTextColor: return "SetTextColor";
+	case EmrType::RestoreDC: return "RestoreDC";
+	case EmrType::SelectClipPath: return "SelectClipPath";
+	case EmrType::SetICMMode: return "SetICMMode";
+	case EmrType::SetLayout: return "SetLayout";
+	case EmrType::SetMetaRgn: return "SetMetaRgn";
+	case EmrType::SaveDC: return "SaveDC";
+	case EmrType::RealizePalette: return "RealizePalette";
+	case EmrType::BeginPath: return "BeginPath";
+	case EmrType::EndPath: return "EndPath";
+	case EmrType::CloseFigure: return "CloseFigure";
+	case EmrType::FlattenPath: return "FlattenPath";
+	case EmrType::WidenPath: return "WidenPath";
+	case EmrType::AbortPath: return "AbortPath";
+	case EmrType::SetWorldTransform: return "SetWorldTransform";
+	case EmrType::ModifyWorldTransform: return "ModifyWorldTransform";
+	case EmrType::Ellipse: return "Ellipse";
+	case EmrType::Rectangle: return "Rectangle";
+	case EmrType::RoundRect: return "RoundRect";
+	case EmrType::Arc: return "Arc";
+	case EmrType::Chord: return "Chord";
+	case EmrType::Pie: return "Pie";
+	case EmrType::ArcTo: return "ArcTo";
+	case EmrType::BitBlt: return "BitBlt";
+	case EmrType::StretchBlt: return "StretchBlt";
+	case EmrType::StretchDIBits: return "StretchDIBits";
+	case EmrType::ExtTextOutA: return "ExtTextOutA";
+	case EmrType::ExtTextOutW: return "ExtTextOutW";
+	default: return "?";
+	}
+}
+
+GdiCallRecorder::GdiCallRecorder(std::ostream& os)
+	: m_os(os)
+{
+}
+
+void GdiCallRecorder::Begin(uint32_t handleCount)
+{
+	m_os << "SetGraphicsMode GM_ADVANCED, " << handleCount << " handles\n";
+}
+
+void GdiCallRecorder::Poly(EmrType op, const GdiPoint* points, uint32_t count)
+{
+	m_os << OpName(op) << ' ' << count;
+	for (uint32_t i = 0; i < count; ++i)
+		m_os << " {" << points[i].x << ',' << points[i].y << '}';
+	m_os << '\n';
+}
+
+void GdiCallRecorder::PolyPoly(EmrType op, const GdiPoint* points, const uint32_t* counts, uint32_t polyCount)
+{
+	m_os << OpName(op) << ' ' << polyCount;
+	for (uint32_t i = 0; i < polyCount; ++i)
+	{
+		m_os << " [";
+		for (uint32_t j = 0; j < counts[i]; ++j, ++points)
+			m_os << (j ? " {" : "{") << points->x << ',' << points->y << '}';
+		m_os << ']';
+	}
+	m_os << '\n';
+}
+
+void GdiCallRecorder::Point(EmrType op, int32_t x, int32_t y)
+{
+	m_os << OpName(op) << ' ' << x << ", " << y << '\n';
+}
+
+void GdiCallRecorder::SetValue(EmrType op, int32_t value)
+{
+	m_os << OpName(op) << ' ' << value << '\n';
+}
+
+void GdiCallRecorder::Command(EmrType op)
+{
+	m_os << OpName(op) << '\n';
+}
+
+void GdiCallRecorder::Transform(EmrType op, const GdiXform& xf, int32_t mode)
+{
+	m_os << OpName(op) << " {" << xf.m11 << ", " << xf.m12 << ", " << xf.m21 << ", " << xf.m22 << ", " << xf.dx << ", " << xf.dy << '}';
+	if (op == EmrType::ModifyWorldTransform)
+		m_os << ", " << mode;
+	m_os << '\n';
+}
+
+void GdiCallRecorder::SelectObject(uint32_t index)
+{
+	if (index & 0x80000000)
+		m_os << "SelectObject stock " << (index & ~0x80000000) << '\n';
+	else
+		m_os << "SelectObject " << index << '\n';
+}
+
+void GdiCallRecorder::DeleteObject(uint32_t index)
+{
+	m_os << "DeleteObject " << index << '\n';
+}
+
+void GdiCallRecorder::CreatePen(uint32_t index, uint32_t style, int32_t width, uint32_t color)
+{
+	m_os << "CreatePen " << index << ": " << style << ", " << width << ", " << color << '\n';
+}
+
+void GdiCallRecorder::CreateBrush(uint32_t index, uint32_t style, uint32_t color, uint32_t hatch)
+{
+	m_os << "CreateBrushIndirect " << index << ": " << style << ", " << color << ", " << hatch << '\n';
+}
+
+void GdiCallRecorder::ExtCreatePen(uint32_t index, uint32_t style, uint32_t width, uint32_t brushStyle, uint32_t color, uint32_t hatch,
+	const uint32_t* styles, uint32_t styleCount)
+{
+	m_os << "ExtCreatePen " << index << ": " << style << ", " << width << ", " << brushStyle << ", " << color << ", " << hatch;
+	for (uint32_t i = 0; i < styleCount; ++i)
+		m_os << (i ? " " : ", {") << styles[i] << (i + 1 == styleCount ? "}" : "");
+	m_os << '\n';
+}
+
+void GdiCallRecorder::CreateLogFont(uint32_t index, const uint8_t* logFont)
+{
+	// lfHeight, lfWeight and the face name.
+	m_os << "CreateFontIndirectW " << index << ": " << ReadI32(logFont) << ", " << ReadI32(logFont + 16) << ", \"";
+	for (const uint8_t* p = logFont + 28; p < logFont + g_logFontSize && (p[0] || p[1]); p += 2)
+		m_os << (p[0] < 0x80 && !p[1] ? (char)p[0] : '?');
+	m_os << "\"\n";
+}
+
+void GdiCallRecorder::Shape(EmrType op, const int32_t* values)
+{
+	int count = op == EmrType::Ellipse || op == EmrType::Rectangle ? 4 : op == EmrType::RoundRect ? 6 : 8;
+	m_os << OpName(op);
+	for (int i = 0; i < count; ++i)
+		m_os << (i ? ", " : " ") << values[i];
+	m_os << '\n';
+}
+
+void GdiCallRecorder::AngleArc(int32_t x, int32_t y, uint32_t radius, float startAngle, float sweepAngle)
+{
+	m_os << "AngleArc " << x << ", " << y << ", " << radius << ", " << startAngle << ", " << sweepAngle << '\n';
+}
+
+void GdiCallRecorder::Blt(const GdiBlt& blt)
+{
+	m_os << OpName(blt.type) << ' ' << blt.xDest << ", " << blt.yDest << ", " << blt.cxDest << ", " << blt.cyDest << " <- "
+		<< blt.xSrc << ", " << blt.ySrc << ", " << blt.cxSrc << ", " << blt.cySrc << ", rop " << blt.rop
+		<< ", " << blt.bmiSize << " + " << blt.bitsSize << " bytes\n";
+}
+
+void GdiCallRecorder::Text(EmrType op, int32_t x, int32_t y, uint32_t options, const EmfRectL& rect, const void* chars, uint32_t count)
+{
+	m_os << OpName(op) << ' ' << x << ", " << y << ", " << options << ", {" << rect.left << ',' << rect.top << ',' << rect.right << ',' << rect.bottom << "}, \"";
+	auto p = (const uint8_t*)chars;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		uint32_t c = op == EmrType::ExtTextOutW ? p[i * 2] | p[i * 2 + 1] << 8 : p[i];
+		m_os << (c >= 0x20 && c < 0x7F ? (char)c : '?');
+	}
+	m_os << "\"\n";
+}
+
+#ifdef _WIN32
+GdiDeviceBackend::GdiDeviceBackend(void* hdc)
+	: m_hdc(hdc)
+{
+}
+
+GdiDeviceBackend::~GdiDeviceBackend()
+{
+	// Objects the metafile didn't delete.
+	for (void* handle : m_handles)
+	{
+		if (handle)
+			::DeleteObject(handle);
+	}
+}
+
+void*& GdiDeviceBackend::Handle(uint32_t index)
+{
+	if (index >= m_handles.size())
+		m_handles.resize(index + 1);
+	return m_handles[index];
+}
+
+void GdiDeviceBackend::Begin(uint32_t handleCount)
+{
+	m_handles.resize(handleCount);
+	SetGraphicsMode((HDC)m_hdc, GM_ADVANCED);
+}
+
+// GdiPoint has the layout of POINT.
+static_assert(sizeof(GdiPoint) == sizeof(POINT), "GdiPoint is used as POINT");
+
+void GdiDeviceBackend::Poly(EmrType op, const GdiPoint* points, uint32_t count)
+{
+	HDC hdc = (HDC)m_hdc;
+	auto pts = reinterpret_cast<const POINT*>(points);
+	switch (op)
+	{
+	case EmrType::PolyBezier:
+		PolyBezier(hdc, pts, count);
+		break;
+	case EmrType::Polygon:
+		Polygon(hdc, pts, count);
+		break;
+	case EmrType::Polyline:
+		Polyline(hdc, pts, count);
+		break;
+	case EmrType::PolyBezierTo:
+		PolyBezierTo(hdc, pts, count);
+		break;
+	case EmrType::PolyLineTo:
+		PolylineTo(hdc, pts, count);
+		break;
+	default:
+		break;
+	}
+}
+
+void GdiDeviceBackend::PolyPoly(EmrType op, const GdiPoint* points, const uint32_t* counts, uint32_t polyCount)
+{
+	auto pts = reinterpret_cast<const POINT*>(points);
+	if (op == EmrType::PolyPolyline)
+		PolyPolyline((HDC)m_hdc, pts, reinterpret_cast<const DWORD*>(counts), polyCount);
+	else
+		PolyPolygon((HDC)m_hdc, pts, reinterpret_cast<const INT*>(counts), polyCount);
+}
+
+void GdiDeviceBackend::Point(EmrType op, int32_t x, int32_t y)
+{
+	HDC hdc = (HDC)m_hdc;
+	switch (op)
+	{
+	case EmrType::SetWindowExtEx:
+		SetWindowExtEx(hdc, x, y, nullptr);
+		break;
+	case EmrType::SetWindowOrgEx:
+		SetWindowOrgEx(hdc, x, y, nullptr);
+		break;
+	case EmrType::SetViewportExtEx:
+		SetViewportExtEx(hdc, x, y, nullptr);
+		break;
+	case EmrType::SetViewportOrgEx:
+		SetViewportOrgEx(hdc, x, y, nullptr);
+		break;
+	case EmrType::MoveToEx:
+		MoveToEx(hdc, x, y, nullptr);
+		break;
+	case EmrType::LineTo:
+		LineTo(hdc, x, y);
+		break;
+	default:
+		break;
+	}
+}
+
+void GdiDeviceBackend::SetValue(EmrType op, int32_t value)
+{
+	HDC hdc = (HDC)m_hdc;
+	switch (op)
+	{
+	case EmrType::SetMapMode:
+		SetMapMode(hdc, value);
+		break;
+	case EmrType::SetBkMode:
+		SetBkMode(hdc, value);
+		break;
+	case EmrType::SetPolyFillMode:
+		SetPolyFillMode(hdc, value);
+		break;
+	case EmrType::SetROP2:
+		SetROP2(hdc, value);
+		break;
+	case EmrType::SetStretchBltMode:
+		SetStretchBltMode(hdc, value);
+		break;
+	case EmrType::SetTextAlign:
+		SetTextAlign(hdc, value);
+		break;
+	case EmrType::SetTextColor:
+		SetTextColor(hdc, (COLORREF)value);
+		break;
+	case EmrType::RestoreDC:
+		RestoreDC(hdc, value);
+		break;
+	case EmrType::SelectClipPath:
+		SelectClipPath(hdc, value);
+		break;
+	case EmrType::SetICMMode:
+		SetICMMode(hdc, value);
+		break;
+	case EmrType::SetLayout:
+		SetLayout(hdc, (DWORD)value);
+		break;
+	default:
+		break;
+	}
+}
+
+void GdiDeviceBackend::Command(EmrType op)
+{
+	HDC hdc = (HDC)m_hdc;
+	switch (op)
+	{
+	case EmrType::SetMetaRgn:
+		SetMetaRgn(hdc);
+		break;
+	case EmrType::SaveDC:
+		SaveDC(hdc);
+		break;
+	case EmrType::RealizePalette:
+		RealizePalette(hdc);
+		break;
+	case EmrType::BeginPath:
+		BeginPath(hdc);
+		break;
+	case EmrType::EndPath:
+		EndPath(hdc);
+		break;
+	case EmrType::CloseFigure:
+		CloseFigure(hdc);
+		break;
+	case EmrType::FlattenPath:
+		FlattenPath(hdc);
+		break;
+	case EmrType::WidenPath:
+		WidenPath(hdc);
+		break;
+	case EmrType::AbortPath:
+		AbortPath(hdc);
+		break;
+	default:
+		break;
+	}
+}
+
+void GdiDeviceBackend::Transform(EmrType op, const GdiXform& xf, int32_t mode)
+{
+	XFORM x = { xf.m11, xf.m12, xf.m21, xf.m22, xf.dx, xf.dy };
+	if (op == EmrType::SetWorldTransform)
+		SetWorldTransform((HDC)m_hdc, &x);
+	else
+		ModifyWorldTransform((HDC)m_hdc, &x, mode);
+}
+
+void GdiDeviceBackend::SelectObject(uint32_t index)
+{
+	if (index & 0x80000000)
+		::SelectObject((HDC)m_hdc, GetStockObject(index & ~0x80000000));
+	else
+		::SelectObject((HDC)m_hdc, Handle(index));
+}
+
+void GdiDeviceBackend::DeleteObject(uint32_t index)
+{
+	::DeleteObject(Handle(index));
+	Handle(index) = nullptr;
+}
+
+void GdiDeviceBackend::CreatePen(uint32_t index, uint32_t style, int32_t width, uint32_t color)
+{
+	Handle(index) = ::CreatePen(style, width, color);
+}
+
+void GdiDeviceBackend::CreateBrush(uint32_t index, uint32_t style, uint32_t color, uint32_t hatch)
+{
+	LOGBRUSH logBrush = { style, color, style == BS_HATCHED ? hatch : 0 };
+	Handle(index) = CreateBrushIndirect(&logBrush);
+}
+
+void GdiDeviceBackend::ExtCreatePen(uint32_t index, uint32_t style, uint32_t width, uint32_t brushStyle, uint32_t color, uint32_t hatch,
+	const uint32_t* styles, uint32_t styleCount)
+{
+	LOGBRUSH logBrush = { brushStyle, color, brushStyle == BS_HATCHED ? hatch : 0 };
+	Handle(index) = ::ExtCreatePen(style, width, &logBrush, styleCount, reinterpret_cast<const DWORD*>(styles));
+}
+
+void GdiDeviceBackend::CreateLogFont(uint32_t index, const uint8_t* logFont)
+{
+	LOGFONTW lf;
+	memcpy(&lf, logFont, sizeof(lf));
+	Handle(index) = CreateFontIndirectW(&lf);
+}
+
+void GdiDeviceBackend::Shape(EmrType op, const int32_t* v)
+{
+	HDC hdc = (HDC)m_hdc;
+	switch (op)
+	{
+	case EmrType::Ellipse:
+		Ellipse(hdc, v[0], v[1], v[2], v[3]);
+		break;
+	case EmrType::Rectangle:
+		Rectangle(hdc, v[0], v[1], v[2], v[3]);
+		break;
+	case EmrType::RoundRect:
+		RoundRect(hdc, v[0], v[1], v[2], v[3], v[4], v[5]);
+		break;
+	case EmrType::Arc:
+		Arc(hdc, v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7]);
+		break;
+	case EmrType::Chord:
+		Chord(hdc, v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7]);
+		break;
+	case EmrType::Pie:
+		Pie(hdc, v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7]);
+		break;
+	case EmrType::ArcTo:
+		ArcTo(hdc, v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7]);
+		break;
+	default:
+		break;
+	}
+}
+
+void GdiDeviceBackend::AngleArc(int32_t x, int32_t y, uint32_t radius, float startAngle, float sweepAngle)
+{
+	::AngleArc((HDC)m_hdc, x, y, radius, startAngle, sweepAngle);
+}
+
+void GdiDeviceBackend::Blt(const GdiBlt& blt)
+{
+	HDC hdc = (HDC)m_hdc;
+	auto bmi = reinterpret_cast<const BITMAPINFO*>(blt.bmi);
+	if (blt.type == EmrType::StretchDIBits)
+	{
+		if (bmi)
+			StretchDIBits(hdc, blt.xDest, blt.yDest, blt.cxDest, blt.cyDest, blt.xSrc, blt.ySrc, blt.cxSrc, blt.cySrc, blt.bits, bmi, blt.usage, blt.rop);
+		return;
+	}
+	if (!bmi)
+	{
+		// No source bitmap, the ROP uses the brush or the destination only.
+		PatBlt(hdc, blt.xDest, blt.yDest, blt.cxDest, blt.cyDest, blt.rop);
+		return;
+	}
+	int height = std::abs(bmi->bmiHeader.biHeight);
+	HBITMAP hBitmap = CreateCompatibleBitmap(hdc, bmi->bmiHeader.biWidth, height);
+	HDC hMemDC = CreateCompatibleDC(hdc);
+	SetDIBits(hdc, hBitmap, 0, height, blt.bits, bmi, blt.usage);
+	HGDIOBJ holdBmp = ::SelectObject(hMemDC, hBitmap);
+	if (blt.type == EmrType::BitBlt)
+		BitBlt(hdc, blt.xDest, blt.yDest, blt.cxDest, blt.cyDest, hMemDC, blt.xSrc, blt.ySrc, blt.rop);
+	else
+		StretchBlt(hdc, blt.xDest, blt.yDest, blt.cxDest, blt.cyDest, hMemDC, blt.xSrc, blt.ySrc, blt.cxSrc, blt.cySrc, blt.rop);
+	::DeleteObject(::SelectObject(hMemDC, holdBmp));
+	DeleteDC(hMemDC);
+}
+
+void GdiDeviceBackend::Text(EmrType op, int32_t x, int32_t y, uint32_t options, const EmfRectL& rect, const void* chars, uint32_t count)
+{
+	RECT rc = { rect.left, rect.top, rect.right, rect.bottom };
+	if (op == EmrType::ExtTextOutW)
+		ExtTextOutW((HDC)m_hdc, x, y, options, &rc, (const wchar_t*)chars, count, nullptr);
+	else
+		ExtTextOutA((HDC)m_hdc, x, y, options, &rc, (const char*)chars, count, nullptr);
+}
+#endif
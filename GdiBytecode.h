@@ -0,0 +1,268 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "EmfFormat.h"
+#include "MappedFile.h"
+
+// Dense bytecode of the GDI calls translated from the records, replayed
+// without parsing the metafile again.
+//
+// File layout, little endian:
+//   GdiBytecodeHeader
+//   code            one byte op code (an EmrType), then its operands as
+//                   varints, signed ones zigzag encoded
+//   pools           points, strings, fonts and blobs: every distinct array
+//                   is stored once, 8 byte aligned, and referred to by index
+// A point array is stored as its count, a byte width, then x, y deltas from
+// the previous point, zigzag encoded in that many bytes, and is decoded on
+// replay; the other arrays are used in place, so loading is mapping the file.
+
+struct GdiPoint
+{
+	int32_t x, y;
+};
+
+struct GdiXform
+{
+	float m11, m12, m21, m22, dx, dy;
+};
+
+enum GdiPool
+{
+	GdiPointPool,
+	// Chars of ExtTextOutA or UTF-16 code units of ExtTextOutW.
+	GdiStringPool,
+	// LOGFONTW.
+	GdiFontPool,
+	// BITMAPINFO, bits, poly counts, pen styles.
+	GdiBlobPool,
+	GdiPoolCount
+};
+
+struct GdiPoolEntry
+{
+	uint64_t offset;
+	uint64_t size;
+};
+
+struct GdiPoolHeader
+{
+	// count GdiPoolEntry at indexOffset, locating the arrays from the file start.
+	uint64_t indexOffset;
+	uint32_t count;
+	uint32_t reserved;
+};
+
+struct GdiBytecodeHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t handleCount;
+	uint32_t callCount;
+	uint64_t codeOffset;
+	uint64_t codeSize;
+	GdiPoolHeader pools[GdiPoolCount];
+};
+
+struct GdiBlt
+{
+	// EmrType::BitBlt, StretchBlt or StretchDIBits.
+	EmrType type;
+	int32_t xDest, yDest, cxDest, cyDest;
+	int32_t xSrc, ySrc, cxSrc, cySrc;
+	uint32_t rop;
+	uint32_t usage;
+	// Null for a blt without source.
+	const uint8_t* bmi;
+	uint32_t bmiSize;
+	const uint8_t* bits;
+	uint32_t bitsSize;
+};
+
+// Receives the calls replayed by GdiBytecode. op tells the GDI function when
+// several share a method, its parameters are those of the function.
+class GdiBackend
+{
+public:
+	virtual ~GdiBackend()
+	{
+	}
+	// Handle table size of the metafile, handle indexes are below it.
+	virtual void Begin(uint32_t /*handleCount*/)
+	{
+	}
+	virtual void End()
+	{
+	}
+	// PolyBezier, Polygon, Polyline, PolyBezierTo, PolyLineTo.
+	virtual void Poly(EmrType /*op*/, const GdiPoint* /*points*/, uint32_t /*count*/)
+	{
+	}
+	// PolyPolyline, PolyPolygon.
+	virtual void PolyPoly(EmrType /*op*/, const GdiPoint* /*points*/, const uint32_t* /*counts*/, uint32_t /*polyCount*/)
+	{
+	}
+	// SetWindowExtEx, SetWindowOrgEx, SetViewportExtEx, SetViewportOrgEx, MoveToEx, LineTo.
+	virtual void Point(EmrType /*op*/, int32_t /*x*/, int32_t /*y*/)
+	{
+	}
+	// SetMapMode, SetBkMode, SetPolyFillMode, SetROP2, SetStretchBltMode,
+	// SetTextAlign, SetTextColor, RestoreDC, SelectClipPath, SetICMMode, SetLayout.
+	virtual void SetValue(EmrType /*op*/, int32_t /*value*/)
+	{
+	}
+	// SetMetaRgn, SaveDC, RealizePalette, BeginPath, EndPath, CloseFigure,
+	// FlattenPath, WidenPath, AbortPath.
+	virtual void Command(EmrType /*op*/)
+	{
+	}
+	// SetWorldTransform, ModifyWorldTransform with mode.
+	virtual void Transform(EmrType /*op*/, const GdiXform& /*xf*/, int32_t /*mode*/)
+	{
+	}
+	// index has the high bit set for a stock object.
+	virtual void SelectObject(uint32_t /*index*/)
+	{
+	}
+	virtual void DeleteObject(uint32_t /*index*/)
+	{
+	}
+	virtual void CreatePen(uint32_t /*index*/, uint32_t /*style*/, int32_t /*width*/, uint32_t /*color*/)
+	{
+	}
+	virtual void CreateBrush(uint32_t /*index*/, uint32_t /*style*/, uint32_t /*color*/, uint32_t /*hatch*/)
+	{
+	}
+	virtual void ExtCreatePen(uint32_t /*index*/, uint32_t /*style*/, uint32_t /*width*/, uint32_t /*brushStyle*/, uint32_t /*color*/, uint32_t /*hatch*/,
+		const uint32_t* /*styles*/, uint32_t /*styleCount*/)
+	{
+	}
+	// logFont is a LOGFONTW.
+	virtual void CreateLogFont(uint32_t /*index*/, const uint8_t* /*logFont*/)
+	{
+	}
+	// Ellipse, Rectangle (4 values), RoundRect (6), Arc, Chord, Pie, ArcTo (8).
+	virtual void Shape(EmrType /*op*/, const int32_t* /*values*/)
+	{
+	}
+	virtual void AngleArc(int32_t /*x*/, int32_t /*y*/, uint32_t /*radius*/, float /*startAngle*/, float /*sweepAngle*/)
+	{
+	}
+	virtual void Blt(const GdiBlt& /*blt*/)
+	{
+	}
+	// ExtTextOutA with count chars, or ExtTextOutW with count UTF-16 code units.
+	virtual void Text(EmrType /*op*/, int32_t /*x*/, int32_t /*y*/, uint32_t /*options*/, const EmfRectL& /*rect*/, const void* /*chars*/, uint32_t /*count*/)
+	{
+	}
+};
+
+// Compile the records translated by EnumMetafileCallback into bytecode,
+// records the translator leaves out are left out.
+void CompileGdiBytecode(const std::vector<EmfRecordSpan>& records, std::vector<uint8_t>& bytecode);
+
+class GdiBytecode
+{
+public:
+	GdiBytecode();
+
+	// fileName is UTF-8. Map the file and check its header.
+	bool Open(const std::string& fileName);
+	// Use bytecode in memory, it must stay valid and 8 byte aligned.
+	bool Load(const uint8_t* data, size_t size);
+	uint32_t CallCount() const
+	{
+		return m_header ? m_header->callCount : 0;
+	}
+	// Make the calls on backend in order. Return false if the code is corrupt,
+	// the calls before the bad one are made.
+	bool Replay(GdiBackend& backend) const;
+
+private:
+	MappedFile m_file;
+	const uint8_t* m_data;
+	size_t m_size;
+	const GdiBytecodeHeader* m_header;
+
+	// Entry index of pool, or nullptr if out of range.
+	const uint8_t* Entry(GdiPool pool, uint64_t index, size_t& size) const;
+	// Decode entry index of the point pool into points, nullptr if corrupt.
+	const GdiPoint* Points(uint64_t index, std::vector<GdiPoint>& points) const;
+};
+
+// Writes one line per call, to compare replays or look at the calls.
+class GdiCallRecorder : public GdiBackend
+{
+public:
+	explicit GdiCallRecorder(std::ostream& os);
+
+	virtual void Begin(uint32_t handleCount) override;
+	virtual void Poly(EmrType op, const GdiPoint* points, uint32_t count) override;
+	virtual void PolyPoly(EmrType op, const GdiPoint* points, const uint32_t* counts, uint32_t polyCount) override;
+	virtual void Point(EmrType op, int32_t x, int32_t y) override;
+	virtual void SetValue(EmrType op, int32_t value) override;
+	virtual void Command(EmrType op) override;
+	virtual void Transform(EmrType op, const GdiXform& xf, int32_t mode) override;
+	virtual void SelectObject(uint32_t index) override;
+	virtual void DeleteObject(uint32_t index) override;
+	virtual void CreatePen(uint32_t index, uint32_t style, int32_t width, uint32_t color) override;
+	virtual void CreateBrush(uint32_t index, uint32_t style, uint32_t color, uint32_t hatch) override;
+	virtual void ExtCreatePen(uint32_t index, uint32_t style, uint32_t width, uint32_t brushStyle, uint32_t color, uint32_t hatch,
+		const uint32_t* styles, uint32_t styleCount) override;
+	virtual void CreateLogFont(uint32_t index, const uint8_t* logFont) override;
+	virtual void Shape(EmrType op, const int32_t* values) override;
+	virtual void AngleArc(int32_t x, int32_t y, uint32_t radius, float startAngle, float sweepAngle) override;
+	virtual void Blt(const GdiBlt& blt) override;
+	virtual void Text(EmrType op, int32_t x, int32_t y, uint32_t options, const EmfRectL& rect, const void* chars, uint32_t count) override;
+
+private:
+	std::ostream& m_os;
+};
+
+#ifdef _WIN32
+// Makes the calls on a device context, as the translated code would.
+class GdiDeviceBackend : public GdiBackend
+{
+public:
+	// hdc is a HDC.
+	explicit GdiDeviceBackend(void* hdc);
+	~GdiDeviceBackend();
+
+	virtual void Begin(uint32_t handleCount) override;
+	virtual void Poly(EmrType op, const GdiPoint* points, uint32_t count) override;
+	virtual void PolyPoly(EmrType op, const GdiPoint* points, const uint32_t* counts, uint32_t polyCount) override;
+	virtual void Point(EmrType op, int32_t x, int32_t y) override;
+	virtual void SetValue(EmrType op, int32_t value) override;
+	virtual void Command(EmrType op) override;
+	virtual void Transform(EmrType op, const GdiXform& xf, int32_t mode) override;
+	virtual void SelectObject(uint32_t index) override;
+	virtual void DeleteObject(uint32_t index) override;
+	virtual void CreatePen(uint32_t index, uint32_t style, int32_t width, uint32_t color) override;
+	virtual void CreateBrush(uint32_t index, uint32_t style, uint32_t color, uint32_t hatch) override;
+	virtual void ExtCreatePen(uint32_t index, uint32_t style, uint32_t width, uint32_t brushStyle, uint32_t color, uint32_t hatch,
+		const uint32_t* styles, uint32_t styleCount) override;
+	virtual void CreateLogFont(uint32_t index, const uint8_t* logFont) override;
+	virtual void Shape(EmrType op, const int32_t* values) override;
+	virtual void AngleArc(int32_t x, int32_t y, uint32_t radius, float startAngle, float sweepAngle) override;
+	virtual void Blt(const GdiBlt& blt) override;
+	virtual void Text(EmrType op, int32_t x, int32_t y, uint32_t options, const EmfRectL& rect, const void* chars, uint32_t count) override;
+
+private:
+	void* m_hdc;
+	std::vector<void*> m_handles;
+
+	void*& Handle(uint32_t index);
+};
+#endif
@@ -0,0 +1,763 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_SYNTHESIS_H
+#include FT_TRUETYPE_TABLES_H
+
+#include "GlyphCache.h"
+
+// Values as in wingdi.h.
+const uint32_t g_etoGlyphIndex = 0x0010;
+const uint32_t g_taRight = 2;
+const uint32_t g_taCenter = 6;
+const uint32_t g_taBottom = 8;
+const uint32_t g_taBaseline = 24;
+const uint8_t g_nonAntialiasedQuality = 3;
+const uint8_t g_fixedPitch = 1;
+const uint8_t g_ffRoman = 0x10;
+const uint8_t g_ffModern = 0x30;
+const int32_t g_fwNormal = 400;
+const int32_t g_fwSemiBold = 600;
+const double g_pi = 3.14159265358979323846;
+
+// Cell height of lfHeight 0, as EmfPlayer assumes.
+const double g_defaultCellHeight = 16;
+// Em sizes past this are drawn this big, a glyph is at most about 16 MB.
+const double g_maxEmPixels = 4096;
+// Slant of synthesized italics, tan 11.3 degrees as GDI.
+const double g_syntheticSlant = 0.2;
+const uint32_t g_atlasPageSize = 1024;
+// Longest side of an image TextRenderer sizes.
+const double g_maxTextImageSide = 16384;
+
+// Glyph keys: strike id << 32 | character, or glyph index with this bit.
+const uint32_t g_glyphIndexBit = 0x80000000;
+
+// StrikeKey::flags.
+const uint8_t g_strikeMono = 1;
+const uint8_t g_strikeBold = 2;
+const uint8_t g_strikeItalic = 4;
+
+// Generic families, preferred first.
+const size_t g_genericCount = 7;
+static const char* const g_sansFamilies[g_genericCount] = { "liberationsans", "arimo", "dejavusans", "notosans", "freesans", "arial", "helvetica" };
+static const char* const g_serifFamilies[g_genericCount] = { "liberationserif", "tinos", "dejavuserif", "notoserif", "freeserif", "timesnewroman", "times" };
+static const char* const g_monoFamilies[g_genericCount] = { "liberationmono", "cousine", "dejavusansmono", "notosansmono", "freemono", "couriernew", "courier" };
+
+// Windows faces and their metric compatible substitutes.
+struct FontSubstitute
+{
+	const char* name;
+	const char* substitute;
+};
+static const FontSubstitute g_fontSubstitutes[] = {
+	{ "arial", "liberationsans" },
+	{ "arial", "arimo" },
+	{ "helvetica", "liberationsans" },
+	{ "arialnarrow", "liberationsansnarrow" },
+	{ "timesnewroman", "liberationserif" },
+	{ "timesnewroman", "tinos" },
+	{ "times", "liberationserif" },
+	{ "couriernew", "liberationmono" },
+	{ "couriernew", "cousine" },
+	{ "courier", "liberationmono" },
+	{ "calibri", "carlito" },
+	{ "cambria", "caladea" },
+	{ "symbol", "opensymbol" },
+};
+
+// Family names compare lower case without spaces, hyphens and underscores.
+static void AppendNormalized(std::string& name, uint32_t c)
+{
+	if (c == ' ' || c == '-' || c == '_')
+		return;
+	if (c >= 'A' && c <= 'Z')
+		c += 'a' - 'A';
+	if (c < 0x80)
+	{
+		name += (char)c;
+	}
+	else if (c < 0x800)
+	{
+		name += (char)(0xC0 | c >> 6);
+		name += (char)(0x80 | (c & 0x3F));
+	}
+	else
+	{
+		name += (char)(0xE0 | c >> 12);
+		name += (char)(0x80 | (c >> 6 & 0x3F));
+		name += (char)(0x80 | (c & 0x3F));
+	}
+}
+
+static std::string NormalizedName(const char* family)
+{
+	std::string name;
+	for (; *family; ++family)
+		AppendNormalized(name, (uint8_t)*family);
+	return name;
+}
+
+static std::string NormalizedName(const EmfFont& font)
+{
+	std::string name;
+	size_t i = 0;
+	// Vertical fonts are "@" and the face name.
+	if (font.faceName[0] == u'@')
+		++i;
+	for (; i < sizeof(font.faceName) / sizeof(font.faceName[0]) && font.faceName[i]; ++i)
+		AppendNormalized(name, font.faceName[i]);
+	return name;
+}
+
+static std::vector<std::string> PlatformFontDirectories()
+{
+	std::vector<std::string> directories;
+#ifdef _WIN32
+	if (const char* windows = getenv("WINDIR"))
+		directories.push_back(std::string(windows) + "\\Fonts");
+	if (const char* local = getenv("LOCALAPPDATA"))
+		directories.push_back(std::string(local) + "\\Microsoft\\Windows\\Fonts");
+#else
+	directories = { "/usr/share/fonts", "/usr/local/share/fonts", "/Library/Fonts", "/System/Library/Fonts" };
+	if (const char* home = getenv("HOME"))
+	{
+		directories.push_back(std::string(home) + "/.local/share/fonts");
+		directories.push_back(std::string(home) + "/.fonts");
+	}
+#endif
+	return directories;
+}
+
+static bool IsFontFile(const std::filesystem::path& path)
+{
+	std::string extension = path.extension().u8string();
+	for (char& c : extension)
+		c = (char)tolower((uint8_t)c);
+	return extension == ".ttf" || extension == ".otf" || extension == ".ttc" || extension == ".otc";
+}
+
+size_t FontResolver::Scan(const std::vector<std::string>& directories)
+{
+	m_faces.clear();
+	m_families.clear();
+	m_resolved.clear();
+	FT_Library library;
+	if (FT_Init_FreeType(&library))
+		return 0;
+	for (const std::string& directory : directories.empty() ? PlatformFontDirectories() : directories)
+	{
+		std::error_code ec;
+		std::filesystem::recursive_directory_iterator it(std::filesystem::u8path(directory),
+			std::filesystem::directory_options::skip_permission_denied, ec);
+		for (; !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec))
+		{
+			if (!it->is_regular_file(ec) || !IsFontFile(it->path()))
+				continue;
+			std::string path = it->path().u8string();
+			FT_Long count = 1;
+			for (FT_Long index = 0; index < count; ++index)
+			{
+				FT_Face face;
+				if (FT_New_Face(library, path.c_str(), index, &face))
+					break;
+				count = face->num_faces;
+				// Bitmap fonts can't be scaled and rotated.
+				if (FT_IS_SCALABLE(face) && face->family_name)
+				{
+					const TT_OS2* os2 = (const TT_OS2*)FT_Get_Sfnt_Table(face, FT_SFNT_OS2);
+					Entry entry;
+					entry.path = path;
+					entry.index = (int32_t)index;
+					entry.weight = os2 && os2->usWeightClass ? os2->usWeightClass : (face->style_flags & FT_STYLE_FLAG_BOLD ? 700 : 400);
+					entry.italic = (face->style_flags & FT_STYLE_FLAG_ITALIC) != 0;
+					entry.fixedPitch = FT_IS_FIXED_WIDTH(face);
+					m_families[NormalizedName(face->family_name)].push_back((uint32_t)m_faces.size());
+					m_faces.push_back(entry);
+				}
+				FT_Done_Face(face);
+			}
+		}
+	}
+	FT_Done_FreeType(library);
+	return m_faces.size();
+}
+
+const std::vector<uint32_t>* FontResolver::Family(const std::string& name) const
+{
+	auto it = m_families.find(name);
+	return it == m_families.end() ? nullptr : &it->second;
+}
+
+bool FontResolver::Resolve(const EmfFont& font, FontFace& face) const
+{
+	std::string name = NormalizedName(font);
+	int32_t weight = font.weight ? font.weight : g_fwNormal;
+	bool italic = font.italic != 0;
+	std::string key = name + '/' + std::to_string(weight) + (italic ? "/i/" : "/r/") + std::to_string(font.pitchAndFamily);
+	{
+		std::shared_lock<std::shared_mutex> lock(m_mutex);
+		auto it = m_resolved.find(key);
+		if (it != m_resolved.end())
+		{
+			face = it->second;
+			return true;
+		}
+	}
+	if (m_faces.empty())
+		return false;
+
+	const std::vector<uint32_t>* family = Family(name);
+	for (const FontSubstitute& substitute : g_fontSubstitutes)
+	{
+		if (!family && name == substitute.name)
+			family = Family(substitute.substitute);
+	}
+	if (!family)
+	{
+		// The generic family of a well known name, else of lfPitchAndFamily.
+		auto listed = [&name](const char* const* generic) {
+			for (size_t i = 0; i < g_genericCount; ++i)
+			{
+				if (name == generic[i])
+					return true;
+			}
+			return false;
+		};
+		const char* const* generic = g_sansFamilies;
+		if (listed(g_monoFamilies))
+			generic = g_monoFamilies;
+		else if (listed(g_serifFamilies))
+			generic = g_serifFamilies;
+		else if (!listed(g_sansFamilies) && ((font.pitchAndFamily & 0xF0) == g_ffModern || (font.pitchAndFamily & 3) == g_fixedPitch))
+			generic = g_monoFamilies;
+		else if (!listed(g_sansFamilies) && (font.pitchAndFamily & 0xF0) == g_ffRoman)
+			generic = g_serifFamilies;
+		for (size_t i = 0; i < g_genericCount && !family; ++i)
+			family = Family(generic[i]);
+	}
+
+	// Nearest weight, a wrong slant is worse than any weight.
+	uint32_t best = 0;
+	int32_t bestScore = INT32_MAX;
+	auto consider = [&](uint32_t index) {
+		const Entry& entry = m_faces[index];
+		int32_t score = std::abs(entry.weight - weight) + (entry.italic != italic ? 1000 : 0);
+		if (score < bestScore)
+		{
+			best = index;
+			bestScore = score;
+		}
+	};
+	if (family)
+	{
+		for (uint32_t index : *family)
+			consider(index);
+	}
+	else
+	{
+		for (uint32_t index = 0; index < m_faces.size(); ++index)
+			consider(index);
+	}
+	const Entry& entry = m_faces[best];
+	face.path = entry.path;
+	face.index = entry.index;
+	face.emboldened = weight >= g_fwSemiBold && entry.weight < g_fwSemiBold;
+	face.slanted = italic && !entry.italic;
+
+	std::unique_lock<std::shared_mutex> lock(m_mutex);
+	m_resolved.emplace(key, face);
+	return true;
+}
+
+struct GlyphCache::Face
+{
+	FT_Face face;
+	// Held to set the size and rasterize, FT_Face isn't thread-safe.
+	std::mutex mutex;
+	int32_t unitsPerEm;
+	// usWinAscent and usWinDescent, which tmAscent and tmDescent and so a
+	// positive lfHeight count, else the ascender and descender.
+	int32_t ascent;
+	int32_t descent;
+	// xAvgCharWidth, which lfWidth counts.
+	int32_t averageWidth;
+};
+
+struct GlyphCache::Strike
+{
+	uint32_t id;
+	uint32_t face;
+	FT_F26Dot6 charWidth;
+	FT_F26Dot6 charHeight;
+	// Escapement rotation after the synthesized slant, y up.
+	FT_Matrix matrix;
+	FT_Int32 loadFlags;
+	FT_Render_Mode renderMode;
+	bool embolden;
+	// Baseline direction, y down.
+	double cos, sin;
+	// Device pixels from the baseline to the top and bottom of the cell.
+	double ascent, descent;
+};
+
+size_t GlyphCache::StrikeKeyHash::operator()(const StrikeKey& key) const
+{
+	uint64_t h = key.face;
+	h = h * 0x9E3779B97F4A7C15ull + (uint32_t)key.width;
+	h = h * 0x9E3779B97F4A7C15ull + (uint32_t)key.height;
+	h = h * 0x9E3779B97F4A7C15ull + (uint32_t)key.escapement;
+	h = h * 0x9E3779B97F4A7C15ull + key.flags;
+	return (size_t)(h ^ h >> 32);
+}
+
+GlyphCache::GlyphCache(const FontResolver& fonts)
+	: m_fonts(fonts)
+	, m_library(nullptr)
+	, m_hits(0)
+	, m_misses(0)
+	, m_page(nullptr)
+	, m_pageBottom(g_atlasPageSize)
+	, m_atlasBytes(0)
+{
+	FT_Library library;
+	if (!FT_Init_FreeType(&library))
+		m_library = library;
+}
+
+GlyphCache::~GlyphCache()
+{
+	for (auto& face : m_faces)
+		FT_Done_Face(face->face);
+	if (m_library)
+		FT_Done_FreeType(m_library);
+}
+
+uint32_t GlyphCache::FaceId(const FontFace& font)
+{
+	std::string key = font.path + '#' + std::to_string(font.index);
+	{
+		std::shared_lock<std::shared_mutex> lock(m_facesMutex);
+		auto it = m_faceIds.find(key);
+		if (it != m_faceIds.end())
+			return it->second;
+	}
+	std::unique_lock<std::shared_mutex> lock(m_facesMutex);
+	auto it = m_faceIds.find(key);
+	if (it != m_faceIds.end())
+		return it->second;
+	FT_Face ftFace;
+	if (!m_library || FT_New_Face(m_library, font.path.c_str(), font.index, &ftFace))
+	{
+		m_faceIds.emplace(key, UINT32_MAX);
+		return UINT32_MAX;
+	}
+	std::unique_ptr<Face> face(new Face);
+	face->face = ftFace;
+	face->unitsPerEm = ftFace->units_per_EM ? ftFace->units_per_EM : 2048;
+	const TT_OS2* os2 = (const TT_OS2*)FT_Get_Sfnt_Table(ftFace, FT_SFNT_OS2);
+	if (os2 && os2->usWinAscent + os2->usWinDescent > 0)
+	{
+		face->ascent = os2->usWinAscent;
+		face->descent = os2->usWinDescent;
+	}
+	else
+	{
+		face->ascent = ftFace->ascender;
+		face->descent = -ftFace->descender;
+	}
+	if (face->ascent + face->descent <= 0)
+	{
+		face->ascent = face->unitsPerEm * 4 / 5;
+		face->descent = face->unitsPerEm / 5;
+	}
+	face->averageWidth = os2 && os2->xAvgCharWidth > 0 ? os2->xAvgCharWidth : 0;
+	uint32_t id = (uint32_t)m_faces.size();
+	m_faces.push_back(std::move(face));
+	m_faceIds.emplace(key, id);
+	return id;
+}
+
+const GlyphCache::Strike* GlyphCache::FindStrike(uint32_t faceId, const FontFace& font, const EmfDeviceContext& dc)
+{
+	const Face* face;
+	{
+		std::shared_lock<std::shared_mutex> lock(m_facesMutex);
+		face = m_faces[faceId].get();
+	}
+	// Negative lfHeight is the em size, positive the cell height.
+	double scale = dc.toDevice.Scale();
+	double height = dc.font.height ? std::abs(dc.font.height) * scale : g_defaultCellHeight * scale;
+	double em = dc.font.height < 0 ? height : height * face->unitsPerEm / (face->ascent + face->descent);
+	em = std::min(std::max(em, 1.0 / 64), g_maxEmPixels);
+	double emWidth = em;
+	if (dc.font.width > 0 && face->averageWidth > 0)
+		emWidth = std::min(std::max(dc.font.width * scale * face->unitsPerEm / face->averageWidth, 1.0 / 64), g_maxEmPixels);
+
+	StrikeKey key;
+	key.face = faceId;
+	key.width = (int32_t)std::lround(emWidth * 64);
+	key.height = (int32_t)std::lround(em * 64);
+	key.escapement = (dc.font.escapement % 3600 + 3600) % 3600;
+	key.flags = (dc.font.quality == g_nonAntialiasedQuality ? g_strikeMono : 0)
+		| (font.emboldened ? g_strikeBold : 0) | (font.slanted ? g_strikeItalic : 0);
+	{
+		std::shared_lock<std::shared_mutex> lock(m_strikesMutex);
+		auto it = m_strikes.find(key);
+		if (it != m_strikes.end())
+			return it->second.get();
+	}
+
+	std::unique_ptr<Strike> strike(new Strike);
+	strike->face = faceId;
+	strike->charWidth = key.width;
+	strike->charHeight = key.height;
+	double angle = key.escapement * g_pi / 1800;
+	strike->cos = std::cos(angle);
+	strike->sin = std::sin(angle);
+	double slant = (key.flags & g_strikeItalic) ? g_syntheticSlant : 0;
+	// Rotation times [1 slant; 0 1].
+	strike->matrix.xx = (FT_Fixed)std::lround(strike->cos * 0x10000);
+	strike->matrix.xy = (FT_Fixed)std::lround((strike->cos * slant - strike->sin) * 0x10000);
+	strike->matrix.yx = (FT_Fixed)std::lround(strike->sin * 0x10000);
+	strike->matrix.yy = (FT_Fixed)std::lround((strike->sin * slant + strike->cos) * 0x10000);
+	// Embedded bitmaps can't be rotated.
+	strike->loadFlags = FT_LOAD_NO_BITMAP | ((key.flags & g_strikeMono) ? FT_LOAD_TARGET_MONO : FT_LOAD_TARGET_NORMAL);
+	strike->renderMode = (key.flags & g_strikeMono) ? FT_RENDER_MODE_MONO : FT_RENDER_MODE_NORMAL;
+	strike->embolden = (key.flags & g_strikeBold) != 0;
+	strike->ascent = em * face->ascent / face->unitsPerEm;
+	strike->descent = em * face->descent / face->unitsPerEm;
+
+	std::unique_lock<std::shared_mutex> lock(m_strikesMutex);
+	auto it = m_strikes.find(key);
+	if (it != m_strikes.end())
+		return it->second.get();
+	strike->id = (uint32_t)m_strikes.size();
+	return m_strikes.emplace(key, std::move(strike)).first->second.get();
+}
+
+static size_t ShardOf(uint64_t key)
+{
+	key *= 0x9E3779B97F4A7C15ull;
+	return (size_t)(key >> 60) % GlyphCache::g_shardCount;
+}
+
+const CachedGlyph* GlyphCache::Glyph(const Strike& strike, uint32_t code)
+{
+	uint64_t key = (uint64_t)strike.id << 32 | code;
+	Shard& shard = m_shards[ShardOf(key)];
+	{
+		std::shared_lock<std::shared_mutex> lock(shard.mutex);
+		auto it = shard.glyphs.find(key);
+		if (it != shard.glyphs.end())
+		{
+			m_hits.fetch_add(1, std::memory_order_relaxed);
+			return &it->second;
+		}
+	}
+	Face* face;
+	{
+		std::shared_lock<std::shared_mutex> lock(m_facesMutex);
+		face = m_faces[strike.face].get();
+	}
+	std::lock_guard<std::mutex> faceLock(face->mutex);
+	// Another thread may have rasterized it while this one waited.
+	{
+		std::shared_lock<std::shared_mutex> lock(shard.mutex);
+		auto it = shard.glyphs.find(key);
+		if (it != shard.glyphs.end())
+		{
+			m_hits.fetch_add(1, std::memory_order_relaxed);
+			return &it->second;
+		}
+	}
+	CachedGlyph glyph = Rasterize(*face, strike, code);
+	m_misses.fetch_add(1, std::memory_order_relaxed);
+	std::unique_lock<std::shared_mutex> lock(shard.mutex);
+	return &shard.glyphs.emplace(key, glyph).first->second;
+}
+
+CachedGlyph GlyphCache::Rasterize(Face& face, const Strike& strike, uint32_t code)
+{
+	CachedGlyph glyph = {};
+	FT_Face ftFace = face.face;
+	if (FT_Set_Char_Size(ftFace, strike.charWidth, strike.charHeight, 72, 72))
+		return glyph;
+	FT_Matrix matrix = strike.matrix;
+	FT_Set_Transform(ftFace, &matrix, nullptr);
+	// Characters missing from the face get glyph 0, the box GDI draws too.
+	FT_Error error = (code & g_glyphIndexBit)
+		? FT_Load_Glyph(ftFace, code & ~g_glyphIndexBit, strike.loadFlags)
+		: FT_Load_Char(ftFace, code, strike.loadFlags);
+	if (error)
+		return glyph;
+	FT_GlyphSlot slot = ftFace->glyph;
+	if (strike.embolden)
+		FT_GlyphSlot_Embolden(slot);
+	glyph.advanceX = (int32_t)slot->advance.x;
+	glyph.advanceY = (int32_t)-slot->advance.y;
+	if (FT_Render_Glyph(slot, strike.renderMode))
+		return glyph;
+
+	const FT_Bitmap& bitmap = slot->bitmap;
+	glyph.left = slot->bitmap_left;
+	glyph.top = -slot->bitmap_top;
+	if (bitmap.width == 0 || bitmap.rows == 0 || bitmap.width > UINT16_MAX || bitmap.rows > UINT16_MAX)
+		return glyph;
+	uint8_t* coverage = Allocate(bitmap.width, bitmap.rows, glyph.stride);
+	for (uint32_t y = 0; y < bitmap.rows; ++y)
+	{
+		const uint8_t* from = bitmap.buffer + (ptrdiff_t)y * bitmap.pitch;
+		uint8_t* to = coverage + (size_t)y * glyph.stride;
+		if (bitmap.pixel_mode == FT_PIXEL_MODE_MONO)
+		{
+			for (uint32_t x = 0; x < bitmap.width; ++x)
+				to[x] = (from[x >> 3] & (0x80 >> (x & 7))) ? 255 : 0;
+		}
+		else
+		{
+			memcpy(to, from, bitmap.width);
+		}
+	}
+	glyph.coverage = coverage;
+	glyph.width = (uint16_t)bitmap.width;
+	glyph.height = (uint16_t)bitmap.rows;
+	return glyph;
+}
+
+uint8_t* GlyphCache::Allocate(uint32_t width, uint32_t height, uint32_t& stride)
+{
+	std::lock_guard<std::mutex> lock(m_atlasMutex);
+	// Huge glyphs get a page of their own, the shelves stay on m_page.
+	if (width > g_atlasPageSize || height > g_atlasPageSize / 4)
+	{
+		m_pages.emplace_back(new uint8_t[(size_t)width * height]);
+		m_atlasBytes += (size_t)width * height;
+		stride = width;
+		return m_pages.back().get();
+	}
+	for (Shelf& shelf : m_shelves)
+	{
+		if (shelf.height >= height && shelf.height - height <= height / 4 && g_atlasPageSize - shelf.x >= width)
+		{
+			uint8_t* coverage = m_page + (size_t)shelf.y * g_atlasPageSize + shelf.x;
+			shelf.x += width;
+			stride = g_atlasPageSize;
+			return coverage;
+		}
+	}
+	if (g_atlasPageSize - m_pageBottom < height || !m_page)
+	{
+		m_pages.emplace_back(new uint8_t[(size_t)g_atlasPageSize * g_atlasPageSize]);
+		m_atlasBytes += (size_t)g_atlasPageSize * g_atlasPageSize;
+		m_page = m_pages.back().get();
+		m_shelves.clear();
+		m_pageBottom = 0;
+	}
+	m_shelves.push_back(Shelf{ m_pageBottom, height, width });
+	uint8_t* coverage = m_page + (size_t)m_pageBottom * g_atlasPageSize;
+	m_pageBottom += height;
+	stride = g_atlasPageSize;
+	return coverage;
+}
+
+bool GlyphCache::Layout(const EmfTextRun& run, const EmfDeviceContext& dc, std::vector<PlacedGlyph>& glyphs)
+{
+	glyphs.clear();
+	FontFace font;
+	if (!m_fonts.Resolve(dc.font, font))
+		return false;
+	uint32_t faceId = FaceId(font);
+	if (faceId == UINT32_MAX)
+		return false;
+	const Strike& strike = *FindStrike(faceId, font, dc);
+
+	// Pen positions along the baseline from the reference point, device pixels.
+	std::vector<double> pens;
+	double pen = 0;
+	bool glyphIndices = (run.options & g_etoGlyphIndex) != 0;
+	for (size_t i = 0; i < run.text.size(); ++i)
+	{
+		uint32_t code = run.text[i];
+		size_t units = 1;
+		if (glyphIndices)
+		{
+			code |= g_glyphIndexBit;
+		}
+		else if (code >= 0xD800 && code < 0xDC00 && i + 1 < run.text.size() && run.text[i + 1] >= 0xDC00 && run.text[i + 1] < 0xE000)
+		{
+			code = 0x10000 + ((code - 0xD800) << 10) + (run.text[i + 1] - 0xDC00);
+			units = 2;
+		}
+		const CachedGlyph* glyph = Glyph(strike, code);
+		glyphs.push_back(PlacedGlyph{ glyph, 0, 0 });
+		pens.push_back(pen);
+		if (i + units <= run.advances.size())
+		{
+			for (size_t k = 0; k < units; ++k)
+				pen += run.advances[i + k];
+		}
+		else
+		{
+			pen += (glyph->advanceX * strike.cos - glyph->advanceY * strike.sin) / 64;
+		}
+		i += units - 1;
+	}
+
+	// Reference point to the start of the baseline, along it and down.
+	double along = 0, down = 0;
+	switch (dc.textAlign & g_taCenter)
+	{
+	case g_taRight:
+		along = -pen;
+		break;
+	case g_taCenter:
+		along = -pen / 2;
+		break;
+	}
+	switch (dc.textAlign & g_taBaseline)
+	{
+	case g_taBaseline:
+		break;
+	case g_taBottom:
+		down = -strike.descent;
+		break;
+	default:
+		down = strike.ascent;
+		break;
+	}
+	// Along is (cos, -sin) and down (sin, cos), y down.
+	for (size_t i = 0; i < glyphs.size(); ++i)
+	{
+		double offset = along + pens[i];
+		glyphs[i].x = (int32_t)std::lround(run.origin.x + offset * strike.cos + down * strike.sin);
+		glyphs[i].y = (int32_t)std::lround(run.origin.y - offset * strike.sin + down * strike.cos);
+	}
+	return true;
+}
+
+void GlyphCache::Draw(const std::vector<PlacedGlyph>& glyphs, uint32_t color, const EmfRegion* clip, RenderedImage& image)
+{
+	// COLORREF is 0x00BBGGRR, pixels 0xAARRGGBB.
+	const uint32_t red = color & 0xFF, green = color >> 8 & 0xFF, blue = color >> 16 & 0xFF;
+	const uint32_t solid = 0xFF000000 | red << 16 | green << 8 | blue;
+	for (const PlacedGlyph& placed : glyphs)
+	{
+		const CachedGlyph& glyph = *placed.glyph;
+		if (!glyph.coverage)
+			continue;
+		int64_t x0 = (int64_t)placed.x + glyph.left, y0 = (int64_t)placed.y + glyph.top;
+		int32_t left = (int32_t)std::max<int64_t>(x0, 0), right = (int32_t)std::min<int64_t>(x0 + glyph.width, image.width);
+		int32_t top = (int32_t)std::max<int64_t>(y0, 0), bottom = (int32_t)std::min<int64_t>(y0 + glyph.height, image.height);
+		for (int32_t y = top; y < bottom; ++y)
+		{
+			const uint8_t* coverage = glyph.coverage + (size_t)(y - y0) * glyph.stride;
+			uint32_t* row = image.pixels.data() + (size_t)y * image.width;
+			auto blend = [&](int32_t from, int32_t to) {
+				for (int32_t x = from; x < to; ++x)
+				{
+					uint32_t a = coverage[x - x0];
+					if (a == 0)
+						continue;
+					if (a == 255)
+					{
+						row[x] = solid;
+						continue;
+					}
+					uint32_t pixel = row[x], inverse = 255 - a;
+					uint32_t r = (red * a + (pixel >> 16 & 0xFF) * inverse + 127) / 255;
+					uint32_t g = (green * a + (pixel >> 8 & 0xFF) * inverse + 127) / 255;
+					uint32_t b = (blue * a + (pixel & 0xFF) * inverse + 127) / 255;
+					uint32_t alpha = a + ((pixel >> 24) * inverse + 127) / 255;
+					row[x] = alpha << 24 | r << 16 | g << 8 | b;
+				}
+			};
+			if (clip)
+				clip->ClipSpan(y, left, right, blend);
+			else if (left < right)
+				blend(left, right);
+		}
+	}
+}
+
+GlyphCacheStats GlyphCache::Stats() const
+{
+	GlyphCacheStats stats;
+	stats.hits = m_hits.load();
+	stats.misses = m_misses.load();
+	{
+		std::shared_lock<std::shared_mutex> lock(m_strikesMutex);
+		stats.strikes = m_strikes.size();
+	}
+	std::lock_guard<std::mutex> lock(m_atlasMutex);
+	stats.atlasPages = m_pages.size();
+	stats.atlasBytes = m_atlasBytes;
+	return stats;
+}
+
+TextRenderer::TextRenderer(GlyphCache& glyphs, RenderedImage& image)
+	: m_glyphs(glyphs)
+	, m_image(image)
+	, m_glyphCount(0)
+{
+}
+
+void TextRenderer::Begin(const EmfHeaderInfo& header)
+{
+	if (!m_image.pixels.empty())
+		return;
+	double left, top, width, height;
+	header.PictureRect(left, top, width, height);
+	m_image.width = (uint32_t)std::min(std::max(std::ceil(left + width), 1.0), g_maxTextImageSide);
+	m_image.height = (uint32_t)std::min(std::max(std::ceil(top + height), 1.0), g_maxTextImageSide);
+	m_image.pixels.assign((size_t)m_image.width * m_image.height, 0);
+}
+
+void TextRenderer::DrawText(const EmfTextRun& run, const EmfDeviceContext& dc)
+{
+	if (!m_glyphs.Layout(run, dc, m_placed))
+		return;
+	GlyphCache::Draw(m_placed, dc.textColor, dc.clip.get(), m_image);
+	m_glyphCount += m_placed.size();
+}
+
+TextBenchmark BenchmarkText(const uint8_t* data, size_t size, GlyphCache& glyphs, unsigned threadCount, unsigned repeat)
+{
+	TextBenchmark result = {};
+	std::vector<uint64_t> counts(std::max(threadCount, 1u));
+	auto worker = [&](unsigned index) {
+		RenderedImage image = {};
+		TextRenderer renderer(glyphs, image);
+		EmfPlayer player;
+		for (unsigned r = 0; r < repeat; ++r)
+			player.Play(data, size, renderer);
+		counts[index] = renderer.GlyphCount();
+	};
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for (unsigned i = 1; i < counts.size(); ++i)
+		threads.emplace_back(worker, i);
+	worker(0);
+	for (auto& t : threads)
+		t.join();
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	for (uint64_t count : counts)
+		result.glyphs += count;
+	return result;
+}
@@ -0,0 +1,240 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "EmfPlayer.h"
+#include "RenderCache.h"
+
+// Text of ExtTextOut without GDI: the LOGFONTW of the DC is resolved to a
+// local font file, and its glyphs are rasterized by FreeType once into
+// atlas pages shared by all threads, then blended from there.
+
+struct FT_LibraryRec_;
+
+// Font file face chosen for a LOGFONTW.
+struct FontFace
+{
+	// UTF-8.
+	std::string path;
+	int32_t index;
+	// Bold or italic asked for but missing in the face, to be synthesized.
+	bool emboldened;
+	bool slanted;
+};
+
+// Faces of the font files of some directories, by family name.
+class FontResolver
+{
+public:
+	// Scan the directories (UTF-8) and their subdirectories, the font
+	// directories of the platform if there are none. Return the number of
+	// faces found. Not thread-safe, scan before resolving.
+	size_t Scan(const std::vector<std::string>& directories = std::vector<std::string>());
+
+	// Face for font: a face of its lfFaceName, else of a metric compatible
+	// substitute, else of the generic family of lfPitchAndFamily, else any,
+	// with the nearest weight and slant. Return false if no face was found.
+	bool Resolve(const EmfFont& font, FontFace& face) const;
+	size_t FaceCount() const
+	{
+		return m_faces.size();
+	}
+
+private:
+	struct Entry
+	{
+		std::string path;
+		int32_t index;
+		uint16_t weight;
+		bool italic;
+		bool fixedPitch;
+	};
+
+	std::vector<Entry> m_faces;
+	// Normalized family name to indices of m_faces.
+	std::unordered_map<std::string, std::vector<uint32_t>> m_families;
+	// Results by face name, weight, slant and pitch and family.
+	mutable std::shared_mutex m_mutex;
+	mutable std::unordered_map<std::string, FontFace> m_resolved;
+
+	const std::vector<uint32_t>* Family(const std::string& name) const;
+};
+
+// 8 bit coverage of a glyph in an atlas page, never moved once rasterized.
+struct CachedGlyph
+{
+	const uint8_t* coverage;
+	uint32_t stride;
+	uint16_t width;
+	uint16_t height;
+	// Top left pixel relative to the pen position, y down.
+	int32_t left;
+	int32_t top;
+	// Along the escapement, 1/64 device pixels, y down.
+	int32_t advanceX;
+	int32_t advanceY;
+};
+
+// A glyph and its pen position in device pixels.
+struct PlacedGlyph
+{
+	const CachedGlyph* glyph;
+	int32_t x;
+	int32_t y;
+};
+
+struct GlyphCacheStats
+{
+	uint64_t hits;
+	uint64_t misses;
+	size_t strikes;
+	size_t atlasPages;
+	size_t atlasBytes;
+};
+
+// Glyphs by face, size, escapement and quality (a strike) and character.
+// Lookups take a shared lock of one of the shards; a miss rasterizes under
+// the lock of the face, so threads only wait for each other on a miss of
+// the same face. The atlas only grows: the glyphs are bounded by the fonts
+// and characters of the documents rendered, not by their size.
+class GlyphCache
+{
+public:
+	explicit GlyphCache(const FontResolver& fonts);
+	~GlyphCache();
+	GlyphCache(const GlyphCache&) = delete;
+	GlyphCache& operator=(const GlyphCache&) = delete;
+
+	// Place the glyphs of run in the font of dc, along its escapement and as
+	// its text alignment says. The advances of run (lpDx) win over those of
+	// the font. Return false if no font resolves.
+	bool Layout(const EmfTextRun& run, const EmfDeviceContext& dc, std::vector<PlacedGlyph>& glyphs);
+
+	// Blend the glyphs into image in color (COLORREF), inside clip if any.
+	static void Draw(const std::vector<PlacedGlyph>& glyphs, uint32_t color, const EmfRegion* clip, RenderedImage& image);
+
+	GlyphCacheStats Stats() const;
+
+	static const unsigned g_shardCount = 16;
+
+private:
+	struct Face;
+	struct Strike;
+	struct StrikeKey
+	{
+		uint32_t face;
+		// Em size in 1/64 device pixels.
+		int32_t width;
+		int32_t height;
+		// Tenths of a degree, [0, 3600).
+		int32_t escapement;
+		uint8_t flags;
+
+		bool operator==(const StrikeKey& other) const
+		{
+			return face == other.face && width == other.width && height == other.height
+				&& escapement == other.escapement && flags == other.flags;
+		}
+	};
+	struct StrikeKeyHash
+	{
+		size_t operator()(const StrikeKey& key) const;
+	};
+	struct Shard
+	{
+		std::shared_mutex mutex;
+		// Strike id and character, node pointers stay valid on rehash.
+		std::unordered_map<uint64_t, CachedGlyph> glyphs;
+	};
+
+	const FontResolver& m_fonts;
+	FT_LibraryRec_* m_library;
+
+	std::shared_mutex m_facesMutex;
+	std::vector<std::unique_ptr<Face>> m_faces;
+	// "path#index" to index of m_faces, UINT32_MAX if it doesn't load.
+	std::unordered_map<std::string, uint32_t> m_faceIds;
+
+	mutable std::shared_mutex m_strikesMutex;
+	std::unordered_map<StrikeKey, std::unique_ptr<Strike>, StrikeKeyHash> m_strikes;
+
+	Shard m_shards[g_shardCount];
+	std::atomic<uint64_t> m_hits;
+	std::atomic<uint64_t> m_misses;
+
+	// Shelves of the page being filled: a glyph goes on the first one tall
+	// enough without wasting a quarter of its height, else on a new one.
+	struct Shelf
+	{
+		uint32_t y;
+		uint32_t height;
+		uint32_t x;
+	};
+	mutable std::mutex m_atlasMutex;
+	// Atlas pages and the pages of huge glyphs.
+	std::vector<std::unique_ptr<uint8_t[]>> m_pages;
+	// Atlas page of the shelves, nullptr before the first.
+	uint8_t* m_page;
+	std::vector<Shelf> m_shelves;
+	uint32_t m_pageBottom;
+	size_t m_atlasBytes;
+
+	uint32_t FaceId(const FontFace& font);
+	const Strike* FindStrike(uint32_t faceId, const FontFace& font, const EmfDeviceContext& dc);
+	const CachedGlyph* Glyph(const Strike& strike, uint32_t code);
+	CachedGlyph Rasterize(Face& face, const Strike& strike, uint32_t code);
+	// Room for a width x height bitmap.
+	uint8_t* Allocate(uint32_t width, uint32_t height, uint32_t& stride);
+};
+
+// Draws the text of the records played into image, whose pixels are device
+// pixels from (0, 0), in the text color and inside the clip. Renderers on
+// other threads may share the GlyphCache.
+class TextRenderer : public EmfSink
+{
+public:
+	TextRenderer(GlyphCache& glyphs, RenderedImage& image);
+
+	// An empty image is sized to the picture, transparent.
+	virtual void Begin(const EmfHeaderInfo& header) override;
+	virtual void DrawText(const EmfTextRun& run, const EmfDeviceContext& dc) override;
+
+	// Glyphs drawn so far.
+	uint64_t GlyphCount() const
+	{
+		return m_glyphCount;
+	}
+
+private:
+	GlyphCache& m_glyphs;
+	RenderedImage& m_image;
+	// Scratch of DrawText, kept to reuse its memory.
+	std::vector<PlacedGlyph> m_placed;
+	uint64_t m_glyphCount;
+};
+
+struct TextBenchmark
+{
+	uint64_t glyphs;
+	double seconds;
+};
+
+// Play the text of an EMF repeat times on each of threadCount threads, all
+// sharing glyphs.
+TextBenchmark BenchmarkText(const uint8_t* data, size_t size, GlyphCache& glyphs, unsigned threadCount, unsigned repeat);
@@ -0,0 +1,224 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+// Text played through TextRenderer with the fonts of the platform: glyphs
+// are cached once, a huge glyph keeps its own page, repeated text draws the
+// same pixels. Skipped where no font is installed.
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "GlyphCache.h"
+
+// The picture is 400 x 400 device pixels.
+const int32_t g_pictureSide = 400;
+
+// Records appended one by one, the header fixed up by Finish.
+class MetafileWriter
+{
+public:
+	MetafileWriter()
+		: m_records(0)
+	{
+		Begin(EmrType::Header);
+		Rect(0, 0, g_pictureSide - 1, g_pictureSide - 1);
+		Rect(0, 0, 10000, 10000);
+		U32(g_emfSignature);
+		U32(0x10000);
+		U32(0); // nBytes
+		U32(0); // nRecords
+		U32(3); // nHandles, nReserved
+		U32(0); // nDescription
+		U32(0); // offDescription
+		U32(0); // nPalEntries
+		U32(1000);
+		U32(1000);
+		U32(320);
+		U32(240);
+		End();
+		Record(EmrType::SetTextColor, { 0x0000FF });
+	}
+
+	// Font ihFont of an em height pixels, selected.
+	void Font(uint32_t index, int32_t height)
+	{
+		Begin(EmrType::ExtCreateFontIndirectW);
+		U32(index);
+		U32((uint32_t)-height);
+		U32(0); // lfWidth
+		U32(0); // lfEscapement
+		U32(0); // lfOrientation
+		U32(400); // lfWeight
+		U32(0); // lfItalic to lfCharSet
+		U32(0); // lfOutPrecision to lfPitchAndFamily
+		const char face[] = "DejaVu Sans";
+		for (size_t i = 0; i < 32; ++i)
+			U16(i < sizeof(face) ? (uint16_t)face[i] : 0);
+		End();
+		Record(EmrType::SelectObject, { index });
+	}
+
+	// ExtTextOutW at (x, y), the top left corner of the text.
+	void Text(int32_t x, int32_t y, const char* text)
+	{
+		uint32_t count = (uint32_t)strlen(text);
+		Begin(EmrType::ExtTextOutW);
+		Rect(0, 0, -1, -1);
+		U32(1); // GM_COMPATIBLE
+		U32(0); // exScale
+		U32(0); // eyScale
+		U32(x);
+		U32(y);
+		U32(count);
+		U32(76); // offString
+		U32(0); // fOptions
+		Rect(0, 0, 0, 0);
+		U32(0); // offDx
+		for (uint32_t i = 0; i < count; ++i)
+			U16((uint8_t)text[i]);
+		End();
+	}
+
+	std::vector<uint8_t> Finish()
+	{
+		Record(EmrType::Eof, { 0, 16, 20 });
+		Patch(48, (uint32_t)m_data.size());
+		Patch(52, m_records);
+		return m_data;
+	}
+
+private:
+	std::vector<uint8_t> m_data;
+	size_t m_start;
+	uint32_t m_records;
+
+	void Begin(EmrType type)
+	{
+		m_start = m_data.size();
+		U32((uint32_t)type);
+		U32(0);
+	}
+	void End()
+	{
+		while (m_data.size() % 4)
+			m_data.push_back(0);
+		Patch(m_start + 4, (uint32_t)(m_data.size() - m_start));
+		++m_records;
+	}
+	void U16(uint16_t value)
+	{
+		m_data.push_back((uint8_t)value);
+		m_data.push_back((uint8_t)(value >> 8));
+	}
+	void U32(uint32_t value)
+	{
+		U16((uint16_t)value);
+		U16((uint16_t)(value >> 16));
+	}
+	void Rect(int32_t left, int32_t top, int32_t right, int32_t bottom)
+	{
+		U32(left);
+		U32(top);
+		U32(right);
+		U32(bottom);
+	}
+	void Record(EmrType type, std::initializer_list<uint32_t> values)
+	{
+		Begin(type);
+		for (uint32_t value : values)
+			U32(value);
+		End();
+	}
+	void Patch(size_t offset, uint32_t value)
+	{
+		for (int i = 0; i < 4; ++i)
+			m_data[offset + i] = (uint8_t)(value >> (8 * i));
+	}
+};
+
+static bool Render(const std::vector<uint8_t>& metafile, GlyphCache& glyphs, RenderedImage& image)
+{
+	image = RenderedImage();
+	TextRenderer renderer(glyphs, image);
+	EmfPlayer player;
+	return player.Play(metafile.data(), metafile.size(), renderer) && image.width == (uint32_t)g_pictureSide
+		&& image.height == (uint32_t)g_pictureSide;
+}
+
+// The width x height pixels from (ax, ay) of a and from (bx, by) of b are equal.
+static bool Same(const RenderedImage& a, int32_t ax, int32_t ay, const RenderedImage& b, int32_t bx, int32_t by, int32_t width, int32_t height)
+{
+	for (int32_t y = 0; y < height; ++y)
+	{
+		if (memcmp(&a.pixels[(size_t)(ay + y) * a.width + ax], &b.pixels[(size_t)(by + y) * b.width + bx], width * sizeof(uint32_t)))
+			return false;
+	}
+	return true;
+}
+
+static size_t Painted(const RenderedImage& image, int32_t left, int32_t top, int32_t right, int32_t bottom)
+{
+	size_t painted = 0;
+	for (int32_t y = top; y < bottom; ++y)
+	{
+		for (int32_t x = left; x < right; ++x)
+			painted += image.pixels[(size_t)y * image.width + x] != 0;
+	}
+	return painted;
+}
+
+int main()
+{
+	FontResolver fonts;
+	if (!fonts.Scan())
+	{
+		printf("GlyphCache: skipped, no fonts\n");
+		return 0;
+	}
+	bool ok = true;
+
+	// A bar taller than a quarter of an atlas page, alone.
+	MetafileWriter bar;
+	bar.Font(1, 300);
+	bar.Text(20, 10, "|");
+	RenderedImage alone;
+	GlyphCache barGlyphs(fonts);
+	ok &= Render(bar.Finish(), barGlyphs, alone);
+	ok &= Painted(alone, 0, 0, 140, g_pictureSide) > 1000;
+
+	// The same bar between small text, the later of which lands on the
+	// atlas page, not on the page of the bar.
+	MetafileWriter text;
+	text.Font(1, 20);
+	text.Text(150, 20, "Hello");
+	text.Font(2, 300);
+	text.Text(20, 10, "|");
+	text.Font(1, 20);
+	text.Text(150, 200, "wxyz Hello");
+	text.Text(150, 300, "wxyz Hello");
+	RenderedImage image;
+	GlyphCache glyphs(fonts);
+	ok &= Render(text.Finish(), glyphs, image);
+	ok &= Same(alone, 0, 0, image, 0, 0, 140, g_pictureSide);
+	ok &= Painted(image, 150, 20, g_pictureSide, 60) > 50;
+	// Repeated text draws from the cache, pixel for pixel.
+	ok &= Same(image, 150, 200, image, 150, 300, g_pictureSide - 150, 60);
+	GlyphCacheStats stats = glyphs.Stats();
+	// H e l o | w x y z and the space miss, the second l, Hello again and
+	// all of the last run hit.
+	ok &= stats.misses == 10 && stats.hits == 1 + 5 + 10;
+	ok &= stats.strikes == 2 && stats.atlasPages == 2;
+	if (!ok)
+		printf("%llu misses, %llu hits, %zu strikes, %zu pages\n", (unsigned long long)stats.misses,
+			(unsigned long long)stats.hits, stats.strikes, stats.atlasPages);
+
+	printf(ok ? "GlyphCache: ok\n" : "GlyphCache: FAILED\n");
+	return ok ? 0 : 1;
+}
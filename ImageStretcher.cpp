@@ -0,0 +1,656 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define EMF_STRETCH_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define EMF_STRETCH_AVX2
+#include <immintrin.h>
+#endif
+
+#include "ImageStretcher.h"
+
+// Halftone weights are 2.14 fixed point, and the rows between the passes
+// hold the channels scaled by 2^7 in 16 bits, so the products and their
+// sums stay in 32 bits.
+const int g_weightBits = 14;
+const int g_rowBits = 7;
+
+// One axis of the stretch: source pixels [origin, origin + size) onto count
+// destination pixels, reversed if mirror.
+struct StretchAxis
+{
+	int32_t origin;
+	uint32_t size;
+	uint32_t count;
+	bool mirror;
+
+	StretchAxis(int32_t src, int32_t srcExtent, int32_t destExtent)
+		: origin(srcExtent < 0 ? src + srcExtent : src),
+		size((uint32_t)std::abs((int64_t)srcExtent)),
+		count((uint32_t)std::abs((int64_t)destExtent)),
+		mirror((srcExtent < 0) != (destExtent < 0))
+	{
+	}
+	// Source pixel of the (unmirrored) offset j.
+	int32_t Source(uint32_t j) const
+	{
+		return origin + (int32_t)(mirror ? size - 1 - j : j);
+	}
+};
+
+// Source pixel under the center of every destination pixel.
+static std::vector<int32_t> NearestIndices(const StretchAxis& axis)
+{
+	std::vector<int32_t> indices(axis.count);
+	for (uint32_t i = 0; i < axis.count; ++i)
+		indices[i] = axis.Source((uint32_t)((2 * (uint64_t)i + 1) * axis.size / (2 * (uint64_t)axis.count)));
+	return indices;
+}
+
+// Source pixels falling on every destination pixel, at least one: the
+// first of them and their count.
+static void Spans(const StretchAxis& axis, std::vector<int32_t>& first, std::vector<uint32_t>& counts)
+{
+	first.resize(axis.count);
+	counts.resize(axis.count);
+	for (uint32_t i = 0; i < axis.count; ++i)
+	{
+		uint32_t begin = (uint32_t)((uint64_t)i * axis.size / axis.count);
+		uint32_t end = std::max(begin + 1, (uint32_t)((uint64_t)(i + 1) * axis.size / axis.count));
+		counts[i] = end - begin;
+		first[i] = axis.mirror ? axis.origin + (int32_t)(axis.size - end) : axis.origin + (int32_t)begin;
+	}
+}
+
+// Contiguous source pixels and their weights for every destination pixel,
+// stride weights apart. The stride is even, so an odd count leaves a 0
+// weight to pair the last tap with.
+// Enlarging, every pixel has the two taps of bilinear interpolation.
+struct HalftoneTaps
+{
+	std::vector<int32_t> first;
+	std::vector<uint32_t> counts;
+	std::vector<int16_t> weights;
+	uint32_t stride;
+	bool bilinear;
+
+	explicit HalftoneTaps(const StretchAxis& axis)
+		: first(axis.count), counts(axis.count)
+	{
+		double scale = (double)axis.size / axis.count;
+		bilinear = axis.size <= axis.count && axis.size >= 2;
+		stride = bilinear ? 2 : ((uint32_t)std::ceil(scale) + 2) & ~1u;
+		weights.assign((size_t)axis.count * stride, 0);
+		std::vector<double> exact(stride);
+		for (uint32_t i = 0; i < axis.count; ++i)
+		{
+			uint32_t begin, n;
+			if (bilinear)
+			{
+				// Pixel centers on pixel centers, the last two pixels at the ends.
+				double center = std::min(std::max((i + 0.5) * scale - 0.5, 0.0), axis.size - 1.0);
+				begin = std::min((uint32_t)center, axis.size - 2);
+				n = 2;
+				exact[1] = center - begin;
+				exact[0] = 1 - exact[1];
+			}
+			else
+			{
+				// Box: the share of every source pixel in [lo, hi).
+				double lo = i * scale, hi = (i + 1) * scale;
+				begin = std::min((uint32_t)lo, axis.size - 1);
+				uint32_t end = std::max(begin + 1, std::min(axis.size, (uint32_t)std::ceil(hi)));
+				n = end - begin;
+				for (uint32_t k = 0; k < n; ++k)
+					exact[k] = (std::min(hi, begin + k + 1.0) - std::max(lo, (double)(begin + k))) / scale;
+			}
+
+			// Round to fixed point, the largest weight taking the error.
+			int16_t* w = weights.data() + (size_t)i * stride;
+			int32_t sum = 0;
+			uint32_t largest = 0;
+			for (uint32_t k = 0; k < n; ++k)
+			{
+				w[k] = (int16_t)std::lround(exact[k] * (1 << g_weightBits));
+				sum += w[k];
+				if (w[k] > w[largest])
+					largest = k;
+			}
+			w[largest] = (int16_t)(w[largest] + (1 << g_weightBits) - sum);
+			if (!bilinear)
+			{
+				// Leave out the zero weights at the ends.
+				uint32_t skip = 0;
+				while (w[skip] == 0)
+					++skip;
+				while (w[n - 1] == 0)
+					--n;
+				n -= skip;
+				std::memmove(w, w + skip, n * sizeof(int16_t));
+				std::fill(w + n, w + stride, (int16_t)0);
+				begin += skip;
+			}
+
+			if (axis.mirror)
+			{
+				std::reverse(w, w + n);
+				begin = axis.size - begin - n;
+			}
+			first[i] = axis.origin + (int32_t)begin;
+			counts[i] = n;
+		}
+	}
+};
+
+static void GatherRow(const uint32_t* src, const int32_t* indices, uint32_t count, uint32_t* dst)
+{
+	uint32_t x = 0;
+#ifdef EMF_STRETCH_AVX2
+	for (; x + 8 <= count; x += 8)
+	{
+		__m256i i = _mm256_loadu_si256((const __m256i*)(indices + x));
+		_mm256_storeu_si256((__m256i*)(dst + x), _mm256_i32gather_epi32((const int*)src, i, 4));
+	}
+#endif
+	for (; x + 4 <= count; x += 4)
+	{
+		dst[x] = src[indices[x]];
+		dst[x + 1] = src[indices[x + 1]];
+		dst[x + 2] = src[indices[x + 2]];
+		dst[x + 3] = src[indices[x + 3]];
+	}
+	for (; x < count; ++x)
+		dst[x] = src[indices[x]];
+}
+
+// Combine the pixels of every span of src, ANDed unless orScans.
+static void CombineRow(const uint32_t* src, const int32_t* first, const uint32_t* counts, uint32_t count, bool orScans, uint32_t* dst)
+{
+	for (uint32_t x = 0; x < count; ++x)
+	{
+		const uint32_t* p = src + first[x];
+		uint32_t v = p[0];
+		if (orScans)
+		{
+			for (uint32_t k = 1; k < counts[x]; ++k)
+				v |= p[k];
+		}
+		else
+		{
+			for (uint32_t k = 1; k < counts[x]; ++k)
+				v &= p[k];
+		}
+		dst[x] = v;
+	}
+}
+
+static void CombineRows(uint32_t* dst, const uint32_t* src, uint32_t count, bool orScans)
+{
+	uint32_t x = 0;
+#ifdef EMF_STRETCH_SSE2
+	for (; x + 4 <= count; x += 4)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(dst + x)), b = _mm_loadu_si128((const __m128i*)(src + x));
+		_mm_storeu_si128((__m128i*)(dst + x), orScans ? _mm_or_si128(a, b) : _mm_and_si128(a, b));
+	}
+#endif
+	for (; x < count; ++x)
+		dst[x] = orScans ? dst[x] | src[x] : dst[x] & src[x];
+}
+
+#ifdef EMF_STRETCH_SSE2
+// Weights k and k + 1 in every 32 bits, for _mm_madd_epi16.
+static __m128i WeightPair(const int16_t* w)
+{
+	return _mm_shuffle_epi32(_mm_cvtsi32_si128((uint16_t)w[0] | (int32_t)w[1] << 16), 0);
+}
+
+// b0 b1 g0 g1 r0 r1 a0 a1 of two pixels, in 16 bits.
+static __m128i ChannelPairs(__m128i twoPixels)
+{
+	__m128i words = _mm_unpacklo_epi8(twoPixels, _mm_setzero_si128());
+	return _mm_unpacklo_epi16(words, _mm_srli_si128(words, 8));
+}
+#endif
+
+// Horizontal halftone pass: the weighted sums of a source row, channels
+// scaled by 2^g_rowBits.
+static void HalftoneRow(const uint32_t* src, const HalftoneTaps& taps, uint32_t count, int16_t* dst)
+{
+	uint32_t x = 0;
+#ifdef EMF_STRETCH_SSE2
+	const int shift = g_weightBits - g_rowBits;
+	const __m128i round = _mm_set1_epi32(1 << (shift - 1));
+#ifdef EMF_STRETCH_AVX2
+	// Pairs of the same channel of two pixels next to each other.
+	const __m128i pairs = _mm_setr_epi8(0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13, 10, 14, 11, 15);
+	const __m256i round8 = _mm256_set1_epi32(1 << (shift - 1));
+	// The weights k, k + 1 to the low lane and k + 2, k + 3 to the high one.
+	const __m256i lanes = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+#endif
+	if (taps.bilinear)
+	{
+#ifdef EMF_STRETCH_AVX2
+		// Four pixels at once, two in each lane.
+		for (; x + 4 <= count; x += 4)
+		{
+			const int16_t* w = taps.weights.data() + 2 * (size_t)x;
+			__m256i weights = _mm256_permutevar8x32_epi32(_mm256_castsi128_si256(_mm_loadl_epi64((const __m128i*)w)), lanes);
+			__m256i weights2 = _mm256_permutevar8x32_epi32(_mm256_castsi128_si256(_mm_loadl_epi64((const __m128i*)(w + 4))), lanes);
+			__m128i p01 = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(src + taps.first[x])), _mm_loadl_epi64((const __m128i*)(src + taps.first[x + 1])));
+			__m128i p23 = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(src + taps.first[x + 2])), _mm_loadl_epi64((const __m128i*)(src + taps.first[x + 3])));
+			__m256i sum01 = _mm256_madd_epi16(_mm256_cvtepu8_epi16(_mm_shuffle_epi8(p01, pairs)), weights);
+			__m256i sum23 = _mm256_madd_epi16(_mm256_cvtepu8_epi16(_mm_shuffle_epi8(p23, pairs)), weights2);
+			sum01 = _mm256_srai_epi32(_mm256_add_epi32(sum01, round8), shift);
+			sum23 = _mm256_srai_epi32(_mm256_add_epi32(sum23, round8), shift);
+			// Pixels 0 2 | 1 3, put back in order.
+			__m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(sum01, sum23), _MM_SHUFFLE(3, 1, 2, 0));
+			_mm256_storeu_si256((__m256i*)(dst + 4 * x), words);
+		}
+#endif
+		for (; x + 2 <= count; x += 2)
+		{
+			const int16_t* w = taps.weights.data() + 2 * (size_t)x;
+			__m128i sum0 = _mm_madd_epi16(ChannelPairs(_mm_loadl_epi64((const __m128i*)(src + taps.first[x]))), WeightPair(w));
+			__m128i sum1 = _mm_madd_epi16(ChannelPairs(_mm_loadl_epi64((const __m128i*)(src + taps.first[x + 1]))), WeightPair(w + 2));
+			sum0 = _mm_srai_epi32(_mm_add_epi32(sum0, round), shift);
+			sum1 = _mm_srai_epi32(_mm_add_epi32(sum1, round), shift);
+			_mm_storeu_si128((__m128i*)(dst + 4 * x), _mm_packs_epi32(sum0, sum1));
+		}
+	}
+	for (; x < count; ++x)
+	{
+		const uint32_t* p = src + taps.first[x];
+		const int16_t* w = taps.weights.data() + (size_t)x * taps.stride;
+		uint32_t n = taps.counts[x], k = 0;
+		__m128i sum = _mm_setzero_si128();
+#ifdef EMF_STRETCH_AVX2
+		if (n >= 4)
+		{
+			__m256i sum4 = _mm256_setzero_si256();
+			for (; k + 4 <= n; k += 4)
+			{
+				__m128i four = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + k)), pairs);
+				__m256i weights = _mm256_permutevar8x32_epi32(_mm256_castsi128_si256(_mm_loadl_epi64((const __m128i*)(w + k))), lanes);
+				sum4 = _mm256_add_epi32(sum4, _mm256_madd_epi16(_mm256_cvtepu8_epi16(four), weights));
+			}
+			sum = _mm_add_epi32(_mm256_castsi256_si128(sum4), _mm256_extracti128_si256(sum4, 1));
+		}
+#endif
+		for (; k + 2 <= n; k += 2)
+			sum = _mm_add_epi32(sum, _mm_madd_epi16(ChannelPairs(_mm_loadl_epi64((const __m128i*)(p + k))), WeightPair(w + k)));
+		if (k < n)
+			sum = _mm_add_epi32(sum, _mm_madd_epi16(ChannelPairs(_mm_cvtsi32_si128((int)p[k])), WeightPair(w + k)));
+		sum = _mm_srai_epi32(_mm_add_epi32(sum, round), shift);
+		_mm_storel_epi64((__m128i*)(dst + 4 * x), _mm_packs_epi32(sum, sum));
+	}
+#endif
+	for (; x < count; ++x)
+	{
+		const uint32_t* p = src + taps.first[x];
+		const int16_t* w = taps.weights.data() + (size_t)x * taps.stride;
+		int32_t sum[4] = {};
+		for (uint32_t k = 0; k < taps.counts[x]; ++k)
+		{
+			for (int c = 0; c < 4; ++c)
+				sum[c] += w[k] * (int32_t)(p[k] >> (8 * c) & 0xFF);
+		}
+		for (int c = 0; c < 4; ++c)
+			dst[4 * x + c] = (int16_t)((sum[c] + (1 << (g_weightBits - g_rowBits - 1))) >> (g_weightBits - g_rowBits));
+	}
+}
+
+// Vertical halftone pass: the weighted sum of n rows of count pixels.
+static void HalftoneColumn(const int16_t* const* rows, const int16_t* w, uint32_t n, uint32_t count, uint32_t* dst)
+{
+	const int shift = g_weightBits + g_rowBits;
+	uint32_t x = 0;
+#ifdef EMF_STRETCH_AVX2
+	const __m256i round8 = _mm256_set1_epi32(1 << (shift - 1));
+	for (; x + 4 <= count; x += 4)
+	{
+		__m256i lo = round8, hi = round8;
+		uint32_t k = 0;
+		for (; k + 2 <= n; k += 2)
+		{
+			__m256i a = _mm256_loadu_si256((const __m256i*)(rows[k] + 4 * x));
+			__m256i b = _mm256_loadu_si256((const __m256i*)(rows[k + 1] + 4 * x));
+			__m256i weights = _mm256_set1_epi32((uint16_t)w[k] | (int32_t)w[k + 1] << 16);
+			lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), weights));
+			hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), weights));
+		}
+		if (k < n)
+		{
+			__m256i a = _mm256_loadu_si256((const __m256i*)(rows[k] + 4 * x)), zero = _mm256_setzero_si256();
+			__m256i weights = _mm256_set1_epi32((uint16_t)w[k]);
+			lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, zero), weights));
+			hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, zero), weights));
+		}
+		// The unpacks and packs work within lanes, so the pixels come back in order.
+		__m256i words = _mm256_packs_epi32(_mm256_srai_epi32(lo, shift), _mm256_srai_epi32(hi, shift));
+		__m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(words, words), _MM_SHUFFLE(3, 1, 2, 0));
+		_mm_storeu_si128((__m128i*)(dst + x), _mm256_castsi256_si128(bytes));
+	}
+#endif
+#ifdef EMF_STRETCH_SSE2
+	const __m128i round = _mm_set1_epi32(1 << (shift - 1));
+	const __m128i zero = _mm_setzero_si128();
+	for (; x + 2 <= count; x += 2)
+	{
+		__m128i lo = round, hi = round;
+		uint32_t k = 0;
+		for (; k + 2 <= n; k += 2)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i*)(rows[k] + 4 * x));
+			__m128i b = _mm_loadu_si128((const __m128i*)(rows[k + 1] + 4 * x));
+			__m128i weights = _mm_set1_epi32((uint16_t)w[k] | (int32_t)w[k + 1] << 16);
+			lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), weights));
+			hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), weights));
+		}
+		if (k < n)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i*)(rows[k] + 4 * x));
+			__m128i weights = _mm_set1_epi32((uint16_t)w[k]);
+			lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, zero), weights));
+			hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, zero), weights));
+		}
+		__m128i words = _mm_packs_epi32(_mm_srai_epi32(lo, shift), _mm_srai_epi32(hi, shift));
+		_mm_storel_epi64((__m128i*)(dst + x), _mm_packus_epi16(words, words));
+	}
+#endif
+	for (; x < count; ++x)
+	{
+		uint32_t pixel = 0;
+		for (int c = 0; c < 4; ++c)
+		{
+			int32_t sum = 1 << (shift - 1);
+			for (uint32_t k = 0; k < n; ++k)
+				sum += w[k] * rows[k][4 * x + c];
+			pixel |= (uint32_t)std::min(sum >> shift, 255) << (8 * c);
+		}
+		dst[x] = pixel;
+	}
+}
+
+static void StretchNearest(const RenderedImage& source, const StretchAxis& horizontal, const StretchAxis& vertical, RenderedImage& destination)
+{
+	std::vector<int32_t> columns = NearestIndices(horizontal), rows = NearestIndices(vertical);
+	for (uint32_t y = 0; y < vertical.count; ++y)
+	{
+		uint32_t* dst = destination.pixels.data() + (size_t)y * destination.width;
+		if (y > 0 && rows[y] == rows[y - 1])
+			std::memcpy(dst, dst - destination.width, destination.width * sizeof(uint32_t));
+		else
+			GatherRow(source.pixels.data() + (size_t)rows[y] * source.width, columns.data(), horizontal.count, dst);
+	}
+}
+
+static void StretchScans(const RenderedImage& source, const StretchAxis& horizontal, const StretchAxis& vertical, bool orScans, RenderedImage& destination)
+{
+	std::vector<int32_t> columns, rows;
+	std::vector<uint32_t> columnCounts, rowCounts;
+	Spans(horizontal, columns, columnCounts);
+	Spans(vertical, rows, rowCounts);
+	bool gather = horizontal.size <= horizontal.count;
+	// Rows falling together are combined first, across the source
+	// rectangle, then their columns.
+	std::vector<uint32_t> scan(source.width);
+	for (uint32_t y = 0; y < vertical.count; ++y)
+	{
+		uint32_t* dst = destination.pixels.data() + (size_t)y * destination.width;
+		if (y > 0 && rows[y] == rows[y - 1] && rowCounts[y] == rowCounts[y - 1])
+		{
+			std::memcpy(dst, dst - destination.width, destination.width * sizeof(uint32_t));
+			continue;
+		}
+		const uint32_t* src = source.pixels.data() + (size_t)rows[y] * source.width;
+		if (rowCounts[y] > 1)
+		{
+			std::memcpy(scan.data() + horizontal.origin, src + horizontal.origin, horizontal.size * sizeof(uint32_t));
+			for (uint32_t k = 1; k < rowCounts[y]; ++k)
+				CombineRows(scan.data() + horizontal.origin, src + (size_t)k * source.width + horizontal.origin, horizontal.size, orScans);
+			src = scan.data();
+		}
+		if (gather)
+			GatherRow(src, columns.data(), horizontal.count, dst);
+		else
+			CombineRow(src, columns.data(), columnCounts.data(), horizontal.count, orScans, dst);
+	}
+}
+
+// Vertical halftone pass first, when shrinking rows: the weighted sum of n
+// source rows of count pixels, channels scaled by 2^g_rowBits.
+static void HalftoneSourceColumn(const uint32_t* const* rows, const int16_t* w, uint32_t n, uint32_t count, int16_t* dst)
+{
+	const int shift = g_weightBits - g_rowBits;
+	uint32_t x = 0;
+#ifdef EMF_STRETCH_AVX2
+	const __m256i round8 = _mm256_set1_epi32(1 << (shift - 1));
+	const __m256i zero8 = _mm256_setzero_si256();
+	for (; x + 8 <= count; x += 8)
+	{
+		// Pixels 0 4, 1 5, 2 6 and 3 7 of the lanes.
+		__m256i sums[4] = { round8, round8, round8, round8 };
+		for (uint32_t k = 0; k < n; k += 2)
+		{
+			__m256i a = _mm256_loadu_si256((const __m256i*)(rows[k] + x));
+			__m256i b = k + 1 < n ? _mm256_loadu_si256((const __m256i*)(rows[k + 1] + x)) : zero8;
+			__m256i weights = _mm256_set1_epi32((uint16_t)w[k] | (int32_t)w[k + 1] << 16);
+			__m256i ab[2] = { _mm256_unpacklo_epi8(a, b), _mm256_unpackhi_epi8(a, b) };
+			for (int i = 0; i < 2; ++i)
+			{
+				sums[2 * i] = _mm256_add_epi32(sums[2 * i], _mm256_madd_epi16(_mm256_unpacklo_epi8(ab[i], zero8), weights));
+				sums[2 * i + 1] = _mm256_add_epi32(sums[2 * i + 1], _mm256_madd_epi16(_mm256_unpackhi_epi8(ab[i], zero8), weights));
+			}
+		}
+		__m256i low = _mm256_packs_epi32(_mm256_srai_epi32(sums[0], shift), _mm256_srai_epi32(sums[1], shift));
+		__m256i high = _mm256_packs_epi32(_mm256_srai_epi32(sums[2], shift), _mm256_srai_epi32(sums[3], shift));
+		_mm256_storeu_si256((__m256i*)(dst + 4 * x), _mm256_permute2x128_si256(low, high, 0x20));
+		_mm256_storeu_si256((__m256i*)(dst + 4 * x + 16), _mm256_permute2x128_si256(low, high, 0x31));
+	}
+#endif
+#ifdef EMF_STRETCH_SSE2
+	const __m128i round = _mm_set1_epi32(1 << (shift - 1));
+	const __m128i zero = _mm_setzero_si128();
+	for (; x + 4 <= count; x += 4)
+	{
+		__m128i sums[4] = { round, round, round, round };
+		for (uint32_t k = 0; k < n; k += 2)
+		{
+			// Channel c of rows k and k + 1 next to each other, for madd.
+			__m128i a = _mm_loadu_si128((const __m128i*)(rows[k] + x));
+			__m128i b = k + 1 < n ? _mm_loadu_si128((const __m128i*)(rows[k + 1] + x)) : zero;
+			__m128i weights = WeightPair(w + k);
+			__m128i ab[2] = { _mm_unpacklo_epi8(a, b), _mm_unpackhi_epi8(a, b) };
+			for (int i = 0; i < 2; ++i)
+			{
+				sums[2 * i] = _mm_add_epi32(sums[2 * i], _mm_madd_epi16(_mm_unpacklo_epi8(ab[i], zero), weights));
+				sums[2 * i + 1] = _mm_add_epi32(sums[2 * i + 1], _mm_madd_epi16(_mm_unpackhi_epi8(ab[i], zero), weights));
+			}
+		}
+		_mm_storeu_si128((__m128i*)(dst + 4 * x), _mm_packs_epi32(_mm_srai_epi32(sums[0], shift), _mm_srai_epi32(sums[1], shift)));
+		_mm_storeu_si128((__m128i*)(dst + 4 * x + 8), _mm_packs_epi32(_mm_srai_epi32(sums[2], shift), _mm_srai_epi32(sums[3], shift)));
+	}
+#endif
+	for (; x < count; ++x)
+	{
+		for (int c = 0; c < 4; ++c)
+		{
+			int32_t sum = 1 << (shift - 1);
+			for (uint32_t k = 0; k < n; ++k)
+				sum += w[k] * (int32_t)(rows[k][x] >> (8 * c) & 0xFF);
+			dst[4 * x + c] = (int16_t)(sum >> shift);
+		}
+	}
+}
+
+// Horizontal halftone pass second: the weighted sums of a row of the
+// vertical pass, starting at source column origin.
+static void HalftoneColumnRow(const int16_t* src, int32_t origin, const HalftoneTaps& taps, uint32_t count, uint32_t* dst)
+{
+	const int shift = g_weightBits + g_rowBits;
+	uint32_t x = 0;
+#ifdef EMF_STRETCH_SSE2
+	const __m128i round = _mm_set1_epi32(1 << (shift - 1));
+	for (; x < count; ++x)
+	{
+		const int16_t* p = src + 4 * (taps.first[x] - origin);
+		const int16_t* w = taps.weights.data() + (size_t)x * taps.stride;
+		uint32_t n = taps.counts[x], k = 0;
+		__m128i sum = round;
+		for (; k + 2 <= n; k += 2)
+		{
+			__m128i two = _mm_loadu_si128((const __m128i*)(p + 4 * k));
+			sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpacklo_epi16(two, _mm_srli_si128(two, 8)), WeightPair(w + k)));
+		}
+		if (k < n)
+			sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(p + 4 * k)), _mm_setzero_si128()), WeightPair(w + k)));
+		__m128i words = _mm_packs_epi32(_mm_srai_epi32(sum, shift), sum);
+		dst[x] = (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+	}
+#endif
+	for (; x < count; ++x)
+	{
+		const int16_t* p = src + 4 * (taps.first[x] - origin);
+		const int16_t* w = taps.weights.data() + (size_t)x * taps.stride;
+		uint32_t pixel = 0;
+		for (int c = 0; c < 4; ++c)
+		{
+			int32_t sum = 1 << (shift - 1);
+			for (uint32_t k = 0; k < taps.counts[x]; ++k)
+				sum += w[k] * p[4 * k + c];
+			pixel |= (uint32_t)std::min(sum >> shift, 255) << (8 * c);
+		}
+		dst[x] = pixel;
+	}
+}
+
+static void StretchHalftone(const RenderedImage& source, const StretchAxis& horizontal, const StretchAxis& vertical, RenderedImage& destination)
+{
+	HalftoneTaps columns(horizontal), rows(vertical);
+	if (vertical.size > vertical.count)
+	{
+		// Shrinking rows, filter them first so the second pass has fewer.
+		std::vector<int16_t> column(4 * (size_t)horizontal.size);
+		std::vector<const uint32_t*> taps(rows.stride);
+		for (uint32_t y = 0; y < vertical.count; ++y)
+		{
+			for (uint32_t k = 0; k < rows.counts[y]; ++k)
+				taps[k] = source.pixels.data() + (size_t)(rows.first[y] + (int32_t)k) * source.width + horizontal.origin;
+			HalftoneSourceColumn(taps.data(), rows.weights.data() + (size_t)y * rows.stride, rows.counts[y], horizontal.size, column.data());
+			HalftoneColumnRow(column.data(), horizontal.origin, columns, horizontal.count, destination.pixels.data() + (size_t)y * destination.width);
+		}
+		return;
+	}
+
+	// The rows a destination row needs are contiguous and at most
+	// rows.stride, so a ring of that many keyed by the source row keeps
+	// them all, each filtered once.
+	uint32_t ringSize = rows.stride;
+	size_t rowSize = 4 * (size_t)destination.width;
+	std::vector<int16_t> ring(ringSize * rowSize);
+	std::vector<int32_t> ringRows(ringSize, INT32_MIN);
+	std::vector<const int16_t*> taps(ringSize);
+	for (uint32_t y = 0; y < vertical.count; ++y)
+	{
+		for (uint32_t k = 0; k < rows.counts[y]; ++k)
+		{
+			int32_t row = rows.first[y] + (int32_t)k;
+			uint32_t slot = (uint32_t)row % ringSize;
+			int16_t* filtered = ring.data() + slot * rowSize;
+			if (ringRows[slot] != row)
+			{
+				HalftoneRow(source.pixels.data() + (size_t)row * source.width, columns, horizontal.count, filtered);
+				ringRows[slot] = row;
+			}
+			taps[k] = filtered;
+		}
+		HalftoneColumn(taps.data(), rows.weights.data() + (size_t)y * rows.stride, rows.counts[y], horizontal.count,
+			destination.pixels.data() + (size_t)y * destination.width);
+	}
+}
+
+bool StretchImage(const RenderedImage& source, int32_t srcX, int32_t srcY, int32_t srcWidth, int32_t srcHeight,
+	int32_t destWidth, int32_t destHeight, uint32_t mode, RenderedImage& destination)
+{
+	if (srcWidth == 0 || srcHeight == 0 || destWidth == 0 || destHeight == 0)
+		return false;
+	StretchAxis horizontal(srcX, srcWidth, destWidth), vertical(srcY, srcHeight, destHeight);
+	if (horizontal.origin < 0 || vertical.origin < 0
+		|| horizontal.origin + (int64_t)horizontal.size > source.width || vertical.origin + (int64_t)vertical.size > source.height)
+		return false;
+	destination.width = horizontal.count;
+	destination.height = vertical.count;
+	destination.pixels.resize((size_t)destination.width * destination.height);
+	if (mode == g_halftone)
+		StretchHalftone(source, horizontal, vertical, destination);
+	else if (mode == g_colorOnColor)
+		StretchNearest(source, horizontal, vertical, destination);
+	else
+		StretchScans(source, horizontal, vertical, mode == g_whiteOnBlack, destination);
+	return true;
+}
+
+std::vector<StretchBenchmark> BenchmarkStretching(uint32_t width, uint32_t height, unsigned repeat)
+{
+	struct Case
+	{
+		const char* name;
+		uint32_t mode;
+		// Destination size in tenths of the source size.
+		uint32_t tenths;
+	};
+	static const Case cases[] = {
+		{ "BLACKONWHITE shrink", g_blackOnWhite, 4 },
+		{ "BLACKONWHITE enlarge", g_blackOnWhite, 25 },
+		{ "WHITEONBLACK shrink", g_whiteOnBlack, 4 },
+		{ "WHITEONBLACK enlarge", g_whiteOnBlack, 25 },
+		{ "COLORONCOLOR shrink", g_colorOnColor, 4 },
+		{ "COLORONCOLOR enlarge", g_colorOnColor, 25 },
+		{ "HALFTONE shrink", g_halftone, 4 },
+		{ "HALFTONE enlarge", g_halftone, 25 },
+	};
+
+	RenderedImage source = { width, height, std::vector<uint32_t>((size_t)width * height) };
+	uint64_t state = 1;
+	for (uint32_t& pixel : source.pixels)
+	{
+		state = state * 6364136223846793005ull + 1442695040888963407ull;
+		pixel = (uint32_t)(state >> 32) | 0xFF000000;
+	}
+	std::vector<StretchBenchmark> results;
+	RenderedImage destination;
+	for (const Case& c : cases)
+	{
+		int32_t destWidth = (int32_t)std::max(1u, width * c.tenths / 10), destHeight = (int32_t)std::max(1u, height * c.tenths / 10);
+		StretchBenchmark result = { c.name, 0, 0, 0 };
+		auto start = std::chrono::steady_clock::now();
+		for (unsigned r = 0; r < repeat; ++r)
+		{
+			if (StretchImage(source, 0, 0, (int32_t)width, (int32_t)height, destWidth, destHeight, c.mode, destination))
+			{
+				result.pixels += (uint64_t)destWidth * destHeight;
+				result.bytes += 4 * ((uint64_t)width * height + (uint64_t)destWidth * destHeight);
+			}
+		}
+		result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		results.push_back(result);
+	}
+	return results;
+}
@@ -0,0 +1,47 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "RenderCache.h"
+
+// SetStretchBltMode values.
+const uint32_t g_blackOnWhite = 1;
+const uint32_t g_whiteOnBlack = 2;
+const uint32_t g_colorOnColor = 3;
+const uint32_t g_halftone = 4;
+
+// Stretch the source rectangle of source, the corners (srcX, srcY) and
+// (srcX + srcWidth, srcY + srcHeight), to |destWidth| x |destHeight| pixels
+// as StretchBlt does in mode. Extents of opposite signs mirror that axis.
+// When shrinking, BLACKONWHITE (and any unknown mode) ANDs the pixels that
+// fall together, keeping the black lines of monochrome bitmaps, WHITEONBLACK
+// ORs them and COLORONCOLOR keeps the nearest one; those modes repeat pixels
+// when enlarging. HALFTONE averages the pixels it shrinks (box filter) and
+// interpolates those it enlarges (bilinear). Pixels are premultiplied, so
+// averaging them blends alpha right.
+// Return false if an extent is 0 or the source rectangle isn't in source.
+bool StretchImage(const RenderedImage& source, int32_t srcX, int32_t srcY, int32_t srcWidth, int32_t srcHeight,
+	int32_t destWidth, int32_t destHeight, uint32_t mode, RenderedImage& destination);
+
+struct StretchBenchmark
+{
+	const char* name;
+	uint64_t pixels;
+	// Pixels read and written.
+	uint64_t bytes;
+	double seconds;
+};
+
+// Shrink a synthesized width x height image to 40% and enlarge it to 250% in
+// every mode, repeat times each.
+std::vector<StretchBenchmark> BenchmarkStretching(uint32_t width, uint32_t height, unsigned repeat);
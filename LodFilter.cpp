@@ -0,0 +1,310 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#include <algorithm>
+#include <cmath>
+
+#include "LodFilter.h"
+
+const uint32_t g_bsSolid = 0;
+// Pixels of the largest picture merging the squares, 8 MB of bits.
+const uint64_t g_maxDotGrid = 64 * 1024 * 1024;
+
+LodFilter::LodFilter(EmfSink& next, double pixelSize)
+	: m_next(next)
+	, m_maxSide(0)
+	, m_pointsIn(0)
+	, m_pointsOut(0)
+	, m_gridLeft(0)
+	, m_gridTop(0)
+	, m_gridWidth(0)
+	, m_gridHeight(0)
+	, m_hasPending(false)
+{
+	SetPixelSize(pixelSize);
+}
+
+LodFilter::LodFilter(EmfSink& next, unsigned maxSide)
+	: m_next(next)
+	, m_maxSide(maxSide)
+	, m_pointsIn(0)
+	, m_pointsOut(0)
+	, m_gridLeft(0)
+	, m_gridTop(0)
+	, m_gridWidth(0)
+	, m_gridHeight(0)
+	, m_hasPending(false)
+{
+	SetPixelSize(1);
+}
+
+void LodFilter::SetPixelSize(double pixelSize)
+{
+	m_pixel = pixelSize > 0 ? (float)pixelSize : 1;
+	m_minDistance2 = m_pixel * m_pixel / 4;
+}
+
+void LodFilter::Begin(const EmfHeaderInfo& header)
+{
+	double left, top, width, height;
+	header.PictureRect(left, top, width, height);
+	if (m_maxSide)
+		SetPixelSize(std::max(width, height) / m_maxSide);
+	m_gridLeft = std::floor(left / m_pixel);
+	m_gridTop = std::floor(top / m_pixel);
+	double gridWidth = std::ceil(width / m_pixel) + 1, gridHeight = std::ceil(height / m_pixel) + 1;
+	if (gridWidth * gridHeight <= g_maxDotGrid)
+	{
+		m_gridWidth = (uint32_t)gridWidth;
+		m_gridHeight = (uint32_t)gridHeight;
+	}
+	else
+		m_gridWidth = m_gridHeight = 0;
+	m_dotPixels.assign(((uint64_t)m_gridWidth * m_gridHeight + 7) / 8, 0);
+	m_next.Begin(header);
+}
+
+void LodFilter::End()
+{
+	m_next.End();
+}
+
+void LodFilter::DrawText(const EmfTextRun& run, const EmfDeviceContext& dc)
+{
+	m_next.DrawText(run, dc);
+}
+
+void LodFilter::DrawImage(const EmfImage& image, const EmfDeviceContext& dc)
+{
+	m_next.DrawImage(image, dc);
+}
+
+void LodFilter::FillGradient(const EmfGradient& gradient, const EmfDeviceContext& dc)
+{
+	m_next.FillGradient(gradient, dc);
+}
+
+void LodFilter::Record(const EmfRecordSpan& record)
+{
+	m_next.Record(record);
+}
+
+void LodFilter::AddDot(EmfPath& out, EmfPointF p)
+{
+	double x = std::floor(p.x / m_pixel), y = std::floor(p.y / m_pixel);
+	double gridX = x - m_gridLeft, gridY = y - m_gridTop;
+	if (gridX >= 0 && gridX < m_gridWidth && gridY >= 0 && gridY < m_gridHeight)
+	{
+		uint64_t bit = (uint64_t)gridY * m_gridWidth + (uint64_t)gridX;
+		uint8_t mask = (uint8_t)(1 << (bit & 7));
+		if (m_dotPixels[bit >> 3] & mask)
+			return;
+		m_dotPixels[bit >> 3] |= mask;
+	}
+	float left = (float)(x * m_pixel), top = (float)(y * m_pixel);
+	out.MoveTo({ left, top });
+	out.LineTo({ left + m_pixel, top });
+	out.LineTo({ left + m_pixel, top + m_pixel });
+	out.LineTo({ left, top + m_pixel });
+	out.Close();
+}
+
+void LodFilter::AddRunPoint(EmfPointF p)
+{
+	// Vertex culling: the points within half a pixel of the last kept one
+	// are dropped, but the last point of the run.
+	EmfPointF kept = m_run.back();
+	float dx = p.x - kept.x, dy = p.y - kept.y;
+	if (dx * dx + dy * dy >= m_minDistance2)
+	{
+		m_run.push_back(p);
+		m_hasPending = false;
+	}
+	else
+	{
+		m_pending = p;
+		m_hasPending = true;
+	}
+}
+
+void LodFilter::FlushRun()
+{
+	if (m_hasPending)
+		m_run.push_back(m_pending);
+	m_hasPending = false;
+	size_t count = m_run.size();
+	if (count < 2)
+	{
+		m_run.clear();
+		return;
+	}
+
+	// Douglas-Peucker within half a pixel, the end points fixed.
+	m_keep.assign(count, 0);
+	m_keep[0] = m_keep[count - 1] = 1;
+	m_stack.clear();
+	if (count > 2)
+		m_stack.emplace_back(0, count - 1);
+	while (!m_stack.empty())
+	{
+		size_t first = m_stack.back().first, last = m_stack.back().second;
+		m_stack.pop_back();
+		EmfPointF a = m_run[first], b = m_run[last];
+		float dx = b.x - a.x, dy = b.y - a.y;
+		float length2 = dx * dx + dy * dy;
+		float scale = length2 > 0 ? length2 : 1;
+		float farthest = -1;
+		size_t index = first;
+		for (size_t i = first + 1; i < last; ++i)
+		{
+			float px = m_run[i].x - a.x, py = m_run[i].y - a.y;
+			// Squared distance to the segment, scaled by its squared length.
+			float d2;
+			float t = px * dx + py * dy;
+			if (length2 <= 0 || t <= 0)
+				d2 = (px * px + py * py) * scale;
+			else if (t >= length2)
+			{
+				float qx = m_run[i].x - b.x, qy = m_run[i].y - b.y;
+				d2 = (qx * qx + qy * qy) * length2;
+			}
+			else
+			{
+				float cross = px * dy - py * dx;
+				d2 = cross * cross;
+			}
+			if (d2 > farthest)
+			{
+				farthest = d2;
+				index = i;
+			}
+		}
+		if (farthest > m_minDistance2 * scale)
+		{
+			m_keep[index] = 1;
+			if (index - first > 1)
+				m_stack.emplace_back(first, index);
+			if (last - index > 1)
+				m_stack.emplace_back(index, last);
+		}
+	}
+	for (size_t i = 1; i < count; ++i)
+	{
+		if (m_keep[i])
+			m_out.LineTo(m_run[i]);
+	}
+	m_run.clear();
+}
+
+void LodFilter::Figure(const EmfPath& path, size_t verbBegin, size_t verbEnd, size_t pointBegin)
+{
+	// The figure is written as it is read, and taken back if it turns out
+	// smaller than a pixel.
+	size_t outVerbs = m_out.verbs.size(), outPoints = m_out.points.size();
+	const EmfPointF* p = path.points.data() + pointBegin;
+	float minX = p->x, maxX = p->x, minY = p->y, maxY = p->y;
+	auto extend = [&](EmfPointF q) {
+		minX = std::min(minX, q.x);
+		maxX = std::max(maxX, q.x);
+		minY = std::min(minY, q.y);
+		maxY = std::max(maxY, q.y);
+	};
+	// The run of line points starts at the last point written.
+	EmfPointF last = *p, start = *p;
+	for (size_t v = verbBegin; v < verbEnd; ++v)
+	{
+		switch (path.verbs[v])
+		{
+		case PathVerb::MoveTo:
+			FlushRun();
+			m_out.MoveTo(*p);
+			last = start = *p++;
+			m_run.push_back(last);
+			break;
+		case PathVerb::LineTo:
+			if (m_run.empty())
+				m_run.push_back(last);
+			last = *p++;
+			extend(last);
+			AddRunPoint(last);
+			break;
+		case PathVerb::BezierTo:
+			{
+				float bx0 = std::min(std::min(last.x, p[0].x), std::min(p[1].x, p[2].x));
+				float bx1 = std::max(std::max(last.x, p[0].x), std::max(p[1].x, p[2].x));
+				float by0 = std::min(std::min(last.y, p[0].y), std::min(p[1].y, p[2].y));
+				float by1 = std::max(std::max(last.y, p[0].y), std::max(p[1].y, p[2].y));
+				extend({ bx0, by0 });
+				extend({ bx1, by1 });
+				if (bx1 - bx0 < m_pixel && by1 - by0 < m_pixel)
+				{
+					// The curve is a line at this scale.
+					if (m_run.empty())
+						m_run.push_back(last);
+					AddRunPoint(p[2]);
+				}
+				else
+				{
+					FlushRun();
+					m_out.BezierTo(p[0], p[1], p[2]);
+				}
+				last = p[2];
+				p += 3;
+			}
+			break;
+		case PathVerb::Close:
+			FlushRun();
+			m_out.Close();
+			last = start;
+			break;
+		}
+	}
+	FlushRun();
+	if (maxX - minX < m_pixel && maxY - minY < m_pixel)
+	{
+		m_out.verbs.resize(outVerbs);
+		m_out.points.resize(outPoints);
+		AddDot(m_dots, { (minX + maxX) / 2, (minY + maxY) / 2 });
+	}
+}
+
+void LodFilter::DrawPath(const EmfPath& path, const EmfDeviceContext& dc, bool stroke, bool fill)
+{
+	m_pointsIn += path.points.size();
+	m_out.Clear();
+	m_dots.Clear();
+	// Figures start at MoveTo.
+	size_t verbBegin = 0, pointBegin = 0, pointIndex = 0;
+	for (size_t v = 0; v <= path.verbs.size(); ++v)
+	{
+		PathVerb verb = v < path.verbs.size() ? path.verbs[v] : PathVerb::MoveTo;
+		if (verb == PathVerb::MoveTo && v > verbBegin)
+		{
+			Figure(path, verbBegin, v, pointBegin);
+			verbBegin = v;
+			pointBegin = pointIndex;
+		}
+		if (v < path.verbs.size())
+			pointIndex += verb == PathVerb::BezierTo ? 3 : verb == PathVerb::Close ? 0 : 1;
+	}
+
+	if (!m_out.Empty())
+	{
+		m_pointsOut += m_out.points.size();
+		m_next.DrawPath(m_out, dc, stroke, fill);
+	}
+	if (!m_dots.Empty())
+	{
+		// Filled with the color the figure would show, its outline covers it.
+		m_pointsOut += m_dots.points.size();
+		EmfDeviceContext dotDC = dc;
+		dotDC.brush = { g_bsSolid, stroke ? dc.pen.color : dc.brush.color, 0 };
+		m_next.DrawPath(m_dots, dotDC, false, true);
+	}
+}
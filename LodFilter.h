@@ -0,0 +1,78 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include "EmfPlayer.h"
+
+// Level of detail for small outputs (thumbnails, previews). Sits between
+// EmfPlayer and another sink, and removes from the paths what can't be seen
+// at the output scale:
+// - a figure smaller than an output pixel becomes a pixel sized square, and
+//   only the first one in a pixel is kept;
+// - the vertices closer than half a pixel to the previous one are dropped,
+//   then the polylines are simplified by Douglas-Peucker within half a pixel;
+// - a bezier smaller than a pixel becomes a line.
+// Text, images and gradients are passed on unchanged.
+class LodFilter : public EmfSink
+{
+public:
+	// pixelSize is the size of an output pixel in device units.
+	LodFilter(EmfSink& next, double pixelSize);
+	// The output pixel size is set by Begin to fit the picture in maxSide pixels.
+	LodFilter(EmfSink& next, unsigned maxSide);
+
+	virtual void Begin(const EmfHeaderInfo& header) override;
+	virtual void End() override;
+	virtual void DrawPath(const EmfPath& path, const EmfDeviceContext& dc, bool stroke, bool fill) override;
+	virtual void DrawText(const EmfTextRun& run, const EmfDeviceContext& dc) override;
+	virtual void DrawImage(const EmfImage& image, const EmfDeviceContext& dc) override;
+	virtual void FillGradient(const EmfGradient& gradient, const EmfDeviceContext& dc) override;
+	virtual void Record(const EmfRecordSpan& record) override;
+
+	// Path points received and passed on, to measure the reduction.
+	uint64_t PointsIn() const
+	{
+		return m_pointsIn;
+	}
+	uint64_t PointsOut() const
+	{
+		return m_pointsOut;
+	}
+
+private:
+	EmfSink& m_next;
+	unsigned m_maxSide;
+	float m_pixel;
+	// Squared half pixel.
+	float m_minDistance2;
+	uint64_t m_pointsIn;
+	uint64_t m_pointsOut;
+	EmfPath m_out;
+	EmfPath m_dots;
+	// Pixels of the picture holding a square made from a figure smaller than
+	// a pixel, one bit each. Squares outside the picture aren't merged.
+	ArenaVector<uint8_t> m_dotPixels;
+	double m_gridLeft, m_gridTop;
+	uint32_t m_gridWidth, m_gridHeight;
+	// Line points kept by the vertex culling, and the last one if culled.
+	ArenaVector<EmfPointF> m_run;
+	EmfPointF m_pending;
+	bool m_hasPending;
+	ArenaVector<uint8_t> m_keep;
+	ArenaVector<std::pair<size_t, size_t>> m_stack;
+
+	void SetPixelSize(double pixelSize);
+	// Add the square of the pixel holding p unless already there.
+	void AddDot(EmfPath& out, EmfPointF p);
+	void AddRunPoint(EmfPointF p);
+	// Simplify m_run and append it but its first point, already in m_out, as LineTo.
+	void FlushRun();
+	void Figure(const EmfPath& path, size_t verbBegin, size_t verbEnd, size_t pointBegin);
+};
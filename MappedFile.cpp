@@ -0,0 +1,131 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "MappedFile.h"
+
+MappedFile::MappedFile()
+	: m_data(nullptr)
+	, m_size(0)
+	, m_modifiedTime(0)
+#ifdef _WIN32
+	, m_file(INVALID_HANDLE_VALUE)
+	, m_mapping(nullptr)
+#else
+	, m_fd(-1)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+#ifdef _WIN32
+bool MappedFile::Open(const std::string& fileName)
+{
+	Close();
+	int len = MultiByteToWideChar(CP_UTF8, 0, fileName.c_str(), (int)fileName.length(), NULL, 0);
+	std::wstring wideName(len, L'\0');
+	MultiByteToWideChar(CP_UTF8, 0, fileName.c_str(), (int)fileName.length(), &wideName[0], len);
+
+	m_file = CreateFileW(wideName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (m_file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	FILETIME writeTime;
+	if (!GetFileSizeEx(m_file, &size) || !GetFileTime(m_file, NULL, NULL, &writeTime))
+	{
+		Close();
+		return false;
+	}
+	m_size = (size_t)size.QuadPart;
+	m_modifiedTime = ((uint64_t)writeTime.dwHighDateTime << 32) | writeTime.dwLowDateTime;
+	if (m_size == 0)
+		return true;
+
+	m_mapping = CreateFileMappingW(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!m_mapping)
+	{
+		Close();
+		return false;
+	}
+	m_data = (const uint8_t*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!m_data)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_data)
+		UnmapViewOfFile(m_data);
+	if (m_mapping)
+		CloseHandle(m_mapping);
+	if (m_file != INVALID_HANDLE_VALUE)
+		CloseHandle(m_file);
+	m_data = nullptr;
+	m_mapping = nullptr;
+	m_file = INVALID_HANDLE_VALUE;
+	m_size = 0;
+	m_modifiedTime = 0;
+}
+#else
+bool MappedFile::Open(const std::string& fileName)
+{
+	Close();
+	m_fd = open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+	if (m_fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(m_fd, &st) != 0)
+	{
+		Close();
+		return false;
+	}
+	m_size = (size_t)st.st_size;
+	m_modifiedTime = (uint64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	if (m_size == 0)
+		return true;
+
+	void* p = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+	if (p == MAP_FAILED)
+	{
+		Close();
+		return false;
+	}
+	madvise(p, m_size, MADV_SEQUENTIAL);
+	m_data = (const uint8_t*)p;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_data)
+		munmap((void*)m_data, m_size);
+	if (m_fd >= 0)
+		close(m_fd);
+	m_data = nullptr;
+	m_fd = -1;
+	m_size = 0;
+	m_modifiedTime = 0;
+}
+#endif
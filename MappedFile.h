@@ -0,0 +1,54 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read only view of a whole file. Big metafiles are mapped instead of read,
+// so only the pages actually touched are loaded.
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// fileName is UTF-8.
+	bool Open(const std::string& fileName);
+	void Close();
+
+	const uint8_t* Data() const
+	{
+		return m_data;
+	}
+	size_t Size() const
+	{
+		return m_size;
+	}
+	// Last write time in the native unit of the platform.
+	uint64_t ModifiedTime() const
+	{
+		return m_modifiedTime;
+	}
+
+private:
+	const uint8_t* m_data;
+	size_t m_size;
+	uint64_t m_modifiedTime;
+#ifdef _WIN32
+	void* m_file;
+	void* m_mapping;
+#else
+	int m_fd;
+#endif
+};
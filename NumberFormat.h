@@ -0,0 +1,64 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+// Longest output of FormatNumber.
+const size_t g_maxNumberText = 24;
+
+template<int Decimals>
+struct DecimalUnit
+{
+	static const int64_t value = 10 * DecimalUnit<Decimals - 1>::value;
+};
+
+template<>
+struct DecimalUnit<0>
+{
+	static const int64_t value = 1;
+};
+
+// Digits of value rounded to Decimals (at most 6) into out, no exponent and
+// no trailing zeros, as SVG and PDF want them. Return the length.
+template<int Decimals>
+inline size_t FormatNumber(char* out, double value)
+{
+	static_assert(Decimals > 0 && Decimals <= 6, "At most 6 decimals");
+	const int64_t unit = DecimalUnit<Decimals>::value;
+	if (!(std::fabs(value) <= 1e12))
+		value = 0;
+	// Most coordinates are whole numbers.
+	if (std::fabs(value) < 2e9 && value == (double)(int32_t)value)
+		return std::to_chars(out, out + 12, (int32_t)value).ptr - out;
+	double scaled = value * unit;
+	int64_t n = (int64_t)(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+	size_t length = 0;
+	if (n < 0)
+	{
+		out[length++] = '-';
+		n = -n;
+	}
+	length = std::to_chars(out + length, out + length + 20, (uint64_t)n / unit).ptr - out;
+	uint32_t fraction = (uint32_t)((uint64_t)n % unit);
+	if (fraction)
+	{
+		out[length++] = '.';
+		for (uint32_t place = unit / 10; fraction; place /= 10)
+		{
+			out[length++] = (char)('0' + fraction / place);
+			fraction %= place;
+		}
+	}
+	return length;
+}
@@ -0,0 +1,328 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define EMF_FLATTEN_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "PathFlattener.h"
+
+// Smallest tolerance accepted, below it floats can't follow anyway.
+const float g_minFlatness = 1.0f / 1024;
+
+PathFlattener::PathFlattener(float tolerance)
+{
+	SetTolerance(tolerance);
+}
+
+void PathFlattener::SetTolerance(float tolerance)
+{
+	m_tolerance = tolerance >= g_minFlatness ? tolerance : g_minFlatness;
+}
+
+float PathFlattener::ToleranceFor(float outputTolerance, double scale)
+{
+	return scale > 0 ? (float)(outputTolerance / scale) : outputTolerance;
+}
+
+uint32_t PathFlattener::SegmentCount(const EmfPointF* p, float tolerance)
+{
+	// The distance between a cubic and its polyline of n segments is at most
+	// 3/4 * max |p[i] - 2 p[i+1] + p[i+2]| / n^2.
+	float x1 = p[0].x - 2 * p[1].x + p[2].x, y1 = p[0].y - 2 * p[1].y + p[2].y;
+	float x2 = p[1].x - 2 * p[2].x + p[3].x, y2 = p[1].y - 2 * p[2].y + p[3].y;
+	float dd = std::sqrt(std::max(x1 * x1 + y1 * y1, x2 * x2 + y2 * y2));
+	float n = std::ceil(std::sqrt(0.75f * dd / tolerance));
+	// NaN fails both comparisons.
+	if (!(n >= 1))
+		return 1;
+	return n < g_maxCurveSegments ? (uint32_t)n : g_maxCurveSegments;
+}
+
+void PathFlattener::CountSegments(const EmfPointF* controls, size_t count, uint32_t* segments) const
+{
+	size_t i = 0;
+#ifdef EMF_FLATTEN_SSE2
+	const __m128 two = _mm_set1_ps(2);
+	const __m128 one = _mm_set1_ps(1);
+	const __m128 factor = _mm_set1_ps(0.75f / m_tolerance);
+	const __m128 maxSegments = _mm_set1_ps((float)g_maxCurveSegments);
+	for (; i + 4 <= count; i += 4)
+	{
+		const EmfPointF* c = controls + i * 4;
+		__m128 x[4], y[4];
+		for (int k = 0; k < 4; ++k)
+		{
+			x[k] = _mm_setr_ps(c[k].x, c[4 + k].x, c[8 + k].x, c[12 + k].x);
+			y[k] = _mm_setr_ps(c[k].y, c[4 + k].y, c[8 + k].y, c[12 + k].y);
+		}
+		__m128 x1 = _mm_add_ps(_mm_sub_ps(x[0], _mm_mul_ps(two, x[1])), x[2]);
+		__m128 y1 = _mm_add_ps(_mm_sub_ps(y[0], _mm_mul_ps(two, y[1])), y[2]);
+		__m128 x2 = _mm_add_ps(_mm_sub_ps(x[1], _mm_mul_ps(two, x[2])), x[3]);
+		__m128 y2 = _mm_add_ps(_mm_sub_ps(y[1], _mm_mul_ps(two, y[2])), y[3]);
+		__m128 dd = _mm_max_ps(_mm_add_ps(_mm_mul_ps(x1, x1), _mm_mul_ps(y1, y1)), _mm_add_ps(_mm_mul_ps(x2, x2), _mm_mul_ps(y2, y2)));
+		__m128 n = _mm_sqrt_ps(_mm_mul_ps(_mm_sqrt_ps(dd), factor));
+		// _mm_max_ps returns its second operand for NaN.
+		n = _mm_min_ps(_mm_max_ps(n, one), maxSegments);
+		// Ceiling: truncate, and add 1 where it went down.
+		__m128i truncated = _mm_cvttps_epi32(n);
+		__m128 below = _mm_cmplt_ps(_mm_cvtepi32_ps(truncated), n);
+		truncated = _mm_sub_epi32(truncated, _mm_castps_si128(below));
+		_mm_storeu_si128((__m128i*)(segments + i), truncated);
+	}
+#endif
+	for (; i < count; ++i)
+		segments[i] = SegmentCount(controls + i * 4, m_tolerance);
+}
+
+void PathFlattener::Evaluate(const EmfPointF* controls, size_t count, const uint32_t* segments, EmfPointF* out, const size_t* offsets)
+{
+	// B(t) = p0 + c t + b t^2 + a t^3, stepped by h = 1/n with
+	// f += df, df += ddf, ddf += dddf. Relative to p0 to keep float precision
+	// on big coordinates, and the last point is p3 itself.
+#ifdef EMF_FLATTEN_SSE2
+	// Lane j of a vector steps through the points 4 m + j + 1 of the curve,
+	// by forward differencing with a step of 4 h, so four consecutive points
+	// are stored at once.
+	const __m128 lanes = _mm_setr_ps(1, 2, 3, 4);
+	const __m128 two = _mm_set1_ps(2);
+	const __m128 six = _mm_set1_ps(6);
+#endif
+	for (size_t i = 0; i < count; ++i)
+	{
+		const EmfPointF* p = controls + i * 4;
+		uint32_t n = segments[i];
+		EmfPointF* o = out + offsets[i];
+		uint32_t step = 1;
+#ifdef EMF_FLATTEN_SSE2
+		if (n > 8)
+		{
+			float h = 1.0f / n;
+			__m128 t = _mm_mul_ps(lanes, _mm_set1_ps(h));
+			__m128 bigStep = _mm_set1_ps(4 * h);
+			__m128 t1 = _mm_add_ps(t, bigStep), t2 = _mm_add_ps(t1, bigStep);
+			__m128 bigStep3 = _mm_mul_ps(_mm_mul_ps(bigStep, bigStep), bigStep);
+			__m128 f[2], df[2], ddf[2], dddf[2];
+			for (int axis = 0; axis < 2; ++axis)
+			{
+				float v1 = axis == 0 ? p[1].x - p[0].x : p[1].y - p[0].y;
+				float v2 = axis == 0 ? p[2].x - p[0].x : p[2].y - p[0].y;
+				float v3 = axis == 0 ? p[3].x - p[0].x : p[3].y - p[0].y;
+				__m128 cc = _mm_set1_ps(3 * v1);
+				__m128 bb = _mm_set1_ps(3 * (v2 - 2 * v1));
+				__m128 aa = _mm_set1_ps(v3 - 3 * (v2 - v1));
+				auto at = [&](__m128 tt) {
+					return _mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(aa, tt), bb), tt), cc), tt);
+				};
+				__m128 b0 = at(t), b1 = at(t1), b2 = at(t2);
+				f[axis] = b0;
+				df[axis] = _mm_sub_ps(b1, b0);
+				ddf[axis] = _mm_add_ps(_mm_sub_ps(b2, _mm_mul_ps(two, b1)), b0);
+				dddf[axis] = _mm_mul_ps(six, _mm_mul_ps(aa, bigStep3));
+			}
+			__m128 origin = _mm_setr_ps(p[0].x, p[0].y, p[0].x, p[0].y);
+			for (; step + 4 <= n; step += 4, o += 4)
+			{
+				// x0 y0 x1 y1 and x2 y2 x3 y3.
+				_mm_storeu_ps(&o[0].x, _mm_add_ps(_mm_unpacklo_ps(f[0], f[1]), origin));
+				_mm_storeu_ps(&o[2].x, _mm_add_ps(_mm_unpackhi_ps(f[0], f[1]), origin));
+				for (int axis = 0; axis < 2; ++axis)
+				{
+					f[axis] = _mm_add_ps(f[axis], df[axis]);
+					df[axis] = _mm_add_ps(df[axis], ddf[axis]);
+					ddf[axis] = _mm_add_ps(ddf[axis], dddf[axis]);
+				}
+			}
+			alignas(16) float x[4], y[4];
+			_mm_store_ps(x, f[0]);
+			_mm_store_ps(y, f[1]);
+			for (int lane = 0; step < n; ++step, ++lane)
+				*o++ = { p[0].x + x[lane], p[0].y + y[lane] };
+			*o = p[3];
+			continue;
+		}
+#endif
+		float h = 1.0f / n, h2 = h * h, h3 = h2 * h;
+		float f[2] = { 0, 0 }, df[2], ddf[2], dddf[2];
+		for (int axis = 0; axis < 2; ++axis)
+		{
+			auto v = [&](int k) { return axis == 0 ? p[k].x - p[0].x : p[k].y - p[0].y; };
+			float cc = 3 * v(1);
+			float bb = 3 * (v(2) - 2 * v(1));
+			float aa = v(3) - 3 * (v(2) - v(1));
+			df[axis] = aa * h3 + bb * h2 + cc * h;
+			dddf[axis] = 6 * aa * h3;
+			ddf[axis] = dddf[axis] + 2 * bb * h2;
+		}
+		for (; step < n; ++step)
+		{
+			for (int axis = 0; axis < 2; ++axis)
+			{
+				f[axis] += df[axis];
+				df[axis] += ddf[axis];
+				ddf[axis] += dddf[axis];
+			}
+			*o++ = { p[0].x + f[0], p[0].y + f[1] };
+		}
+		*o = p[3];
+	}
+}
+
+void PathFlattener::FlattenCurves(const EmfPointF* controls, size_t count, std::vector<EmfPointF>& points, std::vector<uint32_t>& counts)
+{
+	m_segments.resize(count);
+	CountSegments(controls, count, m_segments.data());
+	m_offsets.resize(count);
+	size_t total = points.size();
+	for (size_t i = 0; i < count; ++i)
+	{
+		m_offsets[i] = total;
+		total += m_segments[i];
+	}
+	points.resize(total);
+	counts.insert(counts.end(), m_segments.begin(), m_segments.end());
+	Evaluate(controls, count, m_segments.data(), points.data(), m_offsets.data());
+}
+
+void PathFlattener::Flatten(const EmfPath& path, FlatPath& out)
+{
+	out.Clear();
+	// First the curves, to count their segments all at once.
+	m_controls.clear();
+	{
+		const EmfPointF* p = path.points.data();
+		EmfPointF last = { 0, 0 }, start = { 0, 0 };
+		for (PathVerb verb : path.verbs)
+		{
+			if (verb == PathVerb::BezierTo)
+			{
+				m_controls.push_back(last);
+				m_controls.insert(m_controls.end(), p, p + 3);
+				last = p[2];
+				p += 3;
+			}
+			else if (verb == PathVerb::Close)
+				last = start;
+			else
+			{
+				last = *p++;
+				if (verb == PathVerb::MoveTo)
+					start = last;
+			}
+		}
+	}
+	size_t curveCount = m_controls.size() / 4;
+	m_segments.resize(curveCount);
+	CountSegments(m_controls.data(), curveCount, m_segments.data());
+	m_offsets.resize(curveCount);
+
+	// Then the polylines, with room left for the curve points.
+	const EmfPointF* p = path.points.data();
+	size_t curve = 0;
+	uint32_t* current = nullptr;
+	EmfPointF figureStart = { 0, 0 };
+	auto startPolyline = [&](EmfPointF start) {
+		out.counts.push_back(1);
+		out.closed.push_back(0);
+		out.points.push_back(start);
+		current = &out.counts.back();
+		figureStart = start;
+	};
+	for (PathVerb verb : path.verbs)
+	{
+		switch (verb)
+		{
+		case PathVerb::MoveTo:
+			startPolyline(*p++);
+			break;
+		case PathVerb::LineTo:
+			if (!current)
+				startPolyline(figureStart);
+			out.points.push_back(*p++);
+			++*current;
+			break;
+		case PathVerb::BezierTo:
+			if (!current)
+				startPolyline(m_controls[curve * 4]);
+			m_offsets[curve] = out.points.size();
+			out.points.resize(out.points.size() + m_segments[curve]);
+			*current += m_segments[curve];
+			++curve;
+			p += 3;
+			break;
+		case PathVerb::Close:
+			if (current)
+			{
+				out.closed.back() = 1;
+				// A figure drawn on after Close starts again from its start point.
+				current = nullptr;
+			}
+			break;
+		}
+	}
+	Evaluate(m_controls.data(), curveCount, m_segments.data(), out.points.data(), m_offsets.data());
+}
+
+void PathFlattener::Flatten(const EmfPath& path, EmfPath& out)
+{
+	Flatten(path, m_flat);
+	out.Clear();
+	const EmfPointF* p = m_flat.points.data();
+	for (size_t i = 0; i < m_flat.counts.size(); ++i)
+	{
+		out.MoveTo(*p++);
+		for (uint32_t k = 1; k < m_flat.counts[i]; ++k)
+			out.LineTo(*p++);
+		if (m_flat.closed[i])
+			out.Close();
+	}
+}
+
+class PathCollector : public EmfSink
+{
+public:
+	std::vector<EmfPath> paths;
+
+	virtual void DrawPath(const EmfPath& path, const EmfDeviceContext& /*dc*/, bool /*stroke*/, bool /*fill*/) override
+	{
+		if (std::find(path.verbs.begin(), path.verbs.end(), PathVerb::BezierTo) != path.verbs.end())
+			paths.push_back(path);
+	}
+};
+
+FlattenBenchmark BenchmarkFlatten(const uint8_t* data, size_t size, float tolerance, unsigned repeat)
+{
+	FlattenBenchmark result = {};
+	PathCollector collector;
+	EmfPlayer player;
+	if (!player.Play(data, size, collector))
+		return result;
+	for (const EmfPath& path : collector.paths)
+		result.curves += std::count(path.verbs.begin(), path.verbs.end(), PathVerb::BezierTo);
+	result.curves *= repeat;
+
+	PathFlattener flattener(tolerance);
+	FlatPath flat;
+	auto start = std::chrono::steady_clock::now();
+	for (unsigned r = 0; r < repeat; ++r)
+	{
+		for (const EmfPath& path : collector.paths)
+		{
+			flattener.Flatten(path, flat);
+			result.segments += flat.points.size() - flat.counts.size();
+		}
+	}
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return result;
+}
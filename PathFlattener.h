@@ -0,0 +1,95 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <vector>
+
+#include "EmfPlayer.h"
+
+// Maximum distance in device pixels between a curve and its polyline, by
+// default. GDI flattens with about the same precision.
+const float g_defaultFlatness = 0.25f;
+// Bound of the segments of one bezier, so a huge curve can't exhaust memory.
+const uint32_t g_maxCurveSegments = 4096;
+
+// Polylines of a flattened EmfPath, device space.
+struct FlatPath
+{
+	std::vector<EmfPointF> points;
+	// Point count of every polyline, in order.
+	std::vector<uint32_t> counts;
+	// 1 if the polyline was ended by a Close verb.
+	std::vector<uint8_t> closed;
+
+	void Clear()
+	{
+		points.clear();
+		counts.clear();
+		closed.clear();
+	}
+};
+
+// Turns the beziers of EmfPath into line segments. EmfPlayer has already
+// converted arcs, chords, pies and ellipses into beziers, so every curve
+// of an EMF goes through here.
+//
+// The segment count of a curve is the smallest keeping it within the
+// tolerance (Wang's formula), and the points are computed by forward
+// differencing, four curves at a time with SSE2.
+class PathFlattener
+{
+public:
+	explicit PathFlattener(float tolerance = g_defaultFlatness);
+
+	void SetTolerance(float tolerance);
+	float Tolerance() const
+	{
+		return m_tolerance;
+	}
+	// Tolerance in device pixels giving the tolerance in output pixels when
+	// device space is scaled by scale for the output.
+	static float ToleranceFor(float outputTolerance, double scale);
+
+	// Replace the content of out with the polylines of path.
+	void Flatten(const EmfPath& path, FlatPath& out);
+	// Same for EmfPath consumers, FlattenPath of GDI.
+	void Flatten(const EmfPath& path, EmfPath& out);
+
+	// Flatten count independent cubic curves of 4 control points each.
+	// The points of curve i, its start point excepted, are appended to
+	// points, and their number to counts.
+	void FlattenCurves(const EmfPointF* controls, size_t count, std::vector<EmfPointF>& points, std::vector<uint32_t>& counts);
+
+	// Segments of the curve for the tolerance.
+	static uint32_t SegmentCount(const EmfPointF* controls, float tolerance);
+
+private:
+	float m_tolerance;
+	// Scratch of Flatten, kept to reuse its memory.
+	std::vector<EmfPointF> m_controls;
+	std::vector<uint32_t> m_segments;
+	std::vector<size_t> m_offsets;
+	FlatPath m_flat;
+
+	void CountSegments(const EmfPointF* controls, size_t count, uint32_t* segments) const;
+	// Write the points of the curves, the point of curve i at offsets[i].
+	static void Evaluate(const EmfPointF* controls, size_t count, const uint32_t* segments, EmfPointF* out, const size_t* offsets);
+};
+
+struct FlattenBenchmark
+{
+	uint64_t curves;
+	uint64_t segments;
+	double seconds;
+};
+
+// Flatten every curve drawn by the EMF held in memory repeat times.
+// The curves are collected first, only the flattening is timed.
+FlattenBenchmark BenchmarkFlatten(const uint8_t* data, size_t size, float tolerance, unsigned repeat);
@@ -0,0 +1,860 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <future>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include <zlib.h>
+
+#include "ContentHash.h"
+#include "DibDecoder.h"
+#include "EmfPlayer.h"
+#include "EmzStream.h"
+#include "ImageStretcher.h"
+#include "NumberFormat.h"
+#include "PdfExporter.h"
+
+// Content is cut into streams of about this size, each deflated on its own.
+const size_t g_pdfChunkSize = 1024 * 1024;
+// Pages played ahead of the writer.
+const unsigned g_pdfLookaheadPerThread = 2;
+const double g_pointsPerMm = 72 / 25.4;
+// The default level is 5 times slower on content streams for 15% less output.
+const int g_pdfDeflateLevel = Z_BEST_SPEED;
+
+// Object numbers of the catalog and of the page tree.
+const uint32_t g_catalogObject = 1;
+const uint32_t g_pagesObject = 2;
+
+// wingdi.h values used below.
+const uint32_t g_psStyleMask = 0x0000000F;
+const uint32_t g_psEndCapMask = 0x00000F00;
+const uint32_t g_psJoinMask = 0x0000F000;
+const uint32_t g_psEndCapSquare = 0x00000100;
+const uint32_t g_psEndCapFlat = 0x00000200;
+const uint32_t g_psJoinBevel = 0x00001000;
+const uint32_t g_psJoinMiter = 0x00002000;
+const uint32_t g_alternate = 1;
+const uint32_t g_taCenter = 6;
+const uint32_t g_taBottom = 8;
+const uint32_t g_taBaseline = 24;
+const uint32_t g_etoOpaque = 2;
+
+struct PdfObject
+{
+	std::string dictionary;
+	std::string stream;
+	bool hasStream;
+};
+
+static bool Deflate(const std::string& in, std::string& out)
+{
+	z_stream zs = {};
+	if (deflateInit(&zs, g_pdfDeflateLevel) != Z_OK)
+		return false;
+	out.resize(deflateBound(&zs, (uLong)in.size()));
+	zs.next_in = (Bytef*)in.data();
+	zs.avail_in = (uInt)in.size();
+	zs.next_out = (Bytef*)&out[0];
+	zs.avail_out = (uInt)out.size();
+	int result = deflate(&zs, Z_FINISH);
+	out.resize(zs.total_out);
+	deflateEnd(&zs);
+	return result == Z_STREAM_END;
+}
+
+static PdfObject FlateStream(const std::string& data, const std::string& dictionary)
+{
+	PdfObject object = { dictionary, std::string(), true };
+	if (Deflate(data, object.stream))
+		object.dictionary += "/Filter /FlateDecode ";
+	else
+		object.stream = data;
+	return object;
+}
+
+static void AppendNumber(std::string& s, double value)
+{
+	char text[g_maxNumberText];
+	s.append(text, FormatNumber<2>(text, value));
+}
+
+// Colors need more than 100 levels.
+static void AppendColor(std::string& s, uint32_t color)
+{
+	char text[g_maxNumberText];
+	for (int i = 0; i < 3; ++i)
+	{
+		s.append(text, FormatNumber<3>(text, ((color >> (i * 8)) & 0xFF) / 255.0));
+		s += ' ';
+	}
+}
+
+static void AppendMatrix(std::string& s, const EmfMatrix& m)
+{
+	char text[g_maxNumberText];
+	const double scales[] = { m.a, m.b, m.c, m.d };
+	for (double scale : scales)
+	{
+		s.append(text, FormatNumber<6>(text, scale));
+		s += ' ';
+	}
+	AppendNumber(s, m.e);
+	s += ' ';
+	AppendNumber(s, m.f);
+}
+
+// Windows-1252 code of c, WinAnsiEncoding of the standard fonts is nearly the same.
+static char ToWinAnsi(char16_t c)
+{
+	if (c < 0x80 || (c >= 0xA0 && c <= 0xFF))
+		return (char)c;
+	static const char16_t high[32] = {
+		0x20AC, 0, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021, 0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0, 0x017D, 0,
+		0, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014, 0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0, 0x017E, 0x0178,
+	};
+	for (int i = 0; i < 32; ++i)
+	{
+		if (high[i] == c)
+			return (char)(0x80 + i);
+	}
+	return '?';
+}
+
+static void AppendString(std::string& s, const char16_t* text, size_t length)
+{
+	s += '(';
+	for (size_t i = 0; i < length; ++i)
+	{
+		char c = ToWinAnsi(text[i]);
+		if (c == '(' || c == ')' || c == '\\')
+			s += '\\';
+		else if (c == '\r')
+		{
+			s += "\\r";
+			continue;
+		}
+		s += c;
+	}
+	s += ')';
+}
+
+// Standard font closest to the EMF font, fonts can't be embedded without their files.
+static std::string StandardFont(const EmfFont& font)
+{
+	std::string face;
+	for (int i = 0; i < 32 && font.faceName[i]; ++i)
+		face += (char)(font.faceName[i] < 0x80 ? tolower(font.faceName[i]) : '?');
+	bool bold = font.weight >= 600;
+	bool italic = font.italic != 0;
+	if (face.find("symbol") != std::string::npos || face.find("wingdings") != std::string::npos)
+		return "Symbol";
+	if (face.find("courier") != std::string::npos || face.find("mono") != std::string::npos || face.find("consolas") != std::string::npos
+		|| face.find("console") != std::string::npos || face.find("fixed") != std::string::npos)
+		return std::string("Courier") + (bold ? (italic ? "-BoldOblique" : "-Bold") : (italic ? "-Oblique" : ""));
+	if (face.find("times") != std::string::npos || face.find("roman") != std::string::npos || face.find("serif") != std::string::npos
+		|| face.find("georgia") != std::string::npos || face.find("garamond") != std::string::npos || face.find("cambria") != std::string::npos
+		|| face.find("song") != std::string::npos || face.find("ming") != std::string::npos)
+	{
+		if (face.find("sans") == std::string::npos)
+			return bold ? (italic ? "Times-BoldItalic" : "Times-Bold") : (italic ? "Times-Italic" : "Times-Roman");
+	}
+	return std::string("Helvetica") + (bold ? (italic ? "-BoldOblique" : "-Bold") : (italic ? "-Oblique" : ""));
+}
+
+// Source rectangle of a DIB as 8 bit RGB rows, top-down.
+static bool DibToRgb(const EmfImage& image, int32_t& width, int32_t& height, std::string& rgb)
+{
+	RenderedImage decoded;
+	if (!DecodeDib(image.bmi, image.bmiSize, image.bits, image.bitsSize, false, decoded))
+		return false;
+	int32_t x0 = std::max(0, image.srcX), y0 = std::max(0, image.srcY);
+	int32_t x1 = (int32_t)std::min<int64_t>(decoded.width, (int64_t)image.srcX + image.srcWidth);
+	int32_t y1 = (int32_t)std::min<int64_t>(decoded.height, (int64_t)image.srcY + image.srcHeight);
+	if (x1 <= x0 || y1 <= y0)
+		return false;
+	width = x1 - x0;
+	height = y1 - y0;
+	rgb.resize((size_t)width * height * 3);
+	uint8_t* out = (uint8_t*)&rgb[0];
+	for (int32_t y = y0; y < y1; ++y)
+	{
+		const uint32_t* row = decoded.pixels.data() + (size_t)y * decoded.width;
+		for (int32_t x = x0; x < x1; ++x, out += 3)
+		{
+			// Skipped RLE pixels are transparent, and white as the page.
+			uint32_t pixel = row[x];
+			uint32_t white = 255 - (pixel >> 24);
+			out[0] = (uint8_t)((pixel >> 16 & 0xFF) + white);
+			out[1] = (uint8_t)((pixel >> 8 & 0xFF) + white);
+			out[2] = (uint8_t)((pixel & 0xFF) + white);
+		}
+	}
+	return true;
+}
+
+// Viewers smooth the image if interpolate, for HALFTONE.
+static PdfObject ImageObject(const EmfImage& image, bool interpolate)
+{
+	std::string dictionary = interpolate ? "<< /Type /XObject /Subtype /Image /Interpolate true /Width " : "<< /Type /XObject /Subtype /Image /Width ";
+	int32_t width, height;
+	uint32_t compression = ReadU32(image.bmi + 16);
+	if (compression == g_biJpeg)
+	{
+		// A JPEG file is what DCTDecode reads.
+		width = ReadI32(image.bmi + 4);
+		height = std::abs(ReadI32(image.bmi + 8));
+		dictionary += std::to_string(width) + " /Height " + std::to_string(height)
+			+ " /ColorSpace /DeviceRGB /BitsPerComponent 8 /Filter /DCTDecode ";
+		return PdfObject{ dictionary, std::string((const char*)image.bits, image.bitsSize), true };
+	}
+	std::string rgb;
+	if (!DibToRgb(image, width, height, rgb))
+	{
+		// Keep the reference valid with a white pixel.
+		width = height = 1;
+		rgb.assign(3, (char)0xFF);
+	}
+	dictionary += std::to_string(width) + " /Height " + std::to_string(height) + " /ColorSpace /DeviceRGB /BitsPerComponent 8 ";
+	return FlateStream(rgb, dictionary);
+}
+
+// Fonts and images shared by the pages. Resources are numbered by their
+// object number, and written by the writer before the first page using them.
+class PdfResources
+{
+public:
+	PdfResources()
+		: m_nextObject(g_pagesObject + 1)
+	{
+	}
+
+	uint32_t NewObject()
+	{
+		return m_nextObject++;
+	}
+	uint32_t ObjectCount() const
+	{
+		return m_nextObject;
+	}
+
+	uint32_t Font(const EmfFont& font)
+	{
+		std::string name = StandardFont(font);
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_fonts.find(name);
+		if (it != m_fonts.end())
+			return it->second;
+		uint32_t object = NewObject();
+		m_fonts.emplace(name, object);
+		std::string dictionary = "<< /Type /Font /Subtype /Type1 /BaseFont /" + name;
+		dictionary += name == "Symbol" ? " >>" : " /Encoding /WinAnsiEncoding >>";
+		std::promise<PdfObject> promise;
+		promise.set_value(PdfObject{ dictionary, std::string(), false });
+		m_objects.emplace(object, promise.get_future().share());
+		return object;
+	}
+
+	// 0 if the image can't be converted.
+	uint32_t Image(const EmfImage& image, bool interpolate)
+	{
+		DibInfo info;
+		if (!ReadDibInfo(image.bmi, image.bmiSize, info))
+			return 0;
+		uint64_t key = HashBytes(image.bmi, image.bmiSize);
+		key = HashBytes(image.bits, image.bitsSize, key);
+		key = HashMix(key, interpolate);
+		if (info.compression != g_biJpeg)
+		{
+			key = HashMix(key, (uint64_t)(uint32_t)image.srcX << 32 | (uint32_t)image.srcY);
+			key = HashMix(key, (uint64_t)(uint32_t)image.srcWidth << 32 | (uint32_t)image.srcHeight);
+		}
+		std::promise<PdfObject> promise;
+		uint32_t object;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto it = m_images.find(key);
+			if (it != m_images.end())
+				return it->second;
+			object = NewObject();
+			m_images.emplace(key, object);
+			m_objects.emplace(object, promise.get_future().share());
+		}
+		// Converted and deflated by the thread meeting it first, outside the lock.
+		promise.set_value(ImageObject(image, interpolate));
+		return object;
+	}
+
+	std::shared_future<PdfObject> Object(uint32_t object)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_objects.at(object);
+	}
+
+private:
+	std::atomic<uint32_t> m_nextObject;
+	std::mutex m_mutex;
+	std::map<std::string, uint32_t> m_fonts;
+	std::unordered_map<uint64_t, uint32_t> m_images;
+	std::unordered_map<uint32_t, std::shared_future<PdfObject>> m_objects;
+};
+
+struct PdfPageResult
+{
+	double width, height;
+	// Deflated content streams, drawn one after the other.
+	std::vector<std::future<PdfObject>> contents;
+	std::set<uint32_t> fonts;
+	std::set<uint32_t> images;
+};
+
+// Writes the content stream of one page. Device space of the reference
+// device is mapped on the page by the first operator, so the geometry of
+// EmfPlayer is written as it comes.
+class PdfPageSink : public EmfSink
+{
+public:
+	PdfPageSink(PdfResources& resources, bool asyncDeflate)
+		: m_resources(resources)
+		, m_asyncDeflate(asyncDeflate)
+		, m_fillColor(UINT32_MAX)
+		, m_strokeColor(UINT32_MAX)
+		, m_lineWidth(-1)
+		, m_cap(-1)
+		, m_join(-1)
+		, m_miterLimit(-1)
+		, m_dash(UINT32_MAX)
+		, m_dashWidth(0)
+	{
+		// A4 if there is no header.
+		m_result.width = 210 * g_pointsPerMm;
+		m_result.height = 297 * g_pointsPerMm;
+	}
+
+	PdfPageResult& Result()
+	{
+		return m_result;
+	}
+
+	virtual void Begin(const EmfHeaderInfo& header) override
+	{
+		// Device pixels to points, and y going up.
+		double mmX = header.millimeters.x > 0 && header.device.x > 0 ? (double)header.millimeters.x / header.device.x : 25.4 / 96;
+		double mmY = header.millimeters.y > 0 && header.device.y > 0 ? (double)header.millimeters.y / header.device.y : 25.4 / 96;
+		double sx = mmX * g_pointsPerMm, sy = mmY * g_pointsPerMm;
+		double left, top, width, height;
+		header.PictureRect(left, top, width, height);
+		m_result.width = width * sx;
+		m_result.height = height * sy;
+		AppendMatrix(m_content, EmfMatrix{ sx, 0, 0, -sy, -left * sx, top * sy + m_result.height });
+		m_content += " cm\n";
+	}
+
+	virtual void End() override
+	{
+		if (m_clip)
+			m_content += "Q\n";
+		m_clip.reset();
+		FlushChunk();
+	}
+
+	virtual void DrawPath(const EmfPath& path, const EmfDeviceContext& dc, bool stroke, bool fill) override
+	{
+		SetClip(dc);
+		if (fill)
+			SetFillColor(dc.brush.color);
+		if (stroke)
+			SetPen(dc);
+		const EmfPointF* p = path.points.data();
+		for (PathVerb verb : path.verbs)
+		{
+			switch (verb)
+			{
+			case PathVerb::MoveTo:
+				Point(*p++);
+				m_content += "m\n";
+				break;
+			case PathVerb::LineTo:
+				Point(*p++);
+				m_content += "l\n";
+				break;
+			case PathVerb::BezierTo:
+				Point(p[0]);
+				Point(p[1]);
+				Point(p[2]);
+				p += 3;
+				m_content += "c\n";
+				break;
+			case PathVerb::Close:
+				m_content += "h\n";
+				break;
+			}
+		}
+		bool evenOdd = dc.polyFillMode == g_alternate;
+		if (fill && stroke)
+			m_content += evenOdd ? "B*\n" : "B\n";
+		else if (fill)
+			m_content += evenOdd ? "f*\n" : "f\n";
+		else
+			m_content += "S\n";
+		Drawn();
+	}
+
+	virtual void DrawText(const EmfTextRun& run, const EmfDeviceContext& dc) override
+	{
+		if (run.text.empty())
+			return;
+		SetClip(dc);
+		if (run.options & g_etoOpaque)
+		{
+			SetFillColor(dc.bkColor);
+			Point(run.opaque[0]);
+			m_content += "m ";
+			for (int i = 1; i < 4; ++i)
+			{
+				Point(run.opaque[i]);
+				m_content += "l ";
+			}
+			m_content += "h f\n";
+		}
+
+		uint32_t font = m_resources.Font(dc.font);
+		m_result.fonts.insert(font);
+		double size = run.fontHeight;
+		double angle = dc.font.escapement / 10.0 * 3.14159265358979323846 / 180;
+		// Text space x goes along the baseline, y goes up on the page.
+		double cosA = std::cos(angle), sinA = std::sin(angle);
+		double x = run.origin.x, y = run.origin.y;
+
+		double total = 0;
+		for (float advance : run.advances)
+			total += advance;
+		if (run.advances.empty())
+			total = run.text.size() * size / 2;
+		uint32_t horizontal = dc.textAlign & g_taCenter;
+		double shift = horizontal == g_taCenter ? -total / 2 : horizontal ? -total : 0;
+		// No font metrics, the usual ascent and descent of Latin fonts.
+		uint32_t vertical = dc.textAlign & g_taBaseline;
+		double rise = vertical == 0 ? -0.8 * size : vertical == g_taBottom ? 0.2 * size : 0;
+		x += shift * cosA - rise * sinA;
+		y += -shift * sinA - rise * cosA;
+
+		SetFillColor(dc.textColor);
+		m_content += "BT /F";
+		m_content += std::to_string(font);
+		m_content += ' ';
+		AppendNumber(m_content, size);
+		m_content += " Tf ";
+		AppendMatrix(m_content, EmfMatrix{ cosA, -sinA, -sinA, -cosA, x, y });
+		m_content += " Tm\n";
+		if (run.advances.empty())
+		{
+			AppendString(m_content, run.text.data(), run.text.size());
+			m_content += " Tj\n";
+		}
+		else
+		{
+			// Every glyph where the Dx array puts it.
+			for (size_t i = 0; i < run.text.size(); ++i)
+			{
+				if (i)
+				{
+					AppendNumber(m_content, run.advances[i - 1]);
+					m_content += " 0 Td ";
+				}
+				AppendString(m_content, &run.text[i], 1);
+				m_content += " Tj\n";
+			}
+		}
+		m_content += "ET\n";
+		Drawn();
+	}
+
+	virtual void DrawImage(const EmfImage& image, const EmfDeviceContext& dc) override
+	{
+		uint32_t object = m_resources.Image(image, dc.stretchBltMode == g_halftone);
+		if (!object)
+			return;
+		SetClip(dc);
+		m_result.images.insert(object);
+		// Row 0 of a PDF image is at the top of the unit square.
+		EmfMatrix flip = { 1, 0, 0, -1, 0, 1 };
+		m_content += "q ";
+		AppendMatrix(m_content, flip.Then(image.placement));
+		m_content += " cm /Im";
+		m_content += std::to_string(object);
+		m_content += " Do Q\n";
+		Drawn();
+	}
+
+private:
+	PdfResources& m_resources;
+	bool m_asyncDeflate;
+	PdfPageResult m_result;
+	std::string m_content;
+	// Graphics state already set in the content, to leave out redundant operators.
+	uint32_t m_fillColor;
+	uint32_t m_strokeColor;
+	double m_lineWidth;
+	int m_cap;
+	int m_join;
+	double m_miterLimit;
+	uint32_t m_dash;
+	double m_dashWidth;
+	// Clip region of the open q, nullptr if none is open.
+	std::shared_ptr<const EmfRegion> m_clip;
+
+	// Clip what follows to the region of dc, if it changed. Q drops the
+	// graphics state set since q with the clip, so it is set again as needed.
+	void SetClip(const EmfDeviceContext& dc)
+	{
+		if (dc.clip == m_clip)
+			return;
+		if (m_clip)
+		{
+			m_content += "Q\n";
+			m_fillColor = UINT32_MAX;
+			m_strokeColor = UINT32_MAX;
+			m_lineWidth = -1;
+			m_cap = -1;
+			m_join = -1;
+			m_miterLimit = -1;
+			m_dash = UINT32_MAX;
+			m_dashWidth = 0;
+		}
+		m_clip = dc.clip;
+		if (!m_clip)
+			return;
+		m_content += "q\n";
+		m_clip->ForEachRect([this](int32_t left, int32_t top, int32_t right, int32_t bottom) {
+			m_content += std::to_string(left) + ' ' + std::to_string(top) + ' '
+				+ std::to_string((int64_t)right - left) + ' ' + std::to_string((int64_t)bottom - top) + " re\n";
+		});
+		if (m_clip->Empty())
+			m_content += "0 0 0 0 re\n";
+		m_content += "W n\n";
+	}
+
+	void Point(EmfPointF p)
+	{
+		char text[2 * g_maxNumberText + 2];
+		size_t length = FormatNumber<2>(text, p.x);
+		text[length++] = ' ';
+		length += FormatNumber<2>(text + length, p.y);
+		text[length++] = ' ';
+		m_content.append(text, length);
+	}
+
+	void SetFillColor(uint32_t color)
+	{
+		color &= 0xFFFFFF;
+		if (color == m_fillColor)
+			return;
+		m_fillColor = color;
+		AppendColor(m_content, color);
+		m_content += "rg\n";
+	}
+
+	void SetPen(const EmfDeviceContext& dc)
+	{
+		uint32_t color = dc.pen.color & 0xFFFFFF;
+		if (color != m_strokeColor)
+		{
+			m_strokeColor = color;
+			AppendColor(m_content, color);
+			m_content += "RG\n";
+		}
+		double width = dc.pen.width ? std::max(1.0, dc.pen.width * dc.toDevice.Scale()) : 1;
+		if (width != m_lineWidth)
+		{
+			m_lineWidth = width;
+			AppendNumber(m_content, width);
+			m_content += " w\n";
+		}
+		uint32_t capStyle = dc.pen.style & g_psEndCapMask;
+		int cap = capStyle == g_psEndCapFlat ? 0 : capStyle == g_psEndCapSquare ? 2 : 1;
+		if (cap != m_cap)
+		{
+			m_cap = cap;
+			m_content += std::to_string(cap) + " J\n";
+		}
+		uint32_t joinStyle = dc.pen.style & g_psJoinMask;
+		int join = joinStyle == g_psJoinMiter ? 0 : joinStyle == g_psJoinBevel ? 2 : 1;
+		if (join != m_join)
+		{
+			m_join = join;
+			m_content += std::to_string(join) + " j\n";
+		}
+		double miterLimit = std::max(1.0f, dc.miterLimit);
+		if (join == 0 && miterLimit != m_miterLimit)
+		{
+			m_miterLimit = miterLimit;
+			AppendNumber(m_content, miterLimit);
+			m_content += " M\n";
+		}
+		uint32_t dash = dc.pen.style & g_psStyleMask;
+		if (dash > 4)
+			dash = 0;
+		if (dash != m_dash || (dash && width != m_dashWidth))
+		{
+			// GDI dash lengths grow with geometric pens.
+			static const double dashes[][6] = { { 0 }, { 18, 6 }, { 3, 3 }, { 9, 6, 3, 6 }, { 9, 3, 3, 3, 3, 3 } };
+			static const int dashCount[] = { 0, 2, 2, 4, 6 };
+			m_dash = dash;
+			m_dashWidth = width;
+			m_content += '[';
+			for (int i = 0; i < dashCount[dash]; ++i)
+			{
+				if (i)
+					m_content += ' ';
+				AppendNumber(m_content, dashes[dash][i] * width);
+			}
+			m_content += "] 0 d\n";
+		}
+	}
+
+	void Drawn()
+	{
+		if (m_content.size() >= g_pdfChunkSize)
+			FlushChunk();
+	}
+
+	// Content streams of a page may be cut between operators.
+	void FlushChunk()
+	{
+		if (m_content.empty())
+			return;
+		std::string content;
+		content.swap(m_content);
+		auto deflate = [](std::string chunk) {
+			return FlateStream(chunk, "<< ");
+		};
+		if (m_asyncDeflate)
+			m_result.contents.push_back(std::async(std::launch::async, deflate, std::move(content)));
+		else
+			m_result.contents.push_back(std::async(std::launch::deferred, deflate, std::move(content)));
+		m_content.reserve(g_pdfChunkSize + g_pdfChunkSize / 8);
+	}
+};
+
+// Writes objects in any order and the cross-reference table at the end.
+class PdfWriter
+{
+public:
+	explicit PdfWriter(std::ostream& os)
+		: m_os(os)
+		, m_offset(0)
+	{
+		// The comment of binary characters tells transfer programs this isn't text.
+		Write("%PDF-1.4\n%\xE2\xE3\xCF\xD3\n");
+	}
+
+	void WriteObject(uint32_t number, const PdfObject& object)
+	{
+		if (number >= m_offsets.size())
+			m_offsets.resize(number + 1, 0);
+		m_offsets[number] = m_offset;
+		Write(std::to_string(number) + " 0 obj\n");
+		if (object.hasStream)
+		{
+			Write(object.dictionary);
+			Write("/Length " + std::to_string(object.stream.size()) + " >>\nstream\n");
+			Write(object.stream);
+			Write("\nendstream\nendobj\n");
+		}
+		else
+		{
+			Write(object.dictionary);
+			Write("\nendobj\n");
+		}
+	}
+
+	void Finish(uint32_t objectCount)
+	{
+		m_offsets.resize(std::max<size_t>(m_offsets.size(), objectCount), 0);
+		uint64_t xref = m_offset;
+		std::string table = "xref\n0 " + std::to_string(m_offsets.size()) + "\n";
+		char entry[32];
+		for (size_t i = 0; i < m_offsets.size(); ++i)
+		{
+			if (m_offsets[i] || i == 0)
+				snprintf(entry, sizeof(entry), i ? "%010llu 00000 n \n" : "%010llu 65535 f \n", (unsigned long long)m_offsets[i]);
+			else
+				snprintf(entry, sizeof(entry), "0000000000 65535 f \n");
+			table += entry;
+		}
+		table += "trailer\n<< /Size " + std::to_string(m_offsets.size()) + " /Root " + std::to_string(g_catalogObject) + " 0 R >>\n";
+		table += "startxref\n" + std::to_string(xref) + "\n%%EOF\n";
+		Write(table);
+	}
+
+private:
+	std::ostream& m_os;
+	uint64_t m_offset;
+	std::vector<uint64_t> m_offsets;
+
+	void Write(const std::string& s)
+	{
+		m_os.write(s.data(), s.size());
+		m_offset += s.size();
+	}
+};
+
+static void PlayPage(const PdfPage& page, PdfResources& resources, bool asyncDeflate, PdfPageResult& result)
+{
+	PdfPageSink sink(resources, asyncDeflate);
+	EmfPlayer player;
+	player.Play(page.data, page.size, sink);
+	result = std::move(sink.Result());
+}
+
+static uint32_t WritePage(PdfWriter& writer, PdfResources& resources, std::set<uint32_t>& written, PdfPageResult& page)
+{
+	std::string resourceDictionary = "/Resources << /ProcSet [/PDF /Text /ImageC]";
+	for (int kind = 0; kind < 2; ++kind)
+	{
+		const std::set<uint32_t>& used = kind == 0 ? page.fonts : page.images;
+		if (used.empty())
+			continue;
+		const char* prefix = kind == 0 ? "/F" : "/Im";
+		resourceDictionary += kind == 0 ? " /Font <<" : " /XObject <<";
+		for (uint32_t object : used)
+		{
+			if (written.insert(object).second)
+				writer.WriteObject(object, resources.Object(object).get());
+			resourceDictionary += std::string(" ") + prefix + std::to_string(object) + " " + std::to_string(object) + " 0 R";
+		}
+		resourceDictionary += " >>";
+	}
+	resourceDictionary += " >>";
+
+	std::string contents = "/Contents [";
+	for (auto& content : page.contents)
+	{
+		uint32_t object = resources.NewObject();
+		writer.WriteObject(object, content.get());
+		contents += std::to_string(object) + " 0 R ";
+	}
+	contents += "]";
+
+	uint32_t pageObject = resources.NewObject();
+	std::string dictionary = "<< /Type /Page /Parent " + std::to_string(g_pagesObject) + " 0 R /MediaBox [0 0 ";
+	AppendNumber(dictionary, page.width);
+	dictionary += ' ';
+	AppendNumber(dictionary, page.height);
+	dictionary += "] " + resourceDictionary + " " + contents + " >>";
+	writer.WriteObject(pageObject, PdfObject{ dictionary, std::string(), false });
+	return pageObject;
+}
+
+bool ExportPdf(const std::vector<PdfPage>& pages, std::ostream& os, unsigned threadCount)
+{
+	if (pages.empty())
+		return false;
+	for (const PdfPage& page : pages)
+	{
+		if (!IsEmf(page.data, page.size) && !IsGzip(page.data, page.size))
+			return false;
+	}
+	if (threadCount == 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+	PdfWriter writer(os);
+	PdfResources resources;
+	std::set<uint32_t> written;
+	std::vector<uint32_t> pageObjects;
+
+	if (threadCount == 1 || pages.size() == 1)
+	{
+		// Only the deflating of the content streams runs concurrently.
+		for (const PdfPage& page : pages)
+		{
+			PdfPageResult result;
+			PlayPage(page, resources, threadCount > 1, result);
+			pageObjects.push_back(WritePage(writer, resources, written, result));
+		}
+	}
+	else
+	{
+		// Same scheme as TranslateRecordsParallel: pages are played by the
+		// workers a few ahead of the writer, and written in order.
+		threadCount = std::min<unsigned>(threadCount, (unsigned)pages.size());
+		const size_t lookahead = (size_t)threadCount * g_pdfLookaheadPerThread;
+		std::vector<PdfPageResult> results(pages.size());
+		std::vector<bool> done(pages.size(), false);
+		std::mutex mutex;
+		std::condition_variable cv;
+		size_t writtenPages = 0;
+		std::atomic<size_t> next(0);
+
+		auto worker = [&]() {
+			for (;;)
+			{
+				size_t p = next++;
+				if (p >= pages.size())
+					return;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					cv.wait(lock, [&]() { return p < writtenPages + lookahead; });
+				}
+				PdfPageResult result;
+				PlayPage(pages[p], resources, false, result);
+				// Deflate here rather than on the writer thread.
+				for (auto& content : result.contents)
+					content.wait();
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					results[p] = std::move(result);
+					done[p] = true;
+				}
+				cv.notify_all();
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for (unsigned i = 0; i < threadCount; ++i)
+			threads.emplace_back(worker);
+
+		for (size_t p = 0; p < pages.size(); ++p)
+		{
+			PdfPageResult result;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				cv.wait(lock, [&]() { return done[p]; });
+				result = std::move(results[p]);
+			}
+			pageObjects.push_back(WritePage(writer, resources, written, result));
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				++writtenPages;
+			}
+			cv.notify_all();
+		}
+
+		for (auto& t : threads)
+			t.join();
+	}
+
+	std::string kids;
+	for (uint32_t object : pageObjects)
+		kids += std::to_string(object) + " 0 R ";
+	writer.WriteObject(g_pagesObject, PdfObject{ "<< /Type /Pages /Kids [" + kids + "] /Count " + std::to_string(pageObjects.size()) + " >>", std::string(), false });
+	writer.WriteObject(g_catalogObject, PdfObject{ "<< /Type /Catalog /Pages " + std::to_string(g_pagesObject) + " 0 R >>", std::string(), false });
+	writer.Finish(resources.ObjectCount());
+	return true;
+}
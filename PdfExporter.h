@@ -0,0 +1,34 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <ostream>
+#include <vector>
+
+#include "EmfFormat.h"
+
+// One EMF page held in memory.
+struct PdfPage
+{
+	const uint8_t* data;
+	size_t size;
+};
+
+// Write the pages as one PDF, played through EmfPlayer.
+//
+// Pages are played concurrently and written in page order. Fonts and images
+// are shared by all pages: a font is a standard PDF font chosen from the face
+// name, weight and italic flag, an image is identified by the hash of its
+// BITMAPINFO, bits and source rectangle. Content streams and images are
+// deflated on the worker threads; the content of a single big page is cut
+// into several streams deflated concurrently.
+// Return false, writing nothing, if a page isn't an EMF.
+// threadCount = 0 means one thread per core.
+bool ExportPdf(const std::vector<PdfPage>& pages, std::ostream& os, unsigned threadCount = 0);
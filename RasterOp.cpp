@@ -0,0 +1,448 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <utility>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define EMF_ROP_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define EMF_ROP_AVX2
+#include <immintrin.h>
+#endif
+
+#include "RasterOp.h"
+
+const uint32_t g_opaque = 0xFF000000;
+
+// Truth tables of the common operations.
+const uint8_t g_srcCopy = 0xCC;
+const uint8_t g_srcPaint = 0xEE;
+const uint8_t g_srcAnd = 0x88;
+const uint8_t g_srcInvert = 0x66;
+const uint8_t g_patCopy = 0xF0;
+const uint8_t g_dstInvert = 0x55;
+const uint8_t g_blackness = 0x00;
+const uint8_t g_whiteness = 0xFF;
+const uint8_t g_nop = 0xAA;
+
+// Pixels of a solid pattern expanded at once.
+const size_t g_solidRun = 256;
+
+// Bitwise operations on a pixel or a register of them, for the kernels to
+// be written once.
+struct PixelOps
+{
+	typedef uint32_t T;
+	static const size_t width = 1;
+	static T Load(const uint32_t* p)
+	{
+		return *p;
+	}
+	static void Store(uint32_t* p, T v)
+	{
+		*p = v;
+	}
+	static T Set(uint32_t v)
+	{
+		return v;
+	}
+	static T And(T a, T b)
+	{
+		return a & b;
+	}
+	// ~a & b
+	static T AndNot(T a, T b)
+	{
+		return ~a & b;
+	}
+	static T Or(T a, T b)
+	{
+		return a | b;
+	}
+	static T Xor(T a, T b)
+	{
+		return a ^ b;
+	}
+};
+
+#ifdef EMF_ROP_SSE2
+struct Sse2Ops
+{
+	typedef __m128i T;
+	static const size_t width = 4;
+	static T Load(const uint32_t* p)
+	{
+		return _mm_loadu_si128((const __m128i*)p);
+	}
+	static void Store(uint32_t* p, T v)
+	{
+		_mm_storeu_si128((__m128i*)p, v);
+	}
+	static T Set(uint32_t v)
+	{
+		return _mm_set1_epi32((int)v);
+	}
+	static T And(T a, T b)
+	{
+		return _mm_and_si128(a, b);
+	}
+	static T AndNot(T a, T b)
+	{
+		return _mm_andnot_si128(a, b);
+	}
+	static T Or(T a, T b)
+	{
+		return _mm_or_si128(a, b);
+	}
+	static T Xor(T a, T b)
+	{
+		return _mm_xor_si128(a, b);
+	}
+};
+#endif
+
+#ifdef EMF_ROP_AVX2
+struct Avx2Ops
+{
+	typedef __m256i T;
+	static const size_t width = 8;
+	static T Load(const uint32_t* p)
+	{
+		return _mm256_loadu_si256((const __m256i*)p);
+	}
+	static void Store(uint32_t* p, T v)
+	{
+		_mm256_storeu_si256((__m256i*)p, v);
+	}
+	static T Set(uint32_t v)
+	{
+		return _mm256_set1_epi32((int)v);
+	}
+	static T And(T a, T b)
+	{
+		return _mm256_and_si256(a, b);
+	}
+	static T AndNot(T a, T b)
+	{
+		return _mm256_andnot_si256(a, b);
+	}
+	static T Or(T a, T b)
+	{
+		return _mm256_or_si256(a, b);
+	}
+	static T Xor(T a, T b)
+	{
+		return _mm256_xor_si256(a, b);
+	}
+};
+#endif
+
+// Function of d for a 2 bit table: bit d is the result.
+template <class V, unsigned table>
+typename V::T Evaluate1(typename V::T d)
+{
+	if constexpr (table == 0)
+		return V::Set(0);
+	else if constexpr (table == 1)
+		return V::Xor(d, V::Set(~0u));
+	else if constexpr (table == 2)
+		return d;
+	else
+		return V::Set(~0u);
+}
+
+// The truth table of 2^bits entries split on its first variable x,
+// x ? high : low, until one variable is left. The halves are known when
+// compiling, so constant, equal and complementary halves fold into at most
+// one operation, and any other split into three.
+template <class V, unsigned table, unsigned bits, class Low, class High>
+typename V::T Split(typename V::T x, Low low, High high)
+{
+	const unsigned half = 1u << (bits - 1);
+	const unsigned full = (1u << half) - 1;
+	const unsigned lo = table & full, hi = table >> half;
+	if constexpr (lo == hi)
+		return low();
+	else if constexpr (lo == 0 && hi == full)
+		return x;
+	else if constexpr (lo == full && hi == 0)
+		return V::Xor(x, V::Set(~0u));
+	else if constexpr (lo == 0)
+		return V::And(x, high());
+	else if constexpr (hi == 0)
+		return V::AndNot(x, low());
+	else if constexpr (hi == full)
+		return V::Or(x, low());
+	else if constexpr (lo == full)
+		return V::Xor(V::AndNot(high(), x), V::Set(~0u));
+	else if constexpr ((lo ^ hi) == full)
+		return V::Xor(x, low());
+	else
+		return V::Xor(low(), V::And(x, V::Xor(high(), low())));
+}
+
+// Function of s and d for a 4 bit table: bit (s << 1 | d) is the result.
+template <class V, unsigned table>
+typename V::T Evaluate2(typename V::T s, typename V::T d)
+{
+	return Split<V, table, 2>(s, [&] { return Evaluate1<V, (table & 3)>(d); }, [&] { return Evaluate1<V, (table >> 2)>(d); });
+}
+
+template <class V, unsigned table>
+typename V::T Evaluate3(typename V::T p, typename V::T s, typename V::T d)
+{
+	return Split<V, table, 3>(p, [&] { return Evaluate2<V, (table & 15)>(s, d); }, [&] { return Evaluate2<V, (table >> 4)>(s, d); });
+}
+
+// Pixels [i, count) in registers of V, as far as they go. Operands the
+// table doesn't use aren't loaded.
+template <class V, unsigned table>
+size_t Run(const uint32_t* pattern, const uint32_t* source, uint32_t* destination, size_t i, size_t count)
+{
+	constexpr bool usesPattern = ((table >> 4 ^ table) & 0x0F) != 0;
+	constexpr bool usesSource = ((table >> 2 ^ table) & 0x33) != 0;
+	constexpr bool usesDestination = ((table >> 1 ^ table) & 0x55) != 0;
+	const typename V::T opaque = V::Set(g_opaque), zero = V::Set(0);
+	for (; i + V::width <= count; i += V::width)
+	{
+		typename V::T p = usesPattern ? V::Load(pattern + i) : zero;
+		typename V::T s = usesSource ? V::Load(source + i) : zero;
+		typename V::T d = usesDestination ? V::Load(destination + i) : zero;
+		V::Store(destination + i, V::Or(Evaluate3<V, table>(p, s, d), opaque));
+	}
+	return i;
+}
+
+template <unsigned table>
+void GenericKernel(const uint32_t* pattern, const uint32_t* source, uint32_t* destination, size_t count)
+{
+	size_t i = 0;
+#ifdef EMF_ROP_AVX2
+	i = Run<Avx2Ops, table>(pattern, source, destination, i, count);
+#endif
+#ifdef EMF_ROP_SSE2
+	i = Run<Sse2Ops, table>(pattern, source, destination, i, count);
+#endif
+	Run<PixelOps, table>(pattern, source, destination, i, count);
+}
+
+template <size_t... tables>
+constexpr std::array<RasterOp::Kernel, 256> GenericKernels(std::index_sequence<tables...>)
+{
+	return { { &GenericKernel<(unsigned)tables>... } };
+}
+
+static const std::array<RasterOp::Kernel, 256> g_genericKernels = GenericKernels(std::make_index_sequence<256>());
+
+// The common operations, two registers a step.
+#ifdef EMF_ROP_AVX2
+typedef Avx2Ops WideOps;
+#elif defined(EMF_ROP_SSE2)
+typedef Sse2Ops WideOps;
+#else
+typedef PixelOps WideOps;
+#endif
+
+template <class Operation>
+void DedicatedKernel(const uint32_t* pattern, const uint32_t* source, uint32_t* destination, size_t count)
+{
+	typedef WideOps V;
+	const V::T opaque = V::Set(g_opaque);
+	size_t i = 0;
+	for (; i + 2 * V::width <= count; i += 2 * V::width)
+	{
+		V::T a = Operation::template Combine<V>(pattern, source, destination, i);
+		V::T b = Operation::template Combine<V>(pattern, source, destination, i + V::width);
+		V::Store(destination + i, V::Or(a, opaque));
+		V::Store(destination + i + V::width, V::Or(b, opaque));
+	}
+	for (; i < count; ++i)
+		destination[i] = Operation::template Combine<PixelOps>(pattern, source, destination, i) | g_opaque;
+}
+
+struct SourceCopy
+{
+	template <class V>
+	static typename V::T Combine(const uint32_t*, const uint32_t* s, const uint32_t*, size_t i)
+	{
+		return V::Load(s + i);
+	}
+};
+
+struct PatternCopy
+{
+	template <class V>
+	static typename V::T Combine(const uint32_t* p, const uint32_t*, const uint32_t*, size_t i)
+	{
+		return V::Load(p + i);
+	}
+};
+
+struct SourceAnd
+{
+	template <class V>
+	static typename V::T Combine(const uint32_t*, const uint32_t* s, const uint32_t* d, size_t i)
+	{
+		return V::And(V::Load(s + i), V::Load(d + i));
+	}
+};
+
+struct SourcePaint
+{
+	template <class V>
+	static typename V::T Combine(const uint32_t*, const uint32_t* s, const uint32_t* d, size_t i)
+	{
+		return V::Or(V::Load(s + i), V::Load(d + i));
+	}
+};
+
+struct SourceInvert
+{
+	template <class V>
+	static typename V::T Combine(const uint32_t*, const uint32_t* s, const uint32_t* d, size_t i)
+	{
+		return V::Xor(V::Load(s + i), V::Load(d + i));
+	}
+};
+
+struct DestinationInvert
+{
+	template <class V>
+	static typename V::T Combine(const uint32_t*, const uint32_t*, const uint32_t* d, size_t i)
+	{
+		return V::Xor(V::Load(d + i), V::Set(~0u));
+	}
+};
+
+// Only alpha changes.
+struct Destination
+{
+	template <class V>
+	static typename V::T Combine(const uint32_t*, const uint32_t*, const uint32_t* d, size_t i)
+	{
+		return V::Load(d + i);
+	}
+};
+
+static void Fill(uint32_t* destination, size_t count, uint32_t color)
+{
+	typedef WideOps V;
+	const V::T fill = V::Set(color);
+	size_t i = 0;
+	for (; i + 2 * V::width <= count; i += 2 * V::width)
+	{
+		V::Store(destination + i, fill);
+		V::Store(destination + i + V::width, fill);
+	}
+	for (; i < count; ++i)
+		destination[i] = color;
+}
+
+static void Blackness(const uint32_t*, const uint32_t*, uint32_t* destination, size_t count)
+{
+	Fill(destination, count, g_opaque);
+}
+
+static void Whiteness(const uint32_t*, const uint32_t*, uint32_t* destination, size_t count)
+{
+	Fill(destination, count, 0xFFFFFFFF);
+}
+
+RasterOp::RasterOp(uint32_t rop)
+	: m_index((uint8_t)(rop >> 16)), m_dedicated(true)
+{
+	switch (m_index)
+	{
+	case g_srcCopy:
+		m_kernel = &DedicatedKernel<SourceCopy>;
+		break;
+	case g_patCopy:
+		m_kernel = &DedicatedKernel<PatternCopy>;
+		break;
+	case g_srcAnd:
+		m_kernel = &DedicatedKernel<SourceAnd>;
+		break;
+	case g_srcPaint:
+		m_kernel = &DedicatedKernel<SourcePaint>;
+		break;
+	case g_srcInvert:
+		m_kernel = &DedicatedKernel<SourceInvert>;
+		break;
+	case g_dstInvert:
+		m_kernel = &DedicatedKernel<DestinationInvert>;
+		break;
+	case g_blackness:
+		m_kernel = &Blackness;
+		break;
+	case g_whiteness:
+		m_kernel = &Whiteness;
+		break;
+	case g_nop:
+		m_kernel = &DedicatedKernel<Destination>;
+		break;
+	default:
+		m_kernel = g_genericKernels[m_index];
+		m_dedicated = false;
+		break;
+	}
+}
+
+void RasterOp::Apply(const uint32_t* pattern, uint32_t patternColor, const uint32_t* source, uint32_t* destination, size_t count) const
+{
+	if (pattern || !UsesPattern())
+	{
+		m_kernel(pattern, source, destination, count);
+		return;
+	}
+	if (m_index == g_patCopy)
+	{
+		Fill(destination, count, patternColor | g_opaque);
+		return;
+	}
+	// A row of the solid pattern, reused along the span.
+	alignas(32) uint32_t solid[g_solidRun];
+	std::fill(solid, solid + g_solidRun, patternColor);
+	for (size_t i = 0; i < count; i += g_solidRun)
+		m_kernel(solid, source ? source + i : nullptr, destination + i, std::min(g_solidRun, count - i));
+}
+
+std::vector<RasterOpBenchmark> BenchmarkRasterOps(size_t count, unsigned repeat)
+{
+	std::vector<uint32_t> pattern(count), source(count), destination(count);
+	uint64_t state = 1;
+	for (size_t i = 0; i < count; ++i)
+	{
+		state = state * 6364136223846793005ull + 1442695040888963407ull;
+		pattern[i] = (uint32_t)(state >> 32);
+		source[i] = (uint32_t)state;
+		destination[i] = (uint32_t)(state >> 16);
+	}
+	std::vector<RasterOpBenchmark> results;
+	for (unsigned index = 0; index < 256; ++index)
+	{
+		RasterOp rop(index << 16);
+		RasterOpBenchmark result = { (uint8_t)index, rop.IsDedicated(), 0, 0 };
+		// Once untimed, for the caches.
+		rop.Apply(pattern.data(), 0, source.data(), destination.data(), count);
+		auto start = std::chrono::steady_clock::now();
+		for (unsigned r = 0; r < repeat; ++r)
+		{
+			rop.Apply(pattern.data(), 0, source.data(), destination.data(), count);
+			result.pixels += count;
+		}
+		result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		results.push_back(result);
+	}
+	return results;
+}
@@ -0,0 +1,73 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// The ternary raster operation (ROP3) of BitBlt, StretchBlt and MaskBlt on
+// rows of 0xAARRGGBB pixels. Bits 16-23 of a ROP3 code are the truth table
+// of the operation: bit (p << 2 | s << 1 | d) is the result for the bits p
+// of the pattern, s of the source and d of the destination. Every table has
+// a kernel compiled for it, picked when the operation is made.
+class RasterOp
+{
+public:
+	typedef void (*Kernel)(const uint32_t* pattern, const uint32_t* source, uint32_t* destination, size_t count);
+
+	// dwRop of a record.
+	explicit RasterOp(uint32_t rop);
+
+	uint8_t Index() const
+	{
+		return m_index;
+	}
+	bool UsesPattern() const
+	{
+		return ((m_index >> 4 ^ m_index) & 0x0F) != 0;
+	}
+	bool UsesSource() const
+	{
+		return ((m_index >> 2 ^ m_index) & 0x33) != 0;
+	}
+	bool UsesDestination() const
+	{
+		return ((m_index >> 1 ^ m_index) & 0x55) != 0;
+	}
+	// A hand written kernel of a common operation, else the generic one.
+	bool IsDedicated() const
+	{
+		return m_dedicated;
+	}
+
+	// destination = rop(pattern, source, destination) for count pixels. The
+	// pattern is count pixels of the brush along the row, or nullptr for the
+	// solid patternColor. Pointers the operation doesn't use may be nullptr.
+	// The color bits are combined and the result is opaque, as on a device
+	// without alpha.
+	void Apply(const uint32_t* pattern, uint32_t patternColor, const uint32_t* source, uint32_t* destination, size_t count) const;
+
+private:
+	uint8_t m_index;
+	bool m_dedicated;
+	Kernel m_kernel;
+};
+
+struct RasterOpBenchmark
+{
+	uint8_t index;
+	bool dedicated;
+	uint64_t pixels;
+	double seconds;
+};
+
+// Apply each of the 256 operations to rows of count pixels, repeat times.
+std::vector<RasterOpBenchmark> BenchmarkRasterOps(size_t count, unsigned repeat);
@@ -0,0 +1,401 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+
+#include "ContentHash.h"
+#include "RecordDiff.h"
+
+// Offsets inside ENHMETAHEADER of nBytes, nRecords and nHandles/sReserved.
+// They change whenever anything else changes, so they are not compared.
+const uint32_t g_headerCountersBegin = 48;
+const uint32_t g_headerCountersEnd = 60;
+// ihObject/ihPen/ihBrush/... directly follows EMR in most records that refer to the handle table.
+const uint32_t g_handleIndexOffset = sizeof(EmfRecordHeader);
+// ihBrush of FillRgn and FrameRgn follows rclBounds and cbRgnData.
+const uint32_t g_regionBrushOffset = 28;
+const uint32_t g_stockObjectFlag = 0x80000000;
+
+// Offset of the handle table index of a record, 0 if it has none.
+uint32_t HandleIndexOffset(uint32_t type)
+{
+	switch ((EmrType)type)
+	{
+	case EmrType::FillRgn:
+	case EmrType::FrameRgn:
+		return g_regionBrushOffset;
+	case EmrType::SelectObject:
+	case EmrType::CreatePen:
+	case EmrType::CreateBrushIndirect:
+	case EmrType::DeleteObject:
+	case EmrType::SelectPalette:
+	case EmrType::CreatePalette:
+	case EmrType::SetPaletteEntries:
+	case EmrType::ResizePalette:
+	case EmrType::ExtCreateFontIndirectW:
+	case EmrType::CreateMonoBrush:
+	case EmrType::CreateDIBPatternBrushPt:
+	case EmrType::ExtCreatePen:
+	case EmrType::CreateColorSpace:
+	case EmrType::SetColorSpace:
+	case EmrType::DeleteColorSpace:
+	case EmrType::ColorCorrectPalette:
+	case EmrType::CreateColorSpaceW:
+		return g_handleIndexOffset;
+	default:
+		return 0;
+	}
+}
+
+uint64_t HashRange(uint64_t h, const uint8_t* p, uint32_t begin, uint32_t end)
+{
+	uint32_t i = begin;
+	for (; i + sizeof(uint64_t) <= end; i += sizeof(uint64_t))
+	{
+		uint64_t v;
+		memcpy(&v, p + i, sizeof(v));
+		h = HashMix(h, v);
+	}
+	// Record sizes are multiples of 4, so at most one word is left.
+	if (i < end)
+		h = HashMix(h, ReadU32(p + i));
+	return h;
+}
+
+uint64_t HashNormalizedRecord(const EmfRecordSpan& record)
+{
+	uint64_t h = HashMix(g_hashSeed, ((uint64_t)record.type << 32) | record.size);
+	uint32_t skipBegin = record.size;
+	uint32_t skipEnd = record.size;
+	if (record.type == (uint32_t)EmrType::Header && record.size >= g_headerCountersEnd)
+	{
+		skipBegin = g_headerCountersBegin;
+		skipEnd = g_headerCountersEnd;
+	}
+	else if (uint32_t offset = HandleIndexOffset(record.type))
+	{
+		if (record.size >= offset + sizeof(uint32_t))
+		{
+			uint32_t index = ReadU32(record.data + offset);
+			// Stock objects are identified by value, keep them.
+			if (record.type != (uint32_t)EmrType::SelectObject || !(index & g_stockObjectFlag))
+			{
+				skipBegin = offset;
+				skipEnd = offset + sizeof(uint32_t);
+			}
+		}
+	}
+	h = HashRange(h, record.data, sizeof(EmfRecordHeader), skipBegin);
+	return HashRange(h, record.data, skipEnd, record.size);
+}
+
+enum class EditOp : uint8_t
+{
+	Keep,
+	Delete,
+	Insert,
+};
+
+struct Edit
+{
+	EditOp op;
+	int32_t index;
+};
+
+// Myers' "An O(ND) Difference Algorithm and Its Variations", the linear space
+// refinement: find the middle snake by running the greedy search from both
+// ends, split there and recurse. Common prefix and suffix are trimmed first,
+// which makes the usual case of a few edits in a huge file nearly linear.
+class MyersDiff
+{
+public:
+	MyersDiff(const std::vector<uint64_t>& a, const std::vector<uint64_t>& b, std::vector<Edit>& edits, double timeout)
+		: m_a(a), m_b(b), m_edits(edits)
+		, m_limited(timeout > 0)
+		, m_deadline(std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(m_limited ? timeout : 0)))
+		, m_complete(true)
+	{
+	}
+
+	// False if the deadline cut the search short.
+	bool Run()
+	{
+		Compare(0, (int32_t)m_a.size(), 0, (int32_t)m_b.size());
+		return m_complete;
+	}
+
+private:
+	const std::vector<uint64_t>& m_a;
+	const std::vector<uint64_t>& m_b;
+	std::vector<Edit>& m_edits;
+	std::vector<int32_t> m_v1, m_v2;
+	const bool m_limited;
+	const std::chrono::steady_clock::time_point m_deadline;
+	bool m_complete;
+
+	// Only one Keep is stored for a run of equal records, it separates hunks.
+	void Keep()
+	{
+		if (!m_edits.empty() && m_edits.back().op != EditOp::Keep)
+			m_edits.push_back({ EditOp::Keep, 0 });
+	}
+
+	void Compare(int32_t a0, int32_t a1, int32_t b0, int32_t b1);
+	void Bisect(int32_t a0, int32_t a1, int32_t b0, int32_t b1);
+};
+
+void MyersDiff::Compare(int32_t a0, int32_t a1, int32_t b0, int32_t b1)
+{
+	if (a0 < a1 && b0 < b1 && m_a[a0] == m_b[b0])
+	{
+		Keep();
+		do
+		{
+			++a0;
+			++b0;
+		} while (a0 < a1 && b0 < b1 && m_a[a0] == m_b[b0]);
+	}
+	bool suffix = false;
+	while (a0 < a1 && b0 < b1 && m_a[a1 - 1] == m_b[b1 - 1])
+	{
+		--a1;
+		--b1;
+		suffix = true;
+	}
+
+	if (a0 == a1)
+	{
+		for (int32_t i = b0; i < b1; ++i)
+			m_edits.push_back({ EditOp::Insert, i });
+	}
+	else if (b0 == b1)
+	{
+		for (int32_t i = a0; i < a1; ++i)
+			m_edits.push_back({ EditOp::Delete, i });
+	}
+	else
+	{
+		Bisect(a0, a1, b0, b1);
+	}
+
+	if (suffix)
+		Keep();
+}
+
+void MyersDiff::Bisect(int32_t a0, int32_t a1, int32_t b0, int32_t b1)
+{
+	const uint64_t* a = m_a.data() + a0;
+	const uint64_t* b = m_b.data() + b0;
+	const int32_t n = a1 - a0;
+	const int32_t m = b1 - b0;
+	const int32_t maxD = (n + m + 1) / 2;
+	const int32_t vOffset = maxD;
+	// k runs over [-maxD, maxD] and k + 1 is read too, on a 1x1 part as well.
+	const int32_t vLength = 2 * maxD + 2;
+	m_v1.assign(vLength, -1);
+	m_v2.assign(vLength, -1);
+	int32_t* v1 = m_v1.data();
+	int32_t* v2 = m_v2.data();
+	v1[vOffset + 1] = 0;
+	v2[vOffset + 1] = 0;
+	const int32_t delta = n - m;
+	// If the total number of records is odd, the front path collides with the reverse path.
+	const bool front = (delta & 1) != 0;
+	// Diagonals that run off the grid are not visited again.
+	int32_t k1start = 0, k1end = 0, k2start = 0, k2end = 0;
+	for (int32_t d = 0; d < maxD; ++d)
+	{
+		// Out of time, the part is replaced wholesale below. Every later
+		// part is too, so what is left costs O(N).
+		if (m_limited && std::chrono::steady_clock::now() > m_deadline)
+		{
+			m_complete = false;
+			break;
+		}
+		for (int32_t k1 = -d + k1start; k1 <= d - k1end; k1 += 2)
+		{
+			int32_t k1Offset = vOffset + k1;
+			int32_t x1;
+			if (k1 == -d || (k1 != d && v1[k1Offset - 1] < v1[k1Offset + 1]))
+				x1 = v1[k1Offset + 1];
+			else
+				x1 = v1[k1Offset - 1] + 1;
+			int32_t y1 = x1 - k1;
+			while (x1 < n && y1 < m && a[x1] == b[y1])
+			{
+				++x1;
+				++y1;
+			}
+			v1[k1Offset] = x1;
+			if (x1 > n)
+			{
+				k1end += 2;
+			}
+			else if (y1 > m)
+			{
+				k1start += 2;
+			}
+			else if (front)
+			{
+				int32_t k2Offset = vOffset + delta - k1;
+				if (k2Offset >= 0 && k2Offset < vLength && v2[k2Offset] != -1 && x1 >= n - v2[k2Offset])
+				{
+					Compare(a0, a0 + x1, b0, b0 + y1);
+					Compare(a0 + x1, a1, b0 + y1, b1);
+					return;
+				}
+			}
+		}
+
+		for (int32_t k2 = -d + k2start; k2 <= d - k2end; k2 += 2)
+		{
+			int32_t k2Offset = vOffset + k2;
+			int32_t x2;
+			if (k2 == -d || (k2 != d && v2[k2Offset - 1] < v2[k2Offset + 1]))
+				x2 = v2[k2Offset + 1];
+			else
+				x2 = v2[k2Offset - 1] + 1;
+			int32_t y2 = x2 - k2;
+			while (x2 < n && y2 < m && a[n - x2 - 1] == b[m - y2 - 1])
+			{
+				++x2;
+				++y2;
+			}
+			v2[k2Offset] = x2;
+			if (x2 > n)
+			{
+				k2end += 2;
+			}
+			else if (y2 > m)
+			{
+				k2start += 2;
+			}
+			else if (!front)
+			{
+				int32_t k1Offset = vOffset + delta - k2;
+				if (k1Offset >= 0 && k1Offset < vLength && v1[k1Offset] != -1)
+				{
+					int32_t x1 = v1[k1Offset];
+					int32_t y1 = vOffset + x1 - k1Offset;
+					if (x1 >= n - x2)
+					{
+						Compare(a0, a0 + x1, b0, b0 + y1);
+						Compare(a0 + x1, a1, b0 + y1, b1);
+						return;
+					}
+				}
+			}
+		}
+	}
+
+	// No commonality at all, or no time left.
+	for (int32_t i = a0; i < a1; ++i)
+		m_edits.push_back({ EditOp::Delete, i });
+	for (int32_t i = b0; i < b1; ++i)
+		m_edits.push_back({ EditOp::Insert, i });
+}
+
+void FlushHunk(std::vector<int32_t>& deleted, std::vector<int32_t>& inserted,
+	const std::vector<EmfRecordSpan>& oldRecords, const std::vector<EmfRecordSpan>& newRecords,
+	std::vector<RecordDiffEntry>& diff)
+{
+	size_t paired = std::min(deleted.size(), inserted.size());
+	for (size_t i = 0; i < paired; ++i)
+	{
+		if (oldRecords[deleted[i]].type == newRecords[inserted[i]].type)
+		{
+			diff.push_back({ RecordDiffKind::Changed, deleted[i], inserted[i] });
+		}
+		else
+		{
+			diff.push_back({ RecordDiffKind::Deleted, deleted[i], -1 });
+			diff.push_back({ RecordDiffKind::Inserted, -1, inserted[i] });
+		}
+	}
+	for (size_t i = paired; i < deleted.size(); ++i)
+		diff.push_back({ RecordDiffKind::Deleted, deleted[i], -1 });
+	for (size_t i = paired; i < inserted.size(); ++i)
+		diff.push_back({ RecordDiffKind::Inserted, -1, inserted[i] });
+	deleted.clear();
+	inserted.clear();
+}
+
+std::vector<RecordDiffEntry> DiffRecords(const std::vector<EmfRecordSpan>& oldRecords, const std::vector<EmfRecordSpan>& newRecords,
+	double timeout, bool* complete)
+{
+	std::vector<uint64_t> a(oldRecords.size()), b(newRecords.size());
+	for (size_t i = 0; i < oldRecords.size(); ++i)
+		a[i] = HashNormalizedRecord(oldRecords[i]);
+	for (size_t i = 0; i < newRecords.size(); ++i)
+		b[i] = HashNormalizedRecord(newRecords[i]);
+
+	std::vector<Edit> edits;
+	bool finished = MyersDiff(a, b, edits, timeout).Run();
+	if (complete)
+		*complete = finished;
+
+	std::vector<RecordDiffEntry> diff;
+	std::vector<int32_t> deleted, inserted;
+	for (const auto& edit : edits)
+	{
+		switch (edit.op)
+		{
+		case EditOp::Keep:
+			FlushHunk(deleted, inserted, oldRecords, newRecords, diff);
+			break;
+		case EditOp::Delete:
+			deleted.push_back(edit.index);
+			break;
+		case EditOp::Insert:
+			inserted.push_back(edit.index);
+			break;
+		}
+	}
+	FlushHunk(deleted, inserted, oldRecords, newRecords, diff);
+	return diff;
+}
+
+void AppendDecoded(std::stringstream& ss, const EmfRecordSpan& record, const RecordDecoder& decoder, char prefix)
+{
+	std::stringstream decoded;
+	decoder(record, decoded);
+	std::string line;
+	while (std::getline(decoded, line))
+		ss << prefix << line << '\n';
+}
+
+void WriteRecordDiff(std::stringstream& ss, const std::vector<RecordDiffEntry>& diff,
+	const std::vector<EmfRecordSpan>& oldRecords, const std::vector<EmfRecordSpan>& newRecords,
+	const RecordNamer& namer, const RecordDecoder& decoder)
+{
+	ss << "// " << diff.size() << " differing records\n";
+	for (const auto& entry : diff)
+	{
+		switch (entry.kind)
+		{
+		case RecordDiffKind::Inserted:
+			ss << "// Inserted record " << entry.newIndex << ' ' << namer(newRecords[entry.newIndex].type) << "\n";
+			AppendDecoded(ss, newRecords[entry.newIndex], decoder, '+');
+			break;
+		case RecordDiffKind::Deleted:
+			ss << "// Deleted record " << entry.oldIndex << ' ' << namer(oldRecords[entry.oldIndex].type) << "\n";
+			AppendDecoded(ss, oldRecords[entry.oldIndex], decoder, '-');
+			break;
+		case RecordDiffKind::Changed:
+			ss << "// Changed record " << entry.oldIndex << " -> " << entry.newIndex << ' ' << namer(newRecords[entry.newIndex].type) << "\n";
+			AppendDecoded(ss, oldRecords[entry.oldIndex], decoder, '-');
+			AppendDecoded(ss, newRecords[entry.newIndex], decoder, '+');
+			break;
+		}
+	}
+}
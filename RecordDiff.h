@@ -0,0 +1,58 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <functional>
+#include <sstream>
+#include <vector>
+
+#include "EmfFormat.h"
+
+enum class RecordDiffKind
+{
+	Inserted,
+	Deleted,
+	Changed,
+};
+
+// oldIndex/newIndex index the record lists passed to DiffRecords, -1 if absent.
+struct RecordDiffEntry
+{
+	RecordDiffKind kind;
+	int32_t oldIndex;
+	int32_t newIndex;
+};
+
+using RecordNamer = std::function<const char*(uint32_t type)>;
+using RecordDecoder = std::function<void(const EmfRecordSpan& record, std::stringstream& ss)>;
+
+// Hash of the record with handle table indices (the brush of FillRgn and
+// FrameRgn too) and header counters masked out,
+// so renumbered GDI objects don't show up as differences.
+uint64_t HashNormalizedRecord(const EmfRecordSpan& record);
+
+// Seconds DiffRecords looks for the shortest diff, as diff-match-patch.
+const double g_defaultDiffTimeout = 1.0;
+
+// Record level diff of two metafiles: Myers' O((N+M)D) algorithm in linear
+// space over the normalized record hashes. Adjacent deletions and insertions
+// of the same record type are reported as changes.
+// The search is O(N*D) on files which have little in common. Past timeout
+// seconds (0 for no limit), the parts not yet split are reported deleted and
+// inserted wholesale: still a valid diff, not a shortest one, and complete,
+// if not nullptr, is set to false.
+std::vector<RecordDiffEntry> DiffRecords(const std::vector<EmfRecordSpan>& oldRecords, const std::vector<EmfRecordSpan>& newRecords,
+	double timeout = g_defaultDiffTimeout, bool* complete = nullptr);
+
+// Write the diff as text, every differing record named by namer and followed
+// by its decoded form prefixed with '-' or '+'.
+void WriteRecordDiff(std::stringstream& ss, const std::vector<RecordDiffEntry>& diff,
+	const std::vector<EmfRecordSpan>& oldRecords, const std::vector<EmfRecordSpan>& newRecords,
+	const RecordNamer& namer, const RecordDecoder& decoder);
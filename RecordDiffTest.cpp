@@ -0,0 +1,78 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+// DiffRecords on small record lists with known diffs.
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "RecordDiff.h"
+
+// MoveToEx records, one per letter, the letter as x.
+class Records
+{
+public:
+	explicit Records(const char* letters)
+		: m_data(strlen(letters) * g_size)
+	{
+		for (size_t i = 0; letters[i]; ++i)
+		{
+			uint32_t record[] = { (uint32_t)EmrType::MoveToEx, g_size, (uint32_t)letters[i], 0 };
+			memcpy(m_data.data() + i * g_size, record, g_size);
+			m_spans.push_back({ m_data.data() + i * g_size, i * g_size, record[0], g_size });
+		}
+	}
+
+	const std::vector<EmfRecordSpan>& Spans() const { return m_spans; }
+
+private:
+	static const uint32_t g_size = 16;
+	std::vector<uint8_t> m_data;
+	std::vector<EmfRecordSpan> m_spans;
+};
+
+static std::string Kinds(const std::vector<RecordDiffEntry>& diff)
+{
+	std::string kinds;
+	for (const RecordDiffEntry& entry : diff)
+	{
+		char c = entry.kind == RecordDiffKind::Inserted ? 'I' : entry.kind == RecordDiffKind::Deleted ? 'D' : 'C';
+		kinds += c + std::to_string(entry.oldIndex) + ',' + std::to_string(entry.newIndex) + ' ';
+	}
+	return kinds;
+}
+
+static bool Check(const char* oldLetters, const char* newLetters, const char* expected)
+{
+	Records oldRecords(oldLetters), newRecords(newLetters);
+	bool complete = false;
+	std::string kinds = Kinds(DiffRecords(oldRecords.Spans(), newRecords.Spans(), 0, &complete));
+	if (kinds != expected || !complete)
+	{
+		printf("%s -> %s: \"%s\", expected \"%s\"\n", oldLetters, newLetters, kinds.c_str(), expected);
+		return false;
+	}
+	return true;
+}
+
+int main()
+{
+	bool ok = true;
+	// One record changed between equal ones, a 1x1 middle part.
+	ok &= Check("ABC", "AXC", "C1,1 ");
+	ok &= Check("B", "X", "C0,0 ");
+	ok &= Check("ABC", "ABC", "");
+	ok &= Check("ABC", "AC", "D1,-1 ");
+	ok &= Check("AC", "ABC", "I-1,1 ");
+	ok &= Check("ABCDEF", "AXCDYF", "C1,1 C4,4 ");
+	ok &= Check("ABCD", "XYZ", "C0,0 C1,1 C2,2 D3,-1 ");
+
+	printf(ok ? "RecordDiff: ok\n" : "RecordDiff: FAILED\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,262 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+#include "RecordIndex.h"
+
+const uint32_t g_indexMagic = 0x58494D45; // "EMIX"
+const uint32_t g_indexVersion = 1;
+// 4096 records per block.
+const uint32_t g_blockShift = 12;
+// ENHMETAHEADER::nRecords, used to reserve memory.
+const size_t g_headerRecordsOffset = 52;
+
+inline uint64_t AlignUp(uint64_t n)
+{
+	return (n + 7) & ~(uint64_t)7;
+}
+
+RecordIndex::RecordIndex()
+	: m_source(nullptr)
+	, m_header(nullptr)
+	, m_blocks(nullptr)
+	, m_entries(nullptr)
+	, m_bounds(nullptr)
+	, m_typeStart(nullptr)
+	, m_typeRecords(nullptr)
+{
+}
+
+std::string RecordIndex::SidecarName(const std::string& fileName)
+{
+	return fileName + ".idx";
+}
+
+bool RecordIndex::Open(const std::string& fileName, const MappedFile& file)
+{
+	Close();
+	std::string indexName = SidecarName(fileName);
+	if (m_indexFile.Open(indexName))
+	{
+		if (Attach(m_indexFile.Data(), m_indexFile.Size(), file))
+			return true;
+		m_indexFile.Close();
+	}
+	if (!Build(file))
+		return false;
+	// A read only directory only costs the rebuild next time.
+	Save(indexName);
+	return true;
+}
+
+bool RecordIndex::Build(const MappedFile& file)
+{
+	Close();
+	const uint8_t* data = file.Data();
+	size_t size = file.Size();
+	if (!IsEmf(data, size))
+		return false;
+
+	std::vector<uint64_t> blocks;
+	std::vector<RecordIndexEntry> entries;
+	std::vector<EmfRectL> bounds;
+	std::vector<uint32_t> typeStart(g_indexTypeCount + 1, 0);
+	entries.reserve(std::min<size_t>(ReadU32(data + g_headerRecordsOffset), size / sizeof(EmfRecordHeader)));
+	const uint64_t blockMask = ((uint64_t)1 << g_blockShift) - 1;
+	uint64_t endOffset = 0;
+	bool valid = ForEachRecord(data, size, [&](const EmfRecordSpan& record) {
+		if ((entries.size() & blockMask) == 0)
+			blocks.push_back(record.offset);
+		uint64_t delta = record.offset - blocks.back();
+		if (delta > UINT32_MAX)
+			return false;
+		RecordIndexEntry entry = { (uint32_t)delta, record.type, g_noBounds };
+		EmfRectL rect;
+		if (GetRecordBounds(record, rect))
+		{
+			entry.boundsSlot = (uint32_t)bounds.size();
+			bounds.push_back(rect);
+		}
+		entries.push_back(entry);
+		++typeStart[(record.type < g_indexTypeCount ? record.type : 0) + 1];
+		endOffset = record.offset + record.size;
+		return true;
+	});
+	if (!valid || entries.empty() || entries.size() > UINT32_MAX)
+		return false;
+
+	// Counting sort of the record numbers by type.
+	for (uint32_t t = 0; t < g_indexTypeCount; ++t)
+		typeStart[t + 1] += typeStart[t];
+	std::vector<uint32_t> typeRecords(entries.size());
+	std::vector<uint32_t> fill(typeStart.begin(), typeStart.end() - 1);
+	for (uint32_t i = 0; i < entries.size(); ++i)
+	{
+		uint32_t type = entries[i].type < g_indexTypeCount ? entries[i].type : 0;
+		typeRecords[fill[type]++] = i;
+	}
+
+	RecordIndexHeader header = {};
+	header.magic = g_indexMagic;
+	header.version = g_indexVersion;
+	header.sourceSize = size;
+	header.sourceModifiedTime = file.ModifiedTime();
+	header.recordCount = entries.size();
+	header.boundsCount = bounds.size();
+	header.endOffset = endOffset;
+	header.blockShift = g_blockShift;
+	header.typeCount = g_indexTypeCount;
+	header.blocksOffset = AlignUp(sizeof(RecordIndexHeader));
+	header.entriesOffset = AlignUp(header.blocksOffset + blocks.size() * sizeof(uint64_t));
+	header.boundsOffset = AlignUp(header.entriesOffset + entries.size() * sizeof(RecordIndexEntry));
+	header.typeStartOffset = AlignUp(header.boundsOffset + bounds.size() * sizeof(EmfRectL));
+	header.typeRecordsOffset = AlignUp(header.typeStartOffset + typeStart.size() * sizeof(uint32_t));
+	uint64_t total = AlignUp(header.typeRecordsOffset + typeRecords.size() * sizeof(uint32_t));
+
+	m_buffer.assign(total / sizeof(uint64_t), 0);
+	uint8_t* p = (uint8_t*)m_buffer.data();
+	memcpy(p, &header, sizeof(header));
+	memcpy(p + header.blocksOffset, blocks.data(), blocks.size() * sizeof(uint64_t));
+	memcpy(p + header.entriesOffset, entries.data(), entries.size() * sizeof(RecordIndexEntry));
+	if (!bounds.empty())
+		memcpy(p + header.boundsOffset, bounds.data(), bounds.size() * sizeof(EmfRectL));
+	memcpy(p + header.typeStartOffset, typeStart.data(), typeStart.size() * sizeof(uint32_t));
+	memcpy(p + header.typeRecordsOffset, typeRecords.data(), typeRecords.size() * sizeof(uint32_t));
+	return Attach(p, total, file);
+}
+
+void RecordIndex::Close()
+{
+	m_source = nullptr;
+	m_header = nullptr;
+	m_blocks = nullptr;
+	m_entries = nullptr;
+	m_bounds = nullptr;
+	m_typeStart = nullptr;
+	m_typeRecords = nullptr;
+	m_indexFile.Close();
+	m_buffer.clear();
+}
+
+bool RecordIndex::Attach(const uint8_t* index, size_t size, const MappedFile& file)
+{
+	if (size < sizeof(RecordIndexHeader))
+		return false;
+	auto header = reinterpret_cast<const RecordIndexHeader*>(index);
+	if (header->magic != g_indexMagic || header->version != g_indexVersion
+		|| header->sourceSize != file.Size() || header->sourceModifiedTime != file.ModifiedTime()
+		|| header->typeCount != g_indexTypeCount || header->blockShift >= 32
+		|| header->endOffset > file.Size())
+		return false;
+
+	// Every section must lie inside the index file.
+	uint64_t blockCount = (header->recordCount + ((uint64_t)1 << header->blockShift) - 1) >> header->blockShift;
+	struct Section
+	{
+		uint64_t offset;
+		uint64_t bytes;
+	} sections[] = {
+		{ header->blocksOffset, blockCount * sizeof(uint64_t) },
+		{ header->entriesOffset, header->recordCount * sizeof(RecordIndexEntry) },
+		{ header->boundsOffset, header->boundsCount * sizeof(EmfRectL) },
+		{ header->typeStartOffset, (g_indexTypeCount + 1) * sizeof(uint32_t) },
+		{ header->typeRecordsOffset, header->recordCount * sizeof(uint32_t) },
+	};
+	for (const auto& section : sections)
+	{
+		if ((section.offset & 7) || section.offset > size || section.bytes > size - section.offset)
+			return false;
+	}
+
+	m_source = file.Data();
+	m_header = header;
+	m_blocks = reinterpret_cast<const uint64_t*>(index + header->blocksOffset);
+	m_entries = reinterpret_cast<const RecordIndexEntry*>(index + header->entriesOffset);
+	m_bounds = reinterpret_cast<const EmfRectL*>(index + header->boundsOffset);
+	m_typeStart = reinterpret_cast<const uint32_t*>(index + header->typeStartOffset);
+	m_typeRecords = reinterpret_cast<const uint32_t*>(index + header->typeRecordsOffset);
+	return true;
+}
+
+bool RecordIndex::Save(const std::string& indexName) const
+{
+	if (m_buffer.empty())
+		return false;
+	auto path = std::filesystem::u8path(indexName);
+	auto tempPath = std::filesystem::u8path(indexName + ".tmp");
+	{
+		std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+		if (!out)
+			return false;
+		out.write((const char*)m_buffer.data(), m_buffer.size() * sizeof(uint64_t));
+		if (!out)
+			return false;
+	}
+	// Readers only ever see a complete index.
+	std::error_code ec;
+	std::filesystem::rename(tempPath, path, ec);
+	if (ec)
+	{
+		std::filesystem::remove(tempPath, ec);
+		return false;
+	}
+	return true;
+}
+
+uint64_t RecordIndex::RecordOffset(uint64_t i) const
+{
+	return m_blocks[i >> m_header->blockShift] + m_entries[i].delta;
+}
+
+uint32_t RecordIndex::RecordSize(uint64_t i) const
+{
+	uint64_t next = i + 1 < m_header->recordCount ? RecordOffset(i + 1) : m_header->endOffset;
+	return (uint32_t)(next - RecordOffset(i));
+}
+
+uint32_t RecordIndex::RecordType(uint64_t i) const
+{
+	return m_entries[i].type;
+}
+
+bool RecordIndex::RecordBounds(uint64_t i, EmfRectL& bounds) const
+{
+	uint32_t slot = m_entries[i].boundsSlot;
+	if (slot == g_noBounds || slot >= m_header->boundsCount)
+		return false;
+	bounds = m_bounds[slot];
+	return true;
+}
+
+EmfRecordSpan RecordIndex::Record(uint64_t i) const
+{
+	uint64_t offset = RecordOffset(i);
+	uint32_t size = RecordSize(i);
+	// Don't trust a damaged index to stay inside the metafile.
+	if (offset > m_header->endOffset || size > m_header->endOffset - offset)
+		return { nullptr, (size_t)offset, RecordType(i), 0 };
+	return { m_source + offset, (size_t)offset, RecordType(i), size };
+}
+
+uint64_t RecordIndex::TypeCount(uint32_t type) const
+{
+	if (type >= g_indexTypeCount)
+		type = 0;
+	return m_typeStart[type + 1] - m_typeStart[type];
+}
+
+uint64_t RecordIndex::RecordOfType(uint32_t type, uint64_t n) const
+{
+	if (type >= g_indexTypeCount)
+		type = 0;
+	return m_typeRecords[m_typeStart[type] + n];
+}
@@ -0,0 +1,104 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "EmfFormat.h"
+#include "MappedFile.h"
+
+// Layout of the sidecar index file "<metafile>.idx". All sections are
+// arrays of fixed size items, so the file is used in place once mapped.
+//
+//   RecordIndexHeader
+//   uint64_t           blockBase[blockCount]   offset of the first record of each block
+//   RecordIndexEntry   entries[recordCount]    offset as delta to its block base
+//   EmfRectL           bounds[boundsCount]     only for records carrying bounds
+//   uint32_t           typeStart[g_indexTypeCount + 1]
+//   uint32_t           typeRecords[recordCount] record numbers grouped by type
+//
+// An EMF is at most 4 GB (ENHMETAHEADER::nBytes) and a record at least
+// 8 bytes, so offset deltas and record numbers fit in 32 bits.
+struct RecordIndexHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t sourceSize;
+	uint64_t sourceModifiedTime;
+	uint64_t recordCount;
+	uint64_t boundsCount;
+	// Offset just past the last record, gives the size of the last record.
+	uint64_t endOffset;
+	uint32_t blockShift;
+	uint32_t typeCount;
+	uint64_t blocksOffset;
+	uint64_t entriesOffset;
+	uint64_t boundsOffset;
+	uint64_t typeStartOffset;
+	uint64_t typeRecordsOffset;
+};
+
+struct RecordIndexEntry
+{
+	uint32_t delta;
+	uint32_t type;
+	uint32_t boundsSlot;
+};
+
+// Record types are below 256, bigger ones are all put in slot 0.
+const uint32_t g_indexTypeCount = 256;
+const uint32_t g_noBounds = 0xFFFFFFFF;
+
+// Random access to the records of a metafile: offset, size, type and bounds
+// of any record, or the n-th record of a type, in O(1).
+class RecordIndex
+{
+public:
+	RecordIndex();
+
+	// Use the sidecar index of fileName if it matches the size and write time
+	// of file, else build it and try to save it for the next time.
+	// file must stay open while the index is used.
+	bool Open(const std::string& fileName, const MappedFile& file);
+	// Build the index in memory only.
+	bool Build(const MappedFile& file);
+	void Close();
+
+	static std::string SidecarName(const std::string& fileName);
+
+	uint64_t RecordCount() const
+	{
+		return m_header ? m_header->recordCount : 0;
+	}
+	uint64_t RecordOffset(uint64_t i) const;
+	uint32_t RecordSize(uint64_t i) const;
+	uint32_t RecordType(uint64_t i) const;
+	bool RecordBounds(uint64_t i, EmfRectL& bounds) const;
+	EmfRecordSpan Record(uint64_t i) const;
+
+	uint64_t TypeCount(uint32_t type) const;
+	// Record number of the n-th record of type.
+	uint64_t RecordOfType(uint32_t type, uint64_t n) const;
+
+private:
+	const uint8_t* m_source;
+	const RecordIndexHeader* m_header;
+	const uint64_t* m_blocks;
+	const RecordIndexEntry* m_entries;
+	const EmfRectL* m_bounds;
+	const uint32_t* m_typeStart;
+	const uint32_t* m_typeRecords;
+	MappedFile m_indexFile;
+	std::vector<uint64_t> m_buffer;
+
+	bool Attach(const uint8_t* index, size_t size, const MappedFile& file);
+	bool Save(const std::string& indexName) const;
+};
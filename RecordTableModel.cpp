@@ -0,0 +1,134 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#include <algorithm>
+#include <climits>
+#include <sstream>
+
+#include "ConstantDictionary.h"
+#include "RecordTableModel.h"
+#include "RecordTranslator.h"
+
+
+// About 4M characters of decoded records are kept.
+const int g_decodedCacheCost = 4 * 1024 * 1024;
+
+RecordTableModel::RecordTableModel(QObject* parent)
+	: QAbstractTableModel(parent)
+	, m_decoded(g_decodedCacheCost)
+{
+}
+
+bool RecordTableModel::Open(const QString& fileName)
+{
+	beginResetModel();
+	m_decoded.clear();
+	m_index.Close();
+	bool result = m_file.Open(fileName.toStdString()) && m_index.Open(fileName.toStdString(), m_file);
+	if (!result)
+	{
+		m_index.Close();
+		m_file.Close();
+	}
+	endResetModel();
+	return result;
+}
+
+void RecordTableModel::Close()
+{
+	beginResetModel();
+	m_decoded.clear();
+	m_index.Close();
+	m_file.Close();
+	endResetModel();
+}
+
+QString RecordTableModel::DecodedRecord(int row) const
+{
+	if (row < 0 || (uint64_t)row >= m_index.RecordCount())
+		return QString();
+	if (auto text = m_decoded.object(row))
+		return *text;
+
+	auto record = m_index.Record(row);
+	if (!record.data)
+		return QString();
+	m_arena.Reset();
+	ArenaScope scope(m_arena);
+	ArenaStringStream ss;
+	TranslateRecord(record.data, ss);
+	ArenaString decoded = ss.str();
+	auto text = new QString(QString::fromUtf8(decoded.data(), (int)decoded.size()));
+	QString result = *text;
+	m_decoded.insert(row, text, std::max(1, text->size()));
+	return result;
+}
+
+int RecordTableModel::rowCount(const QModelIndex& parent) const
+{
+	if (parent.isValid())
+		return 0;
+	return (int)std::min<uint64_t>(m_index.RecordCount(), INT_MAX);
+}
+
+int RecordTableModel::columnCount(const QModelIndex& parent) const
+{
+	if (parent.isValid())
+		return 0;
+	return ColumnCount;
+}
+
+QVariant RecordTableModel::data(const QModelIndex& index, int role) const
+{
+	if (!index.isValid())
+		return QVariant();
+	int row = index.row();
+	if (role == Qt::ToolTipRole)
+		return DecodedRecord(row);
+	if (role != Qt::DisplayRole)
+		return QVariant();
+
+	switch (index.column())
+	{
+	case IndexColumn:
+		return row;
+	case TypeColumn:
+		return QString(ConstantDictionary::EmfPlusRecordType(m_index.RecordType(row)));
+	case SizeColumn:
+		return m_index.RecordSize(row);
+	case BoundsColumn:
+		{
+			EmfRectL bounds;
+			if (!m_index.RecordBounds(row, bounds))
+				return QVariant();
+			return QString("(%1,%2,%3,%4)").arg(bounds.left).arg(bounds.top).arg(bounds.right).arg(bounds.bottom);
+		}
+	default:
+		return QVariant();
+	}
+}
+
+QVariant RecordTableModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+	if (orientation != Qt::Horizontal || role != Qt::DisplayRole)
+		return QVariant();
+	switch (section)
+	{
+	case IndexColumn:
+		return tr("Index");
+	case TypeColumn:
+		return tr("Type");
+	case SizeColumn:
+		return tr("Size");
+	case BoundsColumn:
+		return tr("Bounds");
+	default:
+		return QVariant();
+	}
+}
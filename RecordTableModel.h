@@ -0,0 +1,64 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <QAbstractTableModel>
+#include <QCache>
+#include <QString>
+
+#include "Arena.h"
+#include "MappedFile.h"
+#include "RecordIndex.h"
+
+// Records of a metafile listed from its RecordIndex. Only index, type, size
+// and bounds are read to fill the table; the GDI calls of a record are
+// generated when asked for, and the most recent ones are kept in a LRU cache.
+class RecordTableModel : public QAbstractTableModel
+{
+	Q_OBJECT
+
+public:
+	enum Column
+	{
+		IndexColumn,
+		TypeColumn,
+		SizeColumn,
+		BoundsColumn,
+		ColumnCount
+	};
+
+	RecordTableModel(QObject* parent = nullptr);
+
+	bool Open(const QString& fileName);
+	void Close();
+	const MappedFile& File() const
+	{
+		return m_file;
+	}
+	const RecordIndex& Index() const
+	{
+		return m_index;
+	}
+	// Output of EnumMetafileCallback for the record.
+	QString DecodedRecord(int row) const;
+
+	virtual int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+	virtual int columnCount(const QModelIndex& parent = QModelIndex()) const override;
+	virtual QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+	virtual QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+private:
+	MappedFile m_file;
+	RecordIndex m_index;
+	// Cost is the length of the text.
+	mutable QCache<int, QString> m_decoded;
+	// Text of the record being decoded.
+	mutable Arena m_arena;
+};
@@ -0,0 +1,127 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "Arena.h"
+#include "RecordTranslator.h"
+
+// Several chunks per thread so a chunk full of bitmaps doesn't stall the others.
+const unsigned g_chunksPerThread = 4;
+// Chunks translated ahead of the writer, bounds memory to a few chunks per thread.
+const unsigned g_lookaheadPerThread = 2;
+
+void TranslateRecords(const std::vector<EmfRecordSpan>& records, size_t begin, size_t end, std::ostream& ss)
+{
+	for (size_t i = begin; i < end; ++i)
+		TranslateRecord(records[i].data, ss);
+}
+
+// Split records into chunkCount ranges of about the same byte size.
+std::vector<size_t> ChunkBoundaries(const std::vector<EmfRecordSpan>& records, size_t chunkCount)
+{
+	std::vector<size_t> boundaries;
+	boundaries.push_back(0);
+	size_t first = records.front().offset;
+	size_t total = records.back().offset + records.back().size - first;
+	for (size_t c = 1; c < chunkCount; ++c)
+	{
+		size_t target = first + total / chunkCount * c;
+		auto it = std::lower_bound(records.begin(), records.end(), target,
+			[](const EmfRecordSpan& record, size_t offset) { return record.offset < offset; });
+		size_t index = it - records.begin();
+		if (index > boundaries.back())
+			boundaries.push_back(index);
+	}
+	boundaries.push_back(records.size());
+	return boundaries;
+}
+
+void TranslateRecordsParallel(const std::vector<EmfRecordSpan>& records, std::ostream& os, unsigned threadCount)
+{
+	if (threadCount == 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	if (threadCount == 1 || records.size() < 2)
+	{
+		Arena arena;
+		ArenaScope scope(arena);
+		ArenaStringStream ss;
+		TranslateRecords(records, 0, records.size(), ss);
+		ArenaString text = ss.str();
+		os.write(text.data(), text.size());
+		return;
+	}
+
+	auto boundaries = ChunkBoundaries(records, std::min<size_t>((size_t)threadCount * g_chunksPerThread, records.size()));
+	const size_t chunkCount = boundaries.size() - 1;
+	const size_t lookahead = (size_t)threadCount * g_lookaheadPerThread;
+	std::vector<std::string> outputs(chunkCount);
+	std::vector<bool> done(chunkCount, false);
+	std::mutex mutex;
+	std::condition_variable cv;
+	size_t written = 0;
+	std::atomic<size_t> next(0);
+
+	auto worker = [&]() {
+		Arena arena;
+		ArenaScope scope(arena);
+		for (;;)
+		{
+			size_t c = next++;
+			if (c >= chunkCount)
+				return;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				cv.wait(lock, [&]() { return c < written + lookahead; });
+			}
+			std::string text;
+			{
+				ArenaStringStream ss;
+				TranslateRecords(records, boundaries[c], boundaries[c + 1], ss);
+				ArenaString chunk = ss.str();
+				text.assign(chunk.data(), chunk.size());
+			}
+			arena.Reset();
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				outputs[c].swap(text);
+				done[c] = true;
+			}
+			cv.notify_all();
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < threadCount; ++i)
+		threads.emplace_back(worker);
+
+	for (size_t c = 0; c < chunkCount; ++c)
+	{
+		std::string text;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cv.wait(lock, [&]() { return done[c]; });
+			text.swap(outputs[c]);
+		}
+		os.write(text.data(), text.size());
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			++written;
+		}
+		cv.notify_all();
+	}
+
+	for (auto& t : threads)
+		t.join();
+}
@@ -0,0 +1,33 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <ostream>
+#include <vector>
+
+#include "EmfFormat.h"
+
+// Translate one raw record (EMR header included) into GDI calls, as when it
+// is enumerated by EnumMetafileCallback. Needs Windows.
+void TranslateRecord(const unsigned char* record, std::ostream& ss);
+
+// Translate records [begin, end) into GDI calls, in the same way as
+// enumerating them through EnumMetafileCallback one by one.
+void TranslateRecords(const std::vector<EmfRecordSpan>& records, size_t begin, size_t end, std::ostream& ss);
+
+// Same output as TranslateRecords over all records, byte for byte.
+// The records are cut into chunks of about the same number of bytes which are
+// translated concurrently and written to os in record order. A translated
+// record doesn't depend on the records before it, so the chunks need no
+// DC or handle table state from the previous chunk. Each thread translates
+// its chunks in an arena reset between them, so the text of the records
+// takes nothing from the heap once the arena is big enough.
+// threadCount = 0 means one thread per core.
+void TranslateRecordsParallel(const std::vector<EmfRecordSpan>& records, std::ostream& os, unsigned threadCount = 0);
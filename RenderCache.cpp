@@ -0,0 +1,569 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include "ContentHash.h"
+#include "RenderCache.h"
+
+const uint32_t g_renderCacheMagic = 0x43524D45; // "EMRC"
+const uint32_t g_renderCacheVersion = 1;
+const uint32_t g_rasterMagic = 0x52524D45; // "EMRR"
+const uint32_t g_minSlotCount = 64;
+
+enum SlotState : uint32_t
+{
+	SlotEmpty,
+	SlotUsed,
+	SlotDeleted,
+};
+
+// Head of a .raster file, followed by the pixels.
+struct RasterHeader
+{
+	uint32_t magic;
+	uint32_t reserved;
+	RenderKey key;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "The index is shared by processes through atomics");
+
+static bool SameKey(const RenderKey& a, const RenderKey& b)
+{
+	return a.contentHash == b.contentHash && a.width == b.width && a.height == b.height && a.options == b.options;
+}
+
+// A raster of another key or of another size, left by a crash or by another
+// writer, is a miss before anything is allocated for its pixels.
+static bool ValidRaster(const RasterHeader& header, const RenderKey& key)
+{
+	return header.magic == g_rasterMagic && SameKey(header.key, key);
+}
+
+static uint64_t RasterFileSize(const RenderKey& key)
+{
+	return sizeof(RasterHeader) + (uint64_t)key.width * key.height * sizeof(uint32_t);
+}
+
+static uint64_t KeyHash(const RenderKey& key)
+{
+	uint64_t h = HashMix(g_hashSeed, key.contentHash);
+	h = HashMix(h, (uint64_t)key.width << 32 | key.height);
+	return HashMix(h, key.options);
+}
+
+// Shared or exclusive hold of the index, for the threads of this process
+// and for the other processes.
+class RenderCache::IndexLock
+{
+public:
+	IndexLock(RenderCache& cache, bool exclusive)
+		: m_cache(cache)
+		, m_exclusive(exclusive)
+	{
+		if (exclusive)
+		{
+			cache.m_mutex.lock();
+			cache.LockFile(true);
+		}
+		else
+		{
+			cache.m_mutex.lock_shared();
+			std::lock_guard<std::mutex> lock(cache.m_readersMutex);
+			if (cache.m_readers++ == 0)
+				cache.LockFile(false);
+		}
+	}
+	~IndexLock()
+	{
+		if (m_exclusive)
+		{
+			m_cache.UnlockFile();
+			m_cache.m_mutex.unlock();
+		}
+		else
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_cache.m_readersMutex);
+				if (--m_cache.m_readers == 0)
+					m_cache.UnlockFile();
+			}
+			m_cache.m_mutex.unlock_shared();
+		}
+	}
+
+private:
+	RenderCache& m_cache;
+	bool m_exclusive;
+};
+
+RenderCache::RenderCache()
+	: m_header(nullptr)
+	, m_slots(nullptr)
+	, m_mappedSize(0)
+	, m_readers(0)
+#ifdef _WIN32
+	, m_file(INVALID_HANDLE_VALUE)
+	, m_mapping(nullptr)
+#else
+	, m_fd(-1)
+#endif
+{
+}
+
+RenderCache::~RenderCache()
+{
+	Close();
+}
+
+#ifdef _WIN32
+static std::wstring WideName(const std::string& fileName)
+{
+	int len = MultiByteToWideChar(CP_UTF8, 0, fileName.c_str(), (int)fileName.length(), NULL, 0);
+	std::wstring wideName(len, L'\0');
+	MultiByteToWideChar(CP_UTF8, 0, fileName.c_str(), (int)fileName.length(), &wideName[0], len);
+	return wideName;
+}
+
+static bool OpenIndexFile(const std::string& fileName, void*& file)
+{
+	file = CreateFileW(WideName(fileName).c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	return file != INVALID_HANDLE_VALUE;
+}
+
+static uint64_t IndexFileSize(void* file)
+{
+	LARGE_INTEGER size;
+	return GetFileSizeEx(file, &size) ? (uint64_t)size.QuadPart : 0;
+}
+
+bool RenderCache::LockFile(bool exclusive)
+{
+	OVERLAPPED overlapped = {};
+	return LockFileEx(m_file, exclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0, 0, 1, 0, &overlapped) != FALSE;
+}
+
+void RenderCache::UnlockFile()
+{
+	OVERLAPPED overlapped = {};
+	UnlockFileEx(m_file, 0, 1, 0, &overlapped);
+}
+
+bool RenderCache::Map(size_t size)
+{
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(m_file, &fileSize))
+		return false;
+	if ((uint64_t)fileSize.QuadPart < size)
+	{
+		LARGE_INTEGER end;
+		end.QuadPart = size;
+		if (!SetFilePointerEx(m_file, end, NULL, FILE_BEGIN) || !SetEndOfFile(m_file))
+			return false;
+	}
+	m_mapping = CreateFileMappingW(m_file, NULL, PAGE_READWRITE, 0, 0, NULL);
+	if (!m_mapping)
+		return false;
+	void* p = MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (!p)
+		return false;
+	m_header = (RenderCacheHeader*)p;
+	m_mappedSize = size;
+	return true;
+}
+
+void RenderCache::Unmap()
+{
+	if (m_header)
+		UnmapViewOfFile(m_header);
+	if (m_mapping)
+		CloseHandle(m_mapping);
+	m_header = nullptr;
+	m_mapping = nullptr;
+	m_mappedSize = 0;
+}
+
+static void CloseIndexFile(void*& file)
+{
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+	file = INVALID_HANDLE_VALUE;
+}
+
+// Readers let the file be deleted by an eviction while they read it.
+static bool ReadRaster(const std::string& fileName, const RenderKey& key, RenderedImage& image)
+{
+	HANDLE file = CreateFileW(WideName(fileName).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	RasterHeader header;
+	DWORD read = 0;
+	LARGE_INTEGER fileSize;
+	bool ok = ReadFile(file, &header, sizeof(header), &read, NULL) && read == sizeof(header) && ValidRaster(header, key)
+		&& GetFileSizeEx(file, &fileSize) && (uint64_t)fileSize.QuadPart == RasterFileSize(key);
+	if (ok)
+	{
+		image.width = header.key.width;
+		image.height = header.key.height;
+		image.pixels.resize((size_t)image.width * image.height);
+		DWORD bytes = (DWORD)(image.pixels.size() * sizeof(uint32_t));
+		ok = ReadFile(file, image.pixels.data(), bytes, &read, NULL) && read == bytes;
+	}
+	CloseHandle(file);
+	return ok;
+}
+#else
+static bool OpenIndexFile(const std::string& fileName, int& fd)
+{
+	fd = open(fileName.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	return fd >= 0;
+}
+
+static uint64_t IndexFileSize(int fd)
+{
+	struct stat st;
+	return fstat(fd, &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+
+// flock locks belong to the open file, unlike fcntl locks, so two caches
+// opened by one process exclude each other too.
+bool RenderCache::LockFile(bool exclusive)
+{
+	while (flock(m_fd, exclusive ? LOCK_EX : LOCK_SH) != 0)
+	{
+		if (errno != EINTR)
+			return false;
+	}
+	return true;
+}
+
+void RenderCache::UnlockFile()
+{
+	flock(m_fd, LOCK_UN);
+}
+
+bool RenderCache::Map(size_t size)
+{
+	if (IndexFileSize(m_fd) < size && ftruncate(m_fd, (off_t)size) != 0)
+		return false;
+	void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+	if (p == MAP_FAILED)
+		return false;
+	m_header = (RenderCacheHeader*)p;
+	m_mappedSize = size;
+	return true;
+}
+
+void RenderCache::Unmap()
+{
+	if (m_header)
+		munmap(m_header, m_mappedSize);
+	m_header = nullptr;
+	m_mappedSize = 0;
+}
+
+static void CloseIndexFile(int& fd)
+{
+	if (fd >= 0)
+		close(fd);
+	fd = -1;
+}
+
+static bool ReadRaster(const std::string& fileName, const RenderKey& key, RenderedImage& image)
+{
+	int fd = open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	RasterHeader header;
+	struct stat st;
+	bool ok = read(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) && ValidRaster(header, key)
+		&& fstat(fd, &st) == 0 && (uint64_t)st.st_size == RasterFileSize(key);
+	if (ok)
+	{
+		image.width = header.key.width;
+		image.height = header.key.height;
+		image.pixels.resize((size_t)image.width * image.height);
+		size_t bytes = image.pixels.size() * sizeof(uint32_t);
+		ok = read(fd, image.pixels.data(), bytes) == (ssize_t)bytes;
+	}
+	close(fd);
+	return ok;
+}
+#endif
+
+bool RenderCache::Open(const std::string& directory, uint64_t byteBudget, uint32_t slotCount)
+{
+	Close();
+	std::error_code ec;
+	std::filesystem::create_directories(std::filesystem::u8path(directory), ec);
+	m_directory = directory;
+#ifdef _WIN32
+	void*& file = m_file;
+#else
+	int& file = m_fd;
+#endif
+	if (!OpenIndexFile(directory + "/index", file))
+		return false;
+
+	// Whoever finds the index empty or foreign makes it, the others wait for the lock.
+	if (!LockFile(true))
+	{
+		CloseIndexFile(file);
+		return false;
+	}
+	slotCount = std::max(slotCount, g_minSlotCount);
+	bool ok = false;
+	uint64_t existingSize = IndexFileSize(file);
+	if (existingSize >= sizeof(RenderCacheHeader) && Map(sizeof(RenderCacheHeader)))
+	{
+		bool valid = m_header->magic == g_renderCacheMagic && m_header->version == g_renderCacheVersion && m_header->slotCount >= g_minSlotCount
+			&& existingSize >= sizeof(RenderCacheHeader) + (uint64_t)m_header->slotCount * sizeof(RenderCacheSlot);
+		uint32_t existingSlots = m_header->slotCount;
+		Unmap();
+		if (valid)
+		{
+			ok = Map(sizeof(RenderCacheHeader) + (size_t)existingSlots * sizeof(RenderCacheSlot));
+			m_slots = ok ? (RenderCacheSlot*)(m_header + 1) : nullptr;
+		}
+	}
+	if (!ok && Map(sizeof(RenderCacheHeader) + (size_t)slotCount * sizeof(RenderCacheSlot)))
+	{
+		memset((void*)m_header, 0, m_mappedSize);
+		m_slots = (RenderCacheSlot*)(m_header + 1);
+		m_header->magic = g_renderCacheMagic;
+		m_header->version = g_renderCacheVersion;
+		m_header->slotCount = slotCount;
+		m_header->nextFileId = 1;
+		m_header->byteBudget = byteBudget;
+		ok = true;
+	}
+	UnlockFile();
+	if (!ok)
+		Close();
+	return ok;
+}
+
+void RenderCache::Close()
+{
+	Unmap();
+	m_slots = nullptr;
+#ifdef _WIN32
+	CloseIndexFile(m_file);
+#else
+	CloseIndexFile(m_fd);
+#endif
+}
+
+std::string RenderCache::RasterName(uint64_t fileId) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.raster", (unsigned long long)fileId);
+	return m_directory + name;
+}
+
+uint32_t RenderCache::Find(const RenderKey& key) const
+{
+	uint32_t count = m_header->slotCount;
+	uint32_t i = (uint32_t)(KeyHash(key) % count);
+	for (uint32_t n = 0; n < count; ++n, i = i + 1 == count ? 0 : i + 1)
+	{
+		const RenderCacheSlot& slot = m_slots[i];
+		if (slot.state == SlotEmpty)
+			break;
+		if (slot.state == SlotUsed && SameKey(slot.key, key))
+			return i;
+	}
+	return count;
+}
+
+uint32_t RenderCache::LeastRecentlyUsed() const
+{
+	uint32_t count = m_header->slotCount;
+	uint32_t oldest = count;
+	uint64_t oldestUse = UINT64_MAX;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		if (m_slots[i].state != SlotUsed)
+			continue;
+		uint64_t use = m_slots[i].lastUse.load(std::memory_order_relaxed);
+		if (use < oldestUse)
+		{
+			oldestUse = use;
+			oldest = i;
+		}
+	}
+	return oldest;
+}
+
+void RenderCache::Insert(const RenderKey& key, uint64_t fileId, uint64_t size, uint64_t lastUse)
+{
+	uint32_t count = m_header->slotCount;
+	uint32_t i = (uint32_t)(KeyHash(key) % count);
+	while (m_slots[i].state == SlotUsed)
+		i = i + 1 == count ? 0 : i + 1;
+	RenderCacheSlot& slot = m_slots[i];
+	if (slot.state == SlotDeleted)
+		--m_header->deletedSlots;
+	slot.key = key;
+	slot.fileId = fileId;
+	slot.size = size;
+	slot.lastUse.store(lastUse, std::memory_order_relaxed);
+	slot.state = SlotUsed;
+	++m_header->usedSlots;
+	m_header->usedBytes += size;
+}
+
+void RenderCache::Evict(uint32_t i)
+{
+	RenderCacheSlot& slot = m_slots[i];
+	std::error_code ec;
+	std::filesystem::remove(std::filesystem::u8path(RasterName(slot.fileId)), ec);
+	slot.state = SlotDeleted;
+	--m_header->usedSlots;
+	++m_header->deletedSlots;
+	m_header->usedBytes -= slot.size;
+}
+
+void RenderCache::Compact()
+{
+	struct Entry
+	{
+		RenderKey key;
+		uint64_t fileId, size, lastUse;
+	};
+	std::vector<Entry> entries;
+	entries.reserve(m_header->usedSlots);
+	for (uint32_t i = 0; i < m_header->slotCount; ++i)
+	{
+		RenderCacheSlot& slot = m_slots[i];
+		if (slot.state == SlotUsed)
+			entries.push_back({ slot.key, slot.fileId, slot.size, slot.lastUse.load(std::memory_order_relaxed) });
+		slot.state = SlotEmpty;
+	}
+	m_header->usedSlots = 0;
+	m_header->deletedSlots = 0;
+	m_header->usedBytes = 0;
+	for (const Entry& entry : entries)
+		Insert(entry.key, entry.fileId, entry.size, entry.lastUse);
+}
+
+bool RenderCache::Get(const RenderKey& key, RenderedImage& image)
+{
+	if (!m_header)
+		return false;
+	uint64_t fileId;
+	{
+		IndexLock lock(*this, false);
+		uint32_t i = Find(key);
+		if (i == m_header->slotCount)
+			return false;
+		fileId = m_slots[i].fileId;
+		m_slots[i].lastUse.store(m_header->clock.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+	// Out of the lock: an eviction may delete the file meanwhile, it is then a miss.
+	return ReadRaster(RasterName(fileId), key, image);
+}
+
+bool RenderCache::Put(const RenderKey& key, const RenderedImage& image)
+{
+	if (!m_header || image.width != key.width || image.height != key.height || image.pixels.size() != (size_t)key.width * key.height)
+		return false;
+	uint64_t size = RasterFileSize(key);
+	uint64_t fileId;
+	{
+		IndexLock lock(*this, true);
+		if (size > m_header->byteBudget)
+			return false;
+		uint32_t i = Find(key);
+		if (i != m_header->slotCount)
+		{
+			m_slots[i].lastUse.store(m_header->clock.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			return true;
+		}
+		fileId = m_header->nextFileId++;
+	}
+
+	// Written without the lock, under a name nobody looks for.
+	std::string name = RasterName(fileId);
+	auto path = std::filesystem::u8path(name);
+	auto tempPath = std::filesystem::u8path(name + ".tmp");
+	std::error_code ec;
+	{
+		std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+		RasterHeader header = { g_rasterMagic, 0, key };
+		out.write((const char*)&header, sizeof(header));
+		out.write((const char*)image.pixels.data(), image.pixels.size() * sizeof(uint32_t));
+		if (!out)
+		{
+			out.close();
+			std::filesystem::remove(tempPath, ec);
+			return false;
+		}
+	}
+	std::filesystem::rename(tempPath, path, ec);
+	if (ec)
+	{
+		std::filesystem::remove(tempPath, ec);
+		return false;
+	}
+
+	IndexLock lock(*this, true);
+	if (Find(key) != m_header->slotCount)
+	{
+		// Put by another writer meanwhile.
+		std::filesystem::remove(path, ec);
+		return true;
+	}
+	while (m_header->usedSlots && m_header->usedBytes + size > m_header->byteBudget)
+		Evict(LeastRecentlyUsed());
+	// At most 3/4 of the slots used, deleted ones count as they lengthen the probes.
+	uint32_t maxUsed = m_header->slotCount / 4 * 3;
+	while (m_header->usedSlots >= maxUsed)
+		Evict(LeastRecentlyUsed());
+	if (m_header->usedSlots + m_header->deletedSlots >= maxUsed)
+		Compact();
+	Insert(key, fileId, size, m_header->clock.fetch_add(1, std::memory_order_relaxed) + 1);
+	return true;
+}
+
+void RenderCache::SetByteBudget(uint64_t byteBudget)
+{
+	if (!m_header)
+		return;
+	IndexLock lock(*this, true);
+	m_header->byteBudget = byteBudget;
+	while (m_header->usedSlots && m_header->usedBytes > byteBudget)
+		Evict(LeastRecentlyUsed());
+}
+
+uint64_t RenderCache::UsedBytes() const
+{
+	return m_header ? m_header->usedBytes : 0;
+}
+
+uint64_t RenderContentHash(const uint8_t* data, size_t size)
+{
+	return HashBytes(data, size);
+}
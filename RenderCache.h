@@ -0,0 +1,134 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+// A rendering is identified by the content of the metafile, the raster size
+// and whatever else changes the pixels (play rectangle, background...),
+// hashed by the caller into options.
+struct RenderKey
+{
+	uint64_t contentHash;
+	uint32_t width;
+	uint32_t height;
+	uint64_t options;
+};
+
+// 32 bpp BGRA pixels, top-down rows without padding, as a 32 bpp top-down DIB.
+struct RenderedImage
+{
+	uint32_t width;
+	uint32_t height;
+	std::vector<uint32_t> pixels;
+};
+
+// Layout of the index file "<directory>/index", mapped by every process
+// using the cache:
+//
+//   RenderCacheHeader
+//   RenderCacheSlot    slots[slotCount]    open addressing on the key hash
+//
+// Each rendering is a file "<directory>/<fileId>.raster" written once under
+// a temporary name and renamed, so readers never see it incomplete, and
+// never replaced: an evicted file is deleted and its id isn't reused.
+struct RenderCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slotCount;
+	uint32_t usedSlots;
+	uint32_t deletedSlots;
+	uint32_t reserved;
+	uint64_t byteBudget;
+	uint64_t usedBytes;
+	uint64_t nextFileId;
+	// Ticks of the LRU clock, bumped by readers without the exclusive lock.
+	std::atomic<uint64_t> clock;
+};
+
+struct RenderCacheSlot
+{
+	RenderKey key;
+	uint32_t state;
+	uint32_t reserved;
+	uint64_t fileId;
+	uint64_t size;
+	std::atomic<uint64_t> lastUse;
+};
+
+// Persistent LRU cache of rendered rasters, shared by the threads of a
+// process and by processes: the index is locked shared for lookups and
+// exclusive for changes, with a file lock across processes.
+class RenderCache
+{
+public:
+	RenderCache();
+	~RenderCache();
+	RenderCache(const RenderCache&) = delete;
+	RenderCache& operator=(const RenderCache&) = delete;
+
+	// Open or create the cache in directory (UTF-8). byteBudget bounds the
+	// size of the raster files, the least recently used are evicted past it;
+	// it is the budget of a new index only, SetByteBudget changes a shared one.
+	bool Open(const std::string& directory, uint64_t byteBudget, uint32_t slotCount = g_defaultSlotCount);
+	void Close();
+	bool IsOpen() const
+	{
+		return m_header != nullptr;
+	}
+
+	bool Get(const RenderKey& key, RenderedImage& image);
+	bool Put(const RenderKey& key, const RenderedImage& image);
+	void SetByteBudget(uint64_t byteBudget);
+	uint64_t UsedBytes() const;
+
+	static const uint32_t g_defaultSlotCount = 16384;
+
+private:
+	class IndexLock;
+
+	std::string m_directory;
+	RenderCacheHeader* m_header;
+	RenderCacheSlot* m_slots;
+	size_t m_mappedSize;
+	// The file lock is held for the whole process: exclusive for one thread,
+	// or shared while m_readers threads hold m_mutex shared.
+	std::shared_mutex m_mutex;
+	std::mutex m_readersMutex;
+	unsigned m_readers;
+#ifdef _WIN32
+	void* m_file;
+	void* m_mapping;
+#else
+	int m_fd;
+#endif
+
+	bool Map(size_t size);
+	void Unmap();
+	bool LockFile(bool exclusive);
+	void UnlockFile();
+	// Slot holding key, or the slot count.
+	uint32_t Find(const RenderKey& key) const;
+	uint32_t LeastRecentlyUsed() const;
+	void Insert(const RenderKey& key, uint64_t fileId, uint64_t size, uint64_t lastUse);
+	void Evict(uint32_t slot);
+	// Rebuild the table without the deleted slots.
+	void Compact();
+	std::string RasterName(uint64_t fileId) const;
+};
+
+// Key of the metafile content, computed once per file.
+uint64_t RenderContentHash(const uint8_t* data, size_t size);
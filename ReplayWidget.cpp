@@ -17,11 +17,20 @@
 #include <QPainter>
 #include <QPushButton>
 
+#include "ContentHash.h"
+#include "RenderCache.h"
 #include "ReplayWidget.h"
+#include "StepReplayer.h"
 
 
 ReplayWidget::ReplayWidget()
 	: m_pMetafile(nullptr)
+	, m_stepReplayer(new StepReplayer)
+	, m_stepRecord(-1)
+	, m_renderCache(nullptr)
+	, m_contentHash(0)
+	, m_cached()
+	, m_cachedKey()
 	, m_useRect(false)
 	, m_x(), m_y(), m_w(100), m_h(100)
 {
@@ -38,11 +47,91 @@ ReplayWidget::~ReplayWidget()
 void ReplayWidget::SetMetafile(const std::shared_ptr<Gdiplus::Metafile>& pMetafile)
 {
 	m_pMetafile = pMetafile;
+	m_metafileName.clear();
+	m_cached = RenderedImage();
+	Gdiplus::MetafileHeader header;
+	if (m_pMetafile && m_pMetafile->GetMetafileHeader(&header) == Gdiplus::Ok)
+		m_frame = QRect(header.X, header.Y, header.Width, header.Height);
+}
+
+bool ReplayWidget::SetMetafileFile(const QString& fileName)
+{
+	m_pMetafile.reset();
+	m_cached = RenderedImage();
+	Gdiplus::MetafileHeader header;
+	if (Gdiplus::Metafile::GetMetafileHeader((const wchar_t*)fileName.utf16(), &header) != Gdiplus::Ok)
+	{
+		m_metafileName.clear();
+		return false;
+	}
+	m_metafileName = fileName;
+	m_frame = QRect(header.X, header.Y, header.Width, header.Height);
+	return true;
 }
 
 void ReplayWidget::ResetMetafile()
 {
 	m_pMetafile.reset();
+	m_metafileName.clear();
+	m_cached = RenderedImage();
+	m_stepReplayer->Close();
+}
+
+Gdiplus::Metafile* ReplayWidget::Metafile()
+{
+	if (!m_pMetafile && !m_metafileName.isEmpty())
+		m_pMetafile.reset(new Gdiplus::Metafile((const wchar_t*)m_metafileName.utf16()), Gdiplus::Metafile::operator delete);
+	return m_pMetafile.get();
+}
+
+bool ReplayWidget::OpenSteps(const QString& fileName)
+{
+	return m_stepReplayer->Open((const wchar_t*)fileName.utf16());
+}
+
+int ReplayWidget::StepRecordCount() const
+{
+	return (int)m_stepReplayer->RecordCount();
+}
+
+void ReplayWidget::SetStepRecord(int recordCount)
+{
+	m_stepRecord = recordCount;
+	update();
+}
+
+void ReplayWidget::SetRenderCache(RenderCache* cache, uint64_t contentHash)
+{
+	m_renderCache = cache;
+	m_contentHash = contentHash;
+	m_cached = RenderedImage();
+}
+
+// The background and the metafile as shown, without the dotted frame.
+RenderKey ReplayWidget::CacheKey() const
+{
+	RECT rect;
+	GetClientRect((HWND)winId(), &rect);
+	RenderKey key;
+	key.contentHash = m_contentHash;
+	key.width = rect.right - rect.left;
+	key.height = rect.bottom - rect.top;
+	key.options = HashMix(HashMix(HashMix(HashMix(HashMix(g_hashSeed, m_useRect), m_x), m_y), m_w), m_h);
+	return key;
+}
+
+bool ReplayWidget::LoadCached()
+{
+	if (!m_renderCache || !m_renderCache->IsOpen())
+		return false;
+	RenderKey key = CacheKey();
+	if (!key.width || !key.height || !m_renderCache->Get(key, m_cached))
+	{
+		m_cached = RenderedImage();
+		return false;
+	}
+	m_cachedKey = key;
+	return true;
 }
 
 void ReplayWidget::SpecifyRect()
@@ -97,22 +186,89 @@ void ReplayWidget::paint()
 		GetClientRect((HWND)hwnd, &rect);
 		g.FillRectangle(blueBrush, rect.left, rect.top, rect.right - rect.left, rect.bottom - rect.top);
 		delete blueBrush; blueBrush = nullptr;
-		if (m_pMetafile)
+		if (HasMetafile())
 		{
-			Gdiplus::MetafileHeader header;
-			m_pMetafile->GetMetafileHeader(&header);
-
-			if (m_useRect)
-				g.DrawImage(m_pMetafile.get(), m_x, m_y, m_w, m_h);
+			if (m_stepRecord >= 0 && m_stepReplayer->IsOpen())
+			{
+				RECT playRect;
+				if (m_useRect)
+					SetRect(&playRect, m_x, m_y, m_x + m_w, m_y + m_h);
+				else
+					SetRect(&playRect, m_frame.x(), m_frame.y(), m_frame.x() + m_frame.width(), m_frame.y() + m_frame.height());
+				m_stepReplayer->SetTarget(hdc, rect.right - rect.left, rect.bottom - rect.top, playRect, RGB(128, 128, 128));
+				HDC memDC = m_stepReplayer->Render(m_stepRecord);
+				g.Flush(Gdiplus::FlushIntentionSync);
+				if (memDC)
+					BitBlt(hdc, 0, 0, rect.right - rect.left, rect.bottom - rect.top, memDC, 0, 0, SRCCOPY);
+			}
+			else if (m_renderCache && m_renderCache->IsOpen() && rect.right > rect.left && rect.bottom > rect.top)
+			{
+				RenderKey key = CacheKey();
+				// 32 bpp top-down, as RenderedImage.
+				BITMAPINFO bmi = {};
+				bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+				bmi.bmiHeader.biWidth = key.width;
+				bmi.bmiHeader.biHeight = -(LONG)key.height;
+				bmi.bmiHeader.biPlanes = 1;
+				bmi.bmiHeader.biBitCount = 32;
+				bmi.bmiHeader.biCompression = BI_RGB;
+				bool cached = !m_cached.pixels.empty() && m_cachedKey.contentHash == key.contentHash && m_cachedKey.width == key.width
+					&& m_cachedKey.height == key.height && m_cachedKey.options == key.options;
+				void* bits = nullptr;
+				HBITMAP hbm = nullptr;
+				if (!cached && m_renderCache->Get(key, m_cached))
+				{
+					m_cachedKey = key;
+					cached = true;
+				}
+				if (!cached)
+				{
+					m_cached = RenderedImage();
+					hbm = CreateDIBSection(hdc, &bmi, DIB_RGB_COLORS, &bits, NULL, 0);
+				}
+				if (hbm)
+				{
+					HDC memDC = CreateCompatibleDC(hdc);
+					HGDIOBJ oldBitmap = SelectObject(memDC, hbm);
+					{
+						Gdiplus::Graphics mg(memDC);
+						Gdiplus::SolidBrush grayBrush(Gdiplus::Color::Gray);
+						mg.FillRectangle(&grayBrush, 0, 0, key.width, key.height);
+						if (m_useRect)
+							mg.DrawImage(Metafile(), m_x, m_y, m_w, m_h);
+						else
+							mg.DrawImage(Metafile(), m_frame.x(), m_frame.y());
+						mg.Flush(Gdiplus::FlushIntentionSync);
+					}
+					GdiFlush();
+					m_cached.width = key.width;
+					m_cached.height = key.height;
+					m_cached.pixels.assign((const uint32_t*)bits, (const uint32_t*)bits + (size_t)key.width * key.height);
+					m_cachedKey = key;
+					SelectObject(memDC, oldBitmap);
+					DeleteDC(memDC);
+					DeleteObject(hbm);
+					m_renderCache->Put(key, m_cached);
+				}
+				g.Flush(Gdiplus::FlushIntentionSync);
+				if (!m_cached.pixels.empty())
+					SetDIBitsToDevice(hdc, 0, 0, m_cached.width, m_cached.height, 0, 0, 0, m_cached.height, m_cached.pixels.data(), &bmi, DIB_RGB_COLORS);
+				else if (m_useRect)
+					g.DrawImage(Metafile(), m_x, m_y, m_w, m_h);
+				else
+					g.DrawImage(Metafile(), m_frame.x(), m_frame.y());
+			}
+			else if (m_useRect)
+				g.DrawImage(Metafile(), m_x, m_y, m_w, m_h);
 			else
-				g.DrawImage(m_pMetafile.get(), header.X, header.Y);
+				g.DrawImage(Metafile(), m_frame.x(), m_frame.y());
 
 			Gdiplus::Pen pen(Gdiplus::Color::HotPink);
 			pen.SetDashStyle(Gdiplus::DashStyle::DashStyleDot);
 			if (m_useRect)
 				g.DrawRectangle(&pen, m_x, m_y, m_w, m_h);
 			else
-				g.DrawRectangle(&pen, header.X, header.Y, header.Width, header.Height);
+				g.DrawRectangle(&pen, m_frame.x(), m_frame.y(), m_frame.width(), m_frame.height());
 		}
 		//auto redPen = new Gdiplus::Pen(Gdiplus::Color::Red, 2);
 		//g.DrawArc(redPen, 10, 10, 50, 50, 0, 360);
@@ -9,17 +9,23 @@
 ***************************************************************************/
 #pragma once
 
+#include <cstdint>
 #include <memory>
 
 #include <QDialog>
+#include <QRect>
+#include <QString>
 #include <QWidget>
 
+#include "RenderCache.h"
+
 namespace Gdiplus
 {
 	class Metafile;
 }
 class QCheckBox;
 class QLineEdit;
+class StepReplayer;
 class ReplayWidget : public QWidget
 {
 	Q_OBJECT
@@ -28,7 +34,21 @@ public:
 	ReplayWidget();
 	~ReplayWidget();
 	void SetMetafile(const std::shared_ptr<Gdiplus::Metafile>& pMetafile);
+	// Only the header of the file is read, the metafile is loaded when it is
+	// drawn without the render cache.
+	bool SetMetafileFile(const QString& fileName);
 	void ResetMetafile();
+	// Replay record by record instead of drawing the whole Metafile.
+	bool OpenSteps(const QString& fileName);
+	int StepRecordCount() const;
+	// Show the picture after the first recordCount records, -1 shows the whole metafile.
+	void SetStepRecord(int recordCount);
+	// The whole metafile is drawn from cache when it was already rendered at
+	// this size; contentHash identifies the metafile. cache may be null.
+	void SetRenderCache(RenderCache* cache, uint64_t contentHash);
+	// Read the picture at the current size from the render cache, for the
+	// next paint; false if it isn't there.
+	bool LoadCached();
 
 public slots:
 	void SpecifyRect();
@@ -38,8 +58,24 @@ protected:
 	virtual QPaintEngine * paintEngine() const override;
 	virtual bool event(QEvent * event) override;
 	void paint();
+	bool HasMetafile() const
+	{
+		return m_pMetafile || !m_metafileName.isEmpty();
+	}
+	Gdiplus::Metafile* Metafile();
+	RenderKey CacheKey() const;
 
 	std::shared_ptr<Gdiplus::Metafile> m_pMetafile;
+	QString m_metafileName;
+	// Bounds of the metafile header, in pixels.
+	QRect m_frame;
+	// Last picture read from or put into the render cache, and its key.
+	RenderedImage m_cached;
+	RenderKey m_cachedKey;
+	std::unique_ptr<StepReplayer> m_stepReplayer;
+	int m_stepRecord;
+	RenderCache* m_renderCache;
+	uint64_t m_contentHash;
 	bool m_useRect;
 	int m_x, m_y, m_w, m_h;
 	friend class RectWidget;
@@ -0,0 +1,217 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "EmfFormat.h"
+#include "SpoolFile.h"
+
+// dwVersion, cjSize, dpszDocName and dpszOutput of the header record.
+const size_t g_spoolHeaderSize = 16;
+// ulID and cjSize of the other records, cjSize doesn't count them.
+const size_t g_emriHeaderSize = 8;
+// Converted pages waiting to be written, per thread.
+const unsigned g_spoolLookaheadPerThread = 2;
+
+bool IsSpool(const uint8_t* data, size_t size)
+{
+	return size >= g_spoolHeaderSize && ReadU32(data) == g_spoolVersion
+		&& ReadU32(data + 4) >= g_spoolHeaderSize && ReadU32(data + 4) <= size;
+}
+
+// The zero terminated UTF-16 string at offset of the header, as UTF-8.
+static std::string HeaderString(const uint8_t* header, size_t headerSize, uint32_t offset)
+{
+	std::string text;
+	if (offset == 0 || offset >= headerSize)
+		return text;
+	for (size_t i = offset; i + 2 <= headerSize; i += 2)
+	{
+		uint32_t c = header[i] | header[i + 1] << 8;
+		if (c == 0)
+			break;
+		if (c >= 0xD800 && c < 0xDC00 && i + 4 <= headerSize)
+		{
+			uint32_t low = header[i + 2] | header[i + 3] << 8;
+			if (low >= 0xDC00 && low < 0xE000)
+			{
+				c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+				i += 2;
+			}
+		}
+		if (c < 0x80)
+		{
+			text += (char)c;
+		}
+		else if (c < 0x800)
+		{
+			text += (char)(0xC0 | c >> 6);
+			text += (char)(0x80 | (c & 0x3F));
+		}
+		else if (c < 0x10000)
+		{
+			text += (char)(0xE0 | c >> 12);
+			text += (char)(0x80 | (c >> 6 & 0x3F));
+			text += (char)(0x80 | (c & 0x3F));
+		}
+		else
+		{
+			text += (char)(0xF0 | c >> 18);
+			text += (char)(0x80 | (c >> 12 & 0x3F));
+			text += (char)(0x80 | (c >> 6 & 0x3F));
+			text += (char)(0x80 | (c & 0x3F));
+		}
+	}
+	return text;
+}
+
+// Records whose data is a whole EMF.
+static bool IsPageRecord(EmriType type)
+{
+	switch (type)
+	{
+	case EmriType::Metafile:
+	case EmriType::FormMetafile:
+	case EmriType::BwMetafile:
+	case EmriType::BwFormMetafile:
+	case EmriType::MetafileData:
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool IndexSpool(const uint8_t* data, size_t size, SpoolDocument& document)
+{
+	document = SpoolDocument();
+	if (!IsSpool(data, size))
+		return false;
+	uint32_t headerSize = ReadU32(data + 4);
+	document.documentName = HeaderString(data, headerSize, ReadU32(data + 8));
+	document.outputName = HeaderString(data, headerSize, ReadU32(data + 12));
+
+	const uint8_t* devmode = nullptr;
+	size_t devmodeSize = 0;
+	size_t offset = headerSize;
+	while (offset < size)
+	{
+		if (size - offset < g_emriHeaderSize)
+		{
+			document.complete = false;
+			break;
+		}
+		EmriType type = (EmriType)ReadU32(data + offset);
+		uint32_t dataSize = ReadU32(data + offset + 4);
+		if (dataSize > size - offset - g_emriHeaderSize)
+		{
+			document.complete = false;
+			break;
+		}
+		const uint8_t* recordData = data + offset + g_emriHeaderSize;
+		if (IsPageRecord(type) && IsEmf(recordData, dataSize))
+		{
+			document.pages.push_back(SpoolPage{ recordData, dataSize, offset, type, devmode, devmodeSize });
+		}
+		else if (type == EmriType::Devmode)
+		{
+			devmode = dataSize ? recordData : nullptr;
+			devmodeSize = dataSize;
+		}
+		else
+		{
+			++document.skippedRecords;
+		}
+		offset += g_emriHeaderSize + dataSize;
+	}
+	return true;
+}
+
+void ConvertSpoolPages(const std::vector<SpoolPage>& pages, const SpoolPageConvert& convert,
+	const std::function<void(const SpoolPageResult& result)>& write, unsigned threadCount)
+{
+	if (threadCount == 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	threadCount = (unsigned)std::min<size_t>(threadCount, pages.size());
+
+	auto convertPage = [&pages, &convert](size_t page, SpoolPageResult& result) {
+		auto start = std::chrono::steady_clock::now();
+		result.page = page;
+		result.output.clear();
+		result.ok = convert(pages[page], result.output);
+		result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	};
+
+	if (threadCount <= 1)
+	{
+		SpoolPageResult result;
+		for (size_t page = 0; page < pages.size(); ++page)
+		{
+			convertPage(page, result);
+			write(result);
+		}
+		return;
+	}
+
+	const size_t lookahead = (size_t)threadCount * g_spoolLookaheadPerThread;
+	std::vector<SpoolPageResult> results(pages.size());
+	std::vector<bool> done(pages.size(), false);
+	std::mutex mutex;
+	std::condition_variable cv;
+	size_t written = 0;
+	std::atomic<size_t> next(0);
+
+	auto worker = [&]() {
+		for (;;)
+		{
+			size_t page = next++;
+			if (page >= pages.size())
+				return;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				cv.wait(lock, [&]() { return page < written + lookahead; });
+			}
+			SpoolPageResult result;
+			convertPage(page, result);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				results[page] = std::move(result);
+				done[page] = true;
+			}
+			cv.notify_all();
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < threadCount; ++i)
+		threads.emplace_back(worker);
+
+	for (size_t page = 0; page < pages.size(); ++page)
+	{
+		SpoolPageResult result;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cv.wait(lock, [&]() { return done[page]; });
+			result = std::move(results[page]);
+		}
+		write(result);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			++written;
+		}
+		cv.notify_all();
+	}
+
+	for (auto& t : threads)
+		t.join();
+}
@@ -0,0 +1,98 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Record types of an EMF spool file (.SPL), [MS-EMFSPOOL] 2.1.1.
+enum class EmriType : uint32_t
+{
+	Metafile = 0x01,
+	EngineFont = 0x02,
+	Devmode = 0x03,
+	Type1Font = 0x04,
+	PrestartPage = 0x05,
+	DesignVector = 0x06,
+	SubsetFont = 0x07,
+	DeltaFont = 0x08,
+	FormMetafile = 0x09,
+	BwMetafile = 0x0A,
+	BwFormMetafile = 0x0B,
+	MetafileData = 0x0C,
+	MetafileExt = 0x0D,
+	BwMetafileExt = 0x0E,
+	EngineFontExt = 0x0F,
+	Type1FontExt = 0x10,
+	DesignVectorExt = 0x11,
+	SubsetFontExt = 0x12,
+	DeltaFontExt = 0x13,
+	PsJobData = 0x14,
+	EmbedFontExt = 0x15,
+};
+
+// Version of the header record, which starts the file.
+const uint32_t g_spoolVersion = 0x00010000;
+
+// A page of a spool file, an EMF left in place in the spool data.
+struct SpoolPage
+{
+	const uint8_t* data;
+	size_t size;
+	// Offset of its EMRI record in the spool file.
+	size_t offset;
+	EmriType type;
+	// DEVMODEW of the last EMRI_DEVMODE before the page, nullptr if none.
+	const uint8_t* devmode;
+	size_t devmodeSize;
+};
+
+struct SpoolDocument
+{
+	// UTF-8, from the header record.
+	std::string documentName;
+	std::string outputName;
+	std::vector<SpoolPage> pages;
+	// Fonts, PostScript data and the like, which aren't needed to play the pages.
+	size_t skippedRecords = 0;
+	// False if a record size is invalid; the pages before it are indexed.
+	bool complete = true;
+};
+
+// Check for the spool header record.
+bool IsSpool(const uint8_t* data, size_t size);
+
+// Index the pages of the spool file in data without copying them. Every
+// record holding an EMF is a page, EMRI_METAFILE_EXT and the like only point
+// back to them. Return false if data isn't a spool file.
+bool IndexSpool(const uint8_t* data, size_t size, SpoolDocument& document);
+
+// Translate or render one page, called on the worker threads.
+// Return false if the page is bad.
+typedef std::function<bool(const SpoolPage& page, std::string& output)> SpoolPageConvert;
+
+struct SpoolPageResult
+{
+	// Index in pages.
+	size_t page;
+	std::string output;
+	bool ok;
+	// Spent in convert, to find the pathological pages.
+	double seconds;
+};
+
+// Convert the pages concurrently and hand the results to write in page order,
+// on the calling thread. Pages converted ahead of the one written next are
+// bounded to a few per thread. threadCount = 0 means one thread per core.
+void ConvertSpoolPages(const std::vector<SpoolPage>& pages, const SpoolPageConvert& convert,
+	const std::function<void(const SpoolPageResult& result)>& write, unsigned threadCount = 0);
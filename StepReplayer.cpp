@@ -0,0 +1,321 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#include <algorithm>
+
+#include "EmfFormat.h"
+#include "StepReplayer.h"
+
+// Bytes of the rasters kept, the interval grows with the number of records
+// and the size of the bitmap.
+const uint64_t g_checkpointBytes = 256 * 1024 * 1024;
+const uint32_t g_minInterval = 128;
+
+struct StepContext
+{
+	StepReplayer* replayer;
+	uint32_t index;
+	// Raster restored from this checkpoint, pixels of the records before it are already there.
+	uint32_t start;
+	uint32_t end;
+	bool inPath;
+};
+
+// Records whose only lasting effect is on pixels. Inside a path bracket they
+// build the path instead and must be played.
+bool PaintsPixels(uint32_t type)
+{
+	switch ((EmrType)type)
+	{
+	case EmrType::PolyBezier:
+	case EmrType::Polygon:
+	case EmrType::Polyline:
+	case EmrType::PolyBezierTo:
+	case EmrType::PolyLineTo:
+	case EmrType::PolyPolyline:
+	case EmrType::PolyPolygon:
+	case EmrType::SetPixelV:
+	case EmrType::Ellipse:
+	case EmrType::Rectangle:
+	case EmrType::RoundRect:
+	case EmrType::Arc:
+	case EmrType::Chord:
+	case EmrType::Pie:
+	case EmrType::ExtFloodFill:
+	case EmrType::LineTo:
+	case EmrType::FillPath:
+	case EmrType::StrokeAndFillPath:
+	case EmrType::StrokePath:
+	case EmrType::FillRgn:
+	case EmrType::FrameRgn:
+	case EmrType::InvertRgn:
+	case EmrType::PaintRgn:
+	case EmrType::BitBlt:
+	case EmrType::StretchBlt:
+	case EmrType::MaskBlt:
+	case EmrType::PlgBlt:
+	case EmrType::SetDIBitsToDevice:
+	case EmrType::StretchDIBits:
+	case EmrType::ExtTextOutA:
+	case EmrType::ExtTextOutW:
+	case EmrType::PolyBezier16:
+	case EmrType::Polygon16:
+	case EmrType::Polyline16:
+	case EmrType::PolyBezierTo16:
+	case EmrType::PolylineTo16:
+	case EmrType::PolyPolyline16:
+	case EmrType::PolyPolygon16:
+	case EmrType::PolyTextOutA:
+	case EmrType::PolyTextOutW:
+	case EmrType::SmallTextOut:
+	case EmrType::AlphaBlend:
+	case EmrType::TransparentBlt:
+	case EmrType::GradientFill:
+		return true;
+	default:
+		// AngleArc, ArcTo and PolyDraw also move the current position along a
+		// curve, they are always played.
+		return false;
+	}
+}
+
+// Text drawn with TA_UPDATECP moves the current position by its advance,
+// which only GDI knows.
+bool UpdatesCurrentPosition(HDC hdc, uint32_t type)
+{
+	switch ((EmrType)type)
+	{
+	case EmrType::ExtTextOutA:
+	case EmrType::ExtTextOutW:
+	case EmrType::PolyTextOutA:
+	case EmrType::PolyTextOutW:
+	case EmrType::SmallTextOut:
+		return (GetTextAlign(hdc) & TA_UPDATECP) != 0;
+	default:
+		return false;
+	}
+}
+
+// Play a record for its effect on the DC only: its pixels are already in the
+// raster, and may have been painted over since. The clipping region is put
+// back as it was.
+void PlayClippedOut(HDC hdc, HANDLETABLE* handleTable, const ENHMETARECORD* record, int handleCount)
+{
+	HRGN clip = CreateRectRgn(0, 0, 0, 0);
+	bool clipped = GetClipRgn(hdc, clip) == 1;
+	HRGN empty = CreateRectRgn(0, 0, 0, 0);
+	SelectClipRgn(hdc, empty);
+	PlayEnhMetaFileRecord(hdc, handleTable, record, handleCount);
+	SelectClipRgn(hdc, clipped ? clip : NULL);
+	DeleteObject(empty);
+	DeleteObject(clip);
+}
+
+// A skipped record which draws from the current position still has to move it.
+void MoveCurrentPosition(HDC hdc, const ENHMETARECORD* record)
+{
+	switch ((EmrType)record->iType)
+	{
+	case EmrType::LineTo:
+		{
+			auto emr = reinterpret_cast<const EMRLINETO*>(record);
+			MoveToEx(hdc, emr->ptl.x, emr->ptl.y, nullptr);
+		}
+		break;
+	case EmrType::PolyBezierTo:
+	case EmrType::PolyLineTo:
+		{
+			auto emr = reinterpret_cast<const EMRPOLYLINE*>(record);
+			if (emr->cptl)
+				MoveToEx(hdc, emr->aptl[emr->cptl - 1].x, emr->aptl[emr->cptl - 1].y, nullptr);
+		}
+		break;
+	case EmrType::PolyBezierTo16:
+	case EmrType::PolylineTo16:
+		{
+			auto emr = reinterpret_cast<const EMRPOLYLINE16*>(record);
+			if (emr->cpts)
+				MoveToEx(hdc, emr->apts[emr->cpts - 1].x, emr->apts[emr->cpts - 1].y, nullptr);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+StepReplayer::StepReplayer()
+	: m_hemf(NULL)
+	, m_recordCount(0)
+	, m_interval(g_minInterval)
+	, m_memDC(NULL)
+	, m_bitmap(NULL)
+	, m_oldBitmap(NULL)
+	, m_bits(nullptr)
+	, m_width(0), m_height(0)
+	, m_playRect()
+	, m_background(0)
+{
+}
+
+StepReplayer::~StepReplayer()
+{
+	Close();
+	ReleaseBitmap();
+}
+
+bool StepReplayer::Open(const wchar_t* fileName)
+{
+	Close();
+	m_hemf = GetEnhMetaFileW(fileName);
+	if (!m_hemf)
+		return false;
+	ENHMETAHEADER header;
+	GetEnhMetaFileHeader(m_hemf, sizeof(header), &header);
+	m_recordCount = header.nRecords;
+	UpdateInterval();
+	return true;
+}
+
+void StepReplayer::Close()
+{
+	if (m_hemf)
+		DeleteEnhMetaFile(m_hemf);
+	m_hemf = NULL;
+	m_recordCount = 0;
+	m_checkpoints.clear();
+}
+
+void StepReplayer::ReleaseBitmap()
+{
+	if (m_memDC)
+	{
+		SelectObject(m_memDC, m_oldBitmap);
+		DeleteDC(m_memDC);
+	}
+	if (m_bitmap)
+		DeleteObject(m_bitmap);
+	m_memDC = NULL;
+	m_bitmap = NULL;
+	m_oldBitmap = NULL;
+	m_bits = nullptr;
+	m_width = m_height = 0;
+}
+
+void StepReplayer::SetTarget(HDC hdc, int width, int height, const RECT& playRect, COLORREF background)
+{
+	if (m_memDC && width == m_width && height == m_height && EqualRect(&playRect, &m_playRect) && background == m_background)
+		return;
+	m_checkpoints.clear();
+	m_playRect = playRect;
+	m_background = background;
+	if (m_memDC && width == m_width && height == m_height)
+		return;
+
+	ReleaseBitmap();
+	if (width <= 0 || height <= 0)
+		return;
+	BITMAPINFO bmi = {};
+	bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+	bmi.bmiHeader.biWidth = width;
+	bmi.bmiHeader.biHeight = -height;
+	bmi.bmiHeader.biPlanes = 1;
+	bmi.bmiHeader.biBitCount = 32;
+	bmi.bmiHeader.biCompression = BI_RGB;
+	void* bits = nullptr;
+	m_bitmap = CreateDIBSection(hdc, &bmi, DIB_RGB_COLORS, &bits, NULL, 0);
+	if (!m_bitmap)
+		return;
+	m_memDC = CreateCompatibleDC(hdc);
+	m_oldBitmap = SelectObject(m_memDC, m_bitmap);
+	m_bits = (uint32_t*)bits;
+	m_width = width;
+	m_height = height;
+	UpdateInterval();
+}
+
+void StepReplayer::UpdateInterval()
+{
+	uint64_t rasterBytes = std::max<uint64_t>(1, (uint64_t)m_width * m_height * sizeof(uint32_t));
+	uint32_t maxCheckpoints = (uint32_t)std::max<uint64_t>(1, std::min<uint64_t>(UINT32_MAX, g_checkpointBytes / rasterBytes));
+	m_interval = std::max(g_minInterval, (uint32_t)(((uint64_t)m_recordCount + maxCheckpoints - 1) / maxCheckpoints));
+}
+
+void StepReplayer::SaveCheckpoint(uint32_t recordCount)
+{
+	GdiFlush();
+	m_checkpoints[recordCount].assign(m_bits, m_bits + (size_t)m_width * m_height);
+}
+
+HDC StepReplayer::Render(uint32_t recordCount)
+{
+	if (!m_hemf || !m_memDC)
+		return NULL;
+	recordCount = std::min(recordCount, m_recordCount);
+
+	GdiFlush();
+	uint32_t start = 0;
+	auto it = m_checkpoints.upper_bound(recordCount);
+	if (it != m_checkpoints.begin())
+	{
+		--it;
+		start = it->first;
+		std::copy(it->second.begin(), it->second.end(), m_bits);
+	}
+	else
+	{
+		uint32_t pixel = (GetRValue(m_background) << 16) | (GetGValue(m_background) << 8) | GetBValue(m_background);
+		std::fill(m_bits, m_bits + (size_t)m_width * m_height, pixel);
+	}
+
+	if (recordCount > start)
+	{
+		StepContext context = { this, 0, start, recordCount, false };
+		int saved = SaveDC(m_memDC);
+		EnumEnhMetaFile(m_memDC, m_hemf, PlayRecord, &context, &m_playRect);
+		RestoreDC(m_memDC, saved);
+	}
+	GdiFlush();
+	return m_memDC;
+}
+
+int CALLBACK StepReplayer::PlayRecord(HDC hdc, HANDLETABLE* handleTable, const ENHMETARECORD* record, int handleCount, LPARAM data)
+{
+	auto& context = *reinterpret_cast<StepContext*>(data);
+	if (context.index >= context.end)
+		return FALSE;
+
+	switch ((EmrType)record->iType)
+	{
+	case EmrType::BeginPath:
+		context.inPath = true;
+		break;
+	case EmrType::EndPath:
+	case EmrType::AbortPath:
+		context.inPath = false;
+		break;
+	default:
+		break;
+	}
+	if (context.index < context.start && !context.inPath && PaintsPixels(record->iType))
+	{
+		if (UpdatesCurrentPosition(hdc, record->iType))
+			PlayClippedOut(hdc, handleTable, record, handleCount);
+		else
+			MoveCurrentPosition(hdc, record);
+	}
+	else
+		PlayEnhMetaFileRecord(hdc, handleTable, record, handleCount);
+
+	++context.index;
+	StepReplayer* replayer = context.replayer;
+	if (context.index > context.start && context.index % replayer->m_interval == 0
+		&& replayer->m_checkpoints.find(context.index) == replayer->m_checkpoints.end())
+		replayer->SaveCheckpoint(context.index);
+	return TRUE;
+}
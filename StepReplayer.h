@@ -0,0 +1,70 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <Windows.h>
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+// Plays the first N records of a metafile into an offscreen bitmap.
+// Every K records the raster is saved, K chosen so the rasters fit a byte
+// budget. GDI can't copy a DC, and EnumEnhMetaFile always starts at the
+// first record with its own handle table, so a move to record N still goes
+// through the N records: those before the checkpoint which change DC state
+// (objects, transforms, clipping, paths, the current position) are played
+// again, only those painting pixels are skipped, and at most K are painted.
+// The seek is linear in N, cheaper than a replay by what painting costs.
+class StepReplayer
+{
+public:
+	StepReplayer();
+	~StepReplayer();
+	StepReplayer(const StepReplayer&) = delete;
+	StepReplayer& operator=(const StepReplayer&) = delete;
+
+	bool Open(const wchar_t* fileName);
+	void Close();
+	bool IsOpen() const
+	{
+		return m_hemf != NULL;
+	}
+	uint32_t RecordCount() const
+	{
+		return m_recordCount;
+	}
+
+	// Size of the bitmap and where the metafile is played in it.
+	// Checkpoints are dropped when they change.
+	void SetTarget(HDC hdc, int width, int height, const RECT& playRect, COLORREF background);
+	// Play records [0, recordCount) and return the memory DC holding the picture.
+	HDC Render(uint32_t recordCount);
+
+private:
+	HENHMETAFILE m_hemf;
+	uint32_t m_recordCount;
+	uint32_t m_interval;
+	HDC m_memDC;
+	HBITMAP m_bitmap;
+	HGDIOBJ m_oldBitmap;
+	// Pixels of m_bitmap, a top-down 32 bpp DIB section.
+	uint32_t* m_bits;
+	int m_width, m_height;
+	RECT m_playRect;
+	COLORREF m_background;
+	// Record count -> raster after playing that many records.
+	std::map<uint32_t, std::vector<uint32_t>> m_checkpoints;
+
+	void ReleaseBitmap();
+	void UpdateInterval();
+	void SaveCheckpoint(uint32_t recordCount);
+	static int CALLBACK PlayRecord(HDC hdc, HANDLETABLE* handleTable, const ENHMETARECORD* record, int handleCount, LPARAM data);
+};
@@ -0,0 +1,584 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+
+#include "ImageStretcher.h"
+#include "LodFilter.h"
+#include "NumberFormat.h"
+#include "SvgExporter.h"
+
+const size_t g_svgBufferSize = 64 * 1024;
+
+// wingdi.h values used below.
+const uint32_t g_psStyleMask = 0x0000000F;
+const uint32_t g_psEndCapMask = 0x00000F00;
+const uint32_t g_psJoinMask = 0x0000F000;
+const uint32_t g_psEndCapSquare = 0x00000100;
+const uint32_t g_psEndCapFlat = 0x00000200;
+const uint32_t g_psJoinBevel = 0x00001000;
+const uint32_t g_psJoinMiter = 0x00002000;
+const uint32_t g_alternate = 1;
+const uint32_t g_taCenter = 6;
+const uint32_t g_taBottom = 8;
+const uint32_t g_taBaseline = 24;
+const uint32_t g_etoOpaque = 2;
+const uint32_t g_biJpeg = 4;
+const uint32_t g_biPng = 5;
+
+// Longest output of FormatPoint, with room for a separator.
+const size_t g_maxPointText = 2 * g_maxNumberText + 4;
+
+static size_t FormatPoint(char* out, EmfPointF p)
+{
+	size_t length = FormatNumber<2>(out, p.x);
+	out[length++] = ' ';
+	return length + FormatNumber<2>(out + length, p.y);
+}
+
+static void FormatColor(char* out, uint32_t color)
+{
+	// COLORREF is 0x00BBGGRR.
+	static const char hex[] = "0123456789abcdef";
+	uint8_t rgb[3] = { (uint8_t)color, (uint8_t)(color >> 8), (uint8_t)(color >> 16) };
+	out[0] = '#';
+	for (int i = 0; i < 3; ++i)
+	{
+		out[1 + i * 2] = hex[rgb[i] >> 4];
+		out[2 + i * 2] = hex[rgb[i] & 15];
+	}
+}
+
+SvgExporter::SvgExporter(std::ostream& os, unsigned maxSide)
+	: m_os(os)
+	, m_maxSide(maxSide)
+	, m_scale(1)
+	, m_buffer(g_svgBufferSize)
+	, m_used(0)
+	, m_lastClass(0)
+	, m_begun(false)
+	, m_clipCount(0)
+{
+}
+
+SvgExporter::~SvgExporter()
+{
+	Flush();
+}
+
+void SvgExporter::Flush()
+{
+	m_os.write(m_buffer.data(), m_used);
+	m_used = 0;
+}
+
+void SvgExporter::Put(const char* s, size_t length)
+{
+	if (length > m_buffer.size() - m_used)
+	{
+		Flush();
+		if (length > m_buffer.size())
+		{
+			m_os.write(s, length);
+			return;
+		}
+	}
+	memcpy(m_buffer.data() + m_used, s, length);
+	m_used += length;
+}
+
+void SvgExporter::Integer(int64_t value)
+{
+	char text[24];
+	Put(text, std::to_chars(text, text + sizeof(text), value).ptr - text);
+}
+
+void SvgExporter::Number(double value)
+{
+	char text[32];
+	Put(text, FormatNumber<2>(text, value));
+}
+
+void SvgExporter::Point(EmfPointF p)
+{
+	m_used += FormatPoint(Reserve(g_maxPointText), p);
+}
+
+char* SvgExporter::Reserve(size_t length)
+{
+	if (length > m_buffer.size() - m_used)
+		Flush();
+	return m_buffer.data() + m_used;
+}
+
+void SvgExporter::Matrix(const EmfMatrix& m)
+{
+	// Scale factors need more than 2 decimals.
+	char text[192] = "matrix(";
+	size_t length = 7;
+	const double scales[] = { m.a, m.b, m.c, m.d };
+	for (double scale : scales)
+	{
+		length += FormatNumber<6>(text + length, scale);
+		text[length++] = ' ';
+	}
+	length += FormatNumber<2>(text + length, m.e);
+	text[length++] = ' ';
+	length += FormatNumber<2>(text + length, m.f);
+	text[length++] = ')';
+	Put(text, length);
+}
+
+void SvgExporter::Utf16(const char16_t* text, size_t length)
+{
+	for (size_t i = 0; i < length; ++i)
+	{
+		uint32_t c = text[i];
+		if (c >= 0xD800 && c <= 0xDBFF && i + 1 < length && text[i + 1] >= 0xDC00 && text[i + 1] <= 0xDFFF)
+			c = 0x10000 + ((c - 0xD800) << 10) + (text[++i] - 0xDC00);
+		else if (c >= 0xD800 && c <= 0xDFFF)
+			c = 0xFFFD;
+		switch (c)
+		{
+		case '<':
+			Put("&lt;");
+			continue;
+		case '>':
+			Put("&gt;");
+			continue;
+		case '&':
+			Put("&amp;");
+			continue;
+		default:
+			// Not allowed in XML 1.0.
+			if (c < 0x20 && c != '\t')
+				continue;
+			break;
+		}
+		if (c < 0x80)
+			Put((char)c);
+		else if (c < 0x800)
+		{
+			Put((char)(0xC0 | (c >> 6)));
+			Put((char)(0x80 | (c & 0x3F)));
+		}
+		else if (c < 0x10000)
+		{
+			Put((char)(0xE0 | (c >> 12)));
+			Put((char)(0x80 | ((c >> 6) & 0x3F)));
+			Put((char)(0x80 | (c & 0x3F)));
+		}
+		else
+		{
+			Put((char)(0xF0 | (c >> 18)));
+			Put((char)(0x80 | ((c >> 12) & 0x3F)));
+			Put((char)(0x80 | ((c >> 6) & 0x3F)));
+			Put((char)(0x80 | (c & 0x3F)));
+		}
+	}
+}
+
+void SvgExporter::Base64(const uint8_t* data, size_t size, uint8_t (&carry)[3], size_t& carried)
+{
+	// Pass size 0 to write the last partial group.
+	static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	auto group = [this](const uint8_t* in, size_t count) {
+		uint32_t v = (uint32_t)in[0] << 16 | (count > 1 ? (uint32_t)in[1] << 8 : 0) | (count > 2 ? in[2] : 0);
+		char out[4] = { table[v >> 18], table[(v >> 12) & 63], count > 1 ? table[(v >> 6) & 63] : '=', count > 2 ? table[v & 63] : '=' };
+		Put(out, 4);
+	};
+	if (size == 0)
+	{
+		if (carried)
+			group(carry, carried);
+		carried = 0;
+		return;
+	}
+	while (carried && carried < 3 && size)
+	{
+		carry[carried++] = *data++;
+		--size;
+	}
+	if (carried == 3)
+	{
+		group(carry, 3);
+		carried = 0;
+	}
+	for (; size >= 3; data += 3, size -= 3)
+		group(data, 3);
+	while (size--)
+		carry[carried++] = *data++;
+}
+
+unsigned SvgExporter::Class()
+{
+	// Consecutive elements mostly share their style.
+	if (m_style == m_lastStyle)
+		return m_lastClass;
+	m_lastStyle = m_style;
+	auto it = m_classes.find(m_style);
+	if (it != m_classes.end())
+		return m_lastClass = it->second;
+	unsigned n = (unsigned)m_classes.size();
+	m_classes.emplace(m_style, n);
+	m_lastClass = n;
+	Put("<style>.c");
+	Integer(n);
+	Put('{');
+	Put(m_style.data(), m_style.size());
+	Put("}</style>\n");
+	return n;
+}
+
+void SvgExporter::StyleColor(const char* property, uint32_t color)
+{
+	char text[7];
+	FormatColor(text, color);
+	m_style += property;
+	m_style.append(text, 7);
+	m_style += ';';
+}
+
+void SvgExporter::StyleNumber(const char* property, double value, const char* unit)
+{
+	char text[32];
+	m_style += property;
+	m_style.append(text, FormatNumber<2>(text, value));
+	m_style += unit;
+	m_style += ';';
+}
+
+void SvgExporter::Begin(const EmfHeaderInfo& header)
+{
+	if (m_begun)
+		return;
+	m_begun = true;
+	// Device units, the unit of the player output.
+	double left, top, width, height;
+	header.PictureRect(left, top, width, height);
+	m_scale = m_maxSide ? m_maxSide / std::max(width, height) : 1;
+	Put("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		"<svg xmlns=\"http://www.w3.org/2000/svg\" xmlns:xlink=\"http://www.w3.org/1999/xlink\" version=\"1.1\" width=\"");
+	Number(width * m_scale);
+	Put("\" height=\"");
+	Number(height * m_scale);
+	Put("\" viewBox=\"");
+	Number(left);
+	Put(' ');
+	Number(top);
+	Put(' ');
+	Number(width);
+	Put(' ');
+	Number(height);
+	Put("\">\n");
+}
+
+void SvgExporter::Clip(const EmfDeviceContext& dc)
+{
+	if (dc.clip == m_clip)
+		return;
+	if (m_clip)
+		Put("</g>\n");
+	m_clip = dc.clip;
+	if (!m_clip)
+		return;
+	unsigned id = ++m_clipCount;
+	Put("<clipPath id=\"clip");
+	Integer(id);
+	Put("\"><path d=\"");
+	m_clip->ForEachRect([this](int32_t left, int32_t top, int32_t right, int32_t bottom) {
+		Put('M');
+		Integer(left);
+		Put(' ');
+		Integer(top);
+		Put('H');
+		Integer(right);
+		Put('V');
+		Integer(bottom);
+		Put('H');
+		Integer(left);
+		Put('Z');
+	});
+	Put("\"/></clipPath>\n<g clip-path=\"url(#clip");
+	Integer(id);
+	Put(")\">\n");
+}
+
+void SvgExporter::End()
+{
+	if (m_clip)
+		Put("</g>\n");
+	m_clip.reset();
+	if (m_begun)
+		Put("</svg>\n");
+	m_begun = false;
+	Flush();
+}
+
+void SvgExporter::DrawPath(const EmfPath& path, const EmfDeviceContext& dc, bool stroke, bool fill)
+{
+	Clip(dc);
+	m_style.clear();
+	if (fill)
+	{
+		StyleColor("fill:", dc.brush.color);
+		if (dc.polyFillMode == g_alternate)
+			m_style += "fill-rule:evenodd;";
+	}
+	else
+		m_style += "fill:none;";
+	if (stroke)
+	{
+		double width = dc.pen.width ? dc.pen.width * dc.toDevice.Scale() : 1;
+		width = std::max(width, 1.0);
+		StyleColor("stroke:", dc.pen.color);
+		if (width * m_scale < 1)
+		{
+			// GDI draws at least one pixel wide, and so does a thumbnail.
+			width = 1;
+			m_style += "vector-effect:non-scaling-stroke;";
+		}
+		StyleNumber("stroke-width:", width, "");
+		// GDI dash lengths grow with geometric pens.
+		static const char* dashes[] = { nullptr, "18 6", "3 3", "9 6 3 6", "9 3 3 3 3 3" };
+		uint32_t style = dc.pen.style & g_psStyleMask;
+		if (style >= 1 && style <= 4)
+		{
+			m_style += "stroke-dasharray:";
+			if (width > 1)
+			{
+				for (const char* p = dashes[style]; *p; )
+				{
+					char* end;
+					double length = strtod(p, &end);
+					char text[32];
+					m_style.append(text, FormatNumber<2>(text, length * width));
+					p = end;
+					if (*p)
+						m_style += *p++;
+				}
+			}
+			else
+				m_style += dashes[style];
+			m_style += ';';
+		}
+		uint32_t cap = dc.pen.style & g_psEndCapMask;
+		m_style += cap == g_psEndCapFlat ? "stroke-linecap:butt;" : cap == g_psEndCapSquare ? "stroke-linecap:square;" : "stroke-linecap:round;";
+		uint32_t join = dc.pen.style & g_psJoinMask;
+		if (join == g_psJoinMiter)
+			StyleNumber("stroke-miterlimit:", std::max(1.0f, dc.miterLimit), "");
+		else
+			m_style += join == g_psJoinBevel ? "stroke-linejoin:bevel;" : "stroke-linejoin:round;";
+	}
+	unsigned n = Class();
+
+	Put("<path class=\"c");
+	Integer(n);
+	Put("\" d=\"");
+	// Numbers are formatted straight into the output buffer.
+	const EmfPointF* p = path.points.data();
+	PathVerb last = PathVerb::Close;
+	for (PathVerb verb : path.verbs)
+	{
+		char* out = Reserve(3 * g_maxPointText);
+		size_t length = 0;
+		switch (verb)
+		{
+		case PathVerb::MoveTo:
+			out[length++] = 'M';
+			length += FormatPoint(out + length, *p++);
+			break;
+		case PathVerb::LineTo:
+			// Repeated commands may be left out.
+			out[length++] = last == PathVerb::LineTo ? ' ' : 'L';
+			length += FormatPoint(out + length, *p++);
+			break;
+		case PathVerb::BezierTo:
+			out[length++] = last == PathVerb::BezierTo ? ' ' : 'C';
+			length += FormatPoint(out + length, p[0]);
+			out[length++] = ' ';
+			length += FormatPoint(out + length, p[1]);
+			out[length++] = ' ';
+			length += FormatPoint(out + length, p[2]);
+			p += 3;
+			break;
+		case PathVerb::Close:
+			out[length++] = 'Z';
+			break;
+		}
+		m_used += length;
+		last = verb;
+	}
+	Put("\"/>\n");
+}
+
+void SvgExporter::DrawText(const EmfTextRun& run, const EmfDeviceContext& dc)
+{
+	if (run.text.empty())
+		return;
+	Clip(dc);
+	if (run.options & g_etoOpaque)
+	{
+		m_opaque.Clear();
+		m_opaque.MoveTo(run.opaque[0]);
+		m_opaque.LineTo(run.opaque[1]);
+		m_opaque.LineTo(run.opaque[2]);
+		m_opaque.LineTo(run.opaque[3]);
+		m_opaque.Close();
+		EmfDeviceContext opaque = dc;
+		opaque.brush.color = dc.bkColor;
+		DrawPath(m_opaque, opaque, false, true);
+	}
+
+	m_style.clear();
+	m_style += "font-family:'";
+	size_t faceLength = 0;
+	while (faceLength < 32 && dc.font.faceName[faceLength])
+		++faceLength;
+	for (size_t i = 0; i < faceLength; ++i)
+	{
+		// Face names are ASCII in practice, others are left to the fallback font.
+		char16_t c = dc.font.faceName[i];
+		if (c >= 0x20 && c < 0x7F && c != '\'' && c != '"' && c != '<' && c != '>' && c != '&' && c != ';' && c != '{' && c != '}')
+			m_style += (char)c;
+	}
+	m_style += "';";
+	StyleNumber("font-size:", run.fontHeight, "px");
+	if (dc.font.weight >= 600)
+		m_style += "font-weight:bold;";
+	if (dc.font.italic)
+		m_style += "font-style:italic;";
+	if (dc.font.underline || dc.font.strikeOut)
+	{
+		m_style += "text-decoration:";
+		m_style += dc.font.underline ? (dc.font.strikeOut ? "underline line-through;" : "underline;") : "line-through;";
+	}
+	StyleColor("fill:", dc.textColor);
+	unsigned n = Class();
+
+	// Each absolute x starts a new anchored chunk, so with advances the text
+	// is moved by hand and anchored at start.
+	uint32_t horizontal = dc.textAlign & g_taCenter;
+	double x = run.origin.x;
+	if (!run.advances.empty() && horizontal != 0)
+	{
+		double total = 0;
+		for (float advance : run.advances)
+			total += advance;
+		x -= horizontal == g_taCenter ? total / 2 : total;
+	}
+	Put("<text class=\"c");
+	Integer(n);
+	Put("\" xml:space=\"preserve\" x=\"");
+	Number(x);
+	if (!run.advances.empty())
+	{
+		for (size_t i = 0; i + 1 < run.text.size() && i < run.advances.size(); ++i)
+		{
+			x += run.advances[i];
+			Put(' ');
+			Number(x);
+		}
+	}
+	Put("\" y=\"");
+	Number(run.origin.y);
+	Put('"');
+	if (run.advances.empty() && horizontal != 0)
+		Put(horizontal == g_taCenter ? " text-anchor=\"middle\"" : " text-anchor=\"end\"");
+	uint32_t vertical = dc.textAlign & g_taBaseline;
+	if (vertical == 0)
+		Put(" dominant-baseline=\"text-before-edge\"");
+	else if (vertical == g_taBottom)
+		Put(" dominant-baseline=\"text-after-edge\"");
+	if (dc.font.escapement)
+	{
+		// Escapement is counterclockwise in tenths of a degree, y goes down here.
+		Put(" transform=\"rotate(");
+		Number(-dc.font.escapement / 10.0);
+		Put(' ');
+		Point(run.origin);
+		Put(")\"");
+	}
+	Put('>');
+	Utf16(run.text.data(), run.text.size());
+	Put("</text>\n");
+}
+
+void SvgExporter::DrawImage(const EmfImage& image, const EmfDeviceContext& dc)
+{
+	int32_t width = ReadI32(image.bmi + 4);
+	int32_t height = std::abs(ReadI32(image.bmi + 8));
+	uint32_t compression = ReadU32(image.bmi + 16);
+	if (width <= 0 || height == 0 || image.srcWidth == 0 || image.srcHeight == 0)
+		return;
+
+	Clip(dc);
+	Put("<g transform=\"");
+	Matrix(image.placement);
+	Put("\">");
+	bool whole = image.srcX == 0 && image.srcY == 0 && image.srcWidth == width && image.srcHeight == height;
+	if (!whole)
+	{
+		// The nested viewport shows the source rectangle only.
+		Put("<svg width=\"1\" height=\"1\" preserveAspectRatio=\"none\" viewBox=\"");
+		Integer(image.srcX);
+		Put(' ');
+		Integer(image.srcY);
+		Put(' ');
+		Integer(image.srcWidth);
+		Put(' ');
+		Integer(image.srcHeight);
+		Put("\"><image width=\"");
+		Integer(width);
+		Put("\" height=\"");
+		Integer(height);
+	}
+	else
+		Put("<image width=\"1\" height=\"1");
+	// Only HALFTONE smooths a stretched bitmap, the other modes repeat pixels.
+	if (dc.stretchBltMode != g_halftone)
+		Put("\" image-rendering=\"optimizeSpeed");
+	Put("\" preserveAspectRatio=\"none\" xlink:href=\"data:");
+
+	uint8_t carry[3];
+	size_t carried = 0;
+	if (compression == g_biJpeg || compression == g_biPng)
+	{
+		// The bits are a whole JPEG or PNG file.
+		Put(compression == g_biJpeg ? "image/jpeg;base64," : "image/png;base64,");
+		Base64(image.bits, image.bitsSize, carry, carried);
+	}
+	else
+	{
+		// A BMP file is BITMAPFILEHEADER followed by the DIB as stored in the record.
+		Put("image/bmp;base64,");
+		uint32_t offBits = 14 + image.bmiSize;
+		uint32_t fileSize = offBits + image.bitsSize;
+		uint8_t fileHeader[14] = { 'B', 'M' };
+		memcpy(fileHeader + 2, &fileSize, 4);
+		memcpy(fileHeader + 10, &offBits, 4);
+		Base64(fileHeader, sizeof(fileHeader), carry, carried);
+		Base64(image.bmi, image.bmiSize, carry, carried);
+		Base64(image.bits, image.bitsSize, carry, carried);
+	}
+	Base64(nullptr, 0, carry, carried);
+	Put(whole ? "\"/></g>\n" : "\"/></svg></g>\n");
+}
+
+bool ExportSvg(const uint8_t* data, size_t size, std::ostream& os, unsigned maxSide)
+{
+	SvgExporter exporter(os, maxSide);
+	EmfPlayer player;
+	if (!maxSide)
+		return player.Play(data, size, exporter);
+	LodFilter filter(exporter, maxSide);
+	return player.Play(data, size, filter);
+}
@@ -0,0 +1,100 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <functional>
+#include <ostream>
+#include <string_view>
+#include <unordered_map>
+
+#include "EmfPlayer.h"
+
+// Writes the records played by EmfPlayer as SVG, element by element.
+// Nothing is kept but the output buffer and the CSS classes: every distinct
+// pen/brush/font combination becomes a class, defined in a <style> element
+// written just before its first use. Both are taken from the current arena,
+// if any.
+class SvgExporter : public EmfSink
+{
+public:
+	// maxSide, if not 0, is the size in pixels of the longer side of the
+	// picture, else a device pixel is a pixel.
+	explicit SvgExporter(std::ostream& os, unsigned maxSide = 0);
+	~SvgExporter();
+
+	virtual void Begin(const EmfHeaderInfo& header) override;
+	virtual void End() override;
+	virtual void DrawPath(const EmfPath& path, const EmfDeviceContext& dc, bool stroke, bool fill) override;
+	virtual void DrawText(const EmfTextRun& run, const EmfDeviceContext& dc) override;
+	virtual void DrawImage(const EmfImage& image, const EmfDeviceContext& dc) override;
+
+private:
+	struct StyleHash
+	{
+		size_t operator()(const ArenaString& style) const
+		{
+			return std::hash<std::string_view>()(std::string_view(style.data(), style.size()));
+		}
+	};
+	typedef std::unordered_map<ArenaString, unsigned, StyleHash, std::equal_to<ArenaString>,
+		ArenaAllocator<std::pair<const ArenaString, unsigned>>> ClassMap;
+
+	std::ostream& m_os;
+	unsigned m_maxSide;
+	// Output pixels per device unit.
+	double m_scale;
+	ArenaVector<char> m_buffer;
+	size_t m_used;
+	// CSS declarations -> class number.
+	ClassMap m_classes;
+	ArenaString m_style;
+	ArenaString m_lastStyle;
+	unsigned m_lastClass;
+	bool m_begun;
+	// Clip region of the open <g>, nullptr if none is open.
+	std::shared_ptr<const EmfRegion> m_clip;
+	unsigned m_clipCount;
+	// Opaque rectangle of a text.
+	EmfPath m_opaque;
+
+	void Flush();
+	void Put(char c)
+	{
+		if (m_used == m_buffer.size())
+			Flush();
+		m_buffer[m_used++] = c;
+	}
+	void Put(const char* s, size_t length);
+	// Room for length characters at the end of the buffer, add them to m_used once written.
+	char* Reserve(size_t length);
+	void Put(const char* s)
+	{
+		Put(s, strlen(s));
+	}
+	void Integer(int64_t value);
+	// Rounded to 2 decimals, no trailing zeros.
+	void Number(double value);
+	void Point(EmfPointF p);
+	void Matrix(const EmfMatrix& m);
+	// UTF-8, escaped for XML text.
+	void Utf16(const char16_t* text, size_t length);
+	void Base64(const uint8_t* data, size_t size, uint8_t (&carry)[3], size_t& carried);
+	// Class number of the declarations in m_style, defined at first use.
+	unsigned Class();
+	void StyleColor(const char* property, uint32_t color);
+	void StyleNumber(const char* property, double value, const char* unit);
+	// Put what follows in a <g> clipped to the region of dc, if it changed.
+	void Clip(const EmfDeviceContext& dc);
+};
+
+// Convert the EMF held in memory. Return false if it isn't an EMF.
+// With maxSide, the picture is a thumbnail of maxSide pixels at most, and the
+// geometry is simplified by LodFilter.
+bool ExportSvg(const uint8_t* data, size_t size, std::ostream& os, unsigned maxSide = 0);
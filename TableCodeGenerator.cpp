@@ -0,0 +1,834 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include "TableCodeGenerator.h"
+
+const uint32_t g_tableFileMagic = 0x42544D45; // "EMTB"
+// Words per line of a data array.
+const size_t g_wordsPerLine = 16;
+const size_t g_logFontSize = 92;
+
+// The player, written as is next to the tables.
+static const char* g_playerHeader = R"(// Player of the metafile tables written by EmfParser's table code mode.
+#pragma once
+
+#include <Windows.h>
+#include <cstdint>
+
+// One record: code is its EMR_XXX type, its parameters start at
+// words[offset] of the unit.
+struct EmfOp
+{
+	uint32_t code;
+	uint32_t offset;
+};
+
+struct EmfTableUnit
+{
+	const EmfOp* ops;
+	uint32_t opCount;
+	const int32_t* words;
+};
+
+struct EmfTable
+{
+	uint32_t handleCount;
+	const EmfTableUnit* const* units;
+	uint32_t unitCount;
+};
+
+// Make the GDI calls of the metafile on hdc, in order.
+void PlayEmfTable(HDC hdc, const EmfTable& table);
+// Same with the tables of a .dat file. Return false if it can't be read.
+bool PlayEmfTableFile(HDC hdc, const char* fileName);
+)";
+
+static const char* g_playerSource = R"(// Player of the metafile tables written by EmfParser's table code mode.
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "EmfTable.h"
+
+namespace
+{
+	const uint32_t g_tableFileMagic = 0x42544D45; // "EMTB"
+
+	float Float(int32_t word)
+	{
+		float f;
+		memcpy(&f, &word, sizeof(f));
+		return f;
+	}
+
+	XFORM Xform(const int32_t* w)
+	{
+		XFORM xf = { Float(w[0]), Float(w[1]), Float(w[2]), Float(w[3]), Float(w[4]), Float(w[5]) };
+		return xf;
+	}
+
+	class Player
+	{
+	public:
+		Player(HDC hdc, uint32_t handleCount)
+			: m_hdc(hdc)
+			, m_handles(handleCount + 1)
+		{
+		}
+
+		void Play(uint32_t code, const int32_t* w);
+
+	private:
+		HDC m_hdc;
+		std::vector<HGDIOBJ> m_handles;
+		std::vector<POINT> m_points;
+
+		HGDIOBJ& Handle(int32_t index)
+		{
+			if ((uint32_t)index >= m_handles.size())
+				m_handles.resize(index + 1);
+			return m_handles[index];
+		}
+		// The points of the 16 bit records are packed two int16 in a word.
+		const POINT* Points(const int32_t* w, uint32_t count, bool packed)
+		{
+			m_points.resize(count ? count : 1);
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				if (packed)
+				{
+					m_points[i].x = (int16_t)(w[i] & 0xFFFF);
+					m_points[i].y = (int16_t)((uint32_t)w[i] >> 16);
+				}
+				else
+				{
+					m_points[i].x = w[2 * i];
+					m_points[i].y = w[2 * i + 1];
+				}
+			}
+			return m_points.data();
+		}
+		void Blt(uint32_t code, const int32_t* w);
+	};
+
+	// xDest, yDest, cxDest, cyDest, xSrc, ySrc, cxSrc, cySrc, rop, usage,
+	// BITMAPINFO words, BITMAPINFO, bits bytes, bits
+	void Player::Blt(uint32_t code, const int32_t* w)
+	{
+		int32_t xDest = w[0], yDest = w[1], cxDest = w[2], cyDest = w[3];
+		int32_t xSrc = w[4], ySrc = w[5], cxSrc = w[6], cySrc = w[7];
+		DWORD rop = (DWORD)w[8];
+		UINT usage = (UINT)w[9];
+		uint32_t bmiWords = (uint32_t)w[10];
+		const BITMAPINFO* bmi = reinterpret_cast<const BITMAPINFO*>(w + 11);
+		uint32_t bitsBytes = (uint32_t)w[11 + bmiWords];
+		const void* bits = w + 12 + bmiWords;
+		if (code == EMR_STRETCHDIBITS)
+		{
+			StretchDIBits(m_hdc, xDest, yDest, cxDest, cyDest, xSrc, ySrc, cxSrc, cySrc, bitsBytes ? bits : nullptr, bmi, usage, rop);
+			return;
+		}
+		if (!bmiWords)
+		{
+			// No source bitmap, the ROP uses the brush or the destination only.
+			PatBlt(m_hdc, xDest, yDest, cxDest, cyDest, rop);
+			return;
+		}
+		int32_t height = bmi->bmiHeader.biHeight < 0 ? -bmi->bmiHeader.biHeight : bmi->bmiHeader.biHeight;
+		HBITMAP hBitmap = CreateCompatibleBitmap(m_hdc, bmi->bmiHeader.biWidth, height);
+		HDC hMemDC = CreateCompatibleDC(m_hdc);
+		SetDIBits(m_hdc, hBitmap, 0, height, bits, bmi, usage);
+		HGDIOBJ holdBmp = SelectObject(hMemDC, hBitmap);
+		if (code == EMR_BITBLT)
+			BitBlt(m_hdc, xDest, yDest, cxDest, cyDest, hMemDC, xSrc, ySrc, rop);
+		else
+			StretchBlt(m_hdc, xDest, yDest, cxDest, cyDest, hMemDC, xSrc, ySrc, cxSrc, cySrc, rop);
+		DeleteObject(SelectObject(hMemDC, holdBmp));
+		DeleteDC(hMemDC);
+	}
+
+	void Player::Play(uint32_t code, const int32_t* w)
+	{
+		HDC hdc = m_hdc;
+		switch (code)
+		{
+		case EMR_HEADER:
+			SetGraphicsMode(hdc, GM_ADVANCED);
+			break;
+		// count, points
+		case EMR_POLYBEZIER:
+		case EMR_POLYBEZIER16:
+			PolyBezier(hdc, Points(w + 1, w[0], code == EMR_POLYBEZIER16), w[0]);
+			break;
+		case EMR_POLYGON:
+		case EMR_POLYGON16:
+			Polygon(hdc, Points(w + 1, w[0], code == EMR_POLYGON16), w[0]);
+			break;
+		case EMR_POLYLINE:
+		case EMR_POLYLINE16:
+			Polyline(hdc, Points(w + 1, w[0], code == EMR_POLYLINE16), w[0]);
+			break;
+		case EMR_POLYBEZIERTO:
+		case EMR_POLYBEZIERTO16:
+			PolyBezierTo(hdc, Points(w + 1, w[0], code == EMR_POLYBEZIERTO16), w[0]);
+			break;
+		case EMR_POLYLINETO:
+		case EMR_POLYLINETO16:
+			PolylineTo(hdc, Points(w + 1, w[0], code == EMR_POLYLINETO16), w[0]);
+			break;
+		// polygon count, point count, point count of each polygon, points
+		case EMR_POLYPOLYLINE:
+		case EMR_POLYPOLYLINE16:
+			PolyPolyline(hdc, Points(w + 2 + w[0], w[1], code == EMR_POLYPOLYLINE16), reinterpret_cast<const DWORD*>(w + 2), w[0]);
+			break;
+		case EMR_POLYPOLYGON:
+		case EMR_POLYPOLYGON16:
+			PolyPolygon(hdc, Points(w + 2 + w[0], w[1], code == EMR_POLYPOLYGON16), reinterpret_cast<const INT*>(w + 2), w[0]);
+			break;
+		// x, y
+		case EMR_SETWINDOWEXTEX:
+			SetWindowExtEx(hdc, w[0], w[1], nullptr);
+			break;
+		case EMR_SETWINDOWORGEX:
+			SetWindowOrgEx(hdc, w[0], w[1], nullptr);
+			break;
+		case EMR_SETVIEWPORTEXTEX:
+			SetViewportExtEx(hdc, w[0], w[1], nullptr);
+			break;
+		case EMR_SETVIEWPORTORGEX:
+			SetViewportOrgEx(hdc, w[0], w[1], nullptr);
+			break;
+		case EMR_MOVETOEX:
+			MoveToEx(hdc, w[0], w[1], nullptr);
+			break;
+		case EMR_LINETO:
+			LineTo(hdc, w[0], w[1]);
+			break;
+		// mode
+		case EMR_SETMAPMODE:
+			SetMapMode(hdc, w[0]);
+			break;
+		case EMR_SETBKMODE:
+			SetBkMode(hdc, w[0]);
+			break;
+		case EMR_SETPOLYFILLMODE:
+			SetPolyFillMode(hdc, w[0]);
+			break;
+		case EMR_SETROP2:
+			SetROP2(hdc, w[0]);
+			break;
+		case EMR_SETSTRETCHBLTMODE:
+			SetStretchBltMode(hdc, w[0]);
+			break;
+		case EMR_SETTEXTALIGN:
+			SetTextAlign(hdc, w[0]);
+			break;
+		case EMR_SETTEXTCOLOR:
+			SetTextColor(hdc, (COLORREF)w[0]);
+			break;
+		case EMR_RESTOREDC:
+			RestoreDC(hdc, w[0]);
+			break;
+		case EMR_SELECTCLIPPATH:
+			SelectClipPath(hdc, w[0]);
+			break;
+		case EMR_SETICMMODE:
+			SetICMMode(hdc, w[0]);
+			break;
+		case EMR_SETLAYOUT:
+			SetLayout(hdc, (DWORD)w[0]);
+			break;
+		// no parameter
+		case EMR_SETMETARGN:
+			SetMetaRgn(hdc);
+			break;
+		case EMR_SAVEDC:
+			SaveDC(hdc);
+			break;
+		case EMR_REALIZEPALETTE:
+			RealizePalette(hdc);
+			break;
+		case EMR_BEGINPATH:
+			BeginPath(hdc);
+			break;
+		case EMR_ENDPATH:
+			EndPath(hdc);
+			break;
+		case EMR_CLOSEFIGURE:
+			CloseFigure(hdc);
+			break;
+		case EMR_FLATTENPATH:
+			FlattenPath(hdc);
+			break;
+		case EMR_WIDENPATH:
+			WidenPath(hdc);
+			break;
+		case EMR_ABORTPATH:
+			AbortPath(hdc);
+			break;
+		// XFORM as 6 floats, mode
+		case EMR_SETWORLDTRANSFORM:
+			{
+				XFORM xf = Xform(w);
+				SetWorldTransform(hdc, &xf);
+			}
+			break;
+		case EMR_MODIFYWORLDTRANSFORM:
+			{
+				XFORM xf = Xform(w);
+				ModifyWorldTransform(hdc, &xf, w[6]);
+			}
+			break;
+		// handle index, the stock objects have the high bit set
+		case EMR_SELECTOBJECT:
+			if (w[0] & 0x80000000)
+				SelectObject(hdc, GetStockObject(w[0] & ~0x80000000));
+			else
+				SelectObject(hdc, Handle(w[0]));
+			break;
+		case EMR_DELETEOBJECT:
+			DeleteObject(Handle(w[0]));
+			break;
+		// handle index, style, width, color
+		case EMR_CREATEPEN:
+			Handle(w[0]) = CreatePen(w[1], w[2], (COLORREF)w[3]);
+			break;
+		// handle index, style, color, hatch
+		case EMR_CREATEBRUSHINDIRECT:
+			{
+				LOGBRUSH logBrush = { (UINT)w[1], (COLORREF)w[2], (ULONG_PTR)(w[1] == BS_HATCHED ? w[3] : 0) };
+				Handle(w[0]) = CreateBrushIndirect(&logBrush);
+			}
+			break;
+		// handle index, pen style, width, brush style, color, hatch, style count, styles
+		case EMR_EXTCREATEPEN:
+			{
+				LOGBRUSH logBrush = { (UINT)w[3], (COLORREF)w[4], (ULONG_PTR)(w[3] == BS_HATCHED ? w[5] : 0) };
+				Handle(w[0]) = ExtCreatePen(w[1], w[2], &logBrush, w[6], w[6] ? reinterpret_cast<const DWORD*>(w + 7) : nullptr);
+			}
+			break;
+		// handle index, LOGFONTW
+		case EMR_EXTCREATEFONTINDIRECTW:
+			{
+				LOGFONTW logFont;
+				memcpy(&logFont, w + 1, sizeof(logFont));
+				Handle(w[0]) = CreateFontIndirectW(&logFont);
+			}
+			break;
+		// x, y, radius, start angle, sweep angle
+		case EMR_ANGLEARC:
+			AngleArc(hdc, w[0], w[1], (DWORD)w[2], Float(w[3]), Float(w[4]));
+			break;
+		// box, then corner or start and end points
+		case EMR_ELLIPSE:
+			Ellipse(hdc, w[0], w[1], w[2], w[3]);
+			break;
+		case EMR_RECTANGLE:
+			Rectangle(hdc, w[0], w[1], w[2], w[3]);
+			break;
+		case EMR_ROUNDRECT:
+			RoundRect(hdc, w[0], w[1], w[2], w[3], w[4], w[5]);
+			break;
+		case EMR_ARC:
+			Arc(hdc, w[0], w[1], w[2], w[3], w[4], w[5], w[6], w[7]);
+			break;
+		case EMR_CHORD:
+			Chord(hdc, w[0], w[1], w[2], w[3], w[4], w[5], w[6], w[7]);
+			break;
+		case EMR_PIE:
+			Pie(hdc, w[0], w[1], w[2], w[3], w[4], w[5], w[6], w[7]);
+			break;
+		case EMR_ARCTO:
+			ArcTo(hdc, w[0], w[1], w[2], w[3], w[4], w[5], w[6], w[7]);
+			break;
+		case EMR_BITBLT:
+		case EMR_STRETCHBLT:
+		case EMR_STRETCHDIBITS:
+			Blt(code, w);
+			break;
+		// x, y, options, rect, char count, chars
+		case EMR_EXTTEXTOUTA:
+			{
+				RECT rect = { w[3], w[4], w[5], w[6] };
+				ExtTextOutA(hdc, w[0], w[1], w[2], &rect, reinterpret_cast<const char*>(w + 8), w[7], nullptr);
+			}
+			break;
+		case EMR_EXTTEXTOUTW:
+			{
+				RECT rect = { w[3], w[4], w[5], w[6] };
+				ExtTextOutW(hdc, w[0], w[1], w[2], &rect, reinterpret_cast<const wchar_t*>(w + 8), w[7], nullptr);
+			}
+			break;
+		}
+	}
+}
+
+void PlayEmfTable(HDC hdc, const EmfTable& table)
+{
+	Player player(hdc, table.handleCount);
+	for (uint32_t u = 0; u < table.unitCount; ++u)
+	{
+		const EmfTableUnit& unit = *table.units[u];
+		for (uint32_t i = 0; i < unit.opCount; ++i)
+			player.Play(unit.ops[i].code, unit.words + unit.ops[i].offset);
+	}
+}
+
+// magic, handle count, op count, word count, ops, words
+bool PlayEmfTableFile(HDC hdc, const char* fileName)
+{
+	FILE* file = fopen(fileName, "rb");
+	if (!file)
+		return false;
+	uint32_t header[4];
+	bool ok = fread(header, sizeof(header), 1, file) == 1 && header[0] == g_tableFileMagic;
+	std::vector<EmfOp> ops;
+	std::vector<int32_t> words;
+	if (ok)
+	{
+		ops.resize(header[2]);
+		words.resize(header[3] ? header[3] : 1);
+		ok = fread(ops.data(), sizeof(EmfOp), ops.size(), file) == ops.size()
+			&& fread(words.data(), sizeof(int32_t), header[3], file) == header[3];
+	}
+	fclose(file);
+	if (!ok)
+		return false;
+	EmfTableUnit unit = { ops.data(), header[2], words.data() };
+	const EmfTableUnit* units[] = { &unit };
+	EmfTable table = { header[1], units, 1 };
+	PlayEmfTable(hdc, table);
+	return true;
+}
+)";
+
+struct TableOp
+{
+	uint32_t code;
+	uint32_t offset;
+};
+
+// Collects the ops and words of the records, and writes them out a unit at a time.
+class TableWriter
+{
+public:
+	TableWriter(const std::string& directory, const TableCodeOptions& options, std::vector<std::string>* files)
+		: m_directory(directory)
+		, m_options(options)
+		, m_files(files)
+		, m_unitCount(0)
+		, m_handleCount(0)
+		, m_ok(true)
+	{
+	}
+
+	// Return false if the record is truncated, it is left out then, as the
+	// player would read past it.
+	bool Record(const EmfRecordSpan& record);
+	bool Finish();
+
+private:
+	const std::string& m_directory;
+	const TableCodeOptions& m_options;
+	std::vector<std::string>* m_files;
+	std::vector<TableOp> m_ops;
+	std::vector<int32_t> m_words;
+	unsigned m_unitCount;
+	uint32_t m_handleCount;
+	bool m_ok;
+
+	std::string Path(const std::string& fileName)
+	{
+		if (m_files)
+			m_files->push_back(fileName);
+		return m_directory + "/" + fileName;
+	}
+	void Op(uint32_t code)
+	{
+		m_ops.push_back({ code, (uint32_t)m_words.size() });
+	}
+	void Word(int32_t w)
+	{
+		m_words.push_back(w);
+	}
+	void Words(const uint8_t* p, size_t count)
+	{
+		for (size_t i = 0; i < count; ++i)
+			m_words.push_back(ReadI32(p + i * 4));
+	}
+	// Bytes padded to whole words.
+	void Bytes(const uint8_t* p, size_t size)
+	{
+		size_t begin = m_words.size();
+		m_words.resize(begin + (size + 3) / 4, 0);
+		memcpy(m_words.data() + begin, p, size);
+	}
+	bool Translate(const EmfRecordSpan& record);
+	bool Points(const EmfRecordSpan& record, bool packed);
+	bool PolyPoints(const EmfRecordSpan& record, bool packed);
+	bool Blt(const EmfRecordSpan& record);
+	bool Text(const EmfRecordSpan& record, bool wide);
+	void WriteUnit();
+	void WriteArray(std::ofstream& os, const int32_t* words, size_t count);
+};
+
+static bool HasRange(const EmfRecordSpan& record, uint64_t offset, uint64_t size)
+{
+	return offset <= record.size && size <= record.size - offset;
+}
+
+bool TableWriter::Points(const EmfRecordSpan& record, bool packed)
+{
+	// rclBounds, cpts, points
+	if (!HasRange(record, 24, 4))
+		return false;
+	uint32_t count = ReadU32(record.data + 24);
+	if (!HasRange(record, 28, (uint64_t)count * (packed ? 4 : 8)))
+		return false;
+	Op(record.type);
+	Word(count);
+	Words(record.data + 28, packed ? count : (size_t)count * 2);
+	return true;
+}
+
+bool TableWriter::PolyPoints(const EmfRecordSpan& record, bool packed)
+{
+	// rclBounds, nPolys, cpts, aPolyCounts, points
+	if (!HasRange(record, 24, 8))
+		return false;
+	uint32_t polyCount = ReadU32(record.data + 24), count = ReadU32(record.data + 28);
+	uint64_t pointsOffset = 32 + (uint64_t)polyCount * 4;
+	if (!HasRange(record, 32, (uint64_t)polyCount * 4) || !HasRange(record, pointsOffset, (uint64_t)count * (packed ? 4 : 8)))
+		return false;
+	Op(record.type);
+	Word(polyCount);
+	Word(count);
+	Words(record.data + 32, polyCount);
+	Words(record.data + pointsOffset, packed ? count : (size_t)count * 2);
+	return true;
+}
+
+bool TableWriter::Blt(const EmfRecordSpan& record)
+{
+	const uint8_t* p = record.data;
+	int32_t xDest, yDest, cxDest, cyDest, xSrc, ySrc, cxSrc = 0, cySrc = 0;
+	uint32_t rop, usage, offBmi, bmiSize, offBits, bitsSize;
+	if ((EmrType)record.type == EmrType::StretchDIBits)
+	{
+		if (!HasRange(record, 0, 80))
+			return false;
+		xDest = ReadI32(p + 24);
+		yDest = ReadI32(p + 28);
+		xSrc = ReadI32(p + 32);
+		ySrc = ReadI32(p + 36);
+		cxSrc = ReadI32(p + 40);
+		cySrc = ReadI32(p + 44);
+		offBmi = ReadU32(p + 48);
+		bmiSize = ReadU32(p + 52);
+		offBits = ReadU32(p + 56);
+		bitsSize = ReadU32(p + 60);
+		usage = ReadU32(p + 64);
+		rop = ReadU32(p + 68);
+		cxDest = ReadI32(p + 72);
+		cyDest = ReadI32(p + 76);
+	}
+	else
+	{
+		bool stretch = (EmrType)record.type == EmrType::StretchBlt;
+		if (!HasRange(record, 0, stretch ? 108 : 100))
+			return false;
+		xDest = ReadI32(p + 24);
+		yDest = ReadI32(p + 28);
+		cxDest = ReadI32(p + 32);
+		cyDest = ReadI32(p + 36);
+		rop = ReadU32(p + 40);
+		xSrc = ReadI32(p + 44);
+		ySrc = ReadI32(p + 48);
+		usage = ReadU32(p + 80);
+		offBmi = ReadU32(p + 84);
+		bmiSize = ReadU32(p + 88);
+		offBits = ReadU32(p + 92);
+		bitsSize = ReadU32(p + 96);
+		if (stretch)
+		{
+			cxSrc = ReadI32(p + 100);
+			cySrc = ReadI32(p + 104);
+		}
+	}
+	if (!HasRange(record, offBmi, bmiSize) || !HasRange(record, offBits, bitsSize))
+		return false;
+	Op(record.type);
+	for (int32_t w : { xDest, yDest, cxDest, cyDest, xSrc, ySrc, cxSrc, cySrc })
+		Word(w);
+	Word(rop);
+	Word(usage);
+	Word((bmiSize + 3) / 4);
+	Bytes(p + offBmi, bmiSize);
+	Word(bitsSize);
+	Bytes(p + offBits, bitsSize);
+	return true;
+}
+
+bool TableWriter::Text(const EmfRecordSpan& record, bool wide)
+{
+	// rclBounds, iGraphicsMode, exScale, eyScale, then EMRTEXT: ptlReference,
+	// nChars, offString, fOptions, rcl, offDx
+	const uint8_t* p = record.data;
+	if (!HasRange(record, 0, 76))
+		return false;
+	uint32_t count = ReadU32(p + 44), offString = ReadU32(p + 48);
+	if (!HasRange(record, offString, (uint64_t)count * (wide ? 2 : 1)))
+		return false;
+	Op(record.type);
+	Word(ReadI32(p + 36));
+	Word(ReadI32(p + 40));
+	Word(ReadI32(p + 52));
+	Words(p + 56, 4);
+	Word(count);
+	Bytes(p + offString, (size_t)count * (wide ? 2 : 1));
+	return true;
+}
+
+bool TableWriter::Record(const EmfRecordSpan& record)
+{
+	bool translated = Translate(record);
+	// Units end on record boundaries.
+	if (!m_options.externalData && m_words.size() >= m_options.unitWords)
+		WriteUnit();
+	return translated;
+}
+
+bool TableWriter::Translate(const EmfRecordSpan& record)
+{
+	const uint8_t* p = record.data + sizeof(EmfRecordHeader);
+	// Parameter words after the EMR header.
+	auto has = [&record](size_t words) { return HasRange(record, sizeof(EmfRecordHeader), words * 4); };
+	size_t words = 0;
+	switch ((EmrType)record.type)
+	{
+	case EmrType::Header:
+		// nHandles, a WORD
+		if (HasRange(record, 56, 4))
+			m_handleCount = ReadU32(record.data + 56) & 0xFFFF;
+		break;
+	case EmrType::PolyBezier:
+	case EmrType::Polygon:
+	case EmrType::Polyline:
+	case EmrType::PolyBezierTo:
+	case EmrType::PolyLineTo:
+		return Points(record, false);
+	case EmrType::PolyBezier16:
+	case EmrType::Polygon16:
+	case EmrType::Polyline16:
+	case EmrType::PolyBezierTo16:
+	case EmrType::PolylineTo16:
+		return Points(record, true);
+	case EmrType::PolyPolyline:
+	case EmrType::PolyPolygon:
+		return PolyPoints(record, false);
+	case EmrType::PolyPolyline16:
+	case EmrType::PolyPolygon16:
+		return PolyPoints(record, true);
+	case EmrType::SetWindowExtEx:
+	case EmrType::SetWindowOrgEx:
+	case EmrType::SetViewportExtEx:
+	case EmrType::SetViewportOrgEx:
+	case EmrType::MoveToEx:
+	case EmrType::LineTo:
+		words = 2;
+		break;
+	case EmrType::SetMapMode:
+	case EmrType::SetBkMode:
+	case EmrType::SetPolyFillMode:
+	case EmrType::SetROP2:
+	case EmrType::SetStretchBltMode:
+	case EmrType::SetTextAlign:
+	case EmrType::SetTextColor:
+	case EmrType::RestoreDC:
+	case EmrType::SelectClipPath:
+	case EmrType::SetICMMode:
+	case EmrType::SetLayout:
+	case EmrType::SelectObject:
+	case EmrType::DeleteObject:
+		words = 1;
+		break;
+	case EmrType::SetMetaRgn:
+	case EmrType::SaveDC:
+	case EmrType::RealizePalette:
+	case EmrType::BeginPath:
+	case EmrType::EndPath:
+	case EmrType::CloseFigure:
+	case EmrType::FlattenPath:
+	case EmrType::WidenPath:
+	case EmrType::AbortPath:
+		break;
+	case EmrType::SetWorldTransform:
+		words = 6;
+		break;
+	case EmrType::ModifyWorldTransform:
+		words = 7;
+		break;
+	case EmrType::AngleArc:
+		words = 5;
+		break;
+	case EmrType::Ellipse:
+	case EmrType::Rectangle:
+		words = 4;
+		break;
+	case EmrType::RoundRect:
+		words = 6;
+		break;
+	case EmrType::Arc:
+	case EmrType::Chord:
+	case EmrType::Pie:
+	case EmrType::ArcTo:
+		words = 8;
+		break;
+	case EmrType::CreatePen:
+		// ihPen, lopnStyle, lopnWidth.x, lopnWidth.y, lopnColor
+		if (!has(5))
+			return false;
+		Op(record.type);
+		Word(ReadI32(p));
+		Word(ReadI32(p + 4));
+		Word(ReadI32(p + 8));
+		Word(ReadI32(p + 16));
+		return true;
+	case EmrType::CreateBrushIndirect:
+		words = 4;
+		break;
+	case EmrType::ExtCreatePen:
+		{
+			// ihPen, offBmi, cbBmi, offBits, cbBits, elpPenStyle, elpWidth,
+			// elpBrushStyle, elpColor, elpHatch, elpNumEntries, elpStyleEntry
+			if (!has(11))
+				return false;
+			uint32_t entries = ReadU32(p + 40);
+			if (!HasRange(record, 52, (uint64_t)entries * 4))
+				return false;
+			Op(record.type);
+			Word(ReadI32(p));
+			Words(p + 20, 6 + entries);
+			return true;
+		}
+	case EmrType::ExtCreateFontIndirectW:
+		// ihFont, LOGFONTW
+		words = 1 + g_logFontSize / 4;
+		break;
+	case EmrType::BitBlt:
+	case EmrType::StretchBlt:
+	case EmrType::StretchDIBits:
+		return Blt(record);
+	case EmrType::ExtTextOutA:
+		return Text(record, false);
+	case EmrType::ExtTextOutW:
+		return Text(record, true);
+	default:
+		// Left out by the translator too.
+		return true;
+	}
+	if (!has(words))
+		return false;
+	Op(record.type);
+	Words(p, words);
+	return true;
+}
+
+void TableWriter::WriteArray(std::ofstream& os, const int32_t* words, size_t count)
+{
+	char buffer[16];
+	for (size_t i = 0; i < count; ++i)
+	{
+		os << (i % g_wordsPerLine ? " " : "\t");
+		// -2147483648 is the negation of an unsigned literal.
+		if (words[i] == INT32_MIN)
+			os << "INT32_MIN";
+		else
+		{
+			snprintf(buffer, sizeof(buffer), "%d", (int)words[i]);
+			os << buffer;
+		}
+		os << (i + 1 == count ? "\n" : i % g_wordsPerLine == g_wordsPerLine - 1 ? ",\n" : ",");
+	}
+}
+
+void TableWriter::WriteUnit()
+{
+	if (m_ops.empty())
+		return;
+	std::string unitName = m_options.name + "Unit" + std::to_string(m_unitCount);
+	std::ofstream os(Path(unitName + ".cpp"), std::ios::binary);
+	os << "// Generated by EmfParser.\n#include \"EmfTable.h\"\n\n";
+	os << "static const int32_t words[] = {\n";
+	if (m_words.empty())
+		os << "\t0\n";
+	else
+		WriteArray(os, m_words.data(), m_words.size());
+	os << "};\n\nstatic const EmfOp ops[] = {\n";
+	for (size_t i = 0; i < m_ops.size(); ++i)
+		os << (i % 8 ? " {" : "\t{") << m_ops[i].code << ',' << m_ops[i].offset << (i + 1 == m_ops.size() ? "}\n" : i % 8 == 7 ? "},\n" : "},");
+	os << "};\n\nextern const EmfTableUnit g_" << unitName << " = { ops, " << m_ops.size() << ", words };\n";
+	m_ok = m_ok && (bool)os;
+	m_ops.clear();
+	m_words.clear();
+	++m_unitCount;
+}
+
+bool TableWriter::Finish()
+{
+	if (m_options.externalData)
+	{
+		std::ofstream os(Path(m_options.name + ".dat"), std::ios::binary);
+		uint32_t header[4] = { g_tableFileMagic, m_handleCount, (uint32_t)m_ops.size(), (uint32_t)m_words.size() };
+		os.write((const char*)header, sizeof(header));
+		os.write((const char*)m_ops.data(), m_ops.size() * sizeof(TableOp));
+		os.write((const char*)m_words.data(), m_words.size() * sizeof(int32_t));
+		m_ok = m_ok && (bool)os;
+	}
+	else
+	{
+		WriteUnit();
+		std::ofstream os(Path(m_options.name + ".cpp"), std::ios::binary);
+		os << "// Generated by EmfParser. Play with PlayEmfTable(hdc, g_" << m_options.name << "Table).\n#include \"EmfTable.h\"\n\n";
+		for (unsigned u = 0; u < m_unitCount; ++u)
+			os << "extern const EmfTableUnit g_" << m_options.name << "Unit" << u << ";\n";
+		os << "\nstatic const EmfTableUnit* const units[] = {\n";
+		for (unsigned u = 0; u < m_unitCount; ++u)
+			os << "\t&g_" << m_options.name << "Unit" << u << ",\n";
+		if (!m_unitCount)
+			os << "\tnullptr\n";
+		os << "};\n\nextern const EmfTable g_" << m_options.name << "Table = { " << m_handleCount << ", units, " << m_unitCount << " };\n";
+		m_ok = m_ok && (bool)os;
+	}
+	for (const char* text : { g_playerHeader, g_playerSource })
+	{
+		std::ofstream os(Path(text == g_playerHeader ? "EmfTable.h" : "EmfTable.cpp"), std::ios::binary);
+		os << text;
+		m_ok = m_ok && (bool)os;
+	}
+	return m_ok;
+}
+
+bool GenerateTableCode(const std::vector<EmfRecordSpan>& records, const std::string& directory, const TableCodeOptions& options,
+	std::vector<std::string>* files)
+{
+	std::error_code ec;
+	std::filesystem::create_directories(std::filesystem::u8path(directory), ec);
+	TableWriter writer(directory, options, files);
+	for (const EmfRecordSpan& record : records)
+		writer.Record(record);
+	return writer.Finish();
+}
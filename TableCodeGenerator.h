@@ -0,0 +1,45 @@
+/***************************************************************************
+* Copyright (C) 2017, Deping Chen, cdp97531@sina.com
+*
+* All rights reserved.
+* For permission requests, write to the author.
+*
+* This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+* KIND, either express or implied.
+***************************************************************************/
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "EmfFormat.h"
+
+// Words of data per generated translation unit, about 2.5 MB of source.
+const size_t g_defaultTableUnitWords = 256 * 1024;
+
+struct TableCodeOptions
+{
+	// Prefix of the generated files and symbols, a C++ identifier.
+	std::string name;
+	// Data words per translation unit; a unit ends on a record boundary so a
+	// big bitmap may make a bigger one.
+	size_t unitWords = g_defaultTableUnitWords;
+	// Write the tables into "<name>.dat", loaded at run time, instead of
+	// compiling them.
+	bool externalData = false;
+};
+
+// Generated-code mode which compiles fast. The records translated by
+// EnumMetafileCallback become an op table and int32 data arrays instead of
+// straight-line GDI calls, and a small loop in EmfTable.cpp makes the same
+// calls from them. Written into directory:
+//   EmfTable.h, EmfTable.cpp      the player, the same for every metafile
+//   <name>.cpp                    the table of units, g_<name>Table
+//   <name>Unit<N>.cpp             ops and data, unitWords words each
+// or, with externalData, EmfTable.h, EmfTable.cpp and <name>.dat.
+// The generated code plays the metafile with PlayEmfTable(hdc, g_<name>Table)
+// or PlayEmfTableFile(hdc, "<name>.dat").
+// Records the translator leaves out are left out. Return false if a file
+// can't be written; the names of the written files are appended to files.
+bool GenerateTableCode(const std::vector<EmfRecordSpan>& records, const std::string& directory, const TableCodeOptions& options,
+	std::vector<std::string>* files = nullptr);
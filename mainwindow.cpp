@@ -10,35 +10,95 @@
 #include <Windows.h>
 #include <Gdiplus.h>
 
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
 #include <sstream>
 
 #include <QAction>
+#include <QApplication>
+#include <QByteArray>
 #include <QCoreApplication>
+#include <QFile>
 #include <QFileDialog>
+#include <QHeaderView>
 #include <QMessageBox>
 #include <QMenuBar>
 #include <QSplitter>
 #include <QSettings>
+#include <QSlider>
+#include <QStandardPaths>
+#include <QStringList>
+#include <QTableView>
 #include <QTextEdit>
+#include <QTimer>
+#include <QVBoxLayout>
 #include <QWindow>
 
 #include "mainwindow.h"
+#include "Arena.h"
+#include "BatchConverter.h"
 #include "ConstantDictionary.h"
+#include "EmzStream.h"
+#include "GdiBytecode.h"
+#include "MappedFile.h"
+#include "RecordDiff.h"
+#include "RecordTableModel.h"
+#include "RecordTranslator.h"
+#include "RenderCache.h"
 #include "ReplayWidget.h"
+#include "SpoolFile.h"
+#include "PdfExporter.h"
+#include "SvgExporter.h"
+#include "TableCodeGenerator.h"
 
 const char* g_geometry = "MainGeometry";
 const char* g_stateKey = "SplitterState";
+// Bigger EMF files are only listed when opened, records are decoded as they are selected.
+// They are translated on all cores instead of through Graphics::EnumerateMetafile.
+const size_t g_hugeEmfSize = 16 * 1024 * 1024;
+// Longer side of a thumbnail in pixels.
+const unsigned g_thumbnailSize = 256;
+// Bytes of rendered previews kept on disk, 256 MB.
+const uint64_t g_renderCacheBudget = 256 * 1024 * 1024;
+// Slowest pages of a spool file reported.
+const size_t g_slowPageCount = 5;
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
 {
     m_splitter = new QSplitter(Qt::Vertical, this);
 
+    auto replayPane = new QWidget;
+    auto replayLayout = new QVBoxLayout(replayPane);
+    replayLayout->setContentsMargins(0, 0, 0, 0);
     m_replayWidget = new ReplayWidget;
-    m_splitter->addWidget(m_replayWidget);//QWidget::createWindowContainer
+    replayLayout->addWidget(m_replayWidget, 1);//QWidget::createWindowContainer
+    m_stepSlider = new QSlider(Qt::Horizontal);
+    m_stepSlider->setEnabled(false);
+    m_stepSlider->setToolTip(tr("Number of records replayed"));
+    replayLayout->addWidget(m_stepSlider);
+    connect(m_stepSlider, &QSlider::valueChanged, m_replayWidget, &ReplayWidget::SetStepRecord);
+    m_splitter->addWidget(replayPane);
+
+    auto bottomSplitter = new QSplitter(Qt::Horizontal);
+    m_splitter->addWidget(bottomSplitter);
+
+    m_recordModel = new RecordTableModel(this);
+    m_recordView = new QTableView;
+    m_recordView->setModel(m_recordModel);
+    m_recordView->setSelectionBehavior(QAbstractItemView::SelectRows);
+    m_recordView->setSelectionMode(QAbstractItemView::SingleSelection);
+    m_recordView->verticalHeader()->hide();
+    // Fixed row height, the view doesn't have to measure millions of rows.
+    m_recordView->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+    m_recordView->horizontalHeader()->setStretchLastSection(true);
+    bottomSplitter->addWidget(m_recordView);
+    connect(m_recordView->selectionModel(), &QItemSelectionModel::currentRowChanged, this, &MainWindow::ShowRecord);
 
     m_gdiCallsWidget = new QTextEdit;
-    m_splitter->addWidget(m_gdiCallsWidget);
+    bottomSplitter->addWidget(m_gdiCallsWidget);
 
 	QFont font;
 	font.setFamily("Courier");
@@ -66,6 +126,12 @@ MainWindow::MainWindow(QWidget *parent)
 			m_splitter->restoreState(state);
 	}
 
+	// Shared with the other instances, a repeat preview is read instead of replayed.
+	m_renderCache.reset(new RenderCache);
+	QString cacheDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/renders";
+	if (!m_renderCache->Open(cacheDir.toUtf8().constData(), g_renderCacheBudget))
+		m_renderCache.reset();
+
     CreateActions();
     CreateMenus();
 }
@@ -75,6 +141,7 @@ MainWindow::~MainWindow()
 	// Must reset metafile before GdiplusShutdown.
 	// Or program will crash in ~ReplayWidget() because ReplayWidget::m_pMetafile is invalid at that time.
 	m_replayWidget->ResetMetafile();
+	m_replayWidget->SetRenderCache(nullptr, 0);
 	Gdiplus::GdiplusShutdown(m_gdiplusToken);
 }
 
@@ -90,6 +157,48 @@ void MainWindow::CreateActions()
 	m_generateAct->setStatusTip(tr("Generate Windows Emf"));
     connect(m_generateAct, &QAction::triggered, this, &MainWindow::GenerateEmf);
 
+	m_compareAct = new QAction(tr("&Compare Emf..."), this);
+	m_compareAct->setShortcut(QKeySequence(tr("Ctrl+D", "File|Compare Emf")));
+	m_compareAct->setStatusTip(tr("Show the records which differ between two Windows Emf"));
+	connect(m_compareAct, &QAction::triggered, this, &MainWindow::CompareEmf);
+
+	m_translateAct = new QAction(tr("&Translate All"), this);
+	m_translateAct->setShortcut(QKeySequence(tr("Ctrl+T", "File|Translate All")));
+	m_translateAct->setStatusTip(tr("Translate all records into GDI calls"));
+	connect(m_translateAct, &QAction::triggered, this, &MainWindow::TranslateAll);
+
+	m_tableCodeAct = new QAction(tr("Save as Table &Code..."), this);
+	m_tableCodeAct->setStatusTip(tr("Write the GDI calls as data tables played by a loop, which compile fast"));
+	connect(m_tableCodeAct, &QAction::triggered, this, &MainWindow::SaveTableCode);
+
+	m_bytecodeAct = new QAction(tr("Save as &Bytecode..."), this);
+	m_bytecodeAct->setStatusTip(tr("Write the GDI calls as compact bytecode, replayed without parsing the metafile"));
+	connect(m_bytecodeAct, &QAction::triggered, this, &MainWindow::SaveBytecode);
+
+	m_stepAct = new QAction(tr("Step &Replay"), this);
+	m_stepAct->setShortcut(QKeySequence(tr("Ctrl+R", "File|Step Replay")));
+	m_stepAct->setStatusTip(tr("Replay the metafile up to the selected record"));
+	m_stepAct->setCheckable(true);
+	connect(m_stepAct, &QAction::toggled, this, &MainWindow::StepReplay);
+
+	m_svgAct = new QAction(tr("Save as S&VG..."), this);
+	m_svgAct->setShortcut(QKeySequence(tr("Ctrl+E", "File|Save as SVG")));
+	m_svgAct->setStatusTip(tr("Export the metafile as SVG"));
+	connect(m_svgAct, &QAction::triggered, this, &MainWindow::SaveAsSvg);
+
+	m_thumbnailAct = new QAction(tr("Save &Thumbnail as SVG..."), this);
+	m_thumbnailAct->setStatusTip(tr("Export a simplified thumbnail of the metafile as SVG"));
+	connect(m_thumbnailAct, &QAction::triggered, this, &MainWindow::SaveThumbnail);
+
+	m_pdfAct = new QAction(tr("Save as &PDF..."), this);
+	m_pdfAct->setShortcut(QKeySequence(tr("Ctrl+P", "File|Save as PDF")));
+	m_pdfAct->setStatusTip(tr("Export the metafile as PDF"));
+	connect(m_pdfAct, &QAction::triggered, this, &MainWindow::SaveAsPdf);
+
+	m_batchAct = new QAction(tr("&Batch Convert to SVG..."), this);
+	m_batchAct->setStatusTip(tr("Convert every metafile of a directory to SVG, reading and writing many files at once"));
+	connect(m_batchAct, &QAction::triggered, this, &MainWindow::BatchConvert);
+
 	m_rectAct = new QAction(tr("&Specify Retangle to Play Emf..."), this);
 	m_rectAct->setShortcut(QKeySequence(tr("Ctrl+S", "File|Specify Retangle to Play Emf")));
 	m_rectAct->setStatusTip(tr("Specify Retangle to Play Emf"));
@@ -114,6 +223,15 @@ void MainWindow::CreateMenus()
         QMenu* fileMenu = menuBar()->addMenu(tr("&File"));
         fileMenu->addAction(m_openAct);
         fileMenu->addAction(m_generateAct);
+        fileMenu->addAction(m_compareAct);
+        fileMenu->addAction(m_translateAct);
+        fileMenu->addAction(m_tableCodeAct);
+        fileMenu->addAction(m_bytecodeAct);
+        fileMenu->addAction(m_stepAct);
+        fileMenu->addAction(m_svgAct);
+        fileMenu->addAction(m_thumbnailAct);
+        fileMenu->addAction(m_pdfAct);
+        fileMenu->addAction(m_batchAct);
         fileMenu->addAction(m_rectAct);
     }
 
@@ -128,7 +246,7 @@ void MainWindow::OpenEmf()
     QSettings settings(m_iniFile, QSettings::IniFormat);
 	const char* key = "OpenPath";
     QString path = settings.value(key, "").toString();
-    auto fileName = QFileDialog::getOpenFileName(this, tr("Open Emf"), path, tr("Emf Files (*.wmf *.emf)"), nullptr, QFileDialog::ReadOnly);
+    auto fileName = QFileDialog::getOpenFileName(this, tr("Open Emf"), path, tr("Emf Files (*.wmf *.emf *.emz *.spl)"), nullptr, QFileDialog::ReadOnly);
     if (fileName.isEmpty())
         return;
 	QString dir = QFileInfo(fileName).path();
@@ -143,19 +261,372 @@ extern BOOL CALLBACK EnumMetafileCallback(
 	unsigned int dataSize,
 	const unsigned char* data,
 	void* callbackData);
+
+std::vector<PdfPage> MainWindow::SourcePages() const
+{
+	std::vector<PdfPage> pages;
+	for (const SpoolPage& page : m_spool.pages)
+		pages.push_back(PdfPage{ page.data, page.size });
+	if (m_containerFile.Data() && IsSpool(m_containerFile.Data(), m_containerFile.Size()))
+		return pages;
+	const MappedFile& file = m_containerFile.Data() ? m_containerFile : m_recordModel->File();
+	if (file.Data())
+		pages.push_back(PdfPage{ file.Data(), file.Size() });
+	return pages;
+}
+
+// "page (ms), ..." of the slowest pages, numbered from 1.
+static QString SlowestPages(const std::vector<double>& seconds)
+{
+	std::vector<size_t> pages(seconds.size());
+	for (size_t i = 0; i < pages.size(); ++i)
+		pages[i] = i;
+	size_t count = pages.size() < g_slowPageCount ? pages.size() : g_slowPageCount;
+	std::partial_sort(pages.begin(), pages.begin() + count, pages.end(),
+		[&seconds](size_t a, size_t b) { return seconds[a] > seconds[b]; });
+	QStringList list;
+	for (size_t i = 0; i < count; ++i)
+		list << QString("%1 (%2 ms)").arg(pages[i] + 1).arg(seconds[pages[i]] * 1000, 0, 'f', 1);
+	return list.join(", ");
+}
+
 void MainWindow::ParseEmf(const QString& fileName)
 {
-	HWND hwnd = (HWND)m_replayWidget->winId();
-	HDC hdc = GetDC(hwnd);
+	// EMZ and spool files: GDI+ and the record list need a plain metafile, so
+	// only their GDI calls are shown and they can be exported. An EMZ is
+	// translated as it is inflated, the first page of a spool file is previewed.
+	m_containerFile.Close();
+	m_spool = SpoolDocument();
+	bool mapped = m_containerFile.Open(fileName.toUtf8().constData());
+	if (mapped && (IndexSpool(m_containerFile.Data(), m_containerFile.Size(), m_spool) || IsGzip(m_containerFile.Data(), m_containerFile.Size())))
 	{
-		Gdiplus::Graphics graphics(hdc);
-		std::shared_ptr<Gdiplus::Metafile> pMeta(new Gdiplus::Metafile((wchar_t*)fileName.utf16()), Gdiplus::Metafile::operator delete);
-		m_replayWidget->SetMetafile(pMeta);
-		std::stringstream ss;
-		graphics.EnumerateMetafile(pMeta.get(), Gdiplus::Rect(0, 0, 300, 50), EnumMetafileCallback, &ss, nullptr);
-		m_gdiCallsWidget->append(ss.str().c_str());
+		m_recordModel->Close();
+		m_replayWidget->ResetMetafile();
+		m_replayWidget->SetRenderCache(nullptr, 0);
+		if (!m_spool.pages.empty())
+		{
+			const SpoolPage& page = m_spool.pages.front();
+			HENHMETAFILE hemf = SetEnhMetaFileBits((UINT)page.size, page.data);
+			if (hemf)
+			{
+				std::shared_ptr<Gdiplus::Metafile> pMeta(new Gdiplus::Metafile(hemf, TRUE), Gdiplus::Metafile::operator delete);
+				m_replayWidget->SetRenderCache(m_renderCache.get(), RenderContentHash(page.data, page.size));
+				m_replayWidget->SetMetafile(pMeta);
+			}
+		}
+		m_fileName = fileName;
+		StepReplay(m_stepAct->isChecked());
+		TranslateAll();
+		m_replayWidget->update();
+		return;
 	}
-	ReleaseDC(hwnd, hdc);
+	uint64_t contentHash = mapped ? RenderContentHash(m_containerFile.Data(), m_containerFile.Size()) : 0;
+	m_containerFile.Close();
+
+	// A picture of the render cache is shown before the metafile is loaded
+	// and before its records are indexed, which then wait for the next turn
+	// of the event loop.
+	m_recordModel->Close();
+	m_replayWidget->ResetMetafile();
+	m_replayWidget->SetRenderCache(mapped ? m_renderCache.get() : nullptr, contentHash);
+	m_replayWidget->SetMetafileFile(fileName);
+	m_fileName = fileName;
+	if (!m_stepAct->isChecked() && m_replayWidget->LoadCached())
+	{
+		m_replayWidget->update();
+		QTimer::singleShot(0, this, [this, fileName]
+		{
+			if (m_fileName == fileName)
+				OpenRecords();
+		});
+		return;
+	}
+	OpenRecords();
+}
+
+void MainWindow::OpenRecords()
+{
+	// Only the record headers are read, or the sidecar index if it is up to date.
+	m_recordModel->Open(m_fileName);
+	m_replayWidget->OpenSteps(m_fileName);
+	StepReplay(m_stepAct->isChecked());
+	if (m_recordModel->File().Size() < g_hugeEmfSize)
+	{
+		TranslateAll();
+	}
+	else
+	{
+		m_gdiCallsWidget->append(tr("// %1 records. Select a record to decode it, or translate all of them with File|Translate All.")
+			.arg(m_recordModel->Index().RecordCount()));
+	}
+}
+
+void MainWindow::TranslateAll()
+{
+	if (m_fileName.isEmpty())
+		return;
+	m_gdiCallsWidget->clear();
+	// The last translation is dropped and its blocks reused.
+	m_arena.Reset();
+	ArenaScope scope(m_arena);
+	ArenaStringStream ss;
+	const MappedFile& file = m_recordModel->File();
+	std::vector<EmfRecordSpan> records;
+	if (m_containerFile.Data() && IsSpool(m_containerFile.Data(), m_containerFile.Size()))
+	{
+		// Spool file: the pages are translated on all cores and written in
+		// page order, each with the time it took.
+		ArenaStringStream pagesText;
+		std::vector<double> seconds;
+		ConvertSpoolPages(m_spool.pages, [](const SpoolPage& page, std::string& output)
+		{
+			std::vector<EmfRecordSpan> pageRecords;
+			bool valid = ScanRecords(page.data, page.size, pageRecords);
+			std::stringstream pageText;
+			TranslateRecords(pageRecords, 0, pageRecords.size(), pageText);
+			output = pageText.str();
+			return valid;
+		}, [&](const SpoolPageResult& result)
+		{
+			pagesText << "// Page " << result.page + 1 << ", translated in " << result.seconds * 1000 << " ms\n" << result.output;
+			if (!result.ok)
+				pagesText << "// The page is corrupt, the records before the bad one are translated.\n";
+			seconds.push_back(result.seconds);
+		});
+		ss << "// " << m_spool.documentName << ": " << m_spool.pages.size() << " pages, "
+			<< m_spool.skippedRecords << " font and other records skipped.\n";
+		if (!seconds.empty())
+			ss << "// Slowest pages: " << SlowestPages(seconds).toStdString() << "\n";
+		if (!m_spool.complete)
+			ss << "// The spool file is corrupt, the pages before the bad record are translated.\n";
+		ss << pagesText.rdbuf();
+	}
+	else if (m_containerFile.Data())
+	{
+		bool valid = StreamEmzRecords(m_containerFile.Data(), m_containerFile.Size(), [&ss](const EmfRecordSpan& record) {
+			TranslateRecord(record.data, ss);
+			return true;
+		});
+		if (!valid)
+			ss << "// The compressed metafile is corrupt, the records before the bad one are translated.\n";
+	}
+	else if (file.Size() >= g_hugeEmfSize && ScanRecords(file.Data(), file.Size(), records))
+	{
+		// Huge EMF: translate the raw records on all cores.
+		TranslateRecordsParallel(records, ss);
+	}
+	else
+	{
+		HWND hwnd = (HWND)m_replayWidget->winId();
+		HDC hdc = GetDC(hwnd);
+		{
+			Gdiplus::Graphics graphics(hdc);
+			Gdiplus::Metafile meta((wchar_t*)m_fileName.utf16());
+			// The callback writes to an std::ostream.
+			graphics.EnumerateMetafile(&meta, Gdiplus::Rect(0, 0, 300, 50), EnumMetafileCallback, static_cast<std::ostream*>(&ss), nullptr);
+		}
+		ReleaseDC(hwnd, hdc);
+	}
+	m_gdiCallsWidget->append(ss.str().c_str());
+}
+
+void MainWindow::ShowRecord(const QModelIndex& current)
+{
+	if (!current.isValid())
+		return;
+	m_gdiCallsWidget->setPlainText(m_recordModel->DecodedRecord(current.row()));
+	// Picture as of the selected record.
+	if (m_stepAct->isChecked())
+		m_stepSlider->setValue(current.row() + 1);
+}
+
+void MainWindow::StepReplay(bool enable)
+{
+	int recordCount = m_replayWidget->StepRecordCount();
+	enable = enable && recordCount > 0;
+	m_stepSlider->setEnabled(enable);
+	if (enable)
+	{
+		QSignalBlocker blocker(m_stepSlider);
+		m_stepSlider->setRange(0, recordCount);
+		m_stepSlider->setValue(recordCount);
+	}
+	m_replayWidget->SetStepRecord(enable ? m_stepSlider->value() : -1);
+}
+
+void MainWindow::SaveSvg(unsigned maxSide)
+{
+	std::vector<PdfPage> pages = SourcePages();
+	if (m_fileName.isEmpty() || pages.empty())
+		return;
+	QFileInfo info(m_fileName);
+	QString suffix = maxSide ? "_thumbnail.svg" : ".svg";
+	auto svgName = QFileDialog::getSaveFileName(this, tr("Save as SVG"), info.path() + "/" + info.completeBaseName() + suffix, tr("SVG Files (*.svg)"));
+	if (svgName.isEmpty())
+		return;
+	if (!m_spool.pages.empty())
+	{
+		SaveSpoolSvg(svgName, maxSide);
+		return;
+	}
+
+	// The SVG is written as the records are played, through a big file buffer.
+	std::vector<char> buffer(1024 * 1024);
+	std::ofstream os;
+	os.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+	os.open(std::filesystem::u8path(svgName.toStdString()), std::ios::binary | std::ios::trunc);
+	if (!os || !ExportSvg(pages[0].data, pages[0].size, os, maxSide) || !os.flush())
+		QMessageBox::warning(this, tr("Save as SVG"), tr("Can't write %1.").arg(svgName));
+}
+
+void MainWindow::SaveAsSvg()
+{
+	SaveSvg(0);
+}
+
+void MainWindow::SaveThumbnail()
+{
+	SaveSvg(g_thumbnailSize);
+}
+
+void MainWindow::SaveSpoolSvg(const QString& svgName, unsigned maxSide)
+{
+	// name_1.svg, name_2.svg and so on.
+	QFileInfo info(svgName);
+	QString base = info.path() + "/" + info.completeBaseName() + "_%1.svg";
+	QApplication::setOverrideCursor(Qt::WaitCursor);
+	std::vector<double> seconds;
+	QStringList failed;
+	auto start = std::chrono::steady_clock::now();
+	ConvertSpoolPages(m_spool.pages, [maxSide](const SpoolPage& page, std::string& output)
+	{
+		std::ostringstream os;
+		if (!ExportSvg(page.data, page.size, os, maxSide))
+			return false;
+		output = os.str();
+		return true;
+	}, [&](const SpoolPageResult& result)
+	{
+		seconds.push_back(result.seconds);
+		QString pageName = base.arg(result.page + 1);
+		std::ofstream os(std::filesystem::u8path(pageName.toStdString()), std::ios::binary | std::ios::trunc);
+		os.write(result.output.data(), result.output.size());
+		if (!result.ok || !os.flush())
+			failed << pageName;
+	});
+	double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	QApplication::restoreOverrideCursor();
+	if (!failed.isEmpty())
+		QMessageBox::warning(this, tr("Save as SVG"), tr("Can't write %1.").arg(failed.join(", ")));
+	else
+		QMessageBox::information(this, tr("Save as SVG"), tr("%1 pages rendered in %2 s.\nSlowest pages: %3.")
+			.arg(seconds.size()).arg(total, 0, 'f', 3).arg(SlowestPages(seconds)));
+}
+
+void MainWindow::SaveAsPdf()
+{
+	std::vector<PdfPage> pages = SourcePages();
+	if (m_fileName.isEmpty() || pages.empty())
+		return;
+	QFileInfo info(m_fileName);
+	auto pdfName = QFileDialog::getSaveFileName(this, tr("Save as PDF"), info.path() + "/" + info.completeBaseName() + ".pdf", tr("PDF Files (*.pdf)"));
+	if (pdfName.isEmpty())
+		return;
+
+	std::vector<char> buffer(1024 * 1024);
+	std::ofstream os;
+	os.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+	os.open(std::filesystem::u8path(pdfName.toStdString()), std::ios::binary | std::ios::trunc);
+	if (!os || !ExportPdf(pages, os) || !os.flush())
+		QMessageBox::warning(this, tr("Save as PDF"), tr("Can't write %1.").arg(pdfName));
+}
+
+void MainWindow::BatchConvert()
+{
+	auto inputDirectory = QFileDialog::getExistingDirectory(this, tr("Batch Convert from"), QFileInfo(m_fileName).path());
+	if (inputDirectory.isEmpty())
+		return;
+	auto outputDirectory = QFileDialog::getExistingDirectory(this, tr("Batch Convert to"), inputDirectory);
+	if (outputDirectory.isEmpty())
+		return;
+	auto jobs = ListBatchJobs(inputDirectory.toUtf8().constData(), outputDirectory.toUtf8().constData(), ".svg");
+	if (jobs.empty())
+		return;
+
+	QApplication::setOverrideCursor(Qt::WaitCursor);
+	BatchResult result = ConvertBatch(jobs, [](const uint8_t* data, size_t size, std::string& output)
+	{
+		ArenaOStringStream os;
+		if (!ExportSvg(data, size, os))
+			return false;
+		ArenaString text = os.str();
+		output.assign(text.data(), text.size());
+		return true;
+	});
+	QApplication::restoreOverrideCursor();
+	double seconds = result.seconds > 0 ? result.seconds : 1e-6;
+	QMessageBox::information(this, tr("Batch Convert to SVG"),
+		tr("%1 files converted, %2 failed, in %3 s.\nRead %4 MB/s, wrote %5 MB/s, %6 files/s.")
+		.arg(result.files - result.failed).arg(result.failed).arg(result.seconds, 0, 'f', 3)
+		.arg(result.bytesRead / 1e6 / seconds, 0, 'f', 1).arg(result.bytesWritten / 1e6 / seconds, 0, 'f', 1)
+		.arg(result.files / seconds, 0, 'f', 0));
+}
+
+void MainWindow::SaveTableCode()
+{
+	const MappedFile& file = m_recordModel->File();
+	if (m_fileName.isEmpty() || !file.Data())
+		return;
+	QFileInfo info(m_fileName);
+	auto directory = QFileDialog::getExistingDirectory(this, tr("Save as Table Code"), info.path());
+	if (directory.isEmpty())
+		return;
+	std::vector<EmfRecordSpan> records;
+	if (!ScanRecords(file.Data(), file.Size(), records))
+		return;
+
+	// The file name made an identifier.
+	TableCodeOptions options;
+	for (QChar c : info.completeBaseName())
+		options.name += c.isLetterOrNumber() && c.unicode() < 128 ? (char)c.unicode() : '_';
+	if (options.name.empty() || isdigit((unsigned char)options.name[0]))
+		options.name.insert(0, "Emf");
+	QApplication::setOverrideCursor(Qt::WaitCursor);
+	std::vector<std::string> files;
+	bool ok = GenerateTableCode(records, directory.toUtf8().constData(), options, &files);
+	QApplication::restoreOverrideCursor();
+	if (!ok)
+		QMessageBox::warning(this, tr("Save as Table Code"), tr("Can't write into %1.").arg(directory));
+	else
+		QMessageBox::information(this, tr("Save as Table Code"), tr("%1 files written. Play the metafile with PlayEmfTable(hdc, g_%2Table).")
+			.arg(files.size()).arg(QString::fromStdString(options.name)));
+}
+
+void MainWindow::SaveBytecode()
+{
+	const MappedFile& file = m_recordModel->File();
+	if (m_fileName.isEmpty() || !file.Data())
+		return;
+	QFileInfo info(m_fileName);
+	auto bytecodeName = QFileDialog::getSaveFileName(this, tr("Save as Bytecode"), info.path() + "/" + info.completeBaseName() + ".gdibc", tr("GDI Bytecode Files (*.gdibc)"));
+	if (bytecodeName.isEmpty())
+		return;
+	std::vector<EmfRecordSpan> records;
+	if (!ScanRecords(file.Data(), file.Size(), records))
+		return;
+
+	QApplication::setOverrideCursor(Qt::WaitCursor);
+	std::vector<uint8_t> bytecode;
+	CompileGdiBytecode(records, bytecode);
+	std::ofstream os(std::filesystem::u8path(bytecodeName.toStdString()), std::ios::binary | std::ios::trunc);
+	os.write((const char*)bytecode.data(), bytecode.size());
+	bool ok = os.flush().good();
+	QApplication::restoreOverrideCursor();
+	if (!ok)
+		QMessageBox::warning(this, tr("Save as Bytecode"), tr("Can't write %1.").arg(bytecodeName));
+	else
+		QMessageBox::information(this, tr("Save as Bytecode"), tr("%1 GDI calls in %2 bytes, the metafile has %3 bytes.")
+			.arg(reinterpret_cast<const GdiBytecodeHeader*>(bytecode.data())->callCount).arg(bytecode.size()).arg(file.Size()));
 }
 
 void MainWindow::GenerateEmf()
@@ -216,6 +687,49 @@ void MainWindow::GenerateEmf()
 	ReleaseDC(hwnd, hdc);
 }
 
+void MainWindow::CompareEmf()
+{
+	QSettings settings(m_iniFile, QSettings::IniFormat);
+	const char* key = "OpenPath";
+	QString path = settings.value(key, "").toString();
+	auto oldName = QFileDialog::getOpenFileName(this, tr("Open Old Emf"), path, tr("Emf Files (*.emf)"), nullptr, QFileDialog::ReadOnly);
+	if (oldName.isEmpty())
+		return;
+	auto newName = QFileDialog::getOpenFileName(this, tr("Open New Emf"), QFileInfo(oldName).path(), tr("Emf Files (*.emf)"), nullptr, QFileDialog::ReadOnly);
+	if (newName.isEmpty())
+		return;
+	settings.setValue(key, QFileInfo(newName).path());
+
+	QFile oldFile(oldName), newFile(newName);
+	if (!oldFile.open(QIODevice::ReadOnly) || !newFile.open(QIODevice::ReadOnly))
+	{
+		QMessageBox::warning(this, tr("Compare Emf"), tr("Can't read the files."));
+		return;
+	}
+	QByteArray oldData = oldFile.readAll();
+	QByteArray newData = newFile.readAll();
+	std::vector<EmfRecordSpan> oldRecords, newRecords;
+	if (!ScanRecords((const uint8_t*)oldData.constData(), oldData.size(), oldRecords)
+		|| !ScanRecords((const uint8_t*)newData.constData(), newData.size(), newRecords))
+	{
+		QMessageBox::warning(this, tr("Compare Emf"), tr("Not a valid Emf file."));
+		return;
+	}
+
+	bool complete;
+	auto diff = DiffRecords(oldRecords, newRecords, g_defaultDiffTimeout, &complete);
+	std::stringstream ss;
+	ss << "// --- " << oldName.toStdString() << "\n";
+	ss << "// +++ " << newName.toStdString() << "\n";
+	if (!complete)
+		ss << "// The files differ too much to find the shortest diff in time, some records are shown as replaced.\n";
+	WriteRecordDiff(ss, diff, oldRecords, newRecords, &ConstantDictionary::EmfPlusRecordType, [](const EmfRecordSpan& record, std::stringstream& ss) {
+		TranslateRecord(record.data, ss);
+	});
+	m_gdiCallsWidget->clear();
+	m_gdiCallsWidget->append(ss.str().c_str());
+}
+
 void MainWindow::About()
 {
     QMessageBox::about(this, tr("Windows EMF Parser"),
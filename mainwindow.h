@@ -10,8 +10,15 @@
 #ifndef MAINWINDOW_H
 #define MAINWINDOW_H
 
+#include <memory>
+
 #include <QMainWindow>
 
+#include "Arena.h"
+#include "MappedFile.h"
+#include "PdfExporter.h"
+#include "SpoolFile.h"
+
 typedef int BOOL;
 typedef unsigned __int64 ULONG_PTR, *PULONG_PTR;
 namespace Gdiplus
@@ -19,8 +26,13 @@ namespace Gdiplus
 	enum EmfPlusRecordType;
 }
 
+class QModelIndex;
+class QSlider;
 class QSplitter;
+class QTableView;
 class QTextEdit;
+class RecordTableModel;
+class RenderCache;
 class ReplayWidget;
 class MainWindow : public QMainWindow
 {
@@ -38,22 +50,61 @@ protected:
 private:
     QAction* m_openAct;
     QAction* m_generateAct;
+    QAction* m_compareAct;
+    QAction* m_translateAct;
+    QAction* m_tableCodeAct;
+    QAction* m_bytecodeAct;
+    QAction* m_stepAct;
+    QAction* m_svgAct;
+    QAction* m_thumbnailAct;
+    QAction* m_pdfAct;
+    QAction* m_batchAct;
     QAction* m_rectAct;
     //QAction* m_saveAct;
     QAction* m_aboutAct;
 
 	QSplitter* m_splitter;
 	ReplayWidget* m_replayWidget;
+	QSlider* m_stepSlider;
+	QTableView* m_recordView;
+	RecordTableModel* m_recordModel;
     QTextEdit* m_gdiCallsWidget;
 
 	ULONG_PTR m_gdiplusToken;
 	QString m_iniFile;
+	QString m_fileName;
+	std::unique_ptr<RenderCache> m_renderCache;
+	// Mapped when an EMZ or a spool file is open. The records of an EMZ are
+	// never all inflated, the pages of a spool file are played in place.
+	MappedFile m_containerFile;
+	SpoolDocument m_spool;
+	// Text of TranslateAll, kept from a file to the next.
+	Arena m_arena;
 
     void ParseEmf(const QString& fileName);
+	// The record list, the steps and the translation of m_fileName.
+	void OpenRecords();
+	// The pages of the spool file if open, else the EMZ or the EMF of the
+	// record model as one page; played by EmfPlayer either way.
+	std::vector<PdfPage> SourcePages() const;
+	// maxSide as ExportSvg.
+	void SaveSvg(unsigned maxSide);
+	// One SVG a page, rendered on all cores.
+	void SaveSpoolSvg(const QString& svgName, unsigned maxSide);
 
 private slots:
     void OpenEmf();
 	void GenerateEmf();
+	void CompareEmf();
+	void TranslateAll();
+	void SaveTableCode();
+	void SaveBytecode();
+	void ShowRecord(const QModelIndex& current);
+	void StepReplay(bool enable);
+	void SaveAsSvg();
+	void SaveThumbnail();
+	void SaveAsPdf();
+	void BatchConvert();
     void About();
 
 };